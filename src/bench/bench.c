@@ -0,0 +1,747 @@
+
+/*
+ * Sends DNS queries to a resolver as fast as it answers them (closed
+ * loop, --concurrency queries in flight) or at a fixed rate (open loop,
+ * --rate), over UDP or TCP, and reports the throughput, the share of
+ * queries that got no reply in time, and latency percentiles.
+ *
+ * Queries can also be replayed from a packet capture (--pcap), with
+ * their original timing, sped up or slowed down by --speed. Given the
+ * proxy's metrics address (--metrics), the report then includes how
+ * many queries the proxy answered locally, and the upstream traffic
+ * they caused.
+ *
+ * To benchmark the proxy on a single machine, without depending on a
+ * remote resolver, point it to the local test server:
+ *
+ *   src/test-server/dnscrypt-test-server --zone=test/features/support/test.zone
+ *   src/proxy/dnscrypt-proxy -a 127.0.0.1:5300 -r 127.0.0.1:5443 \
+ *     -N 2.dnscrypt-cert.test.local -k <printed provider public key>
+ *   src/bench/dnscrypt-bench -r 127.0.0.1:5300 -D 30
+ *
+ * Synthetic names are not in the test zone; the server answers them
+ * with NXDOMAIN, which costs it as much as a positive answer.
+ */
+
+#include <config.h>
+#include <sys/types.h>
+#ifdef _WIN32
+# include <winsock2.h>
+# include <ws2tcpip.h>
+#else
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <netinet/tcp.h>
+#endif
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+#include <event2/util.h>
+
+#include "bench.h"
+#include "histogram.h"
+#include "options.h"
+#include "proxy_metrics.h"
+#include "queries.h"
+
+#define DNS_OFFSET_FLAGS  2U
+#define DNS_OFFSET_FLAGS2 3U
+#define DNS_FLAGS_TC      0x02U
+
+#define BENCH_SOCKET_BUFFER_SIZE (4U * 1024U * 1024U)
+#define BENCH_UDP_READS_PER_EVENT 64U
+
+static Bench bench;
+
+static const char *rcode_names[DNS_RCODES] = {
+    "NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED"
+};
+
+static const struct {
+    const char *name;
+    double      quantile;
+} bench_quantiles[] = {
+    { "p50", 0.5 },
+    { "p90", 0.9 },
+    { "p99", 0.99 },
+    { "p99.9", 0.999 },
+    { "p99.99", 0.9999 }
+};
+
+static uint64_t
+bench_now(void)
+{
+    struct timeval tv;
+
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+        return (uint64_t) ts.tv_sec * 1000000U +
+            (uint64_t) ts.tv_nsec / 1000U;
+    }
+#endif
+    evutil_gettimeofday(&tv, NULL);
+
+    return (uint64_t) tv.tv_sec * 1000000U + (uint64_t) tv.tv_usec;
+}
+
+/*
+ * Whether a new query is sent as soon as a reply is received, rather
+ * than on a schedule.
+ */
+
+static _Bool
+bench_closed_loop(const Bench * const bench)
+{
+    return bench->rate == 0U && (bench->pcap_file == NULL ||
+                                 bench->speed <= 0.0);
+}
+
+/*
+ * Called when there are no queries left to send. In a closed loop,
+ * the run only ends when the last replies have been received.
+ */
+
+static void
+bench_stop_sending(Bench * const bench, const uint64_t now)
+{
+    bench->stopping = 1;
+    if (bench_closed_loop(bench) == 0 && now < bench->stop_sending_at) {
+        bench->stop_sending_at = now;
+    }
+}
+
+static void
+bench_slot_release(Bench * const bench, BenchSlot * const slot)
+{
+    assert(slot->in_flight != 0);
+    slot->in_flight = 0;
+    if (slot->connection != NULL) {
+        assert(slot->connection->in_flight > 0U);
+        slot->connection->in_flight--;
+    }
+    assert(bench->in_flight > 0U);
+    bench->in_flight--;
+}
+
+/*
+ * Slides the window of IDs: queries that have been waiting for a reply
+ * for too long are lost. With force set, the oldest ID is reclaimed
+ * even if its query hasn't timed out yet.
+ */
+
+static void
+bench_expire(Bench * const bench, const uint64_t now, _Bool force)
+{
+    BenchSlot      *slot;
+    const uint64_t  timeout = (uint64_t) bench->timeout_ms * 1000U;
+
+    while (bench->window > 0U) {
+        slot = &bench->slots[bench->oldest_id];
+        if (slot->in_flight != 0) {
+            if (force == 0 && now - slot->sent_at < timeout) {
+                break;
+            }
+            bench_slot_release(bench, slot);
+            bench->stats.lost++;
+            force = 0;
+        }
+        bench->oldest_id++;
+        bench->window--;
+    }
+}
+
+static int
+bench_send(Bench * const bench, BenchConnection * const connection)
+{
+    uint8_t      wire[DNS_MAX_PACKET_SIZE];
+    uint8_t      tcp_len[2];
+    const Query *query = queries_next(bench->queries);
+    BenchSlot   *slot;
+    uint64_t     now;
+    uint16_t     id;
+
+    now = bench_now();
+    if (query == NULL) {
+        bench_stop_sending(bench, now);
+        return -1;
+    }
+    assert(query->wire_len <= sizeof wire);
+    if (bench->window >= BENCH_MAX_IN_FLIGHT) {
+        bench_expire(bench, now, 1);
+    }
+    assert(bench->window < BENCH_MAX_IN_FLIGHT);
+    id = bench->next_id;
+    slot = &bench->slots[id];
+    assert(slot->in_flight == 0);
+    memcpy(wire, query->wire, query->wire_len);
+    wire[0] = (uint8_t) (id >> 8);
+    wire[1] = (uint8_t) id;
+    if (connection == NULL) {
+        if (send(bench->udp_handle, (const void *) wire,
+                 query->wire_len, 0) != (ssize_t) query->wire_len) {
+            bench->stats.send_errors++;
+            return -1;
+        }
+    } else {
+        tcp_len[0] = (uint8_t) (query->wire_len >> 8);
+        tcp_len[1] = (uint8_t) query->wire_len;
+        if (connection->bev == NULL ||
+            bufferevent_write(connection->bev, tcp_len, sizeof tcp_len) != 0 ||
+            bufferevent_write(connection->bev, wire, query->wire_len) != 0) {
+            bench->stats.send_errors++;
+            return -1;
+        }
+        connection->in_flight++;
+    }
+    slot->connection = connection;
+    slot->sent_at = now;
+    slot->in_flight = 1;
+    bench->next_id++;
+    bench->window++;
+    bench->in_flight++;
+    bench->stats.sent++;
+
+    return 0;
+}
+
+static void
+bench_reply(Bench * const bench, BenchConnection * const connection,
+            const uint8_t * const reply, const size_t reply_len)
+{
+    BenchSlot *slot;
+    uint64_t   now;
+    uint16_t   id;
+
+    if (reply_len < DNS_HEADER_SIZE) {
+        return;
+    }
+    id = (uint16_t) ((reply[0] << 8) | reply[1]);
+    slot = &bench->slots[id];
+    if (slot->in_flight == 0 || slot->connection != connection) {
+        bench->stats.late++;
+        return;
+    }
+    now = bench_now();
+    histogram_record(&bench->stats.latency, now - slot->sent_at);
+    bench_slot_release(bench, slot);
+    bench->stats.received++;
+    bench->stats.rcodes[reply[DNS_OFFSET_FLAGS2] & 0xf]++;
+    if ((reply[DNS_OFFSET_FLAGS] & DNS_FLAGS_TC) != 0U) {
+        bench->stats.truncated++;
+    }
+    if (bench_closed_loop(bench) && bench->stopping == 0) {
+        bench_send(bench, connection);
+    }
+}
+
+static void
+udp_reply_cb(evutil_socket_t handle, short ev_flags, void * const bench_)
+{
+    uint8_t        reply[DNS_MAX_PACKET_SIZE];
+    Bench * const  bench = bench_;
+    ssize_t        nread;
+    unsigned int   i;
+
+    (void) ev_flags;
+    for (i = 0U; i < BENCH_UDP_READS_PER_EVENT; i++) {
+        if ((nread = recv(handle, (void *) reply, sizeof reply, 0)) <
+            (ssize_t) 0) {
+            break;
+        }
+        bench_reply(bench, NULL, reply, (size_t) nread);
+    }
+}
+
+static void
+tcp_reply_cb(struct bufferevent * const bev, void * const connection_)
+{
+    uint8_t                 reply[DNS_MAX_PACKET_SIZE];
+    uint8_t                 tcp_len[2];
+    BenchConnection * const connection = connection_;
+    struct evbuffer        *input = bufferevent_get_input(bev);
+    size_t                  reply_len;
+
+    for (;;) {
+        if (evbuffer_copyout(input, tcp_len, sizeof tcp_len) !=
+            (ev_ssize_t) sizeof tcp_len) {
+            break;
+        }
+        reply_len = ((size_t) tcp_len[0] << 8) | (size_t) tcp_len[1];
+        if (evbuffer_get_length(input) < sizeof tcp_len + reply_len) {
+            break;
+        }
+        evbuffer_drain(input, sizeof tcp_len);
+        evbuffer_remove(input, reply, reply_len);
+        bench_reply(connection->bench, connection, reply, reply_len);
+    }
+}
+
+/* Queries sent over a connection that was closed will never be answered */
+
+static void
+bench_connection_lost(Bench * const bench, BenchConnection * const connection)
+{
+    BenchSlot    *slot;
+    unsigned int  i;
+    uint16_t      id = bench->oldest_id;
+
+    for (i = 0U; i < bench->window && connection->in_flight > 0U; i++) {
+        slot = &bench->slots[id++];
+        if (slot->in_flight != 0 && slot->connection == connection) {
+            bench_slot_release(bench, slot);
+            bench->stats.lost++;
+        }
+    }
+}
+
+static void
+tcp_event_cb(struct bufferevent * const bev, const short events,
+             void * const connection_)
+{
+    BenchConnection * const connection = connection_;
+    int                     on = 1;
+
+    if ((events & BEV_EVENT_CONNECTED) != 0) {
+#ifdef TCP_NODELAY
+        setsockopt(bufferevent_getfd(bev), IPPROTO_TCP, TCP_NODELAY,
+                   (void *) &on, (ev_socklen_t) sizeof on);
+#endif
+        return;
+    }
+    if ((events & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) != 0) {
+        connection->bench->stats.connection_errors++;
+        bufferevent_free(bev);
+        connection->bev = NULL;
+        bench_connection_lost(connection->bench, connection);
+    }
+}
+
+static int
+bench_connect(Bench * const bench, BenchConnection * const connection)
+{
+    assert(connection->bev == NULL);
+    if ((connection->bev =
+         bufferevent_socket_new(bench->event_loop, -1,
+                                BEV_OPT_CLOSE_ON_FREE)) == NULL) {
+        return -1;
+    }
+    bufferevent_setcb(connection->bev, tcp_reply_cb, NULL, tcp_event_cb,
+                      connection);
+    if (bufferevent_socket_connect(connection->bev,
+                                   (struct sockaddr *) &bench->server_sockaddr,
+                                   bench->server_sockaddr_len) != 0) {
+        bench->stats.connection_errors++;
+        bufferevent_free(connection->bev);
+        connection->bev = NULL;
+        return -1;
+    }
+    bufferevent_enable(connection->bev, EV_READ);
+
+    return 0;
+}
+
+/*
+ * Closed loop: a new query is sent as soon as a reply is received.
+ * This only tops up what was lost, failed to be sent, or is needed to
+ * get started.
+ */
+
+static void
+bench_fill(Bench * const bench)
+{
+    BenchConnection *connection;
+    unsigned int     i;
+
+    if (bench->tcp == 0) {
+        for (i = bench->in_flight; i < bench->concurrency; i++) {
+            if (bench_send(bench, NULL) != 0) {
+                break;
+            }
+        }
+        return;
+    }
+    for (i = 0U; i < bench->concurrency; i++) {
+        connection = &bench->connections[i];
+        if (connection->bev == NULL && bench_connect(bench, connection) != 0) {
+            continue;
+        }
+        if (connection->in_flight == 0U) {
+            bench_send(bench, connection);
+        }
+    }
+}
+
+/*
+ * When queries are sent on schedule, they are spread over all the TCP
+ * connections, which are reopened as needed.
+ */
+
+static void
+bench_reconnect(Bench * const bench)
+{
+    BenchConnection *connection;
+    unsigned int     i;
+
+    if (bench->tcp == 0) {
+        return;
+    }
+    for (i = 0U; i < bench->concurrency; i++) {
+        connection = &bench->connections[i];
+        if (connection->bev == NULL) {
+            bench_connect(bench, connection);
+        }
+    }
+}
+
+static BenchConnection *
+bench_next_connection(Bench * const bench)
+{
+    BenchConnection *connection;
+
+    if (bench->tcp == 0) {
+        return NULL;
+    }
+    connection = &bench->connections[bench->next_connection];
+    bench->next_connection =
+        (bench->next_connection + 1U) % bench->concurrency;
+
+    return connection;
+}
+
+/* Open loop: queries are sent on schedule, whether replies come or not */
+
+static void
+bench_pace(Bench * const bench, const uint64_t now)
+{
+    const uint64_t due =
+        (now - bench->start) * (uint64_t) bench->rate / 1000000U;
+
+    bench_reconnect(bench);
+    while (bench->scheduled < due) {
+        bench->scheduled++;
+        bench_send(bench, bench_next_connection(bench));
+    }
+}
+
+/*
+ * Capture replay: queries are sent on the capture's schedule, scaled
+ * by the speed factor, whether replies come or not.
+ */
+
+static void
+bench_replay(Bench * const bench, const uint64_t now)
+{
+    const Query    *query;
+    const uint64_t  due =
+        (uint64_t) ((double) (now - bench->start) * bench->speed);
+
+    bench_reconnect(bench);
+    while ((query = queries_peek(bench->queries)) != NULL &&
+           query->offset <= due) {
+        bench_send(bench, bench_next_connection(bench));
+    }
+    if (query == NULL) {
+        bench_stop_sending(bench, now);
+    }
+}
+
+static void
+bench_tick_cb(evutil_socket_t handle, short ev_flags, void * const bench_)
+{
+    Bench * const  bench = bench_;
+    const uint64_t now = bench_now();
+
+    (void) handle;
+    (void) ev_flags;
+    bench_expire(bench, now, 0);
+    if (bench->stopping == 0 && now >= bench->stop_sending_at) {
+        bench->stopping = 1;
+    }
+    if (bench->stopping != 0) {
+        if (bench->in_flight == 0U) {
+            if (now < bench->stop_sending_at) {
+                bench->stop_sending_at = now;
+            }
+            event_base_loopbreak(bench->event_loop);
+        }
+        return;
+    }
+    if (bench->rate > 0U) {
+        bench_pace(bench, now);
+    } else if (bench_closed_loop(bench)) {
+        bench_fill(bench);
+    } else {
+        bench_replay(bench, now);
+    }
+}
+
+static int
+bench_init(Bench * const bench)
+{
+    struct timeval tv;
+    int            buffer_size = (int) BENCH_SOCKET_BUFFER_SIZE;
+    unsigned int   i;
+
+    bench->server_sockaddr_len = (int) sizeof bench->server_sockaddr;
+    if (evutil_parse_sockaddr_port(bench->server_address,
+                                   (struct sockaddr *) &bench->server_sockaddr,
+                                   &bench->server_sockaddr_len) != 0) {
+        fprintf(stderr, "Unsupported resolver address: [%s]\n",
+                bench->server_address);
+        return -1;
+    }
+    if (bench->server_sockaddr.ss_family == AF_INET &&
+        ((struct sockaddr_in *) &bench->server_sockaddr)->sin_port == 0) {
+        ((struct sockaddr_in *) &bench->server_sockaddr)->sin_port = htons(53);
+    } else if (bench->server_sockaddr.ss_family == AF_INET6 &&
+               ((struct sockaddr_in6 *)
+                &bench->server_sockaddr)->sin6_port == 0) {
+        ((struct sockaddr_in6 *)
+         &bench->server_sockaddr)->sin6_port = htons(53);
+    }
+    if (bench->pcap_file != NULL) {
+        bench->queries = queries_pcap(bench->pcap_file, bench->pcap_port);
+    } else if (bench->query_file != NULL) {
+        bench->queries = queries_load(bench->query_file);
+    } else {
+        bench->queries = queries_zipf(bench->domain, bench->zipf_names,
+                                      bench->zipf_exponent, bench->qtype);
+    }
+    if (bench->queries == NULL) {
+        return -1;
+    }
+    queries_seed(bench->queries, bench->seed);
+    histogram_init(&bench->stats.latency);
+    bench->udp_handle = (evutil_socket_t) -1;
+    if (bench->tcp != 0) {
+        if ((bench->connections =
+             calloc(bench->concurrency, sizeof *bench->connections)) == NULL) {
+            return -1;
+        }
+        for (i = 0U; i < bench->concurrency; i++) {
+            bench->connections[i].bench = bench;
+            bench->connections[i].bev = NULL;
+        }
+    } else {
+        if ((bench->udp_handle =
+             socket(bench->server_sockaddr.ss_family, SOCK_DGRAM,
+                    IPPROTO_UDP)) == -1 ||
+            evutil_make_socket_nonblocking(bench->udp_handle) != 0 ||
+            connect(bench->udp_handle,
+                    (struct sockaddr *) &bench->server_sockaddr,
+                    (ev_socklen_t) bench->server_sockaddr_len) != 0) {
+            perror("Unable to create the UDP socket");
+            return -1;
+        }
+        setsockopt(bench->udp_handle, SOL_SOCKET, SO_RCVBUF,
+                   (void *) &buffer_size, (ev_socklen_t) sizeof buffer_size);
+        setsockopt(bench->udp_handle, SOL_SOCKET, SO_SNDBUF,
+                   (void *) &buffer_size, (ev_socklen_t) sizeof buffer_size);
+        if ((bench->udp_event = event_new(bench->event_loop, bench->udp_handle,
+                                          EV_READ | EV_PERSIST,
+                                          udp_reply_cb, bench)) == NULL ||
+            event_add(bench->udp_event, NULL) != 0) {
+            return -1;
+        }
+    }
+    tv.tv_sec = 0;
+    tv.tv_usec = (long) BENCH_TICK_MS * 1000L;
+    if ((bench->tick_event = event_new(bench->event_loop, -1, EV_PERSIST,
+                                       bench_tick_cb, bench)) == NULL ||
+        event_add(bench->tick_event, &tv) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static void
+bench_free(Bench * const bench)
+{
+    unsigned int i;
+
+    if (bench->connections != NULL) {
+        for (i = 0U; i < bench->concurrency; i++) {
+            if (bench->connections[i].bev != NULL) {
+                bufferevent_free(bench->connections[i].bev);
+            }
+        }
+        free(bench->connections);
+    }
+    if (bench->udp_event != NULL) {
+        event_free(bench->udp_event);
+    }
+    if (bench->udp_handle != (evutil_socket_t) -1) {
+        evutil_closesocket(bench->udp_handle);
+    }
+    if (bench->tick_event != NULL) {
+        event_free(bench->tick_event);
+    }
+    queries_free(bench->queries);
+}
+
+static double
+bench_share(const uint64_t part, const uint64_t total)
+{
+    if (total == 0U) {
+        return 0.0;
+    }
+    return (double) part * 100.0 / (double) total;
+}
+
+static void
+bench_report_proxy(const ProxyMetrics * const before,
+                   const ProxyMetrics * const after)
+{
+    const uint64_t queries = after->queries - before->queries;
+    const uint64_t local_replies = after->local_replies - before->local_replies;
+    const uint64_t upstream_queries =
+        after->upstream_queries - before->upstream_queries;
+    const uint64_t sent =
+        after->upstream_sent_bytes - before->upstream_sent_bytes;
+    const uint64_t received =
+        after->upstream_received_bytes - before->upstream_received_bytes;
+
+    printf("Proxy queries:      %" PRIu64 "\n", queries);
+    printf("  answered locally  %" PRIu64 " (%.2f%%)\n", local_replies,
+           bench_share(local_replies, queries));
+    printf("  sent upstream     %" PRIu64 " (%.2f%%)\n", upstream_queries,
+           bench_share(upstream_queries, queries));
+    printf("Upstream bytes:     %" PRIu64 " sent, %" PRIu64 " received\n",
+           sent, received);
+    if (queries > 0U) {
+        printf("  per client query  %.1f sent, %.1f received\n",
+               (double) sent / (double) queries,
+               (double) received / (double) queries);
+    }
+}
+
+static void
+bench_report(const Bench * const bench)
+{
+    const BenchStats * const stats = &bench->stats;
+    const Histogram  * const latency = &stats->latency;
+    const Queries    * const queries = bench->queries;
+    const double             elapsed =
+        (double) (bench->stop_sending_at - bench->start) / 1e6;
+    uint64_t                 value;
+    size_t                   i;
+
+    printf("Transport:          %s, ", bench->tcp != 0 ? "TCP" : "UDP");
+    if (bench->rate > 0U) {
+        printf("open loop, %u queries/s", bench->rate);
+    } else if (bench_closed_loop(bench) == 0) {
+        printf("capture replay, %gx speed", bench->speed);
+    } else {
+        printf("closed loop, %u queries in flight", bench->concurrency);
+    }
+    if (bench->tcp != 0) {
+        printf(", %u connections", bench->concurrency);
+    }
+    printf("\nDuration:           %.3f s\n", elapsed);
+    if (bench->pcap_file != NULL) {
+        printf("Captured queries:   %lu over %.3f s\n",
+               (unsigned long) queries->queries_count,
+               (double) queries->queries[queries->queries_count - 1U].offset
+               / 1e6);
+    }
+    printf("Queries sent:       %" PRIu64 "\n", stats->sent);
+    printf("Replies received:   %" PRIu64 " (%.2f%%)\n", stats->received,
+           bench_share(stats->received, stats->sent));
+    printf("Queries lost:       %" PRIu64 " (%.2f%%)\n", stats->lost,
+           bench_share(stats->lost, stats->sent));
+    printf("Late replies:       %" PRIu64 "\n", stats->late);
+    printf("Truncated replies:  %" PRIu64 "\n", stats->truncated);
+    printf("Send errors:        %" PRIu64 "\n", stats->send_errors);
+    if (bench->tcp != 0) {
+        printf("Connection errors:  %" PRIu64 "\n", stats->connection_errors);
+    }
+    printf("Throughput:         %.1f replies/s\n",
+           (double) stats->received / elapsed);
+    printf("Response codes:    ");
+    for (i = 0U; i < DNS_RCODES; i++) {
+        if (stats->rcodes[i] == 0U) {
+            continue;
+        }
+        if (rcode_names[i] != NULL) {
+            printf(" %s=%" PRIu64, rcode_names[i], stats->rcodes[i]);
+        } else {
+            printf(" RCODE%u=%" PRIu64, (unsigned int) i, stats->rcodes[i]);
+        }
+    }
+    putchar('\n');
+    if (latency->count == 0U) {
+        return;
+    }
+    printf("Latency (ms):       min %.3f, mean %.3f, max %.3f\n",
+           (double) latency->min / 1000.0,
+           (double) latency->sum / (double) latency->count / 1000.0,
+           (double) latency->max / 1000.0);
+    for (i = 0U; i < sizeof bench_quantiles / sizeof bench_quantiles[0]; i++) {
+        value = histogram_quantile(latency, bench_quantiles[i].quantile);
+        printf("  %-18s%.3f\n", bench_quantiles[i].name,
+               (double) value / 1000.0);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    ProxyMetrics proxy_metrics_before;
+    ProxyMetrics proxy_metrics_after;
+    _Bool        has_proxy_metrics = 0;
+
+    if (options_parse(&bench, argc, argv) != 0) {
+        return 1;
+    }
+#ifdef _WIN32
+    WSADATA wsa_data;
+    WSAStartup(MAKEWORD(2, 2), &wsa_data);
+#endif
+    if ((bench.event_loop = event_base_new()) == NULL) {
+        perror("event_base_new");
+        return 1;
+    }
+    if (bench_init(&bench) != 0) {
+        return 1;
+    }
+    if (bench.metrics_address != NULL &&
+        proxy_metrics_scrape(&proxy_metrics_before,
+                             bench.metrics_address) != 0) {
+        return 1;
+    }
+    bench.start = bench_now();
+    if (bench.duration > 0U) {
+        bench.stop_sending_at =
+            bench.start + (uint64_t) bench.duration * 1000000U;
+    } else {
+        bench.stop_sending_at = UINT64_MAX;
+    }
+    if (bench_closed_loop(&bench)) {
+        bench_fill(&bench);
+    }
+    event_base_dispatch(bench.event_loop);
+    if (bench.metrics_address != NULL &&
+        proxy_metrics_scrape(&proxy_metrics_after,
+                             bench.metrics_address) == 0) {
+        has_proxy_metrics = 1;
+    }
+    bench_report(&bench);
+    if (has_proxy_metrics != 0) {
+        bench_report_proxy(&proxy_metrics_before, &proxy_metrics_after);
+    }
+    bench_free(&bench);
+    event_base_free(bench.event_loop);
+
+    return 0;
+}
@@ -0,0 +1,120 @@
+
+#ifndef __BENCH_H__
+#define __BENCH_H__ 1
+
+#include <sys/types.h>
+#ifdef _WIN32
+# include <winsock2.h>
+#else
+# include <sys/socket.h>
+#endif
+
+#include <stdint.h>
+
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+
+#include "histogram.h"
+#include "queries.h"
+
+#ifndef BENCH_DEFAULT_SERVER_ADDRESS
+# define BENCH_DEFAULT_SERVER_ADDRESS "127.0.0.1:53"
+#endif
+#ifndef BENCH_DEFAULT_CONCURRENCY
+# define BENCH_DEFAULT_CONCURRENCY 16U
+#endif
+#ifndef BENCH_DEFAULT_DURATION
+# define BENCH_DEFAULT_DURATION 10U
+#endif
+#ifndef BENCH_DEFAULT_TIMEOUT_MS
+# define BENCH_DEFAULT_TIMEOUT_MS 2000U
+#endif
+#ifndef BENCH_DEFAULT_ZIPF_NAMES
+# define BENCH_DEFAULT_ZIPF_NAMES 10000U
+#endif
+#ifndef BENCH_DEFAULT_DOMAIN
+# define BENCH_DEFAULT_DOMAIN "bench.test"
+#endif
+#ifndef BENCH_DEFAULT_PCAP_PORT
+# define BENCH_DEFAULT_PCAP_PORT 53U
+#endif
+
+/*
+ * Queries get sequential IDs, and every ID can be in flight at the
+ * same time. IDs from oldest_id to next_id (window) haven't all been
+ * answered yet; the oldest ones are the first to time out.
+ */
+#define BENCH_MAX_IN_FLIGHT 65536U
+#define BENCH_TICK_MS 1U
+#define BENCH_MAX_CONNECTIONS 1024U
+#define BENCH_RATE_MAX 10000000U
+#define BENCH_SPEED_MAX 1000000.0
+
+#define DNS_RCODES 16U
+
+struct Bench_;
+
+typedef struct BenchConnection_ {
+    struct Bench_      *bench;
+    struct bufferevent *bev;
+    unsigned int        in_flight;
+} BenchConnection;
+
+/* A query in flight, indexed by its DNS ID */
+typedef struct BenchSlot_ {
+    BenchConnection *connection;
+    uint64_t         sent_at;
+    _Bool            in_flight;
+} BenchSlot;
+
+typedef struct BenchStats_ {
+    Histogram latency;
+    uint64_t  sent;
+    uint64_t  received;
+    uint64_t  lost;
+    uint64_t  late;
+    uint64_t  truncated;
+    uint64_t  send_errors;
+    uint64_t  connection_errors;
+    uint64_t  rcodes[DNS_RCODES];
+} BenchStats;
+
+typedef struct Bench_ {
+    BenchSlot                slots[BENCH_MAX_IN_FLIGHT];
+    BenchStats               stats;
+    struct sockaddr_storage  server_sockaddr;
+    Queries                 *queries;
+    BenchConnection         *connections;
+    struct event_base       *event_loop;
+    struct event            *udp_event;
+    struct event            *tick_event;
+    const char              *server_address;
+    const char              *query_file;
+    const char              *pcap_file;
+    const char              *metrics_address;
+    const char              *domain;
+    uint64_t                 start;
+    uint64_t                 stop_sending_at;
+    uint64_t                 scheduled;
+    uint64_t                 seed;
+    double                   zipf_exponent;
+    double                   speed;
+    evutil_socket_t          udp_handle;
+    int                      server_sockaddr_len;
+    unsigned int             concurrency;
+    unsigned int             duration;
+    unsigned int             rate;
+    unsigned int             timeout_ms;
+    unsigned int             zipf_names;
+    unsigned int             in_flight;
+    unsigned int             window;
+    unsigned int             next_connection;
+    uint16_t                 next_id;
+    uint16_t                 oldest_id;
+    uint16_t                 qtype;
+    uint16_t                 pcap_port;
+    _Bool                    tcp;
+    _Bool                    stopping;
+} Bench;
+
+#endif
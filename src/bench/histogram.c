@@ -0,0 +1,103 @@
+
+#include <config.h>
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "histogram.h"
+
+static unsigned int
+histogram_msb(uint64_t value)
+{
+    unsigned int msb = 0U;
+
+    while ((value >>= 1) != 0U) {
+        msb++;
+    }
+    return msb;
+}
+
+static size_t
+histogram_index(uint64_t value)
+{
+    unsigned int shift;
+
+    if (value >= ((uint64_t) 1U << HISTOGRAM_MAX_BITS)) {
+        value = ((uint64_t) 1U << HISTOGRAM_MAX_BITS) - 1U;
+    }
+    if (value < 2U * HISTOGRAM_SUB_BUCKETS) {
+        return (size_t) value;
+    }
+    shift = histogram_msb(value) - HISTOGRAM_SUB_BUCKETS_BITS;
+
+    return (size_t) shift * HISTOGRAM_SUB_BUCKETS + (size_t) (value >> shift);
+}
+
+static uint64_t
+histogram_bucket_max(const size_t idx)
+{
+    unsigned int shift;
+    uint64_t     sub;
+
+    if (idx < 2U * HISTOGRAM_SUB_BUCKETS) {
+        return (uint64_t) idx;
+    }
+    shift = (unsigned int) (idx / HISTOGRAM_SUB_BUCKETS) - 1U;
+    sub = (uint64_t) (idx % HISTOGRAM_SUB_BUCKETS) + HISTOGRAM_SUB_BUCKETS;
+
+    return ((sub + 1U) << shift) - 1U;
+}
+
+void
+histogram_init(Histogram * const histogram)
+{
+    memset(histogram, 0, sizeof *histogram);
+    histogram->min = UINT64_MAX;
+}
+
+void
+histogram_record(Histogram * const histogram, const uint64_t value)
+{
+    const size_t idx = histogram_index(value);
+
+    assert(idx < HISTOGRAM_BUCKETS);
+    histogram->buckets[idx]++;
+    histogram->count++;
+    histogram->sum += value;
+    if (value < histogram->min) {
+        histogram->min = value;
+    }
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+uint64_t
+histogram_quantile(const Histogram * const histogram, const double quantile)
+{
+    uint64_t rank;
+    uint64_t seen = 0U;
+    uint64_t value;
+    size_t   i;
+
+    if (histogram->count == 0U) {
+        return 0U;
+    }
+    rank = (uint64_t) (quantile * (double) histogram->count);
+    if (rank >= histogram->count) {
+        rank = histogram->count - 1U;
+    }
+    for (i = 0U; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen > rank) {
+            break;
+        }
+    }
+    value = histogram_bucket_max(i);
+    if (value > histogram->max) {
+        value = histogram->max;
+    }
+    return value;
+}
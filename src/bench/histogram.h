@@ -0,0 +1,36 @@
+
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__ 1
+
+#include <stdint.h>
+
+/*
+ * A high dynamic range histogram of latencies, in microseconds.
+ * Values below 2 * HISTOGRAM_SUB_BUCKETS get their own bucket, larger
+ * values share a bucket with values having the same
+ * HISTOGRAM_SUB_BUCKETS_BITS + 1 most significant bits, so that
+ * percentiles are reported with less than 1% error up to ~71 minutes.
+ */
+#define HISTOGRAM_SUB_BUCKETS_BITS 7U
+#define HISTOGRAM_SUB_BUCKETS (1U << HISTOGRAM_SUB_BUCKETS_BITS)
+#define HISTOGRAM_MAX_BITS 32U
+#define HISTOGRAM_BUCKETS \
+    ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BUCKETS_BITS + 1U) * \
+     HISTOGRAM_SUB_BUCKETS)
+
+typedef struct Histogram_ {
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+} Histogram;
+
+void histogram_init(Histogram * const histogram);
+
+void histogram_record(Histogram * const histogram, const uint64_t value);
+
+uint64_t histogram_quantile(const Histogram * const histogram,
+                            const double quantile);
+
+#endif
@@ -0,0 +1,226 @@
+
+#include <config.h>
+#include <sys/types.h>
+
+#include <assert.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "options.h"
+
+static struct option getopt_long_options[] = {
+    { "concurrency", 1, NULL, 'c' },
+    { "domain", 1, NULL, 'd' },
+    { "duration", 1, NULL, 'D' },
+    { "queries", 1, NULL, 'f' },
+    { "help", 0, NULL, 'h' },
+    { "metrics", 1, NULL, 'm' },
+    { "pcap", 1, NULL, 'p' },
+    { "pcap-port", 1, NULL, 'P' },
+    { "qtype", 1, NULL, 'q' },
+    { "resolver-address", 1, NULL, 'r' },
+    { "rate", 1, NULL, 'R' },
+    { "seed", 1, NULL, 's' },
+    { "speed", 1, NULL, 'S' },
+    { "tcp", 0, NULL, 't' },
+    { "timeout", 1, NULL, 'T' },
+    { "version", 0, NULL, 'V' },
+    { "zipf-names", 1, NULL, 'z' },
+    { "zipf-exponent", 1, NULL, 'Z' },
+    { NULL, 0, NULL, 0 }
+};
+static const char   *getopt_options = "c:d:D:f:hm:p:P:q:r:R:s:S:tT:Vz:Z:";
+
+static void
+options_version(void)
+{
+    puts("dnscrypt-bench v" PACKAGE_VERSION);
+}
+
+static void
+options_usage(void)
+{
+    puts("Usage: dnscrypt-bench [options]\n"
+         "  -c, --concurrency=<n>: queries in flight (closed loop),\n"
+         "    or TCP connections to use\n"
+         "  -d, --domain=<name>: suffix of synthetic names\n"
+         "  -D, --duration=<seconds>: how long to send queries for\n"
+         "    (default: 10 s, or until the end of the capture)\n"
+         "  -f, --queries=<file>: replay \"<name> [<type>]\" lines\n"
+         "    instead of sending synthetic names\n"
+         "  -h, --help: show usage\n"
+         "  -m, --metrics=<ip[:port]|unix:path>: the proxy's metrics\n"
+         "    endpoint, to report local replies and upstream traffic\n"
+         "  -p, --pcap=<file>: replay the queries of a pcap or pcapng\n"
+         "    capture, once, with their original timing\n"
+         "  -P, --pcap-port=<port>: port the captured queries were sent to\n"
+         "  -q, --qtype=<type>: type of synthetic queries\n"
+         "  -r, --resolver-address=<ip[:port]>: the resolver to benchmark\n"
+         "  -R, --rate=<queries/s>: send at a fixed rate (open loop)\n"
+         "  -s, --seed=<n>: seed used to pick synthetic names\n"
+         "  -S, --speed=<factor>: replay the capture this many times\n"
+         "    faster, or as fast as possible (closed loop) with 0\n"
+         "  -t, --tcp: send queries over TCP\n"
+         "  -T, --timeout=<ms>: consider a query lost after this delay\n"
+         "  -V, --version: show version number\n"
+         "  -z, --zipf-names=<n>: number of synthetic names\n"
+         "  -Z, --zipf-exponent=<s>: skew of the name popularity\n"
+         "\n"
+         "Example: dnscrypt-bench -r 127.0.0.1:5300 -R 20000 -D 30\n"
+         "         dnscrypt-bench -r 127.0.0.1:5300 -p dns.pcap -S 10\n"
+         "           -m unix:/var/run/dnscrypt-proxy-metrics.sock\n");
+}
+
+static
+void options_init_with_default(Bench * const bench)
+{
+    bench->server_address = BENCH_DEFAULT_SERVER_ADDRESS;
+    bench->query_file = NULL;
+    bench->pcap_file = NULL;
+    bench->pcap_port = BENCH_DEFAULT_PCAP_PORT;
+    bench->metrics_address = NULL;
+    bench->speed = 1.0;
+    bench->domain = BENCH_DEFAULT_DOMAIN;
+    bench->concurrency = BENCH_DEFAULT_CONCURRENCY;
+    bench->duration = 0U;
+    bench->rate = 0U;
+    bench->timeout_ms = BENCH_DEFAULT_TIMEOUT_MS;
+    bench->zipf_names = BENCH_DEFAULT_ZIPF_NAMES;
+    bench->zipf_exponent = 1.0;
+    bench->seed = 0U;
+    bench->qtype = 1U;
+    bench->tcp = 0;
+}
+
+static unsigned int
+options_parse_uint(const char * const name, const char * const arg,
+                   const unsigned long min, const unsigned long max)
+{
+    char          *endptr;
+    unsigned long  value;
+
+    value = strtoul(arg, &endptr, 10);
+    if (*arg == 0 || *endptr != 0 || value < min || value > max) {
+        fprintf(stderr, "Invalid %s: [%s]\n", name, arg);
+        exit(1);
+    }
+    return (unsigned int) value;
+}
+
+int
+options_parse(Bench * const bench, int argc, char *argv[])
+{
+    char *endptr;
+    int   opt_flag;
+    int   option_index = 0;
+
+    options_init_with_default(bench);
+    while ((opt_flag = getopt_long(argc, argv,
+                                   getopt_options, getopt_long_options,
+                                   &option_index)) != -1) {
+        switch (opt_flag) {
+        case 'c':
+            bench->concurrency = options_parse_uint
+                ("concurrency", optarg, 1UL, BENCH_MAX_IN_FLIGHT);
+            break;
+        case 'd':
+            bench->domain = optarg;
+            break;
+        case 'D':
+            bench->duration = options_parse_uint
+                ("duration", optarg, 1UL, 86400UL);
+            break;
+        case 'f':
+            bench->query_file = optarg;
+            break;
+        case 'h':
+            options_usage();
+            exit(0);
+        case 'm':
+            bench->metrics_address = optarg;
+            break;
+        case 'p':
+            bench->pcap_file = optarg;
+            break;
+        case 'P':
+            bench->pcap_port = (uint16_t) options_parse_uint
+                ("port", optarg, 1UL, 65535UL);
+            break;
+        case 'q':
+            if (queries_parse_type(&bench->qtype, optarg) != 0) {
+                fprintf(stderr, "Unsupported type: [%s]\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'r':
+            bench->server_address = optarg;
+            break;
+        case 'R':
+            bench->rate = options_parse_uint
+                ("rate", optarg, 1UL, BENCH_RATE_MAX);
+            break;
+        case 's':
+            bench->seed = (uint64_t) strtoull(optarg, &endptr, 10);
+            if (*optarg == 0 || *endptr != 0) {
+                fprintf(stderr, "Invalid seed: [%s]\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'S':
+            bench->speed = strtod(optarg, &endptr);
+            if (*optarg == 0 || *endptr != 0 ||
+                !(bench->speed >= 0.0 && bench->speed <= BENCH_SPEED_MAX)) {
+                fprintf(stderr, "Invalid speed: [%s]\n", optarg);
+                exit(1);
+            }
+            break;
+        case 't':
+            bench->tcp = 1;
+            break;
+        case 'T':
+            bench->timeout_ms = options_parse_uint
+                ("timeout", optarg, 1UL, 60000UL);
+            break;
+        case 'V':
+            options_version();
+            exit(0);
+        case 'z':
+            bench->zipf_names = options_parse_uint
+                ("number of names", optarg, 1UL, 10000000UL);
+            break;
+        case 'Z':
+            bench->zipf_exponent = strtod(optarg, &endptr);
+            if (*optarg == 0 || *endptr != 0 ||
+                !(bench->zipf_exponent >= 0.0 &&
+                  bench->zipf_exponent <= 10.0)) {
+                fprintf(stderr, "Invalid exponent: [%s]\n", optarg);
+                exit(1);
+            }
+            break;
+        default:
+            options_usage();
+            exit(1);
+        }
+    }
+    if (optind != argc) {
+        options_usage();
+        exit(1);
+    }
+    if (bench->pcap_file != NULL &&
+        (bench->query_file != NULL || bench->rate > 0U)) {
+        fprintf(stderr, "--pcap cannot be combined with --queries "
+                "or --rate\n");
+        exit(1);
+    }
+    if (bench->duration == 0U && bench->pcap_file == NULL) {
+        bench->duration = BENCH_DEFAULT_DURATION;
+    }
+    if (bench->tcp != 0 && bench->concurrency > BENCH_MAX_CONNECTIONS) {
+        fprintf(stderr, "At most %u TCP connections can be used\n",
+                BENCH_MAX_CONNECTIONS);
+        exit(1);
+    }
+    return 0;
+}
@@ -0,0 +1,9 @@
+
+#ifndef __OPTIONS_H__
+#define __OPTIONS_H__ 1
+
+#include "bench.h"
+
+int options_parse(Bench * const bench, int argc, char *argv[]);
+
+#endif
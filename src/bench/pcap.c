@@ -0,0 +1,475 @@
+
+#include <config.h>
+#include <sys/types.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcap.h"
+
+#define PCAP_MAGIC_USEC   0xa1b2c3d4U
+#define PCAP_MAGIC_NSEC   0xa1b23c4dU
+#define PCAP_HEADER_SIZE  24U
+#define PCAP_RECORD_SIZE  16U
+
+#define PCAPNG_BLOCK_SHB        0x0a0d0d0aU
+#define PCAPNG_BLOCK_IDB        0x00000001U
+#define PCAPNG_BLOCK_OPB        0x00000002U
+#define PCAPNG_BLOCK_SPB        0x00000003U
+#define PCAPNG_BLOCK_EPB        0x00000006U
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4dU
+#define PCAPNG_OPT_END          0U
+#define PCAPNG_OPT_IF_TSRESOL   9U
+#define PCAPNG_MAX_INTERFACES   256U
+#define PCAPNG_MAX_BLOCK_SIZE   (PCAP_MAX_SNAPLEN + 64U)
+
+#define LINKTYPE_NULL       0U
+#define LINKTYPE_ETHERNET   1U
+#define LINKTYPE_RAW        101U
+#define LINKTYPE_LOOP       108U
+#define LINKTYPE_LINUX_SLL  113U
+#define LINKTYPE_IPV4       228U
+#define LINKTYPE_IPV6       229U
+#define LINKTYPE_LINUX_SLL2 276U
+
+#define ETHERTYPE_IPV4   0x0800U
+#define ETHERTYPE_VLAN   0x8100U
+#define ETHERTYPE_QINQ   0x88a8U
+#define ETHERTYPE_IPV6   0x86ddU
+
+#define IP_PROTO_UDP     17U
+#define UDP_HEADER_SIZE  8U
+
+/* Timestamp resolution as stored in a pcapng if_tsresol option */
+#define PCAP_TSRESOL_USEC 6U
+
+typedef struct PcapInterface_ {
+    uint32_t linktype;
+    uint8_t  tsresol;
+} PcapInterface;
+
+typedef struct PcapReader_ {
+    PcapInterface    interfaces[PCAPNG_MAX_INTERFACES];
+    PcapUDPCallback  cb;
+    void            *user_data;
+    const char      *file;
+    uint64_t         last_ts;
+    unsigned int     interfaces_count;
+    uint16_t         dst_port;
+    _Bool            swapped;
+} PcapReader;
+
+static uint16_t
+pcap_u16(const uint8_t * const p, const _Bool swapped)
+{
+    if (swapped != 0) {
+        return (uint16_t) (p[1] << 8 | p[0]);
+    }
+    return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static uint32_t
+pcap_u32(const uint8_t * const p, const _Bool swapped)
+{
+    if (swapped != 0) {
+        return (uint32_t) p[3] << 24 | (uint32_t) p[2] << 16 |
+            (uint32_t) p[1] << 8 | (uint32_t) p[0];
+    }
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+        (uint32_t) p[2] << 8 | (uint32_t) p[3];
+}
+
+/* Capture headers use the writer's byte order, protocol headers don't */
+
+static uint16_t
+pcap_be16(const uint8_t * const p)
+{
+    return pcap_u16(p, 0);
+}
+
+/*
+ * Converts a timestamp expressed in units of 10^-tsresol seconds, or
+ * 2^-(tsresol & 0x7f) seconds if the most significant bit is set,
+ * to microseconds.
+ */
+
+static uint64_t
+pcap_ts_usec(const uint64_t ts, const uint8_t tsresol)
+{
+    double       usec;
+    uint64_t     scale = 1U;
+    unsigned int i;
+
+    if ((tsresol & 0x80) != 0) {
+        usec = ldexp((double) ts * 1e6, -(int) (tsresol & 0x7f));
+        return (uint64_t) usec;
+    }
+    if (tsresol <= PCAP_TSRESOL_USEC) {
+        for (i = tsresol; i < PCAP_TSRESOL_USEC; i++) {
+            scale *= 10U;
+        }
+        return ts * scale;
+    }
+    for (i = PCAP_TSRESOL_USEC; i < tsresol && i < 25U; i++) {
+        scale *= 10U;
+    }
+    return ts / scale;
+}
+
+static int
+pcap_udp(PcapReader * const reader, const uint64_t ts,
+         const uint8_t * const udp, const size_t udp_len)
+{
+    size_t payload_len;
+
+    if (udp_len < UDP_HEADER_SIZE ||
+        pcap_be16(udp + 2U) != reader->dst_port) {
+        return 0;
+    }
+    payload_len = (size_t) pcap_be16(udp + 4U);
+    if (payload_len < UDP_HEADER_SIZE || payload_len > udp_len) {
+        return 0;
+    }
+    payload_len -= UDP_HEADER_SIZE;
+
+    return reader->cb(reader->user_data, ts,
+                      udp + UDP_HEADER_SIZE, payload_len);
+}
+
+static int
+pcap_ip(PcapReader * const reader, const uint64_t ts,
+        const uint8_t * const ip, const size_t ip_len)
+{
+    size_t header_len;
+    size_t total_len;
+
+    if (ip_len < 1U) {
+        return 0;
+    }
+    switch (ip[0] >> 4) {
+    case 4:
+        header_len = (size_t) (ip[0] & 0xf) * 4U;
+        if (ip_len < 20U || header_len < 20U || ip[9] != IP_PROTO_UDP ||
+            (pcap_be16(ip + 6U) & 0x3fff) != 0U) {
+            return 0;
+        }
+        total_len = (size_t) pcap_be16(ip + 2U);
+        if (total_len > ip_len) {
+            total_len = ip_len;
+        }
+        if (header_len > total_len) {
+            return 0;
+        }
+        return pcap_udp(reader, ts, ip + header_len, total_len - header_len);
+    case 6:
+        if (ip_len < 40U || ip[6] != IP_PROTO_UDP) {
+            return 0;
+        }
+        total_len = 40U + (size_t) pcap_be16(ip + 4U);
+        if (total_len > ip_len) {
+            total_len = ip_len;
+        }
+        return pcap_udp(reader, ts, ip + 40U, total_len - 40U);
+    }
+    return 0;
+}
+
+static int
+pcap_packet(PcapReader * const reader, const uint32_t linktype,
+            const uint64_t ts, const uint8_t *frame, size_t frame_len)
+{
+    size_t   header_len;
+    uint16_t ethertype;
+
+    switch (linktype) {
+    case LINKTYPE_NULL:
+    case LINKTYPE_LOOP:
+        header_len = 4U;
+        break;
+    case LINKTYPE_RAW:
+    case LINKTYPE_IPV4:
+    case LINKTYPE_IPV6:
+        header_len = 0U;
+        break;
+    case LINKTYPE_ETHERNET:
+        if (frame_len < 14U) {
+            return 0;
+        }
+        header_len = 14U;
+        ethertype = pcap_be16(frame + 12U);
+        while ((ethertype == ETHERTYPE_VLAN || ethertype == ETHERTYPE_QINQ) &&
+               frame_len >= header_len + 4U) {
+            ethertype = pcap_be16(frame + header_len + 2U);
+            header_len += 4U;
+        }
+        if (ethertype != ETHERTYPE_IPV4 && ethertype != ETHERTYPE_IPV6) {
+            return 0;
+        }
+        break;
+    case LINKTYPE_LINUX_SLL:
+        if (frame_len < 16U) {
+            return 0;
+        }
+        header_len = 16U;
+        ethertype = pcap_be16(frame + 14U);
+        if (ethertype != ETHERTYPE_IPV4 && ethertype != ETHERTYPE_IPV6) {
+            return 0;
+        }
+        break;
+    case LINKTYPE_LINUX_SLL2:
+        if (frame_len < 20U) {
+            return 0;
+        }
+        header_len = 20U;
+        ethertype = pcap_be16(frame);
+        if (ethertype != ETHERTYPE_IPV4 && ethertype != ETHERTYPE_IPV6) {
+            return 0;
+        }
+        break;
+    default:
+        return 0;
+    }
+    if (frame_len < header_len) {
+        return 0;
+    }
+    return pcap_ip(reader, ts, frame + header_len, frame_len - header_len);
+}
+
+static int
+pcap_read_classic(PcapReader * const reader, FILE * const fp,
+                  const uint8_t header[PCAP_HEADER_SIZE])
+{
+    uint8_t        record[PCAP_RECORD_SIZE];
+    uint8_t       *frame;
+    uint32_t       linktype;
+    uint32_t       caplen;
+    uint64_t       ts;
+    int            ret = 0;
+    _Bool          nsec;
+
+    reader->swapped = pcap_u32(header, 0) != PCAP_MAGIC_USEC &&
+        pcap_u32(header, 0) != PCAP_MAGIC_NSEC;
+    nsec = pcap_u32(header, reader->swapped) == PCAP_MAGIC_NSEC;
+    linktype = pcap_u32(header + 20U, reader->swapped) & 0xffff;
+    if ((frame = malloc(PCAP_MAX_SNAPLEN)) == NULL) {
+        return -1;
+    }
+    while (ret == 0 && fread(record, sizeof record, (size_t) 1U, fp) == 1U) {
+        caplen = pcap_u32(record + 8U, reader->swapped);
+        if (caplen > PCAP_MAX_SNAPLEN) {
+            fprintf(stderr, "%s: corrupted packet capture\n", reader->file);
+            ret = -1;
+            break;
+        }
+        if (fread(frame, (size_t) 1U, caplen, fp) != caplen) {
+            break;
+        }
+        ts = (uint64_t) pcap_u32(record, reader->swapped) * 1000000U;
+        if (nsec != 0) {
+            ts += pcap_u32(record + 4U, reader->swapped) / 1000U;
+        } else {
+            ts += pcap_u32(record + 4U, reader->swapped);
+        }
+        ret = pcap_packet(reader, linktype, ts, frame, caplen);
+    }
+    free(frame);
+
+    return ret;
+}
+
+static void
+pcapng_interface(PcapReader * const reader,
+                 const uint8_t * const body, const size_t body_len)
+{
+    PcapInterface *interface;
+    size_t         pos = 8U;
+    uint16_t       code;
+    uint16_t       len;
+
+    if (body_len < 8U || reader->interfaces_count >= PCAPNG_MAX_INTERFACES) {
+        return;
+    }
+    interface = &reader->interfaces[reader->interfaces_count++];
+    interface->linktype = pcap_u16(body, reader->swapped);
+    interface->tsresol = PCAP_TSRESOL_USEC;
+    while (pos + 4U <= body_len) {
+        code = pcap_u16(body + pos, reader->swapped);
+        len = pcap_u16(body + pos + 2U, reader->swapped);
+        pos += 4U;
+        if (code == PCAPNG_OPT_END || pos + len > body_len) {
+            break;
+        }
+        if (code == PCAPNG_OPT_IF_TSRESOL && len >= 1U) {
+            interface->tsresol = body[pos];
+        }
+        pos += ((size_t) len + 3U) & ~(size_t) 3U;
+    }
+}
+
+/*
+ * Enhanced and obsolete packet blocks share the same layout, except
+ * that the interface ID of the latter is only 16 bits long.
+ */
+
+static int
+pcapng_packet(PcapReader * const reader, const uint32_t type,
+              const uint8_t * const block, const size_t body_len)
+{
+    const PcapInterface *interface;
+    uint64_t             ts;
+    uint32_t             interface_id;
+    size_t               caplen;
+
+    if (type == PCAPNG_BLOCK_OPB) {
+        interface_id = pcap_u16(block + 8U, reader->swapped);
+    } else {
+        interface_id = pcap_u32(block + 8U, reader->swapped);
+    }
+    if (interface_id >= reader->interfaces_count) {
+        return 0;
+    }
+    interface = &reader->interfaces[interface_id];
+    ts = (uint64_t) pcap_u32(block + 12U, reader->swapped) << 32 |
+        (uint64_t) pcap_u32(block + 16U, reader->swapped);
+    reader->last_ts = pcap_ts_usec(ts, interface->tsresol);
+    caplen = (size_t) pcap_u32(block + 20U, reader->swapped);
+    if (caplen > body_len - 20U) {
+        caplen = body_len - 20U;
+    }
+    return pcap_packet(reader, interface->linktype, reader->last_ts,
+                       block + 28U, caplen);
+}
+
+static int
+pcap_read_ng(PcapReader * const reader, FILE * const fp,
+             const uint8_t first[PCAP_HEADER_SIZE])
+{
+    uint8_t  *block;
+    uint32_t  type;
+    uint32_t  len;
+    size_t    body_len;
+    int       ret = 0;
+
+    if ((block = malloc(PCAPNG_MAX_BLOCK_SIZE)) == NULL) {
+        return -1;
+    }
+    memcpy(block, first, PCAP_HEADER_SIZE);
+    for (;;) {
+        type = pcap_u32(block, reader->swapped);
+        if (type == PCAPNG_BLOCK_SHB) {
+            if (pcap_u32(block + 8U, 0) == PCAPNG_BYTE_ORDER_MAGIC) {
+                reader->swapped = 0;
+            } else if (pcap_u32(block + 8U, 1) == PCAPNG_BYTE_ORDER_MAGIC) {
+                reader->swapped = 1;
+            } else {
+                ret = -1;
+            }
+            reader->interfaces_count = 0U;
+        }
+        len = pcap_u32(block + 4U, reader->swapped);
+        if (ret != 0 || len < 12U || (len & 3U) != 0U) {
+            fprintf(stderr, "%s: corrupted packet capture\n", reader->file);
+            ret = -1;
+            break;
+        }
+        if (len > PCAPNG_MAX_BLOCK_SIZE) {
+            if (fseek(fp, (long) (len - PCAP_HEADER_SIZE), SEEK_CUR) != 0) {
+                break;
+            }
+        } else if (len > PCAP_HEADER_SIZE) {
+            if (fread(block + PCAP_HEADER_SIZE, (size_t) 1U,
+                      len - PCAP_HEADER_SIZE, fp) != len - PCAP_HEADER_SIZE) {
+                break;
+            }
+        }
+        body_len = (size_t) len - 12U;
+        if (len <= PCAPNG_MAX_BLOCK_SIZE) {
+            switch (type) {
+            case PCAPNG_BLOCK_IDB:
+                pcapng_interface(reader, block + 8U, body_len);
+                break;
+            case PCAPNG_BLOCK_EPB:
+            case PCAPNG_BLOCK_OPB:
+                if (body_len >= 20U) {
+                    ret = pcapng_packet(reader, type, block, body_len);
+                }
+                break;
+            case PCAPNG_BLOCK_SPB:
+                /* No timestamp: reuse the one of the previous packet */
+                if (body_len >= 4U && reader->interfaces_count > 0U) {
+                    ret = pcap_packet(reader, reader->interfaces[0].linktype,
+                                      reader->last_ts, block + 12U,
+                                      body_len - 4U);
+                }
+                break;
+            }
+        }
+        if (ret != 0) {
+            break;
+        }
+        if (len < PCAP_HEADER_SIZE) {
+            memmove(block, block + len, PCAP_HEADER_SIZE - len);
+            if (fread(block + PCAP_HEADER_SIZE - len, (size_t) 1U, len, fp) !=
+                len) {
+                break;
+            }
+        } else if (fread(block, (size_t) 1U, PCAP_HEADER_SIZE, fp) !=
+                   PCAP_HEADER_SIZE) {
+            break;
+        }
+    }
+    free(block);
+
+    return ret;
+}
+
+int
+pcap_read_udp(const char * const file, const uint16_t dst_port,
+              PcapUDPCallback cb, void * const user_data)
+{
+    uint8_t     header[PCAP_HEADER_SIZE];
+    PcapReader *reader;
+    FILE       *fp;
+    uint32_t    magic;
+    int         ret;
+
+    if ((fp = fopen(file, "rb")) == NULL) {
+        perror(file);
+        return -1;
+    }
+    if (fread(header, sizeof header, (size_t) 1U, fp) != 1U) {
+        fprintf(stderr, "%s: not a packet capture\n", file);
+        fclose(fp);
+        return -1;
+    }
+    if ((reader = calloc((size_t) 1U, sizeof *reader)) == NULL) {
+        fclose(fp);
+        return -1;
+    }
+    reader->cb = cb;
+    reader->user_data = user_data;
+    reader->file = file;
+    reader->dst_port = dst_port;
+    magic = pcap_u32(header, 0);
+    if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC ||
+        pcap_u32(header, 1) == PCAP_MAGIC_USEC ||
+        pcap_u32(header, 1) == PCAP_MAGIC_NSEC) {
+        ret = pcap_read_classic(reader, fp, header);
+    } else if (magic == PCAPNG_BLOCK_SHB) {
+        ret = pcap_read_ng(reader, fp, header);
+    } else {
+        fprintf(stderr, "%s: not a packet capture\n", file);
+        ret = -1;
+    }
+    if (ferror(fp)) {
+        perror(file);
+        ret = -1;
+    }
+    free(reader);
+    fclose(fp);
+
+    return ret;
+}
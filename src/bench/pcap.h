@@ -0,0 +1,35 @@
+
+#ifndef __PCAP_H__
+#define __PCAP_H__ 1
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * A minimal reader for packet captures, in the classic pcap format
+ * (either byte order, microsecond or nanosecond timestamps) and in the
+ * pcapng format, as written by tcpdump, tshark and dumpcap.
+ *
+ * Only UDP datagrams over IPv4 or IPv6 are looked at, on Ethernet
+ * (with 802.1Q tags), raw IP, Linux cooked and BSD loopback links.
+ * IP fragments and IPv6 extension headers are skipped.
+ */
+
+#define PCAP_MAX_SNAPLEN 262144U
+
+/*
+ * Called for every UDP datagram sent to dst_port, with the capture
+ * timestamp in microseconds. A non-zero return value stops reading,
+ * and is returned by pcap_read_udp(), which returns -1 if the capture
+ * cannot be read.
+ */
+typedef int (*PcapUDPCallback)(void * const user_data, const uint64_t ts,
+                               const uint8_t * const payload,
+                               const size_t payload_len);
+
+int pcap_read_udp(const char * const file, const uint16_t dst_port,
+                  PcapUDPCallback cb, void * const user_data);
+
+#endif
@@ -0,0 +1,187 @@
+
+#include <config.h>
+#include <sys/types.h>
+#ifdef _WIN32
+# include <winsock2.h>
+# include <ws2tcpip.h>
+#else
+# include <sys/socket.h>
+# include <sys/time.h>
+# include <sys/un.h>
+# include <netinet/in.h>
+#endif
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <event2/util.h>
+
+#include "proxy_metrics.h"
+
+#define PROXY_METRICS_REQUEST "GET /metrics HTTP/1.0\r\n\r\n"
+
+static const struct {
+    const char *name;
+    size_t      offset;
+} proxy_metrics_counters[] = {
+    { "dnscrypt_proxy_queries_total",
+      offsetof(ProxyMetrics, queries) },
+    { "dnscrypt_proxy_local_replies_total",
+      offsetof(ProxyMetrics, local_replies) },
+    { "dnscrypt_proxy_upstream_queries_total",
+      offsetof(ProxyMetrics, upstream_queries) },
+    { "dnscrypt_proxy_upstream_sent_bytes_total",
+      offsetof(ProxyMetrics, upstream_sent_bytes) },
+    { "dnscrypt_proxy_upstream_received_bytes_total",
+      offsetof(ProxyMetrics, upstream_received_bytes) }
+};
+
+static evutil_socket_t
+proxy_metrics_connect(const char * const address)
+{
+    struct sockaddr_storage sockaddr;
+    struct timeval          tv;
+    evutil_socket_t         handle;
+    int                     sockaddr_len = (int) sizeof sockaddr;
+
+    memset(&sockaddr, 0, sizeof sockaddr);
+    if (strncmp(address, PROXY_METRICS_UNIX_PREFIX,
+                sizeof PROXY_METRICS_UNIX_PREFIX - 1U) == 0) {
+#ifdef _WIN32
+        fprintf(stderr, "Unix sockets are not supported on this platform\n");
+        return (evutil_socket_t) -1;
+#else
+        struct sockaddr_un *su = (struct sockaddr_un *) &sockaddr;
+        const char         *path =
+            address + sizeof PROXY_METRICS_UNIX_PREFIX - 1U;
+
+        if (strlen(path) >= sizeof su->sun_path) {
+            fprintf(stderr, "Unix socket path too long: [%s]\n", path);
+            return (evutil_socket_t) -1;
+        }
+        su->sun_family = AF_UNIX;
+        memcpy(su->sun_path, path, strlen(path) + 1U);
+        sockaddr_len = (int) sizeof *su;
+#endif
+    } else if (evutil_parse_sockaddr_port(address,
+                                          (struct sockaddr *) &sockaddr,
+                                          &sockaddr_len) != 0) {
+        fprintf(stderr, "Unsupported metrics address: [%s]\n", address);
+        return (evutil_socket_t) -1;
+    }
+    if (sockaddr.ss_family == AF_INET &&
+        ((struct sockaddr_in *) &sockaddr)->sin_port == 0) {
+        ((struct sockaddr_in *) &sockaddr)->sin_port =
+            htons(PROXY_METRICS_DEFAULT_PORT);
+    } else if (sockaddr.ss_family == AF_INET6 &&
+               ((struct sockaddr_in6 *) &sockaddr)->sin6_port == 0) {
+        ((struct sockaddr_in6 *) &sockaddr)->sin6_port =
+            htons(PROXY_METRICS_DEFAULT_PORT);
+    }
+    if ((handle = socket(sockaddr.ss_family, SOCK_STREAM, 0)) == -1) {
+        perror("socket");
+        return (evutil_socket_t) -1;
+    }
+    tv.tv_sec = PROXY_METRICS_TIMEOUT;
+    tv.tv_usec = 0;
+    setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, (void *) &tv,
+               (ev_socklen_t) sizeof tv);
+    setsockopt(handle, SOL_SOCKET, SO_SNDTIMEO, (void *) &tv,
+               (ev_socklen_t) sizeof tv);
+    if (connect(handle, (struct sockaddr *) &sockaddr,
+                (ev_socklen_t) sockaddr_len) != 0) {
+        fprintf(stderr, "Unable to connect to the metrics endpoint [%s]\n",
+                address);
+        evutil_closesocket(handle);
+        return (evutil_socket_t) -1;
+    }
+    return handle;
+}
+
+/*
+ * Counters with labels, such as the transport, are summed.
+ * Lines look like "<name>[{<labels>}] <value>".
+ */
+
+static void
+proxy_metrics_parse(ProxyMetrics * const metrics, char *response)
+{
+    char     *line;
+    char     *value;
+    char     *endptr;
+    size_t    name_len;
+    size_t    i;
+    uint64_t  counter;
+
+    while ((line = response) != NULL) {
+        if ((response = strchr(line, '\n')) != NULL) {
+            *response++ = 0;
+        }
+        if (*line == '#' || (value = strrchr(line, ' ')) == NULL) {
+            continue;
+        }
+        name_len = strcspn(line, "{ ");
+        counter = (uint64_t) strtoull(value + 1, &endptr, 10);
+        if (endptr == value + 1 || (*endptr != 0 && *endptr != '\r')) {
+            continue;
+        }
+        for (i = 0U; i < sizeof proxy_metrics_counters /
+                 sizeof proxy_metrics_counters[0]; i++) {
+            if (strlen(proxy_metrics_counters[i].name) == name_len &&
+                memcmp(line, proxy_metrics_counters[i].name, name_len) == 0) {
+                *(uint64_t *) (void *)
+                    ((unsigned char *) metrics +
+                     proxy_metrics_counters[i].offset) += counter;
+                break;
+            }
+        }
+    }
+}
+
+int
+proxy_metrics_scrape(ProxyMetrics * const metrics, const char * const address)
+{
+    char            *response;
+    char            *body;
+    size_t           response_len = (size_t) 0U;
+    ssize_t          nread;
+    evutil_socket_t  handle;
+
+    memset(metrics, 0, sizeof *metrics);
+    if ((handle = proxy_metrics_connect(address)) == -1) {
+        return -1;
+    }
+    if ((response = malloc(PROXY_METRICS_MAX_RESPONSE_SIZE + 1U)) == NULL ||
+        send(handle, PROXY_METRICS_REQUEST,
+             sizeof PROXY_METRICS_REQUEST - 1U, 0) !=
+        (ssize_t) (sizeof PROXY_METRICS_REQUEST - 1U)) {
+        free(response);
+        evutil_closesocket(handle);
+        return -1;
+    }
+    while (response_len < PROXY_METRICS_MAX_RESPONSE_SIZE &&
+           (nread = recv(handle, response + response_len,
+                         PROXY_METRICS_MAX_RESPONSE_SIZE - response_len,
+                         0)) > (ssize_t) 0) {
+        response_len += (size_t) nread;
+    }
+    evutil_closesocket(handle);
+    response[response_len] = 0;
+    if (strncmp(response, "HTTP/1.", sizeof "HTTP/1." - 1U) != 0 ||
+        strncmp(response + sizeof "HTTP/1.x" - 1U, " 200",
+                sizeof " 200" - 1U) != 0 ||
+        (body = strstr(response, "\r\n\r\n")) == NULL) {
+        fprintf(stderr, "Unexpected response from the metrics endpoint [%s]\n",
+                address);
+        free(response);
+        return -1;
+    }
+    proxy_metrics_parse(metrics, body + 4U);
+    free(response);
+
+    return 0;
+}
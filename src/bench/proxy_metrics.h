@@ -0,0 +1,29 @@
+
+#ifndef __PROXY_METRICS_H__
+#define __PROXY_METRICS_H__ 1
+
+#include <stdint.h>
+
+/*
+ * Counters read from the proxy's metrics endpoint, before and after a
+ * run, to tell how many client queries it answered without contacting
+ * the resolver, and how much upstream traffic the others caused.
+ */
+
+#define PROXY_METRICS_UNIX_PREFIX "unix:"
+#define PROXY_METRICS_DEFAULT_PORT 9153U
+#define PROXY_METRICS_MAX_RESPONSE_SIZE (1024U * 1024U)
+#define PROXY_METRICS_TIMEOUT 5
+
+typedef struct ProxyMetrics_ {
+    uint64_t queries;
+    uint64_t local_replies;
+    uint64_t upstream_queries;
+    uint64_t upstream_sent_bytes;
+    uint64_t upstream_received_bytes;
+} ProxyMetrics;
+
+int proxy_metrics_scrape(ProxyMetrics * const metrics,
+                         const char * const address);
+
+#endif
@@ -0,0 +1,412 @@
+
+#include <config.h>
+#include <sys/types.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <event2/util.h>
+
+#include "pcap.h"
+#include "queries.h"
+
+#define DNS_CLASS_IN 1U
+#define DNS_FLAGS_QR 0x80U
+#define DNS_FLAGS_OPCODE 0x78U
+#define DNS_FLAGS_RD 0x01U
+#define DNS_OFFSET_FLAGS 2U
+#define DNS_OFFSET_QDCOUNT 4U
+
+#define QUERIES_LINE_MAX 1024U
+
+static const struct {
+    const char *name;
+    uint16_t    qtype;
+} queries_types[] = {
+    { "A", 1U },
+    { "NS", 2U },
+    { "CNAME", 5U },
+    { "SOA", 6U },
+    { "PTR", 12U },
+    { "MX", 15U },
+    { "TXT", 16U },
+    { "AAAA", 28U },
+    { "SRV", 33U },
+    { "DS", 43U },
+    { "DNSKEY", 48U },
+    { "ANY", 255U }
+};
+
+int
+queries_parse_type(uint16_t * const qtype, const char * const name)
+{
+    char          *endptr;
+    unsigned long  value;
+    size_t         i;
+
+    for (i = (size_t) 0U; i < sizeof queries_types / sizeof queries_types[0];
+         i++) {
+        if (evutil_ascii_strcasecmp(name, queries_types[i].name) == 0) {
+            *qtype = queries_types[i].qtype;
+            return 0;
+        }
+    }
+    if (evutil_ascii_strncasecmp(name, "TYPE", 4U) == 0) {
+        value = strtoul(name + 4U, &endptr, 10);
+        if (name[4] != 0 && *endptr == 0 && value <= 0xffff) {
+            *qtype = (uint16_t) value;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int
+queries_encode(Query * const query, const char * const name,
+               const uint16_t qtype)
+{
+    uint8_t     wire[DNS_HEADER_SIZE + DNS_MAX_HOSTNAME_LEN + 6U];
+    const char *label = name;
+    const char *dot;
+    size_t      label_len;
+    size_t      pos = DNS_HEADER_SIZE;
+
+    memset(wire, 0, DNS_HEADER_SIZE);
+    wire[DNS_OFFSET_FLAGS] = DNS_FLAGS_RD;
+    wire[DNS_OFFSET_QDCOUNT + 1U] = 1U;
+    while (*label != 0) {
+        if ((dot = strchr(label, '.')) == NULL) {
+            dot = label + strlen(label);
+        }
+        label_len = (size_t) (dot - label);
+        if (label_len <= (size_t) 0U || label_len > (size_t) 63U ||
+            pos - DNS_HEADER_SIZE + label_len + 2U > DNS_MAX_HOSTNAME_LEN) {
+            return -1;
+        }
+        wire[pos++] = (uint8_t) label_len;
+        memcpy(&wire[pos], label, label_len);
+        pos += label_len;
+        label = *dot == '.' ? dot + 1 : dot;
+    }
+    wire[pos++] = 0U;
+    wire[pos++] = (uint8_t) (qtype >> 8);
+    wire[pos++] = (uint8_t) qtype;
+    wire[pos++] = 0U;
+    wire[pos++] = (uint8_t) DNS_CLASS_IN;
+    if ((query->wire = malloc(pos)) == NULL) {
+        return -1;
+    }
+    memcpy(query->wire, wire, pos);
+    query->wire_len = pos;
+    query->offset = 0U;
+
+    return 0;
+}
+
+static Queries *
+queries_new(const size_t queries_count)
+{
+    Queries *queries;
+
+    if ((queries = calloc((size_t) 1U, sizeof *queries)) == NULL) {
+        return NULL;
+    }
+    queries->zipf_cdf = NULL;
+    queries->queries_count = (size_t) 0U;
+    queries->next = (size_t) 0U;
+    queries->once = 0;
+    queries_seed(queries, 0U);
+    if (queries_count > (size_t) 0U &&
+        (queries->queries = calloc(queries_count,
+                                   sizeof *queries->queries)) == NULL) {
+        free(queries);
+        return NULL;
+    }
+    return queries;
+}
+
+static int
+queries_grow(Queries * const queries, size_t * const queries_max)
+{
+    Query  *tmp;
+    size_t  new_max;
+
+    if (queries->queries_count >= *queries_max) {
+        new_max = *queries_max * 2U + 16U;
+        if ((tmp = realloc(queries->queries,
+                           new_max * sizeof *tmp)) == NULL) {
+            return -1;
+        }
+        queries->queries = tmp;
+        *queries_max = new_max;
+    }
+    return 0;
+}
+
+static int
+queries_add(Queries * const queries, size_t * const queries_max,
+            const char * const name, const uint16_t qtype)
+{
+    if (queries_grow(queries, queries_max) != 0) {
+        return -1;
+    }
+    if (queries_encode(&queries->queries[queries->queries_count],
+                       name, qtype) != 0) {
+        return -1;
+    }
+    queries->queries_count++;
+
+    return 0;
+}
+
+Queries *
+queries_load(const char * const file)
+{
+    char          line[QUERIES_LINE_MAX];
+    Queries      *queries;
+    FILE         *fp;
+    char         *comment;
+    char         *name;
+    char         *type;
+    size_t        queries_max = (size_t) 0U;
+    unsigned int  line_count = 0U;
+    uint16_t      qtype;
+
+    if ((queries = queries_new((size_t) 0U)) == NULL) {
+        return NULL;
+    }
+    if ((fp = fopen(file, "r")) == NULL) {
+        perror(file);
+        queries_free(queries);
+        return NULL;
+    }
+    while (fgets(line, (int) sizeof line, fp) != NULL) {
+        line_count++;
+        if ((comment = strchr(line, ';')) != NULL) {
+            *comment = 0;
+        }
+        if ((name = strtok(line, " \t\r\n")) == NULL) {
+            continue;
+        }
+        qtype = 1U;
+        if ((type = strtok(NULL, " \t\r\n")) != NULL &&
+            queries_parse_type(&qtype, type) != 0) {
+            fprintf(stderr, "%s:%u: unsupported type [%s]\n",
+                    file, line_count, type);
+            break;
+        }
+        if (queries_add(queries, &queries_max, name, qtype) != 0) {
+            fprintf(stderr, "%s:%u: invalid query\n", file, line_count);
+            break;
+        }
+    }
+    if (ferror(fp) || !feof(fp) || queries->queries_count <= (size_t) 0U) {
+        if (queries->queries_count <= (size_t) 0U) {
+            fprintf(stderr, "%s: no queries\n", file);
+        }
+        fclose(fp);
+        queries_free(queries);
+        return NULL;
+    }
+    fclose(fp);
+
+    return queries;
+}
+
+typedef struct QueriesPcapCtx_ {
+    Queries  *queries;
+    size_t    queries_max;
+    uint64_t  first_ts;
+    uint64_t  last_ts;
+} QueriesPcapCtx;
+
+/*
+ * Captures can contain replies and other opcodes sent to the same
+ * port; only standard queries are kept, as they were sent.
+ * Timestamps going backwards, as can happen when a capture merges
+ * several interfaces, are replaced with the previous one.
+ */
+
+static int
+queries_pcap_cb(void * const ctx_, const uint64_t ts,
+                const uint8_t * const payload, const size_t payload_len)
+{
+    QueriesPcapCtx * const ctx = ctx_;
+    Queries * const        queries = ctx->queries;
+    Query                 *query;
+
+    if (payload_len < DNS_HEADER_SIZE ||
+        (payload[DNS_OFFSET_FLAGS] & (DNS_FLAGS_QR | DNS_FLAGS_OPCODE)) != 0U) {
+        return 0;
+    }
+    if (queries->queries_count == (size_t) 0U) {
+        ctx->first_ts = ctx->last_ts = ts;
+    } else if (ts > ctx->last_ts) {
+        ctx->last_ts = ts;
+    }
+    if (queries_grow(queries, &ctx->queries_max) != 0) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    query = &queries->queries[queries->queries_count];
+    if ((query->wire = malloc(payload_len)) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    memcpy(query->wire, payload, payload_len);
+    query->wire_len = payload_len;
+    query->offset = ctx->last_ts - ctx->first_ts;
+    queries->queries_count++;
+
+    return 0;
+}
+
+Queries *
+queries_pcap(const char * const file, const uint16_t port)
+{
+    QueriesPcapCtx ctx;
+
+    memset(&ctx, 0, sizeof ctx);
+    if ((ctx.queries = queries_new((size_t) 0U)) == NULL) {
+        return NULL;
+    }
+    ctx.queries->once = 1;
+    if (pcap_read_udp(file, port, queries_pcap_cb, &ctx) != 0) {
+        queries_free(ctx.queries);
+        return NULL;
+    }
+    if (ctx.queries->queries_count <= (size_t) 0U) {
+        fprintf(stderr, "%s: no queries sent to port %u\n",
+                file, (unsigned int) port);
+        queries_free(ctx.queries);
+        return NULL;
+    }
+    return ctx.queries;
+}
+
+Queries *
+queries_zipf(const char * const domain, const size_t names_count,
+             const double exponent, const uint16_t qtype)
+{
+    char     name[DNS_MAX_HOSTNAME_LEN + 1U];
+    Queries *queries;
+    double   total = 0.0;
+    size_t   i;
+
+    assert(names_count > (size_t) 0U);
+    if ((queries = queries_new(names_count)) == NULL) {
+        return NULL;
+    }
+    if ((queries->zipf_cdf = calloc(names_count,
+                                    sizeof *queries->zipf_cdf)) == NULL) {
+        queries_free(queries);
+        return NULL;
+    }
+    for (i = (size_t) 0U; i < names_count; i++) {
+        evutil_snprintf(name, sizeof name, "%lu.%s",
+                        (unsigned long) i + 1UL, domain);
+        if (queries_encode(&queries->queries[i], name, qtype) != 0) {
+            fprintf(stderr, "Invalid domain: [%s]\n", domain);
+            queries_free(queries);
+            return NULL;
+        }
+        queries->queries_count++;
+        total += 1.0 / pow((double) (i + 1U), exponent);
+        queries->zipf_cdf[i] = total;
+    }
+    for (i = (size_t) 0U; i < names_count; i++) {
+        queries->zipf_cdf[i] /= total;
+    }
+    return queries;
+}
+
+void
+queries_free(Queries * const queries)
+{
+    size_t i;
+
+    if (queries == NULL) {
+        return;
+    }
+    for (i = (size_t) 0U; i < queries->queries_count; i++) {
+        free(queries->queries[i].wire);
+    }
+    free(queries->queries);
+    free(queries->zipf_cdf);
+    free(queries);
+}
+
+void
+queries_seed(Queries * const queries, uint64_t seed)
+{
+    if (seed == 0U) {
+        seed = 0x9e3779b97f4a7c15ULL;
+    }
+    queries->rng_state = seed;
+}
+
+/* xorshift64*: good enough to pick names, and reproducible with --seed */
+
+static uint64_t
+queries_random(Queries * const queries)
+{
+    uint64_t x = queries->rng_state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    queries->rng_state = x;
+
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+const Query *
+queries_next(Queries * const queries)
+{
+    double u;
+    size_t lo;
+    size_t hi;
+    size_t mid;
+
+    if (queries->zipf_cdf == NULL) {
+        if (queries->next >= queries->queries_count) {
+            if (queries->once != 0) {
+                return NULL;
+            }
+            queries->next = (size_t) 0U;
+        }
+        return &queries->queries[queries->next++];
+    }
+    u = (double) (queries_random(queries) >> 11) / 9007199254740992.0;
+    lo = (size_t) 0U;
+    hi = queries->queries_count - 1U;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2U;
+        if (queries->zipf_cdf[mid] <= u) {
+            lo = mid + 1U;
+        } else {
+            hi = mid;
+        }
+    }
+    return &queries->queries[lo];
+}
+
+/* The query queries_next() will return, if it doesn't pick one at random */
+
+const Query *
+queries_peek(const Queries * const queries)
+{
+    assert(queries->zipf_cdf == NULL);
+    if (queries->next >= queries->queries_count) {
+        if (queries->once != 0 || queries->queries_count <= (size_t) 0U) {
+            return NULL;
+        }
+        return &queries->queries[0];
+    }
+    return &queries->queries[queries->next];
+}
@@ -0,0 +1,60 @@
+
+#ifndef __QUERIES_H__
+#define __QUERIES_H__ 1
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define DNS_HEADER_SIZE 12U
+#define DNS_MAX_HOSTNAME_LEN 255U
+#define DNS_MAX_PACKET_SIZE 65535U
+
+/*
+ * The queries to send, encoded once at startup so that sending a query
+ * only takes a copy and a new ID.
+ *
+ * They are either read from a file, with one "<name> [<type>]" per
+ * line and ';' comments, and replayed in order, or synthesized as
+ * "<rank>.<domain>" names, picked with a Zipf distribution so that a
+ * few names are very popular and most are not.
+ *
+ * Queries can also be extracted from a packet capture. They are then
+ * replayed only once, and each of them remembers when it was captured,
+ * relative to the first one.
+ */
+
+typedef struct Query_ {
+    uint8_t  *wire;
+    size_t    wire_len;
+    uint64_t  offset;
+} Query;
+
+typedef struct Queries_ {
+    Query    *queries;
+    double   *zipf_cdf;
+    size_t    queries_count;
+    size_t    next;
+    uint64_t  rng_state;
+    _Bool     once;
+} Queries;
+
+Queries *queries_load(const char * const file);
+
+Queries *queries_pcap(const char * const file, const uint16_t port);
+
+Queries *queries_zipf(const char * const domain, const size_t names_count,
+                      const double exponent, const uint16_t qtype);
+
+void queries_free(Queries * const queries);
+
+void queries_seed(Queries * const queries, uint64_t seed);
+
+const Query *queries_next(Queries * const queries);
+
+const Query *queries_peek(const Queries * const queries);
+
+int queries_parse_type(uint16_t * const qtype, const char * const name);
+
+#endif
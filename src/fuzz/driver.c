@@ -0,0 +1,265 @@
+
+/*
+ * Standalone driver for the fuzzing harnesses, used when no fuzzing
+ * engine is linked.
+ *
+ * ./fuzz-edns < input
+ *   runs a single input read from the standard input, which is what
+ *   AFL expects (afl-fuzz -i corpus/edns -o findings ./fuzz-edns)
+ *
+ * ./fuzz-edns <file or directory> ...
+ *   runs every input once, e.g. to check that a corpus or a crash
+ *   reproducer doesn't trigger anything any more
+ *
+ * ./fuzz-edns -b <file or directory> ...
+ *   runs the inputs over and over for at least one second, and prints
+ *   the parser's throughput as tab-separated values, in the same format
+ *   as hotpath-bench
+ */
+
+#include <config.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fuzz.h"
+
+#define BENCH_MIN_TIME 1.0
+#define INPUT_MAX_SIZE (1024U * 1024U)
+
+typedef struct Input_ {
+    uint8_t *data;
+    size_t   size;
+} Input;
+
+typedef struct Inputs_ {
+    Input  *inputs;
+    size_t  count;
+    size_t  bytes;
+} Inputs;
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (double) tv.tv_sec + (double) tv.tv_usec / 1e6;
+}
+
+static int
+input_read(Input * const input, FILE * const fp)
+{
+    uint8_t *data;
+    size_t   max_size = (size_t) 4096U;
+    size_t   readnb;
+
+    input->size = (size_t) 0U;
+    if ((input->data = malloc(max_size)) == NULL) {
+        return -1;
+    }
+    while ((readnb = fread(input->data + input->size, (size_t) 1U,
+                           max_size - input->size, fp)) > (size_t) 0U) {
+        input->size += readnb;
+        if (input->size < max_size) {
+            continue;
+        }
+        if (max_size >= INPUT_MAX_SIZE ||
+            (data = realloc(input->data, max_size * 2U)) == NULL) {
+            free(input->data);
+            input->data = NULL;
+            return -1;
+        }
+        input->data = data;
+        max_size *= 2U;
+    }
+    if (ferror(fp)) {
+        free(input->data);
+        input->data = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static int
+inputs_add_file(Inputs * const inputs, const char * const path)
+{
+    FILE  *fp;
+    Input *new_inputs;
+    Input  input;
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        perror(path);
+        return -1;
+    }
+    if (input_read(&input, fp) != 0) {
+        fprintf(stderr, "%s: unable to read\n", path);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    if ((new_inputs = realloc(inputs->inputs, (inputs->count + 1U) *
+                              sizeof *inputs->inputs)) == NULL) {
+        free(input.data);
+        return -1;
+    }
+    inputs->inputs = new_inputs;
+    inputs->inputs[inputs->count++] = input;
+    inputs->bytes += input.size;
+
+    return 0;
+}
+
+static int
+inputs_add_path(Inputs * const inputs, const char * const path)
+{
+    char          *file_path;
+    DIR           *dir;
+    struct dirent *entry;
+    struct stat    st;
+    size_t         file_path_len;
+    int            ret = 0;
+
+    if (stat(path, &st) != 0) {
+        perror(path);
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        return inputs_add_file(inputs, path);
+    }
+    if ((dir = opendir(path)) == NULL) {
+        perror(path);
+        return -1;
+    }
+    while (ret == 0 && (entry = readdir(dir)) != NULL) {
+        if (*entry->d_name == '.') {
+            continue;
+        }
+        file_path_len = strlen(path) + 1U + strlen(entry->d_name) + 1U;
+        if ((file_path = malloc(file_path_len)) == NULL) {
+            ret = -1;
+            break;
+        }
+        snprintf(file_path, file_path_len, "%s/%s", path, entry->d_name);
+        ret = inputs_add_path(inputs, file_path);
+        free(file_path);
+    }
+    closedir(dir);
+
+    return ret;
+}
+
+static void
+inputs_free(Inputs * const inputs)
+{
+    size_t i;
+
+    for (i = 0U; i < inputs->count; i++) {
+        free(inputs->inputs[i].data);
+    }
+    free(inputs->inputs);
+    inputs->inputs = NULL;
+    inputs->count = inputs->bytes = (size_t) 0U;
+}
+
+static void
+inputs_run(const Inputs * const inputs)
+{
+    size_t i;
+
+    for (i = 0U; i < inputs->count; i++) {
+        LLVMFuzzerTestOneInput(inputs->inputs[i].data,
+                               inputs->inputs[i].size);
+    }
+}
+
+static void
+inputs_bench(const Inputs * const inputs, const char * const name)
+{
+    unsigned long rounds = 1UL;
+    unsigned long i;
+    double        started;
+    double        elapsed;
+
+    for (;;) {
+        started = now();
+        for (i = 0UL; i < rounds; i++) {
+            inputs_run(inputs);
+        }
+        elapsed = now() - started;
+        if (elapsed >= BENCH_MIN_TIME || rounds >= 1UL << 40) {
+            break;
+        }
+        if (elapsed < BENCH_MIN_TIME / 100.0) {
+            rounds *= 100UL;
+        } else {
+            rounds = (unsigned long)
+                ((double) rounds * BENCH_MIN_TIME * 1.2 / elapsed) + 1UL;
+        }
+    }
+    printf("# benchmark\tparameters\titerations\tns/op\tMB/s\n");
+    printf("%s\tinputs=%lu,bytes=%lu\t%lu\t%.1f\t%.1f\n", name,
+           (unsigned long) inputs->count, (unsigned long) inputs->bytes,
+           rounds * (unsigned long) inputs->count,
+           elapsed * 1e9 / (double) rounds / (double) inputs->count,
+           (double) inputs->bytes * (double) rounds / elapsed / 1e6);
+}
+
+int
+main(int argc, char *argv[])
+{
+    Inputs      inputs = { NULL, (size_t) 0U, (size_t) 0U };
+    const char *name;
+    int         i = 1;
+    _Bool       bench = 0;
+
+    if ((name = strrchr(argv[0], '/')) != NULL) {
+        name++;
+    } else {
+        name = argv[0];
+    }
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        bench = 1;
+        i++;
+    }
+    if (i >= argc) {
+        if (bench != 0) {
+            fprintf(stderr, "Usage: %s [-b] [<file or directory> ...]\n",
+                    name);
+            return 1;
+        }
+        inputs.inputs = malloc(sizeof *inputs.inputs);
+        if (inputs.inputs == NULL ||
+            input_read(&inputs.inputs[0], stdin) != 0) {
+            fprintf(stderr, "Unable to read the standard input\n");
+            return 1;
+        }
+        inputs.count = (size_t) 1U;
+    }
+    for (; i < argc; i++) {
+        if (inputs_add_path(&inputs, argv[i]) != 0) {
+            return 1;
+        }
+    }
+    if (inputs.count <= 0U) {
+        fprintf(stderr, "No inputs\n");
+        return 1;
+    }
+    if (bench != 0) {
+        inputs_bench(&inputs, name);
+    } else {
+        inputs_run(&inputs);
+        fprintf(stderr, "%s: %lu inputs\n", name,
+                (unsigned long) inputs.count);
+    }
+    inputs_free(&inputs);
+
+    return 0;
+}
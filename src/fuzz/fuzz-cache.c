@@ -0,0 +1,69 @@
+
+/*
+ * The example cache plugin's question and resource records parser.
+ * Every input is seen as a query, then as a response that gets cached,
+ * then as a query again, possibly answered from the cache.
+ */
+
+#include <config.h>
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dnscrypt/plugin.h>
+
+#include "fuzz.h"
+
+#define DNS_MAX_PACKET_SIZE 65535U
+#define DNS_MIN_PACKET_MAX_SIZE 512U
+
+static void
+filter(DCPluginSyncFilterResult (*filter_fn)(DCPlugin *, DCPluginDNSPacket *),
+       DCPlugin * const dcplugin, uint8_t * const dns_packet,
+       const size_t dns_packet_max_len,
+       const uint8_t * const data, const size_t size)
+{
+    DCPluginDNSPacket dcp_packet;
+    size_t            dns_packet_len = size;
+
+    memcpy(dns_packet, data, size);
+    memset(&dcp_packet, 0, sizeof dcp_packet);
+    dcp_packet.dns_packet = dns_packet;
+    dcp_packet.dns_packet_len_p = &dns_packet_len;
+    dcp_packet.dns_packet_max_len = dns_packet_max_len;
+    filter_fn(dcplugin, &dcp_packet);
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    DCPlugin  dcplugin;
+    uint8_t  *dns_packet;
+    size_t    dns_packet_max_len = size;
+
+    if (size > DNS_MAX_PACKET_SIZE) {
+        return 0;
+    }
+    if (dns_packet_max_len < DNS_MIN_PACKET_MAX_SIZE) {
+        dns_packet_max_len = DNS_MIN_PACKET_MAX_SIZE;
+    }
+    if ((dns_packet = malloc(dns_packet_max_len)) == NULL) {
+        return 0;
+    }
+    if (dcplugin_init(&dcplugin, 0, NULL) != 0) {
+        free(dns_packet);
+        return 0;
+    }
+    filter(dcplugin_sync_pre_filter, &dcplugin, dns_packet,
+           dns_packet_max_len, data, size);
+    filter(dcplugin_sync_post_filter, &dcplugin, dns_packet,
+           dns_packet_max_len, data, size);
+    filter(dcplugin_sync_pre_filter, &dcplugin, dns_packet,
+           dns_packet_max_len, data, size);
+    dcplugin_destroy(&dcplugin);
+    free(dns_packet);
+
+    return 0;
+}
@@ -0,0 +1,124 @@
+
+/*
+ * Certificates, as received in TXT records.
+ *
+ * An input is a certificate whose signed part is in clear text: the
+ * harness signs it with its own provider key before handing it to
+ * cert_open_bincert(), so that what follows the signature check gets
+ * fuzzed as well. The input is also tried as is, unsigned, and the
+ * certificate is opened twice, to compare it with a previous one.
+ */
+
+#include <config.h>
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sodium.h>
+
+#include "cert_p.h"
+#include "dnscrypt_proxy.h"
+#include "fuzz.h"
+
+#define CERT_HEADER_LEN 8U
+
+/*
+ * cert.c also schedules updates, reports failures and starts the
+ * listeners, but these code paths are not reachable from
+ * cert_open_bincert().
+ */
+
+int
+dnscrypt_proxy_start_listeners(ProxyContext * const proxy_context)
+{
+    (void) proxy_context;
+
+    return 0;
+}
+
+void
+failover_query_failed(ProxyContext * const proxy_context,
+                      const unsigned int generation)
+{
+    (void) proxy_context;
+    (void) generation;
+}
+
+uint64_t
+metrics_now(void)
+{
+    return (uint64_t) 0U;
+}
+
+void
+metrics_callback_done(Metrics * const metrics,
+                      const MetricsCallback callback, const uint64_t started)
+{
+    (void) metrics;
+    (void) callback;
+    (void) started;
+}
+
+static void
+open_bincert(ProxyContext * const proxy_context,
+             const uint8_t * const signed_bincert,
+             const size_t signed_bincert_len)
+{
+    Bincert *bincert = NULL;
+    uint8_t *txt;
+
+    /* TXT records are copied into buffers that are just large enough */
+    if ((txt = malloc(signed_bincert_len)) == NULL) {
+        return;
+    }
+    memcpy(txt, signed_bincert, signed_bincert_len);
+    cert_open_bincert(proxy_context, (const SignedBincert *) (void *) txt,
+                      signed_bincert_len, &bincert);
+    cert_open_bincert(proxy_context, (const SignedBincert *) (void *) txt,
+                      signed_bincert_len, &bincert);
+    free(bincert);
+    free(txt);
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static ProxyContext       proxy_context;
+    static uint8_t            provider_secretkey[crypto_sign_ed25519_SECRETKEYBYTES];
+    static _Bool              initialized;
+    uint8_t                  *signed_bincert;
+    unsigned long long        signed_data_len_ul;
+
+    if (initialized == 0) {
+        if (sodium_init() < 0) {
+            abort();
+        }
+        crypto_sign_ed25519_keypair(proxy_context.provider_publickey,
+                                    provider_secretkey);
+        proxy_context.max_log_level = -1;
+        initialized = 1;
+    }
+    if (size > DNS_MAX_PACKET_SIZE_UDP_RECV) {
+        return 0;
+    }
+    if (size > (size_t) 0U) {
+        open_bincert(&proxy_context, data, size);
+    }
+    if (size < CERT_HEADER_LEN) {
+        return 0;
+    }
+    if ((signed_bincert = malloc(size + crypto_sign_ed25519_BYTES)) == NULL) {
+        return 0;
+    }
+    memcpy(signed_bincert, data, CERT_HEADER_LEN);
+    crypto_sign_ed25519(signed_bincert + CERT_HEADER_LEN, &signed_data_len_ul,
+                        data + CERT_HEADER_LEN, size - CERT_HEADER_LEN,
+                        provider_secretkey);
+    open_bincert(&proxy_context, signed_bincert,
+                 CERT_HEADER_LEN + (size_t) signed_data_len_ul);
+    free(signed_bincert);
+
+    return 0;
+}
@@ -0,0 +1,50 @@
+
+/*
+ * edns_add_section() on any query: the question and the OPT record
+ * parser when the query already has additional records, the code that
+ * appends an OPT record otherwise.
+ */
+
+#include <config.h>
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dnscrypt_proxy.h"
+#include "edns.h"
+#include "fuzz.h"
+
+#define OPT_RR_LEN 11U
+
+static void
+edns_add_section_with_room(const uint8_t * const data, const size_t size,
+                           const size_t room)
+{
+    static ProxyContext proxy_context;
+    uint8_t            *dns_packet;
+    size_t              dns_packet_len = size;
+    size_t              request_edns_payload_size;
+
+    if ((dns_packet = malloc(size + room)) == NULL) {
+        return;
+    }
+    memcpy(dns_packet, data, size);
+    proxy_context.edns_payload_size = DNS_DEFAULT_EDNS_PAYLOAD_SIZE;
+    edns_add_section(&proxy_context, dns_packet, &dns_packet_len,
+                     size + room, &request_edns_payload_size);
+    free(dns_packet);
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size > DNS_MAX_PACKET_SIZE_UDP_RECV) {
+        return 0;
+    }
+    edns_add_section_with_room(data, size, (size_t) 0U);
+    edns_add_section_with_room(data, size, (size_t) OPT_RR_LEN);
+
+    return 0;
+}
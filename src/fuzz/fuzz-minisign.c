@@ -0,0 +1,42 @@
+
+/*
+ * Signatures of the resolvers list, as downloaded next to it.
+ *
+ * An input is a .minisig file, checked against the public key that
+ * signs the official list, so that signatures from the corpus get past
+ * the key identifier check and reach the verification itself.
+ */
+
+#include <config.h>
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dnscrypt_proxy.h"
+#include "fuzz.h"
+#include "minisign.h"
+
+#define MINISIG_MAX_SIZE 4096U
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static const unsigned char message[] = "Name,Provider name\n";
+    char                       trusted_comment[MINISIGN_MAX_COMMENT_LEN];
+    const char                *error;
+    char                      *sig_s;
+
+    if (size > MINISIG_MAX_SIZE || (sig_s = malloc(size + 1U)) == NULL) {
+        return 0;
+    }
+    memcpy(sig_s, data, size);
+    sig_s[size] = 0;
+    (void) minisign_verify(DEFAULT_RESOLVERS_LIST_PUBKEY,
+                           message, sizeof message - 1U,
+                           sig_s, trusted_comment, &error);
+    free(sig_s);
+
+    return 0;
+}
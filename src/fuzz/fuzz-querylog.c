@@ -0,0 +1,68 @@
+
+/*
+ * The query log's label walker, fed with queries and replies, and the
+ * binary log record decoder used by dnscrypt-querylog-decode.
+ * Entries built from a query must survive a write/read round trip.
+ */
+
+#include <config.h>
+#include <sys/types.h>
+#ifdef _WIN32
+# include <ws2tcpip.h>
+#else
+# include <sys/socket.h>
+# include <netinet/in.h>
+#endif
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fuzz.h"
+#include "querylog.h"
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static FILE             *null_fp;
+    QueryLogEntry            entry;
+    QueryLogEntry            read_entry;
+    struct sockaddr_storage  client_addr;
+    unsigned char            record[QUERYLOG_RECORD_MAX_LEN];
+    size_t                   record_len;
+
+    if (null_fp == NULL && (null_fp = fopen("/dev/null", "w")) == NULL) {
+        abort();
+    }
+    memset(&client_addr, 0, sizeof client_addr);
+    client_addr.ss_family = AF_INET;
+    memset(&entry, 0, sizeof entry);
+    if (querylog_entry_from_query(&entry, &client_addr, data, size) == 0) {
+        querylog_entry_set_reply(&entry, data, size);
+        entry.completed = 1;
+        record_len = querylog_record_write(record, &entry);
+        assert(record_len <= sizeof record);
+        memset(&read_entry, 0, sizeof read_entry);
+        if (querylog_record_read(&read_entry, record + 2U,
+                                 record_len - 2U) != QUERYLOG_RECORD_REPLY ||
+            read_entry.qname_len != entry.qname_len ||
+            memcmp(read_entry.qname, entry.qname, entry.qname_len) != 0 ||
+            read_entry.qtype != entry.qtype) {
+            abort();
+        }
+        querylog_text_fprint(null_fp, &read_entry, 0);
+        querylog_text_fprint(null_fp, &read_entry, 1);
+    }
+    memset(&read_entry, 0, sizeof read_entry);
+    switch (querylog_record_read(&read_entry, data, size)) {
+    case QUERYLOG_RECORD_QUERY:
+    case QUERYLOG_RECORD_REPLY:
+        querylog_text_fprint(null_fp, &read_entry, 0);
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
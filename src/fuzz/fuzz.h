@@ -0,0 +1,17 @@
+
+#ifndef __FUZZ_H__
+#define __FUZZ_H__ 1
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Every harness implements the libFuzzer entry point, which must accept
+ * any input without crashing, leaking or reading out of bounds.
+ * When no fuzzing engine is linked, driver.c provides a main() to run
+ * a harness on files, on the standard input, or as a benchmark.
+ */
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+#endif
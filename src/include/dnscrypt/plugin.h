@@ -148,6 +148,26 @@ dcplugin_sync_pre_filter(DCPlugin *dcplugin, DCPluginDNSPacket *dcp_packet);
 DCPluginSyncFilterResult
 dcplugin_sync_post_filter(DCPlugin *dcplugin, DCPluginDNSPacket *dcp_packet);
 
+/**
+ * This optional function is called once all the pre-filters have been
+ * applied to a query.
+ *
+ * Unlike pre-filters, it knows what is going to happen to the query: it
+ * is about to be forwarded to an upstream server if result is
+ * DCP_SYNC_FILTER_RESULT_OK, and will never reach post-filters otherwise.
+ * If result is DCP_SYNC_FILTER_RESULT_DIRECT, the packet is the response
+ * built by a plugin.
+ *
+ * The packet must not be modified.
+ *
+ * @param dcplugin a plugin object
+ * @param dcp_packet a DNS packet
+ * @param result the combined result of all the pre-filters
+ */
+void
+dcplugin_sync_pre_filter_done(DCPlugin *dcplugin, DCPluginDNSPacket *dcp_packet,
+                              DCPluginSyncFilterResult result);
+
 /**
  * Get the user data of a plugin object.
  *
@@ -237,6 +257,18 @@ dcplugin_sync_post_filter(DCPlugin *dcplugin, DCPluginDNSPacket *dcp_packet);
  */
 #define dcplugin_get_wire_data_max_len(D) ((D)->dns_packet_max_len)
 
+/**
+ * Get a number identifying the request a packet belongs to.
+ *
+ * A query and its reply share the same identifier, so that a plugin can
+ * match what a post-filter sees with what a pre-filter saw.
+ * Identifiers are never reused while the proxy is running.
+ *
+ * @param D a DNS packet
+ * @return the request identifier
+ */
+#define dcplugin_get_request_id(D) ((D)->request_id)
+
 #ifdef __cplusplus
 }
 #endif
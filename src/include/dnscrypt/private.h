@@ -23,6 +23,7 @@ struct DCPluginDNSPacket_ {
     size_t                  *dns_packet_len_p;
     size_t                   client_sockaddr_len_s;
     size_t                   dns_packet_max_len;
+    uint64_t                 request_id;
 };
 
 #define DCPLUGIN_MAIN_PRIVATE(ID) \
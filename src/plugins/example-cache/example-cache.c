@@ -37,12 +37,16 @@ typedef struct Cache_ {
 const char *
 dcplugin_description(DCPlugin * const dcplugin)
 {
+    (void) dcplugin;
+
     return "A toy DNS cache";
 }
 
 const char *
 dcplugin_long_description(DCPlugin * const dcplugin)
 {
+    (void) dcplugin;
+
     return
         "This plugin implements a very basic DNS cache, designed to avoid\n"
         "sending the same queries multiple times in a row.\n"
@@ -58,6 +62,8 @@ dcplugin_init(DCPlugin * const dcplugin, int argc, char *argv[])
 {
     Cache *cache;
 
+    (void) argc;
+    (void) argv;
     if ((cache = calloc((size_t) 1U, sizeof *cache)) == NULL) {
         return -1;
     }
@@ -85,6 +91,7 @@ dcplugin_destroy(DCPlugin * const dcplugin)
         next = cache_entry->next;
         free(cache_entry->response);
         cache_entry->response = NULL;
+        free(cache_entry);
         cache_entry = next;
     }
     cache->cache_entries = NULL;
@@ -159,7 +166,7 @@ next_rr(const uint8_t * const dns_packet, const size_t dns_packet_len,
     if (name_len_p != NULL) {
         *name_len_p = (size_t) (offset - *offset_p);
     }
-    if ((is_question ? 6 : 10) > dns_packet_len - offset) {
+    if ((is_question ? 4 : 10) > dns_packet_len - offset) {
         return -1;
     }
     if (qtype_p != NULL) {
@@ -306,8 +313,6 @@ dcplugin_sync_post_filter(DCPlugin *dcplugin, DCPluginDNSPacket *dcp_packet)
     uint32_t    min_ttl;
     uint16_t    qtype;
     uint16_t    qclass;
-    uint16_t    tid;
-    uint8_t     c;
 
     if (wire_data_len < 15U || wire_data[4] != 0U || wire_data[5] != 1U) {
         return DCP_SYNC_FILTER_RESULT_ERROR;
@@ -361,8 +366,8 @@ dcplugin_sync_post_filter(DCPlugin *dcplugin, DCPluginDNSPacket *dcp_packet)
         scanned_cache_entry->response_len = wire_data_len;
         scanned_cache_entry->deadline = cache->now + ttl;
         if (last_cache_entry_parent != NULL) {
-            assert(last_cache_entry_parent->next = scanned_cache_entry);
-            last_cache_entry_parent->next = NULL;
+            assert(last_cache_entry_parent->next == scanned_cache_entry);
+            last_cache_entry_parent->next = scanned_cache_entry->next;
             scanned_cache_entry->next = cache->cache_entries;
             cache->cache_entries = scanned_cache_entry;
         }
@@ -340,6 +340,6 @@ fpst_free(FPST *trie, FPST_FreeFn free_kv_fn)
         fpst_free_branch(&trie->branch, free_kv_fn);
     } else {
         fpst_free_leaf(&trie->leaf, free_kv_fn);
-        free(trie);
     }
+    free(trie);
 }
@@ -2,7 +2,11 @@
 #include <dnscrypt/plugin.h>
 
 #include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
 #ifdef _WIN32
@@ -12,18 +16,77 @@
 # include <arpa/inet.h>
 # include <netinet/in.h>
 #endif
+#include <sys/time.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include "querylog.h"
 
 DCPLUGIN_MAIN(__FILE__);
 
-#ifndef putc_unlocked
-# define putc_unlocked(c, stream) putc((c), (stream))
+#define QUERYLOG_RING_SIZE       (1024U * 1024U)
+#define QUERYLOG_FLUSH_THRESHOLD (64U * 1024U)
+#define QUERYLOG_FLUSH_INTERVAL  1
+#define QUERYLOG_PENDING_SIZE    4096U
+#define QUERYLOG_PENDING_TIMEOUT (10U * 1000000U)
+#define QUERYLOG_PENDING_SWEEP   (1U * 1000000U)
+#define QUERYLOG_BUCKETS_SIZE    4096U
+
+typedef struct QueryLogRing_ {
+    unsigned char   *data;
+    size_t           head;
+    size_t           tail;
+    unsigned long    dropped;
+    time_t           last_flush;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t  mutex;
+    pthread_cond_t   cond;
+    pthread_t        writer;
+    _Bool            writer_running;
+    _Bool            stop;
 #endif
+} QueryLogRing;
+
+typedef struct QueryLogPending_ {
+    QueryLogEntry entry;
+    uint64_t      request_id;
+    uint64_t      sent_usec;
+    _Bool         in_use;
+} QueryLogPending;
+
+typedef struct QueryLogBucket_ {
+    unsigned char prefix[QUERYLOG_ADDR_MAX_LEN];
+    uint64_t      updated_usec;
+    uint64_t      tokens;
+    _Bool         in_use;
+} QueryLogBucket;
 
 typedef struct Logging_ {
-    FILE *fp;
-    _Bool ltsv;
+    FILE            *fp;
+    QueryLogRing    *ring;
+    QueryLogPending *pending;
+    QueryLogBucket  *buckets;
+    uint64_t         pending_swept_usec;
+    unsigned long    sample_rate;
+    unsigned long    rate_limit;
+    unsigned long    rate_limit_burst;
+    unsigned int     ipv4_prefix;
+    unsigned int     ipv6_prefix;
+    _Bool            ltsv;
+    _Bool            binary;
 } Logging;
 
+static struct option getopt_long_options[] = {
+    { "replies", 0, NULL, 'r' },
+    { "sample", 1, NULL, 's' },
+    { "rate-limit", 1, NULL, 'l' },
+    { "ipv4-prefix", 1, NULL, '4' },
+    { "ipv6-prefix", 1, NULL, '6' },
+    { NULL, 0, NULL, 0 }
+};
+static const char *getopt_options = "rs:l:4:6:";
+
 const char *
 dcplugin_description(DCPlugin * const dcplugin)
 {
@@ -41,222 +104,668 @@ dcplugin_long_description(DCPlugin * const dcplugin)
         "\n"
         "# dnscrypt-proxy --plugin libdcplugin_example_logging.la,/var/log/dns.log\n"
         "\n"
-        "Prefixing the file name with ltsv: changes the log format to LTSV.";
+        "Prefixing the file name with ltsv: changes the log format to LTSV.\n"
+        "\n"
+        "Prefixing the file name with bin: writes compact, length-prefixed\n"
+        "binary records instead. Records are buffered in memory and written\n"
+        "in large blocks by a background thread, at least once per second.\n"
+        "Records that don't fit in memory while the file is being written to\n"
+        "are dropped, and their number is printed to the standard error.\n"
+        "The dnscrypt-querylog-decode command converts these files back to\n"
+        "the text or LTSV formats.\n"
+        "\n"
+        "With --replies, a single line is logged once a request has been\n"
+        "completed, including the response code, the number of answers,\n"
+        "the response size, whether the response came from the upstream\n"
+        "server, was answered locally by a plugin, or was blocked, and the\n"
+        "upstream round-trip time in milliseconds:\n"
+        "\n"
+        "# dnscrypt-proxy --plugin \\\n"
+        "  libdcplugin_example_logging.la,--replies,ltsv:/var/log/dns.log\n"
+        "\n"
+        "Queries still without a response after 10 seconds, or when the\n"
+        "proxy stops, are logged as timeouts.\n"
+        "\n"
+        "--sample=<n> only logs one flow out of <n>, a flow being a client\n"
+        "address and a query name: queries for the same name from the same\n"
+        "client are either always or never logged.\n"
+        "\n"
+        "--rate-limit=<records per second>[:<burst>] limits the number of\n"
+        "records logged for each client subnet. Subnets are /24 for IPv4\n"
+        "and /56 for IPv6 by default; this can be changed with\n"
+        "--ipv4-prefix=<bits> and --ipv6-prefix=<bits>.";
+}
+
+static int
+querylog_ring_write(Logging * const logging, const size_t head)
+{
+    QueryLogRing *ring = logging->ring;
+    size_t        tail = ring->tail;
+    size_t        offset;
+    size_t        len;
+
+    while (tail != head) {
+        offset = tail % QUERYLOG_RING_SIZE;
+        len = head - tail;
+        if (len > QUERYLOG_RING_SIZE - offset) {
+            len = QUERYLOG_RING_SIZE - offset;
+        }
+        if (fwrite(&ring->data[offset], (size_t) 1U, len,
+                   logging->fp) != len) {
+            return -1;
+        }
+        tail += len;
+    }
+    fflush(logging->fp);
+
+    return 0;
+}
+
+static void
+querylog_ring_flush(Logging * const logging)
+{
+    QueryLogRing *ring = logging->ring;
+
+    querylog_ring_write(logging, ring->head);
+    ring->tail = ring->head;
+    ring->last_flush = time(NULL);
+}
+
+#ifdef HAVE_PTHREAD
+/*
+ * Records that didn't fit in the ring are reported to stderr, since
+ * plugins have no access to the proxy's logger.
+ */
+
+static void
+querylog_ring_report_dropped(const unsigned long dropped)
+{
+    if (dropped > 0UL) {
+        fprintf(stderr, "Query log: %lu records were dropped\n", dropped);
+    }
+}
+
+static void *
+querylog_writer(void *logging_)
+{
+    Logging         *logging = logging_;
+    QueryLogRing    *ring = logging->ring;
+    struct timespec  deadline;
+    size_t           head;
+    unsigned long    dropped;
+
+    pthread_mutex_lock(&ring->mutex);
+    for (;;) {
+        deadline.tv_sec = time(NULL) + QUERYLOG_FLUSH_INTERVAL;
+        deadline.tv_nsec = 0;
+        while (ring->stop == 0 &&
+               ring->head - ring->tail < QUERYLOG_FLUSH_THRESHOLD) {
+            if (pthread_cond_timedwait(&ring->cond, &ring->mutex,
+                                       &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        dropped = ring->dropped;
+        ring->dropped = 0UL;
+        if ((head = ring->head) != ring->tail || dropped > 0UL) {
+            pthread_mutex_unlock(&ring->mutex);
+            querylog_ring_write(logging, head);
+            querylog_ring_report_dropped(dropped);
+            pthread_mutex_lock(&ring->mutex);
+            ring->tail = head;
+        }
+        if (ring->stop != 0 && ring->head == ring->tail) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ring->mutex);
+
+    return NULL;
+}
+#endif
+
+static int
+querylog_ring_push(Logging * const logging,
+                   const unsigned char * const record, const size_t record_len)
+{
+    QueryLogRing *ring = logging->ring;
+    size_t        offset;
+    size_t        len;
+
+#ifdef HAVE_PTHREAD
+    if (ring->writer_running != 0) {
+        pthread_mutex_lock(&ring->mutex);
+    }
+#endif
+    if (QUERYLOG_RING_SIZE - (ring->head - ring->tail) < record_len) {
+#ifdef HAVE_PTHREAD
+        if (ring->writer_running != 0) {
+            ring->dropped++;
+            pthread_mutex_unlock(&ring->mutex);
+            return -1;
+        }
+#endif
+        querylog_ring_flush(logging);
+    }
+    offset = ring->head % QUERYLOG_RING_SIZE;
+    len = record_len;
+    if (len > QUERYLOG_RING_SIZE - offset) {
+        len = QUERYLOG_RING_SIZE - offset;
+    }
+    memcpy(&ring->data[offset], record, len);
+    memcpy(ring->data, record + len, record_len - len);
+    ring->head += record_len;
+#ifdef HAVE_PTHREAD
+    if (ring->writer_running != 0) {
+        if (ring->head - ring->tail >= QUERYLOG_FLUSH_THRESHOLD) {
+            pthread_cond_signal(&ring->cond);
+        }
+        pthread_mutex_unlock(&ring->mutex);
+        return 0;
+    }
+#endif
+    if (ring->head - ring->tail >= QUERYLOG_FLUSH_THRESHOLD ||
+        time(NULL) - ring->last_flush >= QUERYLOG_FLUSH_INTERVAL) {
+        querylog_ring_flush(logging);
+    }
+    return 0;
+}
+
+static int
+querylog_binary_init(Logging * const logging)
+{
+    QueryLogRing  *ring;
+    unsigned char  header[QUERYLOG_HEADER_LEN];
+    long           pos;
+
+    if (fseek(logging->fp, 0L, SEEK_END) != 0 ||
+        (pos = ftell(logging->fp)) < 0L) {
+        return -1;
+    }
+    if (pos == 0L) {
+        querylog_header_write(header);
+        if (fwrite(header, sizeof header, (size_t) 1U, logging->fp) != 1U) {
+            return -1;
+        }
+        fflush(logging->fp);
+    }
+    if ((ring = calloc((size_t) 1U, sizeof *ring)) == NULL) {
+        return -1;
+    }
+    if ((ring->data = malloc(QUERYLOG_RING_SIZE)) == NULL) {
+        free(ring);
+        return -1;
+    }
+    ring->head = ring->tail = (size_t) 0U;
+    ring->last_flush = time(NULL);
+#ifdef HAVE_PTHREAD
+    if (pthread_mutex_init(&ring->mutex, NULL) != 0) {
+        free(ring->data);
+        free(ring);
+        return -1;
+    }
+    if (pthread_cond_init(&ring->cond, NULL) != 0) {
+        pthread_mutex_destroy(&ring->mutex);
+        free(ring->data);
+        free(ring);
+        return -1;
+    }
+    ring->stop = 0;
+#endif
+    logging->ring = ring;
+#ifdef HAVE_PTHREAD
+    if (pthread_create(&ring->writer, NULL, querylog_writer, logging) == 0) {
+        ring->writer_running = 1;
+    }
+#endif
+    return 0;
+}
+
+static void
+querylog_binary_destroy(Logging * const logging)
+{
+    QueryLogRing *ring = logging->ring;
+
+    if (ring == NULL) {
+        return;
+    }
+#ifdef HAVE_PTHREAD
+    if (ring->writer_running != 0) {
+        pthread_mutex_lock(&ring->mutex);
+        ring->stop = 1;
+        pthread_cond_signal(&ring->cond);
+        pthread_mutex_unlock(&ring->mutex);
+        pthread_join(ring->writer, NULL);
+        ring->writer_running = 0;
+    }
+    pthread_cond_destroy(&ring->cond);
+    pthread_mutex_destroy(&ring->mutex);
+#endif
+    querylog_ring_flush(logging);
+    free(ring->data);
+    free(ring);
+    logging->ring = NULL;
+}
+
+static int
+parse_ulong(const char * const str, unsigned long * const value,
+            char ** const endptr)
+{
+    if (!isdigit((int) (unsigned char) *str)) {
+        return -1;
+    }
+    errno = 0;
+    *value = strtoul(str, endptr, 10);
+    if (errno != 0 || *value > UINT32_MAX) {
+        return -1;
+    }
+    return 0;
 }
 
 int
 dcplugin_init(DCPlugin * const dcplugin, int argc, char *argv[])
 {
     Logging *logging;
+    char    *endptr;
+    int      opt_flag;
+    int      option_index = 0;
 
     if ((logging = calloc((size_t) 1U, sizeof *logging)) == NULL) {
         return -1;
     }
     dcplugin_set_user_data(dcplugin, logging);
     logging->ltsv = 0;
-    if (argc != 2U) {
+    logging->binary = 0;
+    logging->ring = NULL;
+    logging->pending = NULL;
+    logging->buckets = NULL;
+    logging->sample_rate = 1U;
+    logging->rate_limit = 0U;
+    logging->ipv4_prefix = 24U;
+    logging->ipv6_prefix = 56U;
+    optind = 0;
+#ifdef _OPTRESET
+    optreset = 1;
+#endif
+    while ((opt_flag = getopt_long(argc, argv,
+                                   getopt_options, getopt_long_options,
+                                   &option_index)) != -1) {
+        switch (opt_flag) {
+        case 'r':
+            if (logging->pending == NULL &&
+                (logging->pending = calloc(QUERYLOG_PENDING_SIZE,
+                                           sizeof *logging->pending)) == NULL) {
+                return -1;
+            }
+            break;
+        case 's':
+            if (parse_ulong(optarg, &logging->sample_rate, &endptr) != 0 ||
+                *endptr != 0 || logging->sample_rate < 1U) {
+                return -1;
+            }
+            break;
+        case 'l':
+            if (parse_ulong(optarg, &logging->rate_limit, &endptr) != 0 ||
+                logging->rate_limit < 1U) {
+                return -1;
+            }
+            logging->rate_limit_burst = logging->rate_limit;
+            if (*endptr == ':' &&
+                parse_ulong(endptr + 1, &logging->rate_limit_burst,
+                            &endptr) != 0) {
+                return -1;
+            }
+            if (*endptr != 0 || logging->rate_limit_burst < 1U) {
+                return -1;
+            }
+            break;
+        case '4':
+        case '6': {
+            unsigned long bits;
+
+            if (parse_ulong(optarg, &bits, &endptr) != 0 || *endptr != 0 ||
+                bits > (opt_flag == '4' ? 32U : 128U)) {
+                return -1;
+            }
+            if (opt_flag == '4') {
+                logging->ipv4_prefix = (unsigned int) bits;
+            } else {
+                logging->ipv6_prefix = (unsigned int) bits;
+            }
+            break;
+        }
+        default:
+            return -1;
+        }
+    }
+    if (logging->rate_limit > 0U &&
+        (logging->buckets = calloc(QUERYLOG_BUCKETS_SIZE,
+                                   sizeof *logging->buckets)) == NULL) {
+        return -1;
+    }
+    if (optind >= argc) {
         logging->fp = stdout;
+    } else if (optind != argc - 1) {
+        return -1;
     } else {
-        const char *file = argv[1];
+        const char *file = argv[optind];
 
         if (strncmp(file, "ltsv:", (sizeof "ltsv:") - 1U) == 0) {
             logging->ltsv = 1;
             file += (sizeof "ltsv:") - 1U;
+        } else if (strncmp(file, "bin:", (sizeof "bin:") - 1U) == 0) {
+            logging->binary = 1;
+            file += (sizeof "bin:") - 1U;
+        }
+        if ((logging->fp = fopen(file, logging->binary ? "ab" : "a")) == NULL) {
+            return -1;
         }
-        if ((logging->fp = fopen(file, "a")) == NULL) {
+        if (logging->binary != 0 && querylog_binary_init(logging) != 0) {
             return -1;
         }
     }
     return 0;
 }
 
-int
-dcplugin_destroy(DCPlugin * const dcplugin)
+static uint64_t
+timestamp_usec(void)
 {
-    Logging *logging = dcplugin_get_user_data(dcplugin);
+    struct timeval tv;
 
-    if (logging == NULL) {
-        return 0;
+    if (gettimeofday(&tv, NULL) != 0) {
+        return (uint64_t) 0U;
     }
-    if (logging->fp != stdout) {
-        fclose(logging->fp);
+    return (uint64_t) tv.tv_sec * 1000000U + (uint64_t) tv.tv_usec;
+}
+
+static void
+querylog_emit(Logging * const logging, const QueryLogEntry * const entry)
+{
+    unsigned char record[QUERYLOG_RECORD_MAX_LEN];
+    size_t        record_len;
+
+    if (logging->ring != NULL) {
+        record_len = querylog_record_write(record, entry);
+        querylog_ring_push(logging, record, record_len);
+    } else {
+        querylog_text_fprint(logging->fp, entry, logging->ltsv);
+        fflush(logging->fp);
     }
-    logging->fp = NULL;
-    free(logging);
+}
 
-    return 0;
+static uint32_t
+querylog_hash(uint32_t h, const unsigned char * const data, const size_t len,
+              const _Bool lower)
+{
+    size_t i;
+
+    for (i = (size_t) 0U; i < len; i++) {
+        h ^= lower ? (uint32_t) tolower(data[i]) : (uint32_t) data[i];
+        h *= 16777619U;
+    }
+    return h;
 }
 
-static int
-string_fprint(FILE * const fp, const unsigned char *str,
-              const size_t size, _Bool lower)
+static _Bool
+querylog_sampled(const Logging * const logging,
+                 const QueryLogEntry * const entry)
+{
+    uint32_t h = 2166136261U;
+
+    if (logging->sample_rate <= 1U) {
+        return 1;
+    }
+    h = querylog_hash(h, entry->addr, entry->addr_len, 0);
+    h = querylog_hash(h, entry->qname, entry->qname_len, 1);
+
+    return h % logging->sample_rate == 0U;
+}
+
+static _Bool
+querylog_rate_limited(Logging * const logging,
+                      const QueryLogEntry * const entry, const uint64_t now)
 {
-    int    c;
-    size_t i = (size_t) 0U;
-
-    while (i < size) {
-        c = (int) str[i++];
-        if (!isprint(c)) {
-            fprintf(fp, "\\x%02x", (unsigned int) c);
-        } else if (c == '\\') {
-            if (lower) {
-                c = tolower(c);
+    unsigned char   prefix[QUERYLOG_ADDR_MAX_LEN];
+    QueryLogBucket *bucket;
+    const uint64_t  capacity = (uint64_t) logging->rate_limit_burst * 1000000U;
+    uint64_t        elapsed;
+    size_t          i;
+    unsigned int    bits;
+
+    if (logging->buckets == NULL) {
+        return 0;
+    }
+    memset(prefix, 0, sizeof prefix);
+    bits = entry->addr_len == 4U ? logging->ipv4_prefix : logging->ipv6_prefix;
+    for (i = (size_t) 0U; i < entry->addr_len && bits > 0U; i++) {
+        if (bits >= 8U) {
+            prefix[i] = entry->addr[i];
+            bits -= 8U;
+        } else {
+            prefix[i] = entry->addr[i] & (unsigned char) (0xff00 >> bits);
+            bits = 0U;
+        }
+    }
+    bucket = &logging->buckets[querylog_hash(2166136261U, prefix,
+                                             sizeof prefix, 0) &
+                               (QUERYLOG_BUCKETS_SIZE - 1U)];
+    if (bucket->in_use == 0 ||
+        memcmp(bucket->prefix, prefix, sizeof prefix) != 0) {
+        memcpy(bucket->prefix, prefix, sizeof prefix);
+        bucket->tokens = capacity;
+        bucket->updated_usec = now;
+        bucket->in_use = 1;
+    } else if (now > bucket->updated_usec) {
+        elapsed = now - bucket->updated_usec;
+        if (elapsed >= capacity / logging->rate_limit) {
+            bucket->tokens = capacity;
+        } else {
+            bucket->tokens += elapsed * logging->rate_limit;
+            if (bucket->tokens > capacity) {
+                bucket->tokens = capacity;
             }
-            putc_unlocked(c, fp);
         }
-        putc_unlocked(c, fp);
+        bucket->updated_usec = now;
     }
+    if (bucket->tokens < 1000000U) {
+        return 1;
+    }
+    bucket->tokens -= 1000000U;
+
     return 0;
 }
 
-static int
-ltsv_prop(FILE * const fp, const char * const prop,
-          const Logging * const logging)
+static QueryLogPending *
+querylog_pending_lookup(Logging * const logging, const uint64_t request_id)
 {
-    if (logging->ltsv == 0) {
-        return 0;
+    QueryLogPending *pending;
+
+    if (logging->pending == NULL) {
+        return NULL;
+    }
+    pending = &logging->pending[request_id & (QUERYLOG_PENDING_SIZE - 1U)];
+    if (pending->in_use == 0 || pending->request_id != request_id) {
+        return NULL;
     }
-    fprintf(fp, "%s:", prop);
+    return pending;
+}
 
-    return 0;
+static void
+querylog_pending_complete(Logging * const logging,
+                          QueryLogPending * const pending,
+                          const QueryLogDisposition disposition)
+{
+    pending->entry.completed = 1;
+    pending->entry.disposition = (unsigned char) disposition;
+    querylog_emit(logging, &pending->entry);
+    pending->in_use = 0;
 }
 
-static int
-timestamp_fprint(FILE * const fp, _Bool unix_ts)
+static _Bool
+querylog_pending_expired(const QueryLogPending * const pending,
+                         const uint64_t now)
 {
-    char now_s[128];
+    return now > pending->entry.ts_usec &&
+        now - pending->entry.ts_usec >= QUERYLOG_PENDING_TIMEOUT;
+}
 
-    time_t     now;
-    struct tm *tm;
+/*
+ * Plugins don't get timers: queries the proxy gave up on are looked for
+ * at most once per second, when a query or a reply goes through the
+ * plugin, and when the plugin is unloaded.
+ */
 
-    if (time(&now) == (time_t) -1) {
-        putc_unlocked('-', fp);
-        return -1;
+static void
+querylog_pending_expire(Logging * const logging, const uint64_t now,
+                        const _Bool all)
+{
+    QueryLogPending *pending;
+    size_t           i;
+
+    if (logging->pending == NULL) {
+        return;
     }
-    if (unix_ts) {
-        fprintf(fp, "%lu", (unsigned long) now);
-    } else {
-        tm = localtime(&now);
-        strftime(now_s, sizeof now_s, "%c", tm);
-        fprintf(fp, "%s", now_s);
+    if (all == 0) {
+        if (now >= logging->pending_swept_usec &&
+            now - logging->pending_swept_usec < QUERYLOG_PENDING_SWEEP) {
+            return;
+        }
+        logging->pending_swept_usec = now;
+    }
+    for (i = (size_t) 0U; i < QUERYLOG_PENDING_SIZE; i++) {
+        pending = &logging->pending[i];
+        if (pending->in_use != 0 &&
+            (all != 0 || querylog_pending_expired(pending, now))) {
+            querylog_pending_complete(logging, pending,
+                                      QUERYLOG_DISPOSITION_TIMEOUT);
+        }
     }
-    return 0;
 }
 
-static int
-ip_fprint(FILE * const fp,
-          const struct sockaddr_storage * const client_addr,
-          const size_t client_addr_len)
+int
+dcplugin_destroy(DCPlugin * const dcplugin)
 {
-    if (client_addr->ss_family == AF_INET) {
-        struct sockaddr_in in;
-        uint32_t           a;
-
-        memcpy(&in, client_addr, sizeof in);
-        a = ntohl(in.sin_addr.s_addr);
-        fprintf(fp, "%u.%u.%u.%u",
-                (a >> 24) & 0xff, (a >> 16) & 0xff,
-                (a >> 8) & 0xff, a  & 0xff);
-    } else if (client_addr->ss_family == AF_INET6) {
-        struct sockaddr_in6  in6;
-        const unsigned char *a;
-        int                  i;
-        uint16_t             w;
-        _Bool                blanks;
-
-        memcpy(&in6, client_addr, sizeof in6);
-        a = in6.sin6_addr.s6_addr;
-        blanks = (a[0] | a[1]) == 0;
-        putc_unlocked('[', fp);
-        for (i = 0; i < 16; i += 2) {
-            w = ((uint16_t) a[i] << 8) | (uint16_t) a[i + 1];
-            if (blanks) {
-                if (w == 0U) {
-                    continue;
-                }
-                putc_unlocked(':', fp);
-                blanks = 0;
-            }
-            if (i != 0) {
-                putc_unlocked(':', fp);
-            }
-            if (blanks == 0) {
-                fprintf(fp, "%x", (unsigned int) w);
-            }
-        }
-        putc_unlocked(']', fp);
-    } else {
-        putc_unlocked('-', fp);
+    Logging *logging = dcplugin_get_user_data(dcplugin);
+
+    if (logging == NULL) {
+        return 0;
+    }
+    if (logging->fp != NULL) {
+        querylog_pending_expire(logging, timestamp_usec(), 1);
     }
+    querylog_binary_destroy(logging);
+    free(logging->pending);
+    logging->pending = NULL;
+    free(logging->buckets);
+    logging->buckets = NULL;
+    if (logging->fp != stdout) {
+        fclose(logging->fp);
+    }
+    logging->fp = NULL;
+    free(logging);
+
     return 0;
 }
 
 DCPluginSyncFilterResult
 dcplugin_sync_pre_filter(DCPlugin *dcplugin, DCPluginDNSPacket *dcp_packet)
 {
-    Logging             *logging = dcplugin_get_user_data(dcplugin);
-    const unsigned char *wire_data = dcplugin_get_wire_data(dcp_packet);
-    size_t               wire_data_len = dcplugin_get_wire_data_len(dcp_packet);
-    size_t               i = (size_t) 12U;
-    size_t               csize = (size_t) 0U;
-    unsigned short       type;
-    unsigned char        c;
-    _Bool                first = 1;
-
-    if (wire_data_len < 15U || wire_data[4] != 0U || wire_data[5] != 1U) {
+    QueryLogEntry    entry;
+    Logging         *logging = dcplugin_get_user_data(dcplugin);
+    QueryLogPending *pending;
+    const uint64_t   request_id = dcplugin_get_request_id(dcp_packet);
+
+    if (querylog_entry_from_query(&entry,
+                                  dcplugin_get_client_address(dcp_packet),
+                                  dcplugin_get_wire_data(dcp_packet),
+                                  dcplugin_get_wire_data_len(dcp_packet)) != 0) {
         return DCP_SYNC_FILTER_RESULT_ERROR;
     }
-    ltsv_prop(logging->fp, "time", logging);
-    timestamp_fprint(logging->fp, logging->ltsv);
-    putc_unlocked('\t', logging->fp);
-    ltsv_prop(logging->fp, "host", logging);
-    ip_fprint(logging->fp, dcplugin_get_client_address(dcp_packet),
-              dcplugin_get_client_address_len(dcp_packet));
-    putc_unlocked('\t', logging->fp);
-    ltsv_prop(logging->fp, "message", logging);
-    if (wire_data[i] == 0U) {
-        putc_unlocked('.', logging->fp);
-    }
-    while (i < wire_data_len && (csize = wire_data[i]) != 0U &&
-           csize < wire_data_len - i) {
-        i++;
-        if (first != 0) {
-            first = 0;
-        } else {
-            putc_unlocked('.', logging->fp);
+    if (querylog_sampled(logging, &entry) == 0) {
+        return DCP_SYNC_FILTER_RESULT_OK;
+    }
+    entry.ts_usec = timestamp_usec();
+    if (querylog_rate_limited(logging, &entry, entry.ts_usec) != 0) {
+        return DCP_SYNC_FILTER_RESULT_OK;
+    }
+    if (logging->pending == NULL) {
+        querylog_emit(logging, &entry);
+
+        return DCP_SYNC_FILTER_RESULT_OK;
+    }
+    querylog_pending_expire(logging, entry.ts_usec, 0);
+    pending = &logging->pending[request_id & (QUERYLOG_PENDING_SIZE - 1U)];
+    if (pending->in_use != 0) {
+        if (querylog_pending_expired(pending, entry.ts_usec) == 0) {
+            querylog_emit(logging, &entry);
+
+            return DCP_SYNC_FILTER_RESULT_OK;
         }
-        string_fprint(logging->fp, &wire_data[i], csize, 1);
-        i += csize;
-    }
-    type = 0U;
-    if (i < wire_data_len - 2U) {
-        type = (wire_data[i + 1U] << 8) + wire_data[i + 2U];
-    }
-    putc_unlocked('\t', logging->fp);
-    ltsv_prop(logging->fp, "type", logging);
-    switch (type) {
-    case 0x01:
-        fprintf(logging->fp, "A\n"); break;
-    case 0x02:
-        fprintf(logging->fp, "NS\n"); break;
-    case 0x06:
-        fprintf(logging->fp, "SOA\n"); break;
-    case 0x0c:
-        fprintf(logging->fp, "PTR\n"); break;
-    case 0x0f:
-        fprintf(logging->fp, "MX\n"); break;
-    case 0x1c:
-        fprintf(logging->fp, "AAAA\n"); break;
-    default:
-        fprintf(logging->fp, "0x%02hx\n", type);
+        querylog_pending_complete(logging, pending,
+                                  QUERYLOG_DISPOSITION_TIMEOUT);
     }
-    fflush(logging->fp);
+    pending->entry = entry;
+    pending->request_id = request_id;
+    pending->sent_usec = pending->entry.ts_usec;
+    pending->in_use = 1;
 
     return DCP_SYNC_FILTER_RESULT_OK;
 }
 
+void
+dcplugin_sync_pre_filter_done(DCPlugin *dcplugin, DCPluginDNSPacket *dcp_packet,
+                              DCPluginSyncFilterResult result)
+{
+    Logging         *logging = dcplugin_get_user_data(dcplugin);
+    QueryLogPending *pending;
+
+    if ((pending = querylog_pending_lookup
+         (logging, dcplugin_get_request_id(dcp_packet))) == NULL) {
+        return;
+    }
+    switch (result) {
+    case DCP_SYNC_FILTER_RESULT_OK:
+        pending->sent_usec = timestamp_usec();
+        break;
+    case DCP_SYNC_FILTER_RESULT_DIRECT:
+        querylog_entry_set_reply(&pending->entry,
+                                 dcplugin_get_wire_data(dcp_packet),
+                                 dcplugin_get_wire_data_len(dcp_packet));
+        querylog_pending_complete(logging, pending,
+                                  pending->entry.rcode == 5U ?
+                                  QUERYLOG_DISPOSITION_BLOCKED :
+                                  QUERYLOG_DISPOSITION_LOCAL);
+        break;
+    case DCP_SYNC_FILTER_RESULT_KILL:
+        querylog_pending_complete(logging, pending,
+                                  QUERYLOG_DISPOSITION_BLOCKED);
+        break;
+    default:
+        querylog_pending_complete(logging, pending,
+                                  QUERYLOG_DISPOSITION_ERROR);
+    }
+}
+
 DCPluginSyncFilterResult
 dcplugin_sync_post_filter(DCPlugin *dcplugin, DCPluginDNSPacket *dcp_packet)
 {
+    Logging         *logging = dcplugin_get_user_data(dcplugin);
+    QueryLogPending *pending;
+    uint64_t         now;
+
+    if ((pending = querylog_pending_lookup
+         (logging, dcplugin_get_request_id(dcp_packet))) == NULL) {
+        return DCP_SYNC_FILTER_RESULT_OK;
+    }
+    querylog_entry_set_reply(&pending->entry,
+                             dcplugin_get_wire_data(dcp_packet),
+                             dcplugin_get_wire_data_len(dcp_packet));
+    now = timestamp_usec();
+    if (now > pending->sent_usec && now - pending->sent_usec < UINT32_MAX) {
+        pending->entry.rtt_usec = (uint32_t) (now - pending->sent_usec);
+    }
+    querylog_pending_complete(logging, pending, QUERYLOG_DISPOSITION_UPSTREAM);
+    querylog_pending_expire(logging, now, 0);
+
     return DCP_SYNC_FILTER_RESULT_OK;
 }
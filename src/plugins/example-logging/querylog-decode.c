@@ -0,0 +1,83 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "querylog.h"
+
+static void
+usage(void)
+{
+    fputs("Usage: dnscrypt-querylog-decode [-l] [<binary log file>]\n"
+          "\n"
+          "Converts a binary query log written by the logging plugin\n"
+          "to text, or to LTSV with -l.\n", stderr);
+    exit(1);
+}
+
+static int
+querylog_decode(FILE * const in, FILE * const out, const _Bool ltsv)
+{
+    unsigned char header[QUERYLOG_HEADER_LEN];
+    unsigned char record[65535U];
+    unsigned char len_s[2];
+    QueryLogEntry entry;
+    size_t        record_len;
+
+    if (fread(header, sizeof header, (size_t) 1U, in) != 1U ||
+        querylog_header_check(header) != 0) {
+        fputs("Not a binary query log, or unsupported version\n", stderr);
+        return -1;
+    }
+    while (fread(len_s, sizeof len_s, (size_t) 1U, in) == 1U) {
+        record_len = ((size_t) len_s[0] << 8) | (size_t) len_s[1];
+        if (fread(record, (size_t) 1U, record_len, in) != record_len) {
+            fputs("Truncated record\n", stderr);
+            return -1;
+        }
+        switch (querylog_record_read(&entry, record, record_len)) {
+        case -1:
+            fputs("Corrupted record\n", stderr);
+            return -1;
+        case QUERYLOG_RECORD_QUERY:
+        case QUERYLOG_RECORD_REPLY:
+            querylog_text_fprint(out, &entry, ltsv);
+            break;
+        default:
+            break;
+        }
+    }
+    if (ferror(in)) {
+        perror("fread");
+        return -1;
+    }
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    FILE  *in = stdin;
+    int    i = 1;
+    int    ret;
+    _Bool  ltsv = 0;
+
+    if (i < argc && strcmp(argv[i], "-l") == 0) {
+        ltsv = 1;
+        i++;
+    }
+    if (i < argc - 1 || (i < argc && *argv[i] == '-')) {
+        usage();
+    }
+    if (i < argc && (in = fopen(argv[i], "rb")) == NULL) {
+        perror(argv[i]);
+        return 1;
+    }
+    ret = querylog_decode(in, stdout, ltsv);
+    if (in != stdin) {
+        fclose(in);
+    }
+    fflush(stdout);
+
+    return ret == 0 ? 0 : 1;
+}
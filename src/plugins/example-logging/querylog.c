@@ -0,0 +1,477 @@
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+# include <ws2tcpip.h>
+#else
+# include <sys/socket.h>
+# include <arpa/inet.h>
+# include <netinet/in.h>
+#endif
+
+#include "querylog.h"
+
+#ifndef putc_unlocked
+# define putc_unlocked(c, stream) putc((c), (stream))
+#endif
+
+static void
+put16(unsigned char * const p, const uint16_t v)
+{
+    p[0] = (unsigned char) (v >> 8);
+    p[1] = (unsigned char) v;
+}
+
+static void
+put32(unsigned char * const p, const uint32_t v)
+{
+    p[0] = (unsigned char) (v >> 24);
+    p[1] = (unsigned char) (v >> 16);
+    p[2] = (unsigned char) (v >> 8);
+    p[3] = (unsigned char) v;
+}
+
+static void
+put64(unsigned char * const p, const uint64_t v)
+{
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        p[i] = (unsigned char) (v >> (56 - i * 8));
+    }
+}
+
+static uint16_t
+get16(const unsigned char * const p)
+{
+    return (uint16_t) (((uint16_t) p[0] << 8) | (uint16_t) p[1]);
+}
+
+static uint32_t
+get32(const unsigned char * const p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+        ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+static uint64_t
+get64(const unsigned char * const p)
+{
+    uint64_t v = (uint64_t) 0U;
+    int      i;
+
+    for (i = 0; i < 8; i++) {
+        v = (v << 8) | (uint64_t) p[i];
+    }
+    return v;
+}
+
+int
+querylog_entry_from_query(QueryLogEntry * const entry,
+                          const struct sockaddr_storage * const client_addr,
+                          const unsigned char * const wire_data,
+                          const size_t wire_data_len)
+{
+    size_t i = (size_t) 12U;
+    size_t csize;
+
+    if (wire_data_len < 15U || wire_data[4] != 0U || wire_data[5] != 1U) {
+        return -1;
+    }
+    entry->completed = 0;
+    entry->disposition = QUERYLOG_DISPOSITION_UPSTREAM;
+    entry->rcode = 0U;
+    entry->ancount = entry->reply_len = 0U;
+    entry->rtt_usec = 0U;
+    entry->addr_len = (size_t) 0U;
+    if (client_addr->ss_family == AF_INET) {
+        struct sockaddr_in in;
+
+        memcpy(&in, client_addr, sizeof in);
+        memcpy(entry->addr, &in.sin_addr.s_addr, (size_t) 4U);
+        entry->addr_len = (size_t) 4U;
+    } else if (client_addr->ss_family == AF_INET6) {
+        struct sockaddr_in6 in6;
+
+        memcpy(&in6, client_addr, sizeof in6);
+        memcpy(entry->addr, in6.sin6_addr.s6_addr, (size_t) 16U);
+        entry->addr_len = (size_t) 16U;
+    }
+    while (i < wire_data_len && (csize = wire_data[i]) != 0U &&
+           csize < wire_data_len - i &&
+           i + csize + 1U - 12U < sizeof entry->qname) {
+        i += csize + 1U;
+    }
+    entry->qname_len = i - 12U;
+    memcpy(entry->qname, &wire_data[12], entry->qname_len);
+    entry->qname[entry->qname_len++] = 0U;
+    entry->qtype = 0U;
+    if (i < wire_data_len - 2U) {
+        entry->qtype = (uint16_t) ((wire_data[i + 1U] << 8) + wire_data[i + 2U]);
+    }
+    return 0;
+}
+
+void
+querylog_entry_set_reply(QueryLogEntry * const entry,
+                         const unsigned char * const wire_data,
+                         const size_t wire_data_len)
+{
+    if (wire_data_len < 12U) {
+        return;
+    }
+    entry->rcode = wire_data[3] & 0xf;
+    entry->ancount = get16(&wire_data[6]);
+    entry->reply_len = wire_data_len > 0xffff ?
+        (uint16_t) 0xffff : (uint16_t) wire_data_len;
+}
+
+void
+querylog_header_write(unsigned char header[QUERYLOG_HEADER_LEN])
+{
+    memcpy(header, QUERYLOG_MAGIC, QUERYLOG_MAGIC_LEN);
+    put16(&header[QUERYLOG_MAGIC_LEN], QUERYLOG_VERSION);
+    put16(&header[QUERYLOG_MAGIC_LEN + 2U], 0U);
+}
+
+int
+querylog_header_check(const unsigned char header[QUERYLOG_HEADER_LEN])
+{
+    if (memcmp(header, QUERYLOG_MAGIC, QUERYLOG_MAGIC_LEN) != 0 ||
+        get16(&header[QUERYLOG_MAGIC_LEN]) != QUERYLOG_VERSION) {
+        return -1;
+    }
+    return 0;
+}
+
+size_t
+querylog_record_write(unsigned char * const record,
+                      const QueryLogEntry * const entry)
+{
+    unsigned char *p = record;
+    size_t         record_len;
+
+    record_len = QUERYLOG_RECORD_QUERY_FIXED_LEN +
+        entry->addr_len + entry->qname_len;
+    if (entry->completed != 0) {
+        record_len += QUERYLOG_RECORD_REPLY_EXTRA_LEN;
+    }
+    put16(p, (uint16_t) (record_len - 2U));
+    p += 2U;
+    *p++ = entry->completed != 0 ?
+        QUERYLOG_RECORD_REPLY : QUERYLOG_RECORD_QUERY;
+    *p++ = (unsigned char) entry->addr_len;
+    put64(p, entry->ts_usec);
+    p += 8U;
+    put16(p, entry->qtype);
+    p += 2U;
+    *p++ = (unsigned char) entry->qname_len;
+    memcpy(p, entry->addr, entry->addr_len);
+    p += entry->addr_len;
+    memcpy(p, entry->qname, entry->qname_len);
+    p += entry->qname_len;
+    if (entry->completed != 0) {
+        *p++ = entry->disposition;
+        *p++ = entry->rcode;
+        put16(p, entry->ancount);
+        p += 2U;
+        put16(p, entry->reply_len);
+        p += 2U;
+        put32(p, entry->rtt_usec);
+        p += 4U;
+    }
+    assert((size_t) (p - record) == record_len);
+
+    return record_len;
+}
+
+int
+querylog_record_read(QueryLogEntry * const entry,
+                     const unsigned char * const record,
+                     const size_t record_len)
+{
+    const unsigned char *p = record;
+    size_t               extra_len = (size_t) 0U;
+    int                  type;
+
+    if (record_len < 1U) {
+        return -1;
+    }
+    type = (int) *p++;
+    switch (type) {
+    case QUERYLOG_RECORD_QUERY:
+        entry->completed = 0;
+        break;
+    case QUERYLOG_RECORD_REPLY:
+        entry->completed = 1;
+        extra_len = QUERYLOG_RECORD_REPLY_EXTRA_LEN;
+        break;
+    default:
+        return type;
+    }
+    if (record_len < QUERYLOG_RECORD_QUERY_FIXED_LEN - 2U + extra_len) {
+        return -1;
+    }
+    entry->addr_len = (size_t) *p++;
+    entry->ts_usec = get64(p);
+    p += 8U;
+    entry->qtype = get16(p);
+    p += 2U;
+    entry->qname_len = (size_t) *p++;
+    if ((entry->addr_len != 0U && entry->addr_len != 4U &&
+         entry->addr_len != 16U) || entry->qname_len < 1U ||
+        record_len != QUERYLOG_RECORD_QUERY_FIXED_LEN - 2U +
+        entry->addr_len + entry->qname_len + extra_len) {
+        return -1;
+    }
+    memcpy(entry->addr, p, entry->addr_len);
+    p += entry->addr_len;
+    memcpy(entry->qname, p, entry->qname_len);
+    p += entry->qname_len;
+    if (entry->qname[entry->qname_len - 1U] != 0U) {
+        return -1;
+    }
+    if (entry->completed != 0) {
+        entry->disposition = *p++;
+        entry->rcode = *p++;
+        entry->ancount = get16(p);
+        p += 2U;
+        entry->reply_len = get16(p);
+        p += 2U;
+        entry->rtt_usec = get32(p);
+    }
+    return type;
+}
+
+static int
+string_fprint(FILE * const fp, const unsigned char *str,
+              const size_t size, _Bool lower)
+{
+    int    c;
+    size_t i = (size_t) 0U;
+
+    while (i < size) {
+        c = (int) str[i++];
+        if (!isprint(c)) {
+            fprintf(fp, "\\x%02x", (unsigned int) c);
+        } else if (c == '\\') {
+            if (lower) {
+                c = tolower(c);
+            }
+            putc_unlocked(c, fp);
+        }
+        putc_unlocked(c, fp);
+    }
+    return 0;
+}
+
+static int
+ltsv_prop(FILE * const fp, const char * const prop, const _Bool ltsv)
+{
+    if (ltsv == 0) {
+        return 0;
+    }
+    fprintf(fp, "%s:", prop);
+
+    return 0;
+}
+
+static int
+timestamp_fprint(FILE * const fp, const uint64_t ts_usec, _Bool unix_ts)
+{
+    char now_s[128];
+
+    time_t     now = (time_t) (ts_usec / 1000000U);
+    struct tm *tm;
+
+    if (unix_ts) {
+        fprintf(fp, "%lu", (unsigned long) now);
+    } else {
+        if ((tm = localtime(&now)) == NULL) {
+            putc_unlocked('-', fp);
+            return -1;
+        }
+        strftime(now_s, sizeof now_s, "%c", tm);
+        fprintf(fp, "%s", now_s);
+    }
+    return 0;
+}
+
+static int
+ip_fprint(FILE * const fp, const unsigned char * const a, const size_t a_len)
+{
+    if (a_len == 4U) {
+        fprintf(fp, "%u.%u.%u.%u",
+                (unsigned int) a[0], (unsigned int) a[1],
+                (unsigned int) a[2], (unsigned int) a[3]);
+    } else if (a_len == 16U) {
+        int      i;
+        uint16_t w;
+        _Bool    blanks;
+
+        blanks = (a[0] | a[1]) == 0;
+        putc_unlocked('[', fp);
+        for (i = 0; i < 16; i += 2) {
+            w = ((uint16_t) a[i] << 8) | (uint16_t) a[i + 1];
+            if (blanks) {
+                if (w == 0U) {
+                    continue;
+                }
+                putc_unlocked(':', fp);
+                blanks = 0;
+            }
+            if (i != 0) {
+                putc_unlocked(':', fp);
+            }
+            if (blanks == 0) {
+                fprintf(fp, "%x", (unsigned int) w);
+            }
+        }
+        putc_unlocked(']', fp);
+    } else {
+        putc_unlocked('-', fp);
+    }
+    return 0;
+}
+
+static int
+qname_fprint(FILE * const fp, const unsigned char * const qname,
+             const size_t qname_len)
+{
+    size_t i = (size_t) 0U;
+    size_t csize;
+    _Bool  first = 1;
+
+    if (qname[i] == 0U) {
+        putc_unlocked('.', fp);
+    }
+    while (i < qname_len && (csize = qname[i]) != 0U &&
+           csize < qname_len - i) {
+        i++;
+        if (first != 0) {
+            first = 0;
+        } else {
+            putc_unlocked('.', fp);
+        }
+        string_fprint(fp, &qname[i], csize, 1);
+        i += csize;
+    }
+    return 0;
+}
+
+static int
+type_fprint(FILE * const fp, const uint16_t type)
+{
+    switch (type) {
+    case 0x01:
+        fprintf(fp, "A"); break;
+    case 0x02:
+        fprintf(fp, "NS"); break;
+    case 0x06:
+        fprintf(fp, "SOA"); break;
+    case 0x0c:
+        fprintf(fp, "PTR"); break;
+    case 0x0f:
+        fprintf(fp, "MX"); break;
+    case 0x1c:
+        fprintf(fp, "AAAA"); break;
+    default:
+        fprintf(fp, "0x%02hx", (unsigned short) type);
+    }
+    return 0;
+}
+
+static int
+rcode_fprint(FILE * const fp, const unsigned char rcode)
+{
+    static const char * const names[] = {
+        "NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED"
+    };
+
+    if (rcode < sizeof names / sizeof names[0]) {
+        fprintf(fp, "%s", names[rcode]);
+    } else {
+        fprintf(fp, "%u", (unsigned int) rcode);
+    }
+    return 0;
+}
+
+static int
+disposition_fprint(FILE * const fp, const unsigned char disposition)
+{
+    static const char * const names[] = {
+        "upstream", "cache", "blocked", "timeout", "error", "local"
+    };
+
+    if (disposition < sizeof names / sizeof names[0]) {
+        fprintf(fp, "%s", names[disposition]);
+    } else {
+        putc_unlocked('-', fp);
+    }
+    return 0;
+}
+
+static int
+reply_fprint(FILE * const fp, const QueryLogEntry * const entry,
+             const _Bool ltsv)
+{
+    putc_unlocked('\t', fp);
+    ltsv_prop(fp, "rcode", ltsv);
+    if (entry->reply_len > 0U) {
+        rcode_fprint(fp, entry->rcode);
+    } else {
+        putc_unlocked('-', fp);
+    }
+    putc_unlocked('\t', fp);
+    ltsv_prop(fp, "answers", ltsv);
+    if (entry->reply_len > 0U) {
+        fprintf(fp, "%u", (unsigned int) entry->ancount);
+    } else {
+        putc_unlocked('-', fp);
+    }
+    putc_unlocked('\t', fp);
+    ltsv_prop(fp, "size", ltsv);
+    fprintf(fp, "%u", (unsigned int) entry->reply_len);
+    putc_unlocked('\t', fp);
+    ltsv_prop(fp, "disposition", ltsv);
+    disposition_fprint(fp, entry->disposition);
+    putc_unlocked('\t', fp);
+    ltsv_prop(fp, "rtt", ltsv);
+    if (entry->disposition == QUERYLOG_DISPOSITION_UPSTREAM) {
+        fprintf(fp, "%lu.%03lu",
+                (unsigned long) (entry->rtt_usec / 1000U),
+                (unsigned long) (entry->rtt_usec % 1000U));
+    } else {
+        putc_unlocked('-', fp);
+    }
+    return 0;
+}
+
+int
+querylog_text_fprint(FILE * const fp, const QueryLogEntry * const entry,
+                     const _Bool ltsv)
+{
+    ltsv_prop(fp, "time", ltsv);
+    timestamp_fprint(fp, entry->ts_usec, ltsv);
+    putc_unlocked('\t', fp);
+    ltsv_prop(fp, "host", ltsv);
+    ip_fprint(fp, entry->addr, entry->addr_len);
+    putc_unlocked('\t', fp);
+    ltsv_prop(fp, "message", ltsv);
+    qname_fprint(fp, entry->qname, entry->qname_len);
+    putc_unlocked('\t', fp);
+    ltsv_prop(fp, "type", ltsv);
+    type_fprint(fp, entry->qtype);
+    if (entry->completed != 0) {
+        reply_fprint(fp, entry, ltsv);
+    }
+    putc_unlocked('\n', fp);
+
+    return 0;
+}
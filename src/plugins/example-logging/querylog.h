@@ -0,0 +1,100 @@
+
+#ifndef __QUERYLOG_H__
+#define __QUERYLOG_H__ 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+# include <ws2tcpip.h>
+#else
+# include <sys/socket.h>
+#endif
+
+/*
+ * Binary query log format.
+ *
+ * A file starts with a header made of the QUERYLOG_MAGIC string followed
+ * by a 16-bit version number and 16 reserved bits.
+ * It is followed by records, each starting with a 16-bit length (not
+ * including the length itself) and an 8-bit record type, so that
+ * readers can skip records they don't know about.
+ * All integers are stored in network byte order.
+ *
+ * QUERYLOG_RECORD_QUERY:
+ *   u16 length, u8 type, u8 address length (0, 4 or 16),
+ *   u64 timestamp (microseconds since the epoch), u16 qtype,
+ *   u8 qname length, address, qname (wire format, 0-terminated)
+ *
+ * QUERYLOG_RECORD_REPLY:
+ *   the QUERYLOG_RECORD_QUERY fields, followed by
+ *   u8 disposition, u8 rcode, u16 answer count, u16 reply size (0 if
+ *   there was no reply), u32 upstream round-trip time (microseconds)
+ */
+
+#define QUERYLOG_MAGIC        "DCQL"
+#define QUERYLOG_MAGIC_LEN    (sizeof QUERYLOG_MAGIC - 1U)
+#define QUERYLOG_VERSION      1U
+#define QUERYLOG_HEADER_LEN   (QUERYLOG_MAGIC_LEN + 4U)
+
+#define QUERYLOG_RECORD_QUERY 1U
+#define QUERYLOG_RECORD_REPLY 2U
+
+#define QUERYLOG_ADDR_MAX_LEN  16U
+#define QUERYLOG_QNAME_MAX_LEN 255U
+
+#define QUERYLOG_RECORD_QUERY_FIXED_LEN (2U + 1U + 1U + 8U + 2U + 1U)
+#define QUERYLOG_RECORD_REPLY_EXTRA_LEN (1U + 1U + 2U + 2U + 4U)
+#define QUERYLOG_RECORD_MAX_LEN \
+    (QUERYLOG_RECORD_QUERY_FIXED_LEN + QUERYLOG_ADDR_MAX_LEN + \
+     QUERYLOG_QNAME_MAX_LEN + QUERYLOG_RECORD_REPLY_EXTRA_LEN)
+
+typedef enum QueryLogDisposition_ {
+    QUERYLOG_DISPOSITION_UPSTREAM,
+    QUERYLOG_DISPOSITION_CACHE,
+    QUERYLOG_DISPOSITION_BLOCKED,
+    QUERYLOG_DISPOSITION_TIMEOUT,
+    QUERYLOG_DISPOSITION_ERROR,
+    QUERYLOG_DISPOSITION_LOCAL
+} QueryLogDisposition;
+
+typedef struct QueryLogEntry_ {
+    uint64_t      ts_usec;
+    unsigned char addr[QUERYLOG_ADDR_MAX_LEN];
+    unsigned char qname[QUERYLOG_QNAME_MAX_LEN];
+    size_t        addr_len;
+    size_t        qname_len;
+    uint32_t      rtt_usec;
+    uint16_t      qtype;
+    uint16_t      ancount;
+    uint16_t      reply_len;
+    unsigned char rcode;
+    unsigned char disposition;
+    _Bool         completed;
+} QueryLogEntry;
+
+int querylog_entry_from_query(QueryLogEntry * const entry,
+                              const struct sockaddr_storage * const client_addr,
+                              const unsigned char * const wire_data,
+                              const size_t wire_data_len);
+
+void querylog_entry_set_reply(QueryLogEntry * const entry,
+                              const unsigned char * const wire_data,
+                              const size_t wire_data_len);
+
+void querylog_header_write(unsigned char header[QUERYLOG_HEADER_LEN]);
+
+int querylog_header_check(const unsigned char header[QUERYLOG_HEADER_LEN]);
+
+size_t querylog_record_write(unsigned char * const record,
+                             const QueryLogEntry * const entry);
+
+int querylog_record_read(QueryLogEntry * const entry,
+                         const unsigned char * const record,
+                         const size_t record_len);
+
+int querylog_text_fprint(FILE * const fp, const QueryLogEntry * const entry,
+                         const _Bool ltsv);
+
+#endif
@@ -0,0 +1,311 @@
+
+#include <ctype.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+# include <ws2tcpip.h>
+#endif
+
+#include <dnscrypt/plugin.h>
+
+#ifdef _MSC_VER
+# define strcasecmp _stricmp
+# define strncasecmp _strnicmp
+#endif
+
+DCPLUGIN_MAIN(__FILE__);
+
+#define DNS_HEADER_SIZE 12U
+#define DNS_OFFSET_FLAGS 2U
+#define DNS_OFFSET_FLAGS2 3U
+#define DNS_OFFSET_QDCOUNT 4U
+#define DNS_OFFSET_QUESTION DNS_HEADER_SIZE
+#define DNS_FLAGS_QR 0x80U
+#define DNS_FLAGS_OPCODE 0x78U
+#define DNS_FLAGS2_RA 0x80U
+#define DNS_RCODE_REFUSED 5U
+#define DNS_TYPE_SOA 6U
+#define DNS_QTYPE_PLUS_QCLASS_LEN 4U
+
+#define DEFAULT_SOA_TTL 3600U
+#define MAX_SOA_TTL 604800U
+
+#define BITMAP_GET(B, V) (((B)[(V) >> 3] >> ((V) & 7U)) & 1U)
+#define BITMAP_SET(B, V) ((B)[(V) >> 3] |= (uint8_t) (1U << ((V) & 7U)))
+#define BITMAP_CLEAR(B, V) ((B)[(V) >> 3] &= (uint8_t) ~(1U << ((V) & 7U)))
+
+typedef struct QTypeFilter_ {
+    uint8_t  blocked_types[65536U / 8U];
+    uint8_t  blocked_classes[65536U / 8U];
+    uint32_t soa_ttl;
+} QTypeFilter;
+
+typedef struct DNSMnemonic_ {
+    const char *name;
+    uint16_t    value;
+} DNSMnemonic;
+
+static const DNSMnemonic dns_types[] = {
+    { "A", 1U }, { "NS", 2U }, { "CNAME", 5U }, { "SOA", 6U },
+    { "NULL", 10U }, { "WKS", 11U }, { "PTR", 12U }, { "HINFO", 13U },
+    { "MX", 15U }, { "TXT", 16U }, { "RP", 17U }, { "AFSDB", 18U },
+    { "SIG", 24U }, { "KEY", 25U }, { "AAAA", 28U }, { "LOC", 29U },
+    { "SRV", 33U }, { "NAPTR", 35U }, { "KX", 36U }, { "CERT", 37U },
+    { "DNAME", 39U }, { "OPT", 41U }, { "APL", 42U }, { "DS", 43U },
+    { "SSHFP", 44U }, { "IPSECKEY", 45U }, { "RRSIG", 46U },
+    { "NSEC", 47U }, { "DNSKEY", 48U }, { "DHCID", 49U },
+    { "NSEC3", 50U }, { "NSEC3PARAM", 51U }, { "TLSA", 52U },
+    { "SMIMEA", 53U }, { "HIP", 55U }, { "CDS", 59U }, { "CDNSKEY", 60U },
+    { "OPENPGPKEY", 61U }, { "CSYNC", 62U }, { "ZONEMD", 63U },
+    { "SVCB", 64U }, { "HTTPS", 65U }, { "SPF", 99U }, { "TKEY", 249U },
+    { "TSIG", 250U }, { "IXFR", 251U }, { "AXFR", 252U },
+    { "MAILB", 253U }, { "MAILA", 254U }, { "ANY", 255U }, { "URI", 256U },
+    { "CAA", 257U }, { NULL, 0U }
+};
+
+static const DNSMnemonic dns_classes[] = {
+    { "IN", 1U }, { "CH", 3U }, { "CHAOS", 3U }, { "HS", 4U },
+    { "NONE", 254U }, { "ANY", 255U }, { NULL, 0U }
+};
+
+static struct option getopt_long_options[] = {
+    { "allow", 1, NULL, 'a' },
+    { "block", 1, NULL, 'b' },
+    { "block-class", 1, NULL, 'c' },
+    { "soa-ttl", 1, NULL, 't' },
+    { NULL, 0, NULL, 0 }
+};
+static const char *getopt_options = "a:b:c:t:";
+
+const char *
+dcplugin_description(DCPlugin * const dcplugin)
+{
+    return "Directly return an empty response to queries for specific types";
+}
+
+const char *
+dcplugin_long_description(DCPlugin * const dcplugin)
+{
+    return
+        "This plugin answers queries for blocked record types with an\n"
+        "empty (NODATA) response, including a SOA record so that clients\n"
+        "can cache it. Queries for blocked classes are refused.\n"
+        "\n"
+        "Recognized switches are:\n"
+        "\n"
+        "--block=<type>: block a record type (e.g. AAAA, ANY, HTTPS, TYPE65)\n"
+        "--allow=<type>: only allow the given record types\n"
+        "--block-class=<class>: block a class (e.g. CHAOS)\n"
+        "--soa-ttl=<seconds>: how long clients can cache the response\n"
+        "\n"
+        "Switches can be repeated.\n"
+        "\n"
+        "# dnscrypt-proxy --plugin \\\n"
+        "  libdcplugin_example_qtype_filter.la,--block=AAAA,--block=ANY";
+}
+
+static int
+parse_mnemonic(const DNSMnemonic * const mnemonics, const char * const prefix,
+               const char * const str, uint16_t * const value_p)
+{
+    const DNSMnemonic *mnemonic;
+    const char        *number = str;
+    char              *endptr;
+    unsigned long      value;
+    const size_t       prefix_len = strlen(prefix);
+
+    for (mnemonic = mnemonics; mnemonic->name != NULL; mnemonic++) {
+        if (strcasecmp(mnemonic->name, str) == 0) {
+            *value_p = mnemonic->value;
+            return 0;
+        }
+    }
+    if (strncasecmp(str, prefix, prefix_len) == 0) {
+        number += prefix_len;
+    }
+    if (!isdigit((int) (unsigned char) *number)) {
+        return -1;
+    }
+    value = strtoul(number, &endptr, 10);
+    if (*endptr != 0 || value > 0xffff) {
+        return -1;
+    }
+    *value_p = (uint16_t) value;
+
+    return 0;
+}
+
+int
+dcplugin_init(DCPlugin * const dcplugin, int argc, char *argv[])
+{
+    QTypeFilter   *filter;
+    char          *endptr;
+    unsigned long  soa_ttl;
+    size_t         i;
+    uint16_t       value;
+    int            opt_flag;
+    int            option_index = 0;
+    _Bool          allow_list = 0;
+
+    if ((filter = calloc((size_t) 1U, sizeof *filter)) == NULL) {
+        return -1;
+    }
+    dcplugin_set_user_data(dcplugin, filter);
+    filter->soa_ttl = DEFAULT_SOA_TTL;
+    optind = 0;
+#ifdef _OPTRESET
+    optreset = 1;
+#endif
+    while ((opt_flag = getopt_long(argc, argv,
+                                   getopt_options, getopt_long_options,
+                                   &option_index)) != -1) {
+        switch (opt_flag) {
+        case 'a':
+            if (parse_mnemonic(dns_types, "TYPE", optarg, &value) != 0) {
+                return -1;
+            }
+            if (allow_list == 0) {
+                for (i = (size_t) 0U; i < sizeof filter->blocked_types; i++) {
+                    filter->blocked_types[i] = 0xff;
+                }
+                allow_list = 1;
+            }
+            BITMAP_CLEAR(filter->blocked_types, value);
+            break;
+        case 'b':
+            if (parse_mnemonic(dns_types, "TYPE", optarg, &value) != 0) {
+                return -1;
+            }
+            BITMAP_SET(filter->blocked_types, value);
+            break;
+        case 'c':
+            if (parse_mnemonic(dns_classes, "CLASS", optarg, &value) != 0) {
+                return -1;
+            }
+            BITMAP_SET(filter->blocked_classes, value);
+            break;
+        case 't':
+            soa_ttl = strtoul(optarg, &endptr, 10);
+            if (*optarg == 0 || *endptr != 0 || soa_ttl > MAX_SOA_TTL) {
+                return -1;
+            }
+            filter->soa_ttl = (uint32_t) soa_ttl;
+            break;
+        default:
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int
+dcplugin_destroy(DCPlugin * const dcplugin)
+{
+    free(dcplugin_get_user_data(dcplugin));
+
+    return 0;
+}
+
+static int
+skip_qname(const uint8_t * const dns_packet, const size_t dns_packet_len,
+           size_t * const offset_p)
+{
+    size_t  offset = *offset_p;
+    uint8_t label_len;
+
+    do {
+        if (offset >= dns_packet_len) {
+            return -1;
+        }
+        label_len = dns_packet[offset];
+        if ((label_len & 0xc0) != 0U) {
+            return -1;
+        }
+        offset += (size_t) label_len + 1U;
+    } while (label_len != 0U);
+    *offset_p = offset;
+
+    return 0;
+}
+
+static DCPluginSyncFilterResult
+reply_nodata(const QTypeFilter * const filter,
+             DCPluginDNSPacket * const dcp_packet, const size_t question_end,
+             const unsigned int qclass)
+{
+    uint8_t        *wire_data = dcplugin_get_wire_data(dcp_packet);
+    const uint32_t  ttl = filter->soa_ttl;
+    const uint8_t   soa_rr[] = {
+        0xc0, DNS_OFFSET_QUESTION,             /* name: qname */
+        0U, DNS_TYPE_SOA, (qclass >> 8) & 0xff, qclass & 0xff,
+        (ttl >> 24) & 0xff, (ttl >> 16) & 0xff, (ttl >> 8) & 0xff, ttl & 0xff,
+        0U, 22U,                               /* rdlen */
+        0U,                                    /* mname: root */
+        0U,                                    /* rname: root */
+        0U, 0U, 0U, 1U,                        /* serial */
+        (ttl >> 24) & 0xff, (ttl >> 16) & 0xff, (ttl >> 8) & 0xff, ttl & 0xff,
+        (ttl >> 24) & 0xff, (ttl >> 16) & 0xff, (ttl >> 8) & 0xff, ttl & 0xff,
+        (ttl >> 24) & 0xff, (ttl >> 16) & 0xff, (ttl >> 8) & 0xff, ttl & 0xff,
+        (ttl >> 24) & 0xff, (ttl >> 16) & 0xff, (ttl >> 8) & 0xff, ttl & 0xff
+    };
+
+    if (dcplugin_get_wire_data_max_len(dcp_packet) - question_end <
+        sizeof soa_rr) {
+        return DCP_SYNC_FILTER_RESULT_ERROR;
+    }
+    wire_data[DNS_OFFSET_FLAGS] |= DNS_FLAGS_QR;
+    wire_data[DNS_OFFSET_FLAGS2] = DNS_FLAGS2_RA;
+    memset(wire_data + DNS_OFFSET_QDCOUNT + 2U, 0, 6U);
+    wire_data[DNS_OFFSET_QDCOUNT + 5U] = 1U;   /* nscount */
+    memcpy(wire_data + question_end, soa_rr, sizeof soa_rr);
+    dcplugin_set_wire_data_len(dcp_packet, question_end + sizeof soa_rr);
+
+    return DCP_SYNC_FILTER_RESULT_DIRECT;
+}
+
+static DCPluginSyncFilterResult
+reply_refused(DCPluginDNSPacket * const dcp_packet, const size_t question_end)
+{
+    uint8_t *wire_data = dcplugin_get_wire_data(dcp_packet);
+
+    wire_data[DNS_OFFSET_FLAGS] |= DNS_FLAGS_QR;
+    wire_data[DNS_OFFSET_FLAGS2] = DNS_FLAGS2_RA | DNS_RCODE_REFUSED;
+    memset(wire_data + DNS_OFFSET_QDCOUNT + 2U, 0, 6U);
+    dcplugin_set_wire_data_len(dcp_packet, question_end);
+
+    return DCP_SYNC_FILTER_RESULT_DIRECT;
+}
+
+DCPluginSyncFilterResult
+dcplugin_sync_pre_filter(DCPlugin *dcplugin, DCPluginDNSPacket *dcp_packet)
+{
+    const QTypeFilter *filter = dcplugin_get_user_data(dcplugin);
+    const uint8_t     *wire_data = dcplugin_get_wire_data(dcp_packet);
+    const size_t       wire_data_len = dcplugin_get_wire_data_len(dcp_packet);
+    size_t             offset = DNS_OFFSET_QUESTION;
+    unsigned int       qtype;
+    unsigned int       qclass;
+
+    if (wire_data_len < DNS_HEADER_SIZE ||
+        (wire_data[DNS_OFFSET_FLAGS] & (DNS_FLAGS_QR | DNS_FLAGS_OPCODE)) != 0U ||
+        wire_data[DNS_OFFSET_QDCOUNT] != 0U ||
+        wire_data[DNS_OFFSET_QDCOUNT + 1U] != 1U ||
+        skip_qname(wire_data, wire_data_len, &offset) != 0 ||
+        wire_data_len - offset < DNS_QTYPE_PLUS_QCLASS_LEN) {
+        return DCP_SYNC_FILTER_RESULT_OK;
+    }
+    qtype = (wire_data[offset] << 8) | wire_data[offset + 1U];
+    qclass = (wire_data[offset + 2U] << 8) | wire_data[offset + 3U];
+    offset += DNS_QTYPE_PLUS_QCLASS_LEN;
+    if (BITMAP_GET(filter->blocked_classes, qclass) != 0U) {
+        return reply_refused(dcp_packet, offset);
+    }
+    if (BITMAP_GET(filter->blocked_types, qtype) != 0U) {
+        return reply_nodata(filter, dcp_packet, offset, qclass);
+    }
+    return DCP_SYNC_FILTER_RESULT_OK;
+}
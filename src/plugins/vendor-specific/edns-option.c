@@ -0,0 +1,259 @@
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "edns-option.h"
+
+#define DNS_HEADER_SIZE 12U
+#define DNS_OFFSET_QDCOUNT 4U
+#define DNS_OFFSET_ANCOUNT 6U
+#define DNS_OFFSET_NSCOUNT 8U
+#define DNS_OFFSET_ARCOUNT 10U
+#define DNS_QTYPE_PLUS_QCLASS_LEN 4U
+#define DNS_RR_FIXED_LEN 10U
+#define DNS_TYPE_OPT 41U
+
+static unsigned int
+_get_u16(const uint8_t * const p)
+{
+    return ((unsigned int) p[0] << 8) | (unsigned int) p[1];
+}
+
+static void
+_put_u16(uint8_t * const p, const unsigned int v)
+{
+    p[0] = (uint8_t) (v >> 8);
+    p[1] = (uint8_t) v;
+}
+
+static int
+_skip_name(const uint8_t * const dns_packet, const size_t dns_packet_len,
+           size_t * const offset_p)
+{
+    size_t  offset = *offset_p;
+    uint8_t label_len;
+
+    for (;;) {
+        if (offset >= dns_packet_len) {
+            return -1;
+        }
+        label_len = dns_packet[offset];
+        if ((label_len & 0xC0) == 0xC0) {
+            offset += 2U;
+            break;
+        }
+        if ((label_len & 0xC0) != 0U) {
+            return -1;
+        }
+        offset += (size_t) label_len + 1U;
+        if (label_len == 0U) {
+            break;
+        }
+    }
+    if (offset > dns_packet_len) {
+        return -1;
+    }
+    *offset_p = offset;
+
+    return 0;
+}
+
+static int
+_skip_rr(const uint8_t * const dns_packet, const size_t dns_packet_len,
+         size_t * const offset_p, unsigned int * const type_p)
+{
+    size_t offset = *offset_p;
+
+    if (_skip_name(dns_packet, dns_packet_len, &offset) != 0 ||
+        dns_packet_len - offset < DNS_RR_FIXED_LEN) {
+        return -1;
+    }
+    *type_p = _get_u16(dns_packet + offset);
+    offset += DNS_RR_FIXED_LEN;
+    offset += _get_u16(dns_packet + offset - 2U);
+    if (offset > dns_packet_len) {
+        return -1;
+    }
+    *offset_p = offset;
+
+    return 0;
+}
+
+/*
+ * Returns the offset of the RDLENGTH field of the OPT RR, 0 if there is
+ * no OPT RR, or -1 if the packet cannot be parsed.
+ */
+
+static long
+_find_opt_rdlen(const uint8_t * const dns_packet, const size_t dns_packet_len)
+{
+    size_t       offset = DNS_HEADER_SIZE;
+    size_t       rr_offset;
+    long         opt_rdlen_offset = 0L;
+    unsigned int count;
+    unsigned int type;
+
+    count = _get_u16(dns_packet + DNS_OFFSET_QDCOUNT);
+    while (count-- > 0U) {
+        if (_skip_name(dns_packet, dns_packet_len, &offset) != 0 ||
+            dns_packet_len - offset < DNS_QTYPE_PLUS_QCLASS_LEN) {
+            return -1L;
+        }
+        offset += DNS_QTYPE_PLUS_QCLASS_LEN;
+    }
+    count = _get_u16(dns_packet + DNS_OFFSET_ANCOUNT) +
+        _get_u16(dns_packet + DNS_OFFSET_NSCOUNT);
+    while (count-- > 0U) {
+        if (_skip_rr(dns_packet, dns_packet_len, &offset, &type) != 0) {
+            return -1L;
+        }
+    }
+    count = _get_u16(dns_packet + DNS_OFFSET_ARCOUNT);
+    while (count-- > 0U) {
+        rr_offset = offset;
+        if (_skip_rr(dns_packet, dns_packet_len, &offset, &type) != 0) {
+            return -1L;
+        }
+        if (type == DNS_TYPE_OPT) {
+            if (opt_rdlen_offset != 0L || dns_packet[rr_offset] != 0U) {
+                return -1L;
+            }
+            opt_rdlen_offset = (long) (rr_offset + 1U + DNS_RR_FIXED_LEN - 2U);
+        }
+    }
+    return opt_rdlen_offset;
+}
+
+static int
+_append_opt_rr(uint8_t * const dns_packet, size_t * const dns_packet_len_p,
+               const size_t dns_packet_max_len)
+{
+    const uint8_t opt_rr[] = {
+        0U,                      /* name */
+        0U, DNS_TYPE_OPT,        /* type */
+        (EDNS_OPTION_DEFAULT_PAYLOAD_SIZE >> 8) & 0xFF,
+        EDNS_OPTION_DEFAULT_PAYLOAD_SIZE & 0xFF,
+        0U, 0U, 0U, 0U,          /* rcode */
+        0U, 0U                   /* rdlen */
+    };
+    const unsigned int arcount =
+        _get_u16(dns_packet + DNS_OFFSET_ARCOUNT);
+
+    if (dns_packet_max_len - *dns_packet_len_p < sizeof opt_rr ||
+        arcount >= 0xFFFF) {
+        return -1;
+    }
+    memcpy(dns_packet + *dns_packet_len_p, opt_rr, sizeof opt_rr);
+    *dns_packet_len_p += sizeof opt_rr;
+    _put_u16(dns_packet + DNS_OFFSET_ARCOUNT, arcount + 1U);
+
+    return 0;
+}
+
+int
+edns_option_set(uint8_t * const dns_packet, size_t * const dns_packet_len_p,
+                const size_t dns_packet_max_len,
+                const uint8_t * const option, const size_t option_len)
+{
+    size_t       dns_packet_len = *dns_packet_len_p;
+    size_t       opt_rdlen_offset;
+    size_t       rdata_end;
+    size_t       offset;
+    size_t       current_option_len;
+    size_t       replaced_offset = (size_t) 0U;
+    size_t       replaced_len = (size_t) 0U;
+    long         opt_rdlen_offset_l;
+    unsigned int rdlen;
+
+    if (option_len < EDNS_OPTION_HEADER_LEN || option_len > 0xFFFF ||
+        _get_u16(option + 2U) != option_len - EDNS_OPTION_HEADER_LEN ||
+        dns_packet_len < DNS_HEADER_SIZE ||
+        dns_packet_len > dns_packet_max_len) {
+        return -1;
+    }
+    if ((opt_rdlen_offset_l =
+         _find_opt_rdlen(dns_packet, dns_packet_len)) < 0L) {
+        return -1;
+    }
+    if (opt_rdlen_offset_l == 0L) {
+        if (dns_packet_max_len - dns_packet_len <
+            DNS_RR_FIXED_LEN + 1U + option_len ||
+            _append_opt_rr(dns_packet, &dns_packet_len,
+                           dns_packet_max_len) != 0) {
+            return -1;
+        }
+        opt_rdlen_offset = dns_packet_len - 2U;
+    } else {
+        opt_rdlen_offset = (size_t) opt_rdlen_offset_l;
+    }
+    rdlen = _get_u16(dns_packet + opt_rdlen_offset);
+    rdata_end = opt_rdlen_offset + 2U + rdlen;
+    for (offset = opt_rdlen_offset + 2U; offset < rdata_end;
+         offset += current_option_len) {
+        if (rdata_end - offset < EDNS_OPTION_HEADER_LEN) {
+            return -1;
+        }
+        current_option_len =
+            EDNS_OPTION_HEADER_LEN + _get_u16(dns_packet + offset + 2U);
+        if (current_option_len > rdata_end - offset) {
+            return -1;
+        }
+        if (replaced_len == (size_t) 0U &&
+            memcmp(dns_packet + offset, option, 2U) == 0) {
+            replaced_offset = offset;
+            replaced_len = current_option_len;
+        }
+    }
+    if (dns_packet_max_len - dns_packet_len + replaced_len < option_len ||
+        rdlen - replaced_len + option_len > 0xFFFF) {
+        return -1;
+    }
+    if (replaced_len != (size_t) 0U) {
+        memmove(dns_packet + replaced_offset,
+                dns_packet + replaced_offset + replaced_len,
+                dns_packet_len - replaced_offset - replaced_len);
+        dns_packet_len -= replaced_len;
+        rdata_end -= replaced_len;
+    }
+    memmove(dns_packet + rdata_end + option_len, dns_packet + rdata_end,
+            dns_packet_len - rdata_end);
+    memcpy(dns_packet + rdata_end, option, option_len);
+    dns_packet_len += option_len;
+    _put_u16(dns_packet + opt_rdlen_offset,
+             (unsigned int) (rdlen - replaced_len + option_len));
+    *dns_packet_len_p = dns_packet_len;
+
+    return 0;
+}
+
+int
+edns_option_hex_decode(uint8_t * const bin, const size_t bin_len,
+                       const char * const hex, const size_t hex_len)
+{
+    size_t        i;
+    unsigned char c;
+    unsigned char nibble;
+
+    if (hex_len != bin_len * 2U) {
+        return -1;
+    }
+    for (i = 0U; i < hex_len; i++) {
+        c = (unsigned char) hex[i];
+        if (c >= '0' && c <= '9') {
+            nibble = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            nibble = c - 'a' + 10U;
+        } else if (c >= 'A' && c <= 'F') {
+            nibble = c - 'A' + 10U;
+        } else {
+            return -1;
+        }
+        if ((i & 1U) == 0U) {
+            bin[i / 2U] = (uint8_t) (nibble << 4);
+        } else {
+            bin[i / 2U] |= nibble;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+
+#ifndef __EDNS_OPTION_H__
+#define __EDNS_OPTION_H__ 1
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Wire-level EDNS option writer, shared by the OpenDNS plugins.
+ *
+ * An option is a precomputed blob made of a 16-bit code, a 16-bit
+ * length and the option data, all in network byte order.
+ * It is added to the OPT RR of a query in place: an option with the
+ * same code is replaced, other options are kept, and an OPT RR is
+ * appended if the query doesn't have one yet.
+ */
+
+#define EDNS_OPTION_HEADER_LEN 4U
+
+#ifndef EDNS_OPTION_DEFAULT_PAYLOAD_SIZE
+# define EDNS_OPTION_DEFAULT_PAYLOAD_SIZE 512U
+#endif
+
+int edns_option_set(uint8_t * const dns_packet,
+                    size_t * const dns_packet_len_p,
+                    const size_t dns_packet_max_len,
+                    const uint8_t * const option, const size_t option_len);
+
+int edns_option_hex_decode(uint8_t * const bin, const size_t bin_len,
+                           const char * const hex, const size_t hex_len);
+
+#endif
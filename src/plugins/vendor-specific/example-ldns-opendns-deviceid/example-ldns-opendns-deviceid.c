@@ -1,5 +1,6 @@
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,12 +10,16 @@
 #endif
 
 #include <dnscrypt/plugin.h>
-#include <ldns/ldns.h>
+
+#include "edns-option.h"
 
 DCPLUGIN_MAIN(__FILE__);
 
-#define EDNS_HEADER "0004000f4f70656e444e53"
-#define EDNS_DEV_ID "cafebabedeadbeef"
+#define EDNS_HEADER "\x00\x04" "\x00\x0f" "OpenDNS"
+#define EDNS_DEV_ID_LEN 8U
+#define EDNS_DEV_ID_HEX_LEN (EDNS_DEV_ID_LEN * 2U)
+
+#define EDNS_OPTION_LEN (sizeof EDNS_HEADER - 1U + EDNS_DEV_ID_LEN)
 
 const char *
 dcplugin_description(DCPlugin * const dcplugin)
@@ -41,62 +46,56 @@ dcplugin_long_description(DCPlugin * const dcplugin)
         "(16 hex characters).\n";
 }
 
-static char *
-load_device_id_from_file(const char * const file_name)
+static int
+load_device_id_from_file(uint8_t * const device_id,
+                         const char * const file_name)
 {
-    FILE *fp;
-    char *device_id;
+    char    device_id_hex[EDNS_DEV_ID_HEX_LEN + 3U];
+    FILE   *fp;
+    size_t  device_id_hex_len;
 
     if ((fp = fopen(file_name, "r")) == NULL) {
-        return NULL;
-    }
-    if ((device_id = calloc(1U, sizeof EDNS_DEV_ID)) == NULL) {
-        return NULL;
+        return -1;
     }
-    if (fread(device_id, 1U, sizeof EDNS_DEV_ID, fp) !=
-        sizeof EDNS_DEV_ID) {
-        free(device_id);
-        return NULL;
+    if (fgets(device_id_hex, (int) sizeof device_id_hex, fp) == NULL) {
+        fclose(fp);
+        return -1;
     }
     fclose(fp);
+    device_id_hex_len = strcspn(device_id_hex, "\r\n");
 
-    return device_id;
+    return edns_option_hex_decode(device_id, EDNS_DEV_ID_LEN,
+                                  device_id_hex, device_id_hex_len);
 }
 
 int
 dcplugin_init(DCPlugin * const dcplugin, int argc, char *argv[])
 {
-    char   *device_id = NULL;
-    char   *device_id_env = NULL;
-    char   *edns_hex;
-    size_t  edns_hex_size = sizeof EDNS_HEADER EDNS_DEV_ID;
-
-    edns_hex = malloc(sizeof EDNS_HEADER EDNS_DEV_ID);
-    dcplugin_set_user_data(dcplugin, edns_hex);
-    if (edns_hex == NULL) {
+    uint8_t *edns_option;
+    char    *device_id_env;
+
+    edns_option = malloc(EDNS_OPTION_LEN);
+    dcplugin_set_user_data(dcplugin, edns_option);
+    if (edns_option == NULL) {
         return -1;
     }
-    memcpy(edns_hex, EDNS_HEADER EDNS_DEV_ID, edns_hex_size);
-    assert(sizeof EDNS_DEV_ID - 1U == (size_t) 16U);
-    if (argc == 2U) {
-        device_id = load_device_id_from_file(argv[1]);
+    memcpy(edns_option, EDNS_HEADER, sizeof EDNS_HEADER - 1U);
+    assert(EDNS_OPTION_LEN - 4U == (size_t) 0x0f);
+    if (argc == 2 &&
+        load_device_id_from_file(edns_option + sizeof EDNS_HEADER - 1U,
+                                 argv[1]) == 0) {
+        return 0;
     }
-    if (device_id == NULL) {
-        if ((device_id_env = getenv("OPENDNS_DEVICE_ID")) == NULL) {
-            return -1;
-        }
-        if ((device_id = strdup(device_id_env)) == NULL) {
-            return -1;
-        }
-    }
-    if (device_id != NULL) {
-        memcpy(edns_hex + sizeof EDNS_HEADER - (size_t) 1U,
-               device_id, sizeof EDNS_DEV_ID);
-        free(device_id);
+    if ((device_id_env = getenv("OPENDNS_DEVICE_ID")) == NULL) {
+        return -1;
     }
-    if (device_id_env != NULL) {
-        memset(device_id_env, 0, strlen(device_id_env));
+    if (edns_option_hex_decode(edns_option + sizeof EDNS_HEADER - 1U,
+                               EDNS_DEV_ID_LEN, device_id_env,
+                               strlen(device_id_env)) != 0) {
+        return -1;
     }
+    memset(device_id_env, 0, strlen(device_id_env));
+
     return 0;
 }
 
@@ -111,31 +110,15 @@ dcplugin_destroy(DCPlugin *dcplugin)
 DCPluginSyncFilterResult
 dcplugin_sync_pre_filter(DCPlugin *dcplugin, DCPluginDNSPacket *dcp_packet)
 {
-    uint8_t  *new_packet;
-    ldns_rdf *edns_data;
-    ldns_pkt *packet = NULL;
-    size_t    new_packet_size;
-
-    if (ldns_wire2pkt(&packet, dcplugin_get_wire_data(dcp_packet),
-                      dcplugin_get_wire_data_len(dcp_packet))
-        != LDNS_STATUS_OK) {
-        return DCP_SYNC_FILTER_RESULT_ERROR;
-    }
+    size_t dns_packet_len = dcplugin_get_wire_data_len(dcp_packet);
 
-    edns_data = ldns_rdf_new_frm_str(LDNS_RDF_TYPE_HEX,
-                                     dcplugin_get_user_data(dcplugin));
-    ldns_pkt_set_edns_data(packet, edns_data);
-
-    if (ldns_pkt2wire(&new_packet, packet, &new_packet_size)
-        != LDNS_STATUS_OK) {
+    if (edns_option_set(dcplugin_get_wire_data(dcp_packet), &dns_packet_len,
+                        dcplugin_get_wire_data_max_len(dcp_packet),
+                        dcplugin_get_user_data(dcplugin),
+                        EDNS_OPTION_LEN) != 0) {
         return DCP_SYNC_FILTER_RESULT_ERROR;
     }
-    if (dcplugin_get_wire_data_max_len(dcp_packet) >= new_packet_size) {
-        dcplugin_set_wire_data(dcp_packet, new_packet, new_packet_size);
-    }
-
-    free(new_packet);
-    ldns_pkt_free(packet);
+    dcplugin_set_wire_data_len(dcp_packet, dns_packet_len);
 
     return DCP_SYNC_FILTER_RESULT_OK;
 }
@@ -0,0 +1,130 @@
+
+/*
+ * Per-query cost of adding the OpenDNS EDNS option to a query,
+ * parsing and rebuilding the packet with ldns vs editing it in place.
+ *
+ * make edns-option-bench && ./edns-option-bench [<iterations>]
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ldns/ldns.h>
+
+#include "edns-option.h"
+
+#define EDNS_DATA_HEX \
+    "4f56" "0014" "4f444e5300" "00" "10" "7f000001" "40" "deadbeefabad1dea"
+
+#define DEFAULT_ITERATIONS 1000000UL
+
+/* www.example.com IN A, with the OPT RR the proxy adds */
+static const uint8_t query[] = {
+    0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+    0x03, 'w', 'w', 'w', 0x07, 'e', 'x', 'a', 'm', 'p', 'l', 'e',
+    0x03, 'c', 'o', 'm', 0x00, 0x00, 0x01, 0x00, 0x01,
+    0x00, 0x00, 0x29, 0x04, 0xe4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (double) tv.tv_sec + (double) tv.tv_usec / 1e6;
+}
+
+static int
+add_option_ldns(uint8_t * const packet, size_t * const packet_len,
+                const size_t packet_max_len)
+{
+    uint8_t  *new_packet;
+    ldns_rdf *edns_data;
+    ldns_pkt *pkt = NULL;
+    size_t    new_packet_size;
+
+    if (ldns_wire2pkt(&pkt, packet, *packet_len) != LDNS_STATUS_OK) {
+        return -1;
+    }
+    edns_data = ldns_rdf_new_frm_str(LDNS_RDF_TYPE_HEX, EDNS_DATA_HEX);
+    ldns_pkt_set_edns_data(pkt, edns_data);
+    if (ldns_pkt2wire(&new_packet, pkt, &new_packet_size) != LDNS_STATUS_OK) {
+        ldns_pkt_free(pkt);
+        return -1;
+    }
+    if (packet_max_len >= new_packet_size) {
+        memcpy(packet, new_packet, new_packet_size);
+        *packet_len = new_packet_size;
+    }
+    free(new_packet);
+    ldns_pkt_free(pkt);
+
+    return 0;
+}
+
+static int
+add_option_wire(uint8_t * const packet, size_t * const packet_len,
+                const size_t packet_max_len)
+{
+    static uint8_t option[sizeof EDNS_DATA_HEX / 2U];
+
+    if (option[0] == 0U &&
+        edns_option_hex_decode(option, sizeof option, EDNS_DATA_HEX,
+                               sizeof EDNS_DATA_HEX - 1U) != 0) {
+        return -1;
+    }
+    return edns_option_set(packet, packet_len, packet_max_len,
+                           option, sizeof option);
+}
+
+static double
+bench(int (*add_option)(uint8_t * const packet, size_t * const packet_len,
+                        const size_t packet_max_len),
+      const unsigned long iterations, size_t * const packet_len)
+{
+    uint8_t       packet[512];
+    double        started;
+    unsigned long i;
+
+    started = now();
+    for (i = 0UL; i < iterations; i++) {
+        memcpy(packet, query, sizeof query);
+        *packet_len = sizeof query;
+        if (add_option(packet, packet_len, sizeof packet) != 0) {
+            fputs("Unable to add the EDNS option\n", stderr);
+            exit(1);
+        }
+    }
+    return (now() - started) * 1e9 / (double) iterations;
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned long iterations = DEFAULT_ITERATIONS;
+    size_t        ldns_len;
+    size_t        wire_len;
+    double        ldns_ns;
+    double        wire_ns;
+
+    if (argc > 1 && (iterations = strtoul(argv[1], NULL, 10)) == 0UL) {
+        fputs("Usage: edns-option-bench [<iterations>]\n", stderr);
+        return 1;
+    }
+    ldns_ns = bench(add_option_ldns, iterations, &ldns_len);
+    wire_ns = bench(add_option_wire, iterations, &wire_len);
+    printf("ldns round-trip: %10.1f ns/query (%lu bytes)\n",
+           ldns_ns, (unsigned long) ldns_len);
+    printf("in place:        %10.1f ns/query (%lu bytes)\n",
+           wire_ns, (unsigned long) wire_len);
+    printf("speedup:         %10.1fx\n", ldns_ns / wire_ns);
+
+    return 0;
+}
@@ -7,6 +7,7 @@
 #endif
 
 #include <assert.h>
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -19,16 +20,19 @@
 #include <ldns/ldns.h>
 #include <ldns/util.h>
 
+#include "edns-option.h"
+
 DCPLUGIN_MAIN(__FILE__);
 
-#define EDNS_HEADER           "4f56" "0014" "4f444e5300" "00"
-#define EDNS_HEADER_CLIENT_IP "10"
-#define EDNS_CLIENT_IP        "7f000001"
-#define EDNS_HEADER_FODDER    "40"
-#define EDNS_FODDER           "deadbeefabad1dea"
+#define EDNS_HEADER           "\x4f\x56" "\x00\x14" "ODNS\x00" "\x00"
+#define EDNS_HEADER_CLIENT_IP "\x10"
+#define EDNS_CLIENT_IP        "\x7f\x00\x00\x01"
+#define EDNS_HEADER_FODDER    "\x40"
+#define EDNS_FODDER           "\xde\xad\xbe\xef\xab\xad\x1d\xea"
 
 #define EDNS_DATA EDNS_HEADER \
     EDNS_HEADER_CLIENT_IP EDNS_CLIENT_IP EDNS_HEADER_FODDER EDNS_FODDER
+#define EDNS_DATA_LEN (sizeof EDNS_DATA - 1U)
 
 #define EDNS_CLIENT_IP_OFFSET (sizeof EDNS_HEADER - 1U + \
                                sizeof EDNS_HEADER_CLIENT_IP - 1U)
@@ -83,37 +87,19 @@ _inet_pton(const int af, const char * const src, void * const dst)
     return 1;
 }
 
-static void
-ip4tohex(char hex[4 * 2 + 1], unsigned char ip[4])
-{
-    static const char HEX[16] = "0123456789ABCDEF";
-    size_t            i;
-
-    for (i = 0U; i < 4U; i++) {
-        hex[i * 2U] = HEX[(ip[i] >> 4) & 0xf];
-        hex[i * 2U + 1U] = HEX[ip[i] & 0xf];
-    }
-    hex[i * 2U] = 0;
-}
-
 static int
-parse_client_ip(const char *ip_s, char * const edns_hex)
+parse_client_ip(const char *ip_s, uint8_t * const edns_option)
 {
-    char            ip_hex[8U + 1U];
     struct in_addr  ip_in_addr;
-    unsigned char  *sa;
     const size_t    ip_s_len = strlen(ip_s);
 
     if (ip_s_len <= INET_ADDRSTRLEN && strchr(ip_s, '.') != NULL &&
         _inet_pton(AF_INET, ip_s, &ip_in_addr) > 0) {
-        sa = (unsigned char *) &ip_in_addr.s_addr;
-        ip4tohex(ip_hex, sa);
-        memcpy(edns_hex + EDNS_CLIENT_IP_OFFSET,
-               ip_hex, sizeof EDNS_CLIENT_IP - 1U);
-    } else if (ip_s_len == sizeof EDNS_CLIENT_IP - 1U) {
-        memcpy(edns_hex + EDNS_CLIENT_IP_OFFSET,
-               ip_s, sizeof EDNS_CLIENT_IP - 1U);
-    } else {
+        memcpy(edns_option + EDNS_CLIENT_IP_OFFSET,
+               &ip_in_addr.s_addr, sizeof EDNS_CLIENT_IP - 1U);
+    } else if (edns_option_hex_decode(edns_option + EDNS_CLIENT_IP_OFFSET,
+                                      sizeof EDNS_CLIENT_IP - 1U,
+                                      ip_s, ip_s_len) != 0) {
         return -1;
     }
     return 0;
@@ -122,19 +108,19 @@ parse_client_ip(const char *ip_s, char * const edns_hex)
 int
 dcplugin_init(DCPlugin * const dcplugin, int argc, char *argv[])
 {
-    char   *edns_hex;
-    size_t  edns_hex_size = sizeof EDNS_DATA;
+    uint8_t *edns_option;
 
     ldns_init_random(NULL, 0U);
-    edns_hex = malloc(edns_hex_size);
-    dcplugin_set_user_data(dcplugin, edns_hex);
-    if (edns_hex == NULL) {
+    edns_option = malloc(EDNS_DATA_LEN);
+    dcplugin_set_user_data(dcplugin, edns_option);
+    if (edns_option == NULL) {
         return -1;
     }
-    memcpy(edns_hex, EDNS_DATA, edns_hex_size);
-    assert(sizeof EDNS_CLIENT_IP - 1U == (size_t) 8U);
+    memcpy(edns_option, EDNS_DATA, EDNS_DATA_LEN);
+    assert(sizeof EDNS_CLIENT_IP - 1U == (size_t) 4U);
+    assert(EDNS_DATA_LEN - EDNS_OPTION_HEADER_LEN == (size_t) 0x14);
     if (argc > 1 && argv[1] != NULL) {
-        parse_client_ip(argv[1], edns_hex);
+        parse_client_ip(argv[1], edns_option);
     }
     return 0;
 }
@@ -148,48 +134,34 @@ dcplugin_destroy(DCPlugin *dcplugin)
 }
 
 static void
-fill_with_random_hex_data(char * const str, size_t size)
+fill_with_random_data(uint8_t * const buf, size_t size)
 {
     size_t   i = (size_t) 0U;
     uint16_t rnd;
 
     while (i < size) {
         rnd = ldns_get_random();
-        str[i++] = "0123456789abcdef"[rnd & 0xf];
-        str[i++] = "0123456789abcdef"[(rnd >> 8) & 0xf];
+        buf[i++] = (uint8_t) rnd;
+        if (i < size) {
+            buf[i++] = (uint8_t) (rnd >> 8);
+        }
     }
 }
 
 DCPluginSyncFilterResult
 dcplugin_sync_pre_filter(DCPlugin *dcplugin, DCPluginDNSPacket *dcp_packet)
 {
-    uint8_t  *new_packet;
-    ldns_rdf *edns_data;
-    char     *edns_data_str;
-    ldns_pkt *packet = NULL;
-    size_t    new_packet_size;
-
-    if (ldns_wire2pkt(&packet, dcplugin_get_wire_data(dcp_packet),
-                      dcplugin_get_wire_data_len(dcp_packet))
-        != LDNS_STATUS_OK) {
-        return DCP_SYNC_FILTER_RESULT_ERROR;
-    }
-    edns_data_str = dcplugin_get_user_data(dcplugin);
-    fill_with_random_hex_data(edns_data_str + EDNS_FODDER_OFFSET,
-                              sizeof EDNS_FODDER - 1U);
-    edns_data = ldns_rdf_new_frm_str(LDNS_RDF_TYPE_HEX, edns_data_str);
-    ldns_pkt_set_edns_data(packet, edns_data);
-
-    if (ldns_pkt2wire(&new_packet, packet, &new_packet_size)
-        != LDNS_STATUS_OK) {
+    uint8_t *edns_option = dcplugin_get_user_data(dcplugin);
+    size_t   dns_packet_len = dcplugin_get_wire_data_len(dcp_packet);
+
+    fill_with_random_data(edns_option + EDNS_FODDER_OFFSET,
+                          sizeof EDNS_FODDER - 1U);
+    if (edns_option_set(dcplugin_get_wire_data(dcp_packet), &dns_packet_len,
+                        dcplugin_get_wire_data_max_len(dcp_packet),
+                        edns_option, EDNS_DATA_LEN) != 0) {
         return DCP_SYNC_FILTER_RESULT_ERROR;
     }
-    if (dcplugin_get_wire_data_max_len(dcp_packet) >= new_packet_size) {
-        dcplugin_set_wire_data(dcp_packet, new_packet, new_packet_size);
-    }
-
-    free(new_packet);
-    ldns_pkt_free(packet);
+    dcplugin_set_wire_data_len(dcp_packet, dns_packet_len);
 
     return DCP_SYNC_FILTER_RESULT_OK;
 }
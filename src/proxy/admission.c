@@ -0,0 +1,161 @@
+
+#include <config.h>
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sodium.h>
+
+#include "admission.h"
+#include "client_prefix.h"
+#include "dnscrypt_proxy.h"
+#include "logger.h"
+#include "metrics.h"
+#include "tcp_request.h"
+#include "udp_request.h"
+
+void
+admission_init(Admission * const admission, const unsigned int delay_target_ms)
+{
+    memset(admission, 0, sizeof *admission);
+    admission->delay_target = (uint64_t) delay_target_ms * 1000U;
+    randombytes_buf(admission->key, sizeof admission->key);
+}
+
+uint32_t
+admission_client_bucket(const Admission * const admission,
+                        const struct sockaddr_storage * const sa)
+{
+    return (uint32_t)
+        (client_prefix_hash(admission->key, sa, ADMISSION_IPV4_PREFIX,
+                            ADMISSION_IPV6_PREFIX) & (ADMISSION_BUCKETS - 1U));
+}
+
+void
+admission_request_start(Admission * const admission, const uint32_t bucket)
+{
+    assert(bucket < ADMISSION_BUCKETS);
+    if (admission->active[bucket]++ == 0U) {
+        admission->active_buckets++;
+    }
+}
+
+void
+admission_request_done(Admission * const admission, const uint32_t bucket)
+{
+    assert(bucket < ADMISSION_BUCKETS);
+    assert(admission->active[bucket] > 0U);
+    if (--admission->active[bucket] == 0U) {
+        assert(admission->active_buckets > 0U);
+        admission->active_buckets--;
+    }
+}
+
+static unsigned int
+admission_fair_share(const ProxyContext * const proxy_context)
+{
+    const unsigned int active_buckets =
+        proxy_context->admission.active_buckets;
+
+    if (active_buckets <= 1U) {
+        return proxy_context->connections_count_max;
+    }
+    if (active_buckets >= proxy_context->connections_count_max) {
+        return 1U;
+    }
+    return proxy_context->connections_count_max / active_buckets;
+}
+
+int
+admission_client_is_heavy(const ProxyContext * const proxy_context,
+                          const uint32_t bucket)
+{
+    return proxy_context->admission.active[bucket] >
+        admission_fair_share(proxy_context);
+}
+
+static void
+admission_shed(ProxyContext * const proxy_context,
+               const AdmissionShedReason reason)
+{
+    proxy_context->admission.shed[reason]++;
+    logger(proxy_context, LOG_DEBUG, "Overloaded, shedding [%s]",
+           admission_shed_reason_name(reason));
+}
+
+/*
+ * Called when a query from the network `bucket` arrives while the maximum
+ * number of active requests has been reached.
+ *
+ * - Like CoDel, a request that has been waiting longer than the delay
+ * target is considered as a standing queue rather than as a burst: it is
+ * unlikely to be answered in time, so the oldest request is dropped.
+ * - Otherwise, if the client's network already has its fair share of
+ * active requests, the new query is dropped.
+ * - Otherwise, the oldest request of a network exceeding its fair share
+ * is dropped; UDP requests go first, as they can be retried cheaply.
+ * - If there is no such network, the oldest request is dropped.
+ *
+ * Returns 0 if room has been made for the new query, -1 if it has to be
+ * dropped.
+ */
+
+int
+admission_make_room(ProxyContext * const proxy_context, const uint32_t bucket)
+{
+    Admission * const admission = &proxy_context->admission;
+    uint64_t          oldest_udp;
+    uint64_t          oldest_tcp;
+    uint64_t          oldest;
+
+    if (admission->delay_target > 0U) {
+        oldest_udp = udp_listener_oldest_request_ts(proxy_context);
+        oldest_tcp = tcp_listener_oldest_request_ts(proxy_context);
+        if (oldest_udp != 0U && (oldest_tcp == 0U || oldest_udp <= oldest_tcp)) {
+            oldest = oldest_udp;
+        } else {
+            oldest = oldest_tcp;
+        }
+        if (oldest != 0U && metrics_now() - oldest > admission->delay_target) {
+            if (oldest == oldest_udp) {
+                udp_listener_kill_oldest_request(proxy_context);
+            } else {
+                tcp_listener_kill_oldest_request(proxy_context);
+            }
+            admission_shed(proxy_context, ADMISSION_SHED_STALE);
+            return 0;
+        }
+    }
+    if (admission->active[bucket] >= admission_fair_share(proxy_context)) {
+        admission_shed(proxy_context, ADMISSION_SHED_CLIENT_SHARE);
+        return -1;
+    }
+    if (udp_listener_kill_oldest_heavy_request(proxy_context) == 0 ||
+        tcp_listener_kill_oldest_heavy_request(proxy_context) == 0) {
+        admission_shed(proxy_context, ADMISSION_SHED_HEAVY_CLIENT);
+        return 0;
+    }
+    if (udp_listener_kill_oldest_request(proxy_context) == 0 ||
+        tcp_listener_kill_oldest_request(proxy_context) == 0) {
+        admission_shed(proxy_context, ADMISSION_SHED_OLDEST);
+        return 0;
+    }
+    return -1;
+}
+
+const char *
+admission_shed_reason_name(const AdmissionShedReason reason)
+{
+    static const char * const names[ADMISSION_SHED_REASONS] = {
+        [ADMISSION_SHED_STALE] = "stale",
+        [ADMISSION_SHED_CLIENT_SHARE] = "client_share",
+        [ADMISSION_SHED_HEAVY_CLIENT] = "heavy_client",
+        [ADMISSION_SHED_OLDEST] = "oldest"
+    };
+
+    assert(reason < ADMISSION_SHED_REASONS);
+
+    return names[reason];
+}
@@ -0,0 +1,66 @@
+
+#ifndef __ADMISSION_H__
+#define __ADMISSION_H__ 1
+
+#include <stdint.h>
+
+#include "client_prefix.h"
+
+/*
+ * Decides what to do with a new query when the maximum number of active
+ * requests has been reached. Active requests are counted per client
+ * network, so that a single network flooding the proxy can't evict
+ * queries from everybody else.
+ */
+
+#define ADMISSION_BUCKETS 4096U
+
+#ifndef ADMISSION_IPV4_PREFIX
+# define ADMISSION_IPV4_PREFIX 24U
+#endif
+#ifndef ADMISSION_IPV6_PREFIX
+# define ADMISSION_IPV6_PREFIX 56U
+#endif
+#ifndef ADMISSION_DELAY_TARGET_MS
+# define ADMISSION_DELAY_TARGET_MS 500U
+#endif
+
+typedef enum AdmissionShedReason_ {
+    ADMISSION_SHED_STALE,
+    ADMISSION_SHED_CLIENT_SHARE,
+    ADMISSION_SHED_HEAVY_CLIENT,
+    ADMISSION_SHED_OLDEST,
+    ADMISSION_SHED_REASONS
+} AdmissionShedReason;
+
+typedef struct Admission_ {
+    uint8_t      key[CLIENT_PREFIX_KEYBYTES];
+    uint64_t     shed[ADMISSION_SHED_REASONS];
+    uint64_t     delay_target;
+    unsigned int active[ADMISSION_BUCKETS];
+    unsigned int active_buckets;
+} Admission;
+
+struct ProxyContext_;
+
+void admission_init(Admission * const admission,
+                    const unsigned int delay_target_ms);
+
+uint32_t admission_client_bucket(const Admission * const admission,
+                                 const struct sockaddr_storage * const sa);
+
+void admission_request_start(Admission * const admission,
+                             const uint32_t bucket);
+
+void admission_request_done(Admission * const admission,
+                            const uint32_t bucket);
+
+int admission_client_is_heavy(const struct ProxyContext_ * const proxy_context,
+                              const uint32_t bucket);
+
+int admission_make_room(struct ProxyContext_ * const proxy_context,
+                        const uint32_t bucket);
+
+const char *admission_shed_reason_name(const AdmissionShedReason reason);
+
+#endif
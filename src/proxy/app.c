@@ -35,61 +35,112 @@
 #include "stack_trace.h"
 #include "tcp_request.h"
 #include "udp_request.h"
+#include "utils.h"
 #ifdef PLUGINS
 # include "plugin_support.h"
 #endif
 
-#ifndef INET6_ADDRSTRLEN
-# define INET6_ADDRSTRLEN 46U
-#endif
+typedef enum StartupPhase_ {
+    STARTUP_PHASE_OPTIONS,
+    STARTUP_PHASE_PLUGINS,
+    STARTUP_PHASE_KEYS,
+    STARTUP_PHASE_SOCKETS,
+    STARTUP_PHASE_CERTIFICATE,
+    STARTUP_PHASES
+} StartupPhase;
+
+/*
+ * When every startup phase started and ended, relative to the start of
+ * the process. Plugins are loaded while the following phases run, so
+ * the total is shorter than the sum.
+ */
+
+typedef struct StartupTimer_ {
+    uint64_t started;
+    uint64_t phase_started[STARTUP_PHASES];
+    uint64_t phase_done[STARTUP_PHASES];
+} StartupTimer;
 
 static AppContext            app_context;
+static StartupTimer          startup_timer;
 static volatile sig_atomic_t skip_dispatch;
 
-static int
-sockaddr_from_ip_and_port(struct sockaddr_storage * const sockaddr,
-                          ev_socklen_t * const sockaddr_len_p,
-                          const char * const ip, const char * const port,
-                          const char * const error_msg)
+static void
+startup_phase_start(const StartupPhase phase)
 {
-    char   sockaddr_port[INET6_ADDRSTRLEN + sizeof "[]:65535"];
-    int    sockaddr_len_int;
-    char  *pnt;
-    _Bool  has_column = 0;
-    _Bool  has_columns = 0;
-    _Bool  has_brackets = *ip == '[';
-
-    if ((pnt = strchr(ip, ':')) != NULL) {
-        has_column = 1;
-        if (strchr(pnt + 1, ':') != NULL) {
-            has_columns = 1;
-        }
-    }
-    sockaddr_len_int = (int) sizeof *sockaddr;
-    if ((has_brackets != 0 || has_column != has_columns) &&
-        evutil_parse_sockaddr_port(ip, (struct sockaddr *) sockaddr,
-                                   &sockaddr_len_int) == 0) {
-        *sockaddr_len_p = (ev_socklen_t) sockaddr_len_int;
-        return 0;
-    }
-    if (has_columns != 0 && has_brackets == 0) {
-        evutil_snprintf(sockaddr_port, sizeof sockaddr_port, "[%s]:%s",
-                        ip, port);
-    } else {
-        evutil_snprintf(sockaddr_port, sizeof sockaddr_port, "%s:%s",
-                        ip, port);
-    }
-    sockaddr_len_int = (int) sizeof *sockaddr;
-    if (evutil_parse_sockaddr_port(sockaddr_port, (struct sockaddr *) sockaddr,
-                                   &sockaddr_len_int) != 0) {
-        logger(NULL, LOG_ERR, "%s: %s", error_msg, sockaddr_port);
-        *sockaddr_len_p = (ev_socklen_t) 0U;
+    startup_timer.phase_started[phase] = dnscrypt_hrtime();
+}
 
-        return -1;
+static void
+startup_phase_done(const StartupPhase phase, uint64_t done)
+{
+    if (done == (uint64_t) 0U) {
+        done = dnscrypt_hrtime();
     }
-    *sockaddr_len_p = (ev_socklen_t) sockaddr_len_int;
+    startup_timer.phase_done[phase] = done;
+}
 
-    return 0;
+static void
+startup_timer_report(ProxyContext * const proxy_context)
+{
+    static const char * const phase_names[STARTUP_PHASES] = {
+        [STARTUP_PHASE_OPTIONS] = "options",
+        [STARTUP_PHASE_PLUGINS] = "plugins",
+        [STARTUP_PHASE_KEYS] = "keys",
+        [STARTUP_PHASE_SOCKETS] = "sockets",
+        [STARTUP_PHASE_CERTIFICATE] = "certificate"
+    };
+    char         report[256];
+    size_t       report_len = (size_t) 0U;
+    uint64_t     elapsed;
+    unsigned int phase;
+
+    *report = 0;
+    for (phase = 0U; phase < STARTUP_PHASES; phase++) {
+        if (startup_timer.phase_done[phase] <
+            startup_timer.phase_started[phase] ||
+            startup_timer.phase_started[phase] == (uint64_t) 0U) {
+            continue;
+        }
+        elapsed = startup_timer.phase_done[phase] -
+            startup_timer.phase_started[phase];
+        evutil_snprintf(report + report_len, sizeof report - report_len,
+                        "%s%s %.1f ms", report_len > (size_t) 0U ? ", " : "",
+                        phase_names[phase], (double) elapsed / 1000.0);
+        report_len += strlen(report + report_len);
+    }
+    elapsed = dnscrypt_hrtime() - startup_timer.started;
+    logger(proxy_context, LOG_NOTICE, "Startup: %s - ready after %.1f ms",
+           report, (double) elapsed / 1000.0);
+}
+
+/*
+ * Listeners can't be started before the plugins are ready, since they
+ * may have to block queries. The loader is joined as soon as the
+ * certificate queries have been sent, before the event loop starts, so
+ * that a plugin that can't be loaded stops the proxy right away, even if
+ * no certificate is ever received. Only the network round trip of these
+ * queries overlaps plugin loading: replies are not processed until the
+ * plugins are loaded. Waiting again is a no-op.
+ */
+
+static void
+plugins_wait(ProxyContext * const proxy_context)
+{
+#ifdef PLUGINS
+    uint64_t loaded_at;
+
+    if (plugin_support_context_load_wait(app_context.dcps_context,
+                                         &loaded_at) != 0) {
+        logger_noformat(proxy_context, LOG_ERR, "Unable to load plugins");
+        exit(2);
+    }
+    if (startup_timer.phase_done[STARTUP_PHASE_PLUGINS] == (uint64_t) 0U) {
+        startup_phase_done(STARTUP_PHASE_PLUGINS, loaded_at);
+    }
+#else
+    (void) proxy_context;
+#endif
 }
 
 static int
@@ -135,6 +186,16 @@ proxy_context_init(ProxyContext * const proxy_context, int argc, char *argv[])
                                   "Unsupported local address") != 0) {
         return -1;
     }
+    if (proxy_context->metrics_address != NULL &&
+        strncmp(proxy_context->metrics_address, METRICS_UNIX_PREFIX,
+                sizeof METRICS_UNIX_PREFIX - 1U) != 0 &&
+        sockaddr_from_ip_and_port(&proxy_context->metrics_sockaddr,
+                                  &proxy_context->metrics_sockaddr_len,
+                                  proxy_context->metrics_address,
+                                  METRICS_DEFAULT_PORT,
+                                  "Unsupported metrics address") != 0) {
+        return -1;
+    }
     return 0;
 }
 
@@ -145,6 +206,10 @@ proxy_context_free(ProxyContext * const proxy_context)
         return;
     }
     options_free(proxy_context);
+    if (proxy_context->slow_query_log_fp != NULL) {
+        fclose(proxy_context->slow_query_log_fp);
+        proxy_context->slow_query_log_fp = NULL;
+    }
     logger_close(proxy_context);
 }
 
@@ -180,14 +245,36 @@ init_tz(void)
     return 0;
 }
 
+/*
+ * Done before plugins start being loaded, since setlocale() and putenv()
+ * are not thread-safe.
+ */
+
 static void
-revoke_privileges(ProxyContext * const proxy_context)
+init_environment(void)
 {
-    (void) proxy_context;
-
     init_locale();
     init_tz();
     (void) strerror(ENOENT);
+}
+
+static _Bool
+will_revoke_privileges(const ProxyContext * const proxy_context)
+{
+#if !defined(DEBUG) && !defined(_WIN32)
+    return proxy_context->user_dir != NULL ||
+        proxy_context->user_id != (uid_t) 0;
+#else
+    (void) proxy_context;
+    return 0;
+#endif
+}
+
+static void
+revoke_privileges(ProxyContext * const proxy_context)
+{
+    (void) proxy_context;
+
 #ifndef DEBUG
     randombytes_stir();
 # ifndef _WIN32
@@ -235,6 +322,8 @@ dnscrypt_proxy_start_listeners(ProxyContext * const proxy_context)
     if (proxy_context->listeners_started != 0) {
         return 0;
     }
+    startup_phase_done(STARTUP_PHASE_CERTIFICATE, 0U);
+    plugins_wait(proxy_context);
     if (udp_listener_start(proxy_context) != 0 ||
         tcp_listener_start(proxy_context) != 0) {
         exit(1);
@@ -248,6 +337,7 @@ dnscrypt_proxy_start_listeners(ProxyContext * const proxy_context)
     logger(proxy_context, LOG_NOTICE, "Proxying from %s to %s",
            local_addr_s, resolver_addr_s);
     proxy_context->listeners_started = 1;
+    startup_timer_report(proxy_context);
     systemd_notify(proxy_context, "READY=1");
     return 0;
 }
@@ -328,6 +418,7 @@ dnscrypt_proxy_main(int argc, char *argv[])
     struct event *sigint_event;
     struct event *sigterm_event;    
 
+    startup_timer.started = dnscrypt_hrtime();
     setvbuf(stdout, NULL, _IOLBF, BUFSIZ);
     stack_trace_on_crash();
     if (sodium_init() != 0) {
@@ -339,20 +430,22 @@ dnscrypt_proxy_main(int argc, char *argv[])
         exit(2);
     }
 #endif
+    startup_phase_start(STARTUP_PHASE_OPTIONS);
     if (proxy_context_init(&proxy_context, argc, argv) != 0) {
         logger_noformat(NULL, LOG_ERR, "Unable to start the proxy");
         exit(1);
     }
+    startup_phase_done(STARTUP_PHASE_OPTIONS, 0U);
     logger_noformat(&proxy_context, LOG_NOTICE, "Starting " PACKAGE_STRING);
     sodium_mlock(&proxy_context, sizeof proxy_context);
     randombytes_set_implementation(&randombytes_salsa20_implementation);
+    init_environment();
+    startup_phase_start(STARTUP_PHASE_PLUGINS);
 #ifdef PLUGINS
-    if (plugin_support_context_load(app_context.dcps_context) != 0) {
-        logger_noformat(NULL, LOG_ERR, "Unable to load plugins");
-        exit(2);
-    }
+    plugin_support_context_load_start(app_context.dcps_context);
 #endif
     app_context.proxy_context = &proxy_context;
+    startup_phase_start(STARTUP_PHASE_KEYS);
     proxy_context.dnscrypt_client.ephemeral_keys =
         proxy_context.ephemeral_keys;
     if (proxy_context.dnscrypt_client.ephemeral_keys != 0) {
@@ -366,10 +459,22 @@ dnscrypt_proxy_main(int argc, char *argv[])
         dnscrypt_client_init_with_new_key_pair(&proxy_context.dnscrypt_client);
     }
     logger_noformat(&proxy_context, LOG_INFO, "Done");
+    startup_phase_done(STARTUP_PHASE_KEYS, 0U);
 
+    startup_phase_start(STARTUP_PHASE_SOCKETS);
     if (cert_updater_init(&proxy_context) != 0) {
         exit(1);
     }
+    admission_init(&proxy_context.admission,
+                   proxy_context.overload_delay_target);
+    if (rrl_init(&proxy_context.rrl, proxy_context.rate_limit,
+                 proxy_context.rate_limit_ipv4_prefix,
+                 proxy_context.rate_limit_ipv6_prefix,
+                 proxy_context.rate_limit_action) != 0) {
+        logger_noformat(&proxy_context, LOG_ERR,
+                        "Unable to allocate the rate limiting table");
+        exit(1);
+    }
 #ifdef HAVE_LIBSYSTEMD
     if (init_descriptors_from_systemd(&proxy_context) != 0) {
         exit(1);
@@ -377,17 +482,32 @@ dnscrypt_proxy_main(int argc, char *argv[])
 #endif
     if (proxy_context.test_only == 0 &&
         (udp_listener_bind(&proxy_context) != 0 ||
-         tcp_listener_bind(&proxy_context) != 0)) {
+         tcp_listener_bind(&proxy_context) != 0 ||
+         metrics_bind(&proxy_context) != 0)) {
         exit(1);
     }
+    startup_phase_done(STARTUP_PHASE_SOCKETS, 0U);
 #ifdef SIGPIPE
     signal(SIGPIPE, SIG_IGN);
 #endif
 
+    /*
+     * Plugins may need files that won't be reachable after chroot(), and
+     * the certificate shouldn't be parsed with root privileges. When
+     * privileges are dropped, plugins have to be loaded before the
+     * certificate is fetched.
+     */
+    if (will_revoke_privileges(&proxy_context)) {
+        plugins_wait(&proxy_context);
+    }
     revoke_privileges(&proxy_context);
-    if (cert_updater_start(&proxy_context) != 0) {
+    startup_phase_start(STARTUP_PHASE_CERTIFICATE);
+    if (cert_updater_start(&proxy_context) != 0 ||
+        failover_start(&proxy_context) != 0 ||
+        forwarding_start(&proxy_context) != 0) {
         exit(1);
     }
+    plugins_wait(&proxy_context);
 
     sigint_event  = evsignal_new(proxy_context.event_loop, SIGINT,
                                  signal_cb, &proxy_context);
@@ -400,6 +520,10 @@ dnscrypt_proxy_main(int argc, char *argv[])
 #ifdef HAVE_LIBSYSTEMD
     sd_notifyf(0, "MAINPID=%lu", (unsigned long) getpid());
 #endif
+    if (logger_async_start(&proxy_context) != 0) {
+        logger_noformat(&proxy_context, LOG_WARNING,
+                        "Unable to start the logging thread");
+    }
     if (skip_dispatch == 0) {
         event_base_dispatch(proxy_context.event_loop);
     }
@@ -407,8 +531,12 @@ dnscrypt_proxy_main(int argc, char *argv[])
     systemd_notify(0, "STOPPING=1");
 
     cert_updater_free(&proxy_context);
+    failover_free(&proxy_context);
     udp_listener_stop(&proxy_context);
     tcp_listener_stop(&proxy_context);
+    forwarding_free(&proxy_context);
+    metrics_stop(&proxy_context);
+    rrl_free(&proxy_context.rrl);
     event_free(sigint_event);
     event_free(sigterm_event);
     event_base_free(proxy_context.event_loop);
@@ -23,6 +23,7 @@
 #include "cert.h"
 #include "cert_p.h"
 #include "dnscrypt_proxy.h"
+#include "failover.h"
 #include "logger.h"
 #include "probes.h"
 #include "shims.h"
@@ -30,13 +31,25 @@
 
 static int cert_updater_update(ProxyContext * const proxy_context);
 
+/*
+ * Resolvers being probed are not in use yet, and their errors are reported
+ * by whoever started the probe: certificate messages are then only logged
+ * at the debug level.
+ */
+
+static inline int
+cert_log_level(const _Bool quiet, const int crit)
+{
+    return quiet != 0 ? LOG_DEBUG : crit;
+}
+
 static int
 cert_parse_version(ProxyContext * const proxy_context,
                    const SignedBincert * const signed_bincert,
-                   const size_t signed_bincert_len)
+                   const size_t signed_bincert_len, const _Bool quiet)
 {
-    if (signed_bincert_len < (size_t) (signed_bincert->signed_data -
-                                       signed_bincert->magic_cert) ||
+    if (signed_bincert_len <= (size_t) (signed_bincert->signed_data -
+                                        signed_bincert->magic_cert) ||
         memcmp(signed_bincert->magic_cert, CERT_MAGIC_CERT,
                sizeof signed_bincert->magic_cert) != 0) {
         logger_noformat(proxy_context, LOG_DEBUG,
@@ -49,7 +62,7 @@ cert_parse_version(ProxyContext * const proxy_context,
          && signed_bincert->version_major[1] != 2U
 #endif
         )) {
-        logger(proxy_context, LOG_WARNING,
+        logger(proxy_context, cert_log_level(quiet, LOG_WARNING),
                "Unsupported certificate version: [%u][%u]",
                signed_bincert->version_major[0],
                signed_bincert->version_major[1]);
@@ -61,18 +74,19 @@ cert_parse_version(ProxyContext * const proxy_context,
 static int
 cert_parse_bincert(ProxyContext * const proxy_context,
                    const Bincert * const bincert,
-                   const Bincert * const previous_bincert)
+                   const Bincert * const previous_bincert,
+                   const _Bool quiet)
 {
     uint32_t serial;
     memcpy(&serial, bincert->serial, sizeof serial);
     serial = htonl(serial);
     if (serial >= 0x30303030 && serial <= 0x30303039) {
-        logger(proxy_context, LOG_INFO,
+        logger(proxy_context, cert_log_level(quiet, LOG_INFO),
                "Server certificate with serial '%c%c%c%c' received",
                (serial >> 24) & 0xff, (serial >> 16) & 0xff,
                (serial >> 8) & 0xff, serial & 0xff);
     } else {
-        logger(proxy_context, LOG_INFO,
+        logger(proxy_context, cert_log_level(quiet, LOG_INFO),
                "Server certificate with serial #%" PRIu32 " received", serial);
     }
     uint32_t ts_begin;
@@ -84,7 +98,7 @@ cert_parse_bincert(ProxyContext * const proxy_context,
     ts_end = htonl(ts_end);
 
     if (ts_end <= ts_begin) {
-        logger_noformat(proxy_context, LOG_WARNING,
+        logger_noformat(proxy_context, cert_log_level(quiet, LOG_WARNING),
                         "This certificate has a bogus validity period");
         return -1;
     }
@@ -93,21 +107,22 @@ cert_parse_bincert(ProxyContext * const proxy_context,
 
     if (now_u32 < ts_begin) {
         if (proxy_context->ignore_timestamps != 0) {
-            logger_noformat(proxy_context, LOG_WARNING,
+            logger_noformat(proxy_context, cert_log_level(quiet, LOG_WARNING),
                             "Clock might be off - "
                             "Pretending that this certificate is valid no matter what");
         } else {
-            logger_noformat(proxy_context, LOG_INFO,
+            logger_noformat(proxy_context, cert_log_level(quiet, LOG_INFO),
                             "This certificate has not been activated yet");
         }
         return -1;
     }
     if (now_u32 > ts_end) {
-        logger_noformat(proxy_context, LOG_INFO,
+        logger_noformat(proxy_context, cert_log_level(quiet, LOG_INFO),
                         "This certificate has expired");
         return -1;
     }
-    logger_noformat(proxy_context, LOG_INFO, "This certificate is valid");
+    logger_noformat(proxy_context, cert_log_level(quiet, LOG_INFO),
+                    "This certificate is valid");
     if (previous_bincert == NULL) {
         return 0;
     }
@@ -129,42 +144,47 @@ cert_parse_bincert(ProxyContext * const proxy_context,
     previous_serial = htonl(previous_serial);
 
     if (previous_version > version) {
-        logger(proxy_context, LOG_INFO, "Keeping certificate #%" PRIu32 " "
+        logger(proxy_context, cert_log_level(quiet, LOG_INFO),
+               "Keeping certificate #%" PRIu32 " "
                "which is for a more recent version than #%" PRIu32,
                previous_serial, serial);
         return -1;
     } else if (previous_version < version) {
-        logger(proxy_context, LOG_INFO, "Favoring certificate #%" PRIu32 " "
+        logger(proxy_context, cert_log_level(quiet, LOG_INFO),
+               "Favoring certificate #%" PRIu32 " "
                "which is for a more recent version than #%" PRIu32,
                serial, previous_serial);
         return 0;
     }
     if (previous_serial > serial) {
-        logger(proxy_context, LOG_INFO, "Certificate #%" PRIu32 " "
+        logger(proxy_context, cert_log_level(quiet, LOG_INFO),
+               "Certificate #%" PRIu32 " "
                "has been superseded by certificate #%" PRIu32,
                previous_serial, serial);
         return -1;
     }
-    logger(proxy_context, LOG_INFO,
+    logger(proxy_context, cert_log_level(quiet, LOG_INFO),
            "This certificate supersedes certificate #%" PRIu32,
            previous_serial);
 
     return 0;
 }
 
-static int
-cert_open_bincert(ProxyContext * const proxy_context,
-                  const SignedBincert * const signed_bincert,
-                  const size_t signed_bincert_len,
-                  Bincert ** const bincert_p)
+int
+cert_open_bincert_for_provider(ProxyContext * const proxy_context,
+                               const uint8_t provider_publickey[crypto_sign_ed25519_PUBLICKEYBYTES],
+                               const SignedBincert * const signed_bincert,
+                               const size_t signed_bincert_len,
+                               Bincert ** const bincert_p,
+                               const _Bool quiet)
 {
     Bincert            *bincert;
     unsigned long long  bincert_data_len_ul;
     size_t              bincert_size;
     size_t              signed_data_len;
 
-    if (cert_parse_version(proxy_context,
-                           signed_bincert, signed_bincert_len) != 0) {
+    if (cert_parse_version(proxy_context, signed_bincert,
+                           signed_bincert_len, quiet) != 0) {
         DNSCRYPT_PROXY_CERTS_UPDATE_ERROR_COMMUNICATION();
         return -1;
     }
@@ -182,14 +202,23 @@ cert_open_bincert(ProxyContext * const proxy_context,
     memcpy(bincert, signed_bincert, signed_bincert_len - signed_data_len);
     if (crypto_sign_ed25519_open(bincert->server_publickey, &bincert_data_len_ul,
                                  signed_bincert->signed_data, signed_data_len,
-                                 proxy_context->provider_publickey) != 0) {
+                                 provider_publickey) != 0) {
         free(bincert);
-        logger_noformat(proxy_context, LOG_ERR,
+        logger_noformat(proxy_context, cert_log_level(quiet, LOG_ERR),
                         "Suspicious certificate received");
         DNSCRYPT_PROXY_CERTS_UPDATE_ERROR_SECURITY();
         return -1;
     }
-    if (cert_parse_bincert(proxy_context, bincert, *bincert_p) != 0) {
+    if (bincert_data_len_ul < (unsigned long long)
+        (sizeof *bincert - (size_t) (bincert->server_publickey -
+                                     bincert->magic_cert))) {
+        free(bincert);
+        logger_noformat(proxy_context, cert_log_level(quiet, LOG_ERR),
+                        "Truncated certificate received");
+        DNSCRYPT_PROXY_CERTS_UPDATE_ERROR_COMMUNICATION();
+        return -1;
+    }
+    if (cert_parse_bincert(proxy_context, bincert, *bincert_p, quiet) != 0) {
         memset(bincert, 0, sizeof *bincert);
         free(bincert);
         return -1;
@@ -203,6 +232,33 @@ cert_open_bincert(ProxyContext * const proxy_context,
     return 0;
 }
 
+int
+cert_open_bincert(ProxyContext * const proxy_context,
+                  const SignedBincert * const signed_bincert,
+                  const size_t signed_bincert_len,
+                  Bincert ** const bincert_p)
+{
+    return cert_open_bincert_for_provider(proxy_context,
+                                          proxy_context->provider_publickey,
+                                          signed_bincert, signed_bincert_len,
+                                          bincert_p, 0);
+}
+
+Cipher
+cert_bincert_cipher(const Bincert * const bincert)
+{
+    switch (bincert->version_major[1]) {
+    case 1:
+        return CIPHER_XSALSA20POLY1305;
+#ifdef HAVE_XCHACHA20
+    case 2:
+        return CIPHER_XCHACHA20POLY1305;
+#endif
+    default:
+        return CIPHER_UNDEFINED;
+    }
+}
+
 static void
 cert_print_bincert_info(ProxyContext * const proxy_context,
                         const Bincert * const bincert)
@@ -268,12 +324,15 @@ cert_timer_cb(evutil_socket_t handle, const short event,
               void * const proxy_context_)
 {
     ProxyContext * const proxy_context = proxy_context_;
+    const uint64_t       started = metrics_now();
 
     (void) handle;
     (void) event;
     logger_noformat(proxy_context, LOG_INFO,
                     "Refetching server certificates");
     cert_updater_update(proxy_context);
+    metrics_callback_done(&proxy_context->metrics,
+                          METRICS_CALLBACK_CERT, started);
 }
 
 static void
@@ -364,6 +423,7 @@ cert_query_cb(int result, char type, int count, int ttl,
         logger_noformat(proxy_context, LOG_ERR,
                         "Unable to retrieve server certificates");
         cert_reschedule_query_after_failure(proxy_context);
+        failover_query_failed(proxy_context, proxy_context->failover.generation);
         DNSCRYPT_PROXY_CERTS_UPDATE_ERROR_COMMUNICATION();
         return;
     }
@@ -378,22 +438,14 @@ cert_query_cb(int result, char type, int count, int ttl,
         logger_noformat(proxy_context, LOG_ERR,
                         "No useable certificates found");
         cert_reschedule_query_after_failure(proxy_context);
+        failover_query_failed(proxy_context, proxy_context->failover.generation);
         DNSCRYPT_PROXY_CERTS_UPDATE_ERROR_NOCERTS();
         if (proxy_context->test_only) {
             exit(DNSCRYPT_EXIT_CERT_NOCERTS);
         }
         return;
     }
-    switch (bincert->version_major[1]) {
-    case 1:
-        cipher = CIPHER_XSALSA20POLY1305;
-        break;
-#ifdef HAVE_XCHACHA20
-    case 2:
-        cipher = CIPHER_XCHACHA20POLY1305;
-        break;
-#endif
-    default:
+    if ((cipher = cert_bincert_cipher(bincert)) == CIPHER_UNDEFINED) {
         logger_noformat(proxy_context, LOG_ERR,
                         "Unsupported certificate version");
         cert_reschedule_query_after_failure(proxy_context);
@@ -445,6 +497,7 @@ cert_query_cb(int result, char type, int count, int ttl,
     }
     dnscrypt_proxy_start_listeners(proxy_context);
     proxy_context->cert_updater.query_retry_step = 0U;
+    proxy_context->metrics.cert_updates++;
     cert_reschedule_query_after_success(proxy_context);
     DNSCRYPT_PROXY_CERTS_UPDATE_DONE((unsigned char *)
                                      proxy_context->resolver_publickey);
@@ -469,6 +522,18 @@ cert_updater_init(ProxyContext * const proxy_context)
     return 0;
 }
 
+static void
+cert_query_timed_cb(int result, char type, int count, int ttl,
+                    void * const txt_records_, void * const arg)
+{
+    ProxyContext   *proxy_context = arg;
+    const uint64_t  started = metrics_now();
+
+    cert_query_cb(result, type, count, ttl, txt_records_, proxy_context);
+    metrics_callback_done(&proxy_context->metrics,
+                          METRICS_CALLBACK_CERT, started);
+}
+
 static int
 cert_updater_update(ProxyContext * const proxy_context)
 {
@@ -497,7 +562,7 @@ cert_updater_update(ProxyContext * const proxy_context)
     if (evdns_base_resolve_txt(cert_updater->evdns_base,
                                proxy_context->provider_name,
                                DNS_QUERY_NO_SEARCH,
-                               cert_query_cb,
+                               cert_query_timed_cb,
                                proxy_context) == NULL) {
         return -1;
     }
@@ -523,6 +588,26 @@ cert_updater_stop(ProxyContext * const proxy_context)
     evtimer_del(cert_updater->cert_timer);
 }
 
+/*
+ * Called once the certificates of a different resolver have been
+ * installed: a query still waiting for the previous resolver is dropped,
+ * and the next update is scheduled as after a successful one.
+ */
+
+void
+cert_updater_reset(ProxyContext * const proxy_context)
+{
+    CertUpdater * const cert_updater = &proxy_context->cert_updater;
+
+    if (cert_updater->evdns_base != NULL) {
+        evdns_base_free(cert_updater->evdns_base, 0);
+        cert_updater->evdns_base = NULL;
+    }
+    evtimer_del(cert_updater->cert_timer);
+    cert_updater->query_retry_step = 0U;
+    cert_reschedule_query_after_success(proxy_context);
+}
+
 void
 cert_updater_free(ProxyContext * const proxy_context)
 {
@@ -27,6 +27,7 @@ struct ProxyContext_;
 int cert_updater_init(struct ProxyContext_ * const proxy_context);
 int cert_updater_start(struct ProxyContext_ * const proxy_context);
 void cert_updater_stop(struct ProxyContext_ * const proxy_context);
+void cert_updater_reset(struct ProxyContext_ * const proxy_context);
 void cert_updater_free(struct ProxyContext_ * const proxy_context);
 
 #endif
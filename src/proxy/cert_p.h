@@ -8,6 +8,8 @@
 
 #include <sodium.h>
 
+#include "dnscrypt_client.h"
+
 #define CERT_MAGIC_CERT "DNSC"
 
 typedef struct Bincert_ {
@@ -31,4 +33,19 @@ typedef struct SignedBincert_ {
     uint8_t signed_data[];
 } SignedBincert;
 
+struct ProxyContext_;
+int cert_open_bincert(struct ProxyContext_ * const proxy_context,
+                      const SignedBincert * const signed_bincert,
+                      const size_t signed_bincert_len,
+                      Bincert ** const bincert_p);
+
+int cert_open_bincert_for_provider(struct ProxyContext_ * const proxy_context,
+                                   const uint8_t provider_publickey[crypto_sign_ed25519_PUBLICKEYBYTES],
+                                   const SignedBincert * const signed_bincert,
+                                   const size_t signed_bincert_len,
+                                   Bincert ** const bincert_p,
+                                   const _Bool quiet);
+
+Cipher cert_bincert_cipher(const Bincert * const bincert);
+
 #endif
@@ -0,0 +1,81 @@
+
+#include <config.h>
+#include <sys/types.h>
+#ifdef _WIN32
+# include <winsock2.h>
+# include <ws2tcpip.h>
+#else
+# include <sys/socket.h>
+# include <netinet/in.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include <sodium.h>
+
+#include "client_prefix.h"
+
+static size_t
+client_prefix_mask(uint8_t * const addr, const size_t addr_len,
+                   unsigned int prefix)
+{
+    size_t i;
+
+    if (prefix > addr_len * 8U) {
+        prefix = (unsigned int) addr_len * 8U;
+    }
+    i = prefix / 8U;
+    if ((prefix & 7U) != 0U) {
+        addr[i] &= (uint8_t) (0xff << (8U - (prefix & 7U)));
+        i++;
+    }
+    memset(addr + i, 0, addr_len - i);
+
+    return addr_len;
+}
+
+uint64_t
+client_prefix_hash(const uint8_t key[CLIENT_PREFIX_KEYBYTES],
+                   const struct sockaddr_storage * const sa,
+                   const unsigned int ipv4_prefix,
+                   const unsigned int ipv6_prefix)
+{
+    static const uint8_t v4_mapped[12] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff
+    };
+    uint8_t  prefix[1U + 16U];
+    uint8_t  hash[crypto_shorthash_BYTES];
+    uint64_t h;
+    size_t   prefix_len;
+
+    memset(prefix, 0, sizeof prefix);
+    if (sa->ss_family == AF_INET6) {
+        const struct sockaddr_in6 * const sin6 =
+            (const struct sockaddr_in6 *) (const void *) sa;
+        const uint8_t * const addr = sin6->sin6_addr.s6_addr;
+
+        if (memcmp(addr, v4_mapped, sizeof v4_mapped) == 0) {
+            prefix[0] = 4U;
+            memcpy(&prefix[1], addr + sizeof v4_mapped, 4U);
+            prefix_len = 1U + client_prefix_mask(&prefix[1], 4U, ipv4_prefix);
+        } else {
+            prefix[0] = 6U;
+            memcpy(&prefix[1], addr, 16U);
+            prefix_len = 1U + client_prefix_mask(&prefix[1], 16U, ipv6_prefix);
+        }
+    } else if (sa->ss_family == AF_INET) {
+        const struct sockaddr_in * const sin =
+            (const struct sockaddr_in *) (const void *) sa;
+
+        prefix[0] = 4U;
+        memcpy(&prefix[1], &sin->sin_addr.s_addr, 4U);
+        prefix_len = 1U + client_prefix_mask(&prefix[1], 4U, ipv4_prefix);
+    } else {
+        prefix_len = 1U;
+    }
+    crypto_shorthash(hash, prefix, (unsigned long long) prefix_len, key);
+    memcpy(&h, hash, sizeof h);
+
+    return h;
+}
@@ -0,0 +1,29 @@
+
+#ifndef __CLIENT_PREFIX_H__
+#define __CLIENT_PREFIX_H__ 1
+
+#include <sys/types.h>
+#ifdef _WIN32
+# include <winsock2.h>
+#else
+# include <sys/socket.h>
+#endif
+
+#include <stdint.h>
+
+#include <sodium.h>
+
+#define CLIENT_PREFIX_KEYBYTES crypto_shorthash_KEYBYTES
+
+/*
+ * Keyed hash of the network a client address belongs to: the address
+ * truncated to ipv4_prefix or ipv6_prefix bits. IPv4-mapped IPv6
+ * addresses are considered as IPv4 addresses.
+ */
+
+uint64_t client_prefix_hash(const uint8_t key[CLIENT_PREFIX_KEYBYTES],
+                            const struct sockaddr_storage * const sa,
+                            const unsigned int ipv4_prefix,
+                            const unsigned int ipv6_prefix);
+
+#endif
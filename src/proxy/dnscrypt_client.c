@@ -52,10 +52,15 @@ dnscrypt_make_client_nonce(DNSCryptClient * const client,
 // 12 bytes: a client-selected nonce for this packet (crypto_box_NONCEBYTES / 2)
 // 16 bytes: Poly1305 MAC (crypto_box_MACBYTES)
 
+/*
+ * Same as dnscrypt_client_curve(), for a query that has already been
+ * stored DNSCRYPT_QUERY_BOX_OFFSET bytes after the beginning of buf.
+ */
+
 ssize_t
-dnscrypt_client_curve(DNSCryptClient * const client,
-                      uint8_t client_nonce[crypto_box_HALF_NONCEBYTES],
-                      uint8_t *buf, size_t len, const size_t max_len)
+dnscrypt_client_curve_in_place(DNSCryptClient * const client,
+                               uint8_t client_nonce[crypto_box_HALF_NONCEBYTES],
+                               uint8_t *buf, size_t len, const size_t max_len)
 {
     uint8_t  eph_publickey[crypto_box_PUBLICKEYBYTES];
     uint8_t  eph_secretkey[crypto_box_SECRETKEYBYTES];
@@ -69,10 +74,8 @@ dnscrypt_client_curve(DNSCryptClient * const client,
         return (ssize_t) -1;
     }
     assert(max_len > dnscrypt_query_header_size());
-    boxed = buf + sizeof client->magic_query
-        + crypto_box_PUBLICKEYBYTES + crypto_box_HALF_NONCEBYTES;
+    boxed = buf + DNSCRYPT_QUERY_BOX_OFFSET;
     assert((boxed - buf) + crypto_box_MACBYTES <= dnscrypt_query_header_size());
-    memmove(boxed, buf, len);
     len = dnscrypt_pad(boxed, len, max_len - dnscrypt_query_header_size());
     dnscrypt_make_client_nonce(client, nonce);
     memcpy(client_nonce, nonce, crypto_box_HALF_NONCEBYTES);
@@ -124,6 +127,20 @@ dnscrypt_client_curve(DNSCryptClient * const client,
     return (ssize_t) (len + dnscrypt_query_header_size());
 }
 
+ssize_t
+dnscrypt_client_curve(DNSCryptClient * const client,
+                      uint8_t client_nonce[crypto_box_HALF_NONCEBYTES],
+                      uint8_t *buf, size_t len, const size_t max_len)
+{
+    if (max_len < len || max_len - len < dnscrypt_query_header_size()) {
+        return (ssize_t) -1;
+    }
+    memmove(buf + DNSCRYPT_QUERY_BOX_OFFSET, buf, len);
+
+    return dnscrypt_client_curve_in_place(client, client_nonce,
+                                          buf, len, max_len);
+}
+
 //  8 bytes: the string r6fnvWJ8 (DNSCRYPT_MAGIC_RESPONSE)
 // 12 bytes: the client's nonce (crypto_box_NONCEBYTES / 2)
 // 12 bytes: a server-selected nonce extension (crypto_box_NONCEBYTES / 2)
@@ -24,10 +24,19 @@ typedef struct DNSCryptClient_ {
     _Bool    ephemeral_keys;
 } DNSCryptClient;
 
+#define DNSCRYPT_QUERY_BOX_OFFSET \
+    (DNSCRYPT_MAGIC_QUERY_LEN + crypto_box_PUBLICKEYBYTES + \
+     crypto_box_HALF_NONCEBYTES)
+
 ssize_t dnscrypt_client_curve(DNSCryptClient * const client,
                               uint8_t client_nonce[crypto_box_HALF_NONCEBYTES],
                               uint8_t *buf, size_t len, const size_t max_len);
 
+ssize_t dnscrypt_client_curve_in_place(DNSCryptClient * const client,
+                                       uint8_t client_nonce[crypto_box_HALF_NONCEBYTES],
+                                       uint8_t *buf, size_t len,
+                                       const size_t max_len);
+
 int dnscrypt_client_uncurve(const DNSCryptClient * const client,
                             const uint8_t client_nonce[crypto_box_HALF_NONCEBYTES],
                             uint8_t * const buf, size_t * const lenp);
@@ -12,15 +12,24 @@
 #include <event2/listener.h>
 #include <sodium.h>
 
+#include "admission.h"
 #include "app.h"
 #include "cert.h"
 #include "dnscrypt_client.h"
+#include "failover.h"
+#include "forwarding.h"
+#include "metrics.h"
 #include "queue.h"
+#include "rrl.h"
 
 #ifndef DNS_QUERY_TIMEOUT
 # define DNS_QUERY_TIMEOUT 10
 #endif
 
+#ifndef TCP_IDLE_TIMEOUT
+# define TCP_IDLE_TIMEOUT 10
+#endif
+
 #define DNS_MAX_PACKET_SIZE_UDP_RECV (65536U - 20U - 8U)
 #define DNS_MAX_PACKET_SIZE_UDP_NO_EDNS_SEND 512U
 
@@ -48,6 +57,11 @@
 # endif
 #endif
 
+#ifndef DEFAULT_RESOLVERS_LIST_PUBKEY
+# define DEFAULT_RESOLVERS_LIST_PUBKEY \
+    "RWQf6LRCGA9i53mlYecO4IzT51TGPpvWucNSCh1CBM0QTaLn73Y7GFO3"
+#endif
+
 #ifndef DEFAULT_RESOLVER_NAME
 # define DEFAULT_RESOLVER_NAME NULL
 #endif
@@ -81,30 +95,44 @@
 #define DNSCRYPT_EXIT_CERT_MARGIN  4
 
 typedef TAILQ_HEAD(TCPRequestQueue_, TCPRequest_) TCPRequestQueue;
+typedef TAILQ_HEAD(TCPSessionQueue_, TCPSession_) TCPSessionQueue;
 typedef TAILQ_HEAD(UDPRequestQueue_, UDPRequest_) UDPRequestQueue;
 
 typedef struct ProxyContext_ {
     uint8_t                  dnscrypt_magic_query[DNSCRYPT_MAGIC_QUERY_LEN];
     uint8_t                  provider_publickey[crypto_sign_ed25519_PUBLICKEYBYTES];
     uint8_t                  resolver_publickey[crypto_box_PUBLICKEYBYTES];
+    Admission                admission;
     DNSCryptClient           dnscrypt_client;
     CertUpdater              cert_updater;
+    Failover                 failover;
+    Forwarding               forwarding;
+    Metrics                  metrics;
+    RRL                      rrl;
     struct sockaddr_storage  local_sockaddr;
     struct sockaddr_storage  resolver_sockaddr;
+    struct sockaddr_storage  metrics_sockaddr;
     TCPRequestQueue          tcp_request_queue;
+    TCPSessionQueue          tcp_session_queue;
     UDPRequestQueue          udp_request_queue;
     AppContext              *app_context;
     struct event_base       *event_loop;
     FILE                    *log_fp;
+    FILE                    *slow_query_log_fp;
     const char              *client_key_file;
+    const char              *forwarding_rules;
     const char              *local_ip;
     const char              *log_file;
+    const char              *metrics_address;
     const char              *pid_file;
     const char              *provider_name;
     const char              *provider_publickey_s;
     const char              *resolvers_list;
+    const char              *resolvers_list_pubkey;
     const char              *resolver_name;
     const char              *resolver_ip;
+    const char              *slow_query_log_file;
+    const char              *standby_resolvers;
     const char              *syslog_prefix;
 #ifndef _WIN32
     char                    *user_dir;
@@ -116,6 +144,7 @@ typedef struct ProxyContext_ {
     struct event            *udp_proxy_resolver_event;
     ev_socklen_t             local_sockaddr_len;
     ev_socklen_t             resolver_sockaddr_len;
+    ev_socklen_t             metrics_sockaddr_len;
     size_t                   edns_payload_size;
     size_t                   udp_current_max_size;
     size_t                   udp_max_size;
@@ -126,15 +155,26 @@ typedef struct ProxyContext_ {
     uid_t                    user_id;
     gid_t                    user_group;
 #endif
+    time_t                   tcp_idle_timeout;
     time_t                   test_cert_margin;
+    uint64_t                 last_request_id;
+    uint64_t                 slow_query_threshold;
     unsigned int             connections_count;
     unsigned int             connections_count_max;
+    unsigned int             overload_delay_target;
+    unsigned int             rate_limit;
+    unsigned int             rate_limit_ipv4_prefix;
+    unsigned int             rate_limit_ipv6_prefix;
+    RRLAction                rate_limit_action;
+    unsigned int             tcp_sessions_count;
     int                      max_log_level;
+    _Bool                    compile_resolvers_list;
     _Bool                    daemonize;
     _Bool                    ephemeral_keys;
     _Bool                    ignore_timestamps;
     _Bool                    listeners_started;
     _Bool                    syslog;
+    _Bool                    tcp_fast_open;
     _Bool                    tcp_only;
     _Bool                    test_only;
 } ProxyContext;
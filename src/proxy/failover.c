@@ -0,0 +1,372 @@
+
+#include <config.h>
+#include <sys/types.h>
+#ifdef _WIN32
+# include <winsock2.h>
+#else
+# include <sys/socket.h>
+#endif
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <event2/event.h>
+#include <event2/util.h>
+
+#include <sodium.h>
+
+#include "cert.h"
+#include "dnscrypt_client.h"
+#include "dnscrypt_proxy.h"
+#include "failover.h"
+#include "logger.h"
+#include "resolver_probe.h"
+#include "resolvers_db.h"
+#include "utils.h"
+
+/*
+ * Adds a resolver to the list, after the ones that were already added.
+ * The first resolver is the one the proxy starts with. A resolver that
+ * is already in the list is ignored.
+ */
+
+int
+failover_add_resolver(ProxyContext * const proxy_context,
+                      const ResolversDBEntry * const entry)
+{
+    Failover * const  failover = &proxy_context->failover;
+    FailoverResolver *resolver;
+    FailoverResolver *resolvers;
+    size_t            i;
+
+    for (i = (size_t) 0U; i < failover->resolvers_count; i++) {
+        if (evutil_ascii_strcasecmp
+            (failover->resolvers[i].probe.fields[RESOLVERS_DB_FIELD_NAME],
+             entry->fields[RESOLVERS_DB_FIELD_NAME]) == 0) {
+            return 0;
+        }
+    }
+    if ((resolvers = realloc(failover->resolvers,
+                             (failover->resolvers_count + 1U) *
+                             sizeof *resolvers)) == NULL) {
+        return -1;
+    }
+    failover->resolvers = resolvers;
+    resolver = &resolvers[failover->resolvers_count];
+    memset(resolver, 0, sizeof *resolver);
+    if (resolver_probe_init(&resolver->probe, entry) != 0) {
+        return -1;
+    }
+    resolver->healthy = failover->resolvers_count == (size_t) 0U;
+    failover->resolvers_count++;
+
+    return 0;
+}
+
+static const char *
+failover_resolver_name(const FailoverResolver * const resolver)
+{
+    return resolver->probe.fields[RESOLVERS_DB_FIELD_NAME];
+}
+
+static void
+failover_replace_string(const char ** const str_p, const char * const str)
+{
+    char *copy;
+
+    if ((copy = strdup(str)) == NULL) {
+        logger_noformat(NULL, LOG_EMERG, "Out of memory");
+        exit(1);
+    }
+    free((void *) *str_p);
+    *str_p = copy;
+}
+
+/*
+ * Makes the proxy use another resolver, with the certificate that the
+ * last check of this resolver received. Queries that are still waiting
+ * for a reply from the previous resolver will time out.
+ */
+
+static void
+failover_switch(ProxyContext * const proxy_context, const size_t idx)
+{
+    Failover         * const failover = &proxy_context->failover;
+    FailoverResolver * const from = &failover->resolvers[failover->active];
+    FailoverResolver * const to = &failover->resolvers[idx];
+    ResolverProbe    * const probe = &to->probe;
+
+    assert(idx != failover->active && to->has_cert != 0);
+    logger(proxy_context, LOG_NOTICE, "Switching from [%s] to [%s]",
+           failover_resolver_name(from), failover_resolver_name(to));
+    failover_replace_string(&proxy_context->provider_name,
+                            probe->fields[RESOLVERS_DB_FIELD_PROVIDER_NAME]);
+    failover_replace_string(&proxy_context->provider_publickey_s,
+                            probe->fields[RESOLVERS_DB_FIELD_PROVIDER_PUBLICKEY]);
+    failover_replace_string(&proxy_context->resolver_ip,
+                            probe->fields[RESOLVERS_DB_FIELD_RESOLVER_ADDRESS]);
+    memcpy(proxy_context->provider_publickey, probe->provider_publickey,
+           sizeof proxy_context->provider_publickey);
+    assert(probe->resolver_sockaddr_len <=
+           (ev_socklen_t) sizeof proxy_context->resolver_sockaddr);
+    memcpy(&proxy_context->resolver_sockaddr, &probe->resolver_sockaddr,
+           (size_t) probe->resolver_sockaddr_len);
+    proxy_context->resolver_sockaddr_len = probe->resolver_sockaddr_len;
+    COMPILER_ASSERT(sizeof proxy_context->resolver_publickey ==
+                    sizeof to->resolver_publickey);
+    memcpy(proxy_context->resolver_publickey, to->resolver_publickey,
+           sizeof proxy_context->resolver_publickey);
+    COMPILER_ASSERT(sizeof proxy_context->dnscrypt_magic_query ==
+                    sizeof to->magic_query);
+    memcpy(proxy_context->dnscrypt_magic_query, to->magic_query,
+           sizeof proxy_context->dnscrypt_magic_query);
+    dnscrypt_client_init_magic_query(&proxy_context->dnscrypt_client,
+                                     to->magic_query, to->cipher);
+    if (dnscrypt_client_init_resolver_publickey
+        (&proxy_context->dnscrypt_client, proxy_context->resolver_publickey) != 0) {
+        logger_noformat(proxy_context, LOG_ERR, "Suspicious public key");
+        exit(DNSCRYPT_EXIT_CERT_NOCERTS);
+    }
+    proxy_context->udp_current_max_size = DNS_MAX_PACKET_SIZE_UDP_NO_EDNS_SEND;
+    failover->active = idx;
+    failover->generation++;
+    failover->query_failures = 0U;
+    proxy_context->metrics.failovers++;
+    cert_updater_reset(proxy_context);
+    dnscrypt_proxy_start_listeners(proxy_context);
+}
+
+/*
+ * Uses the first healthy resolver. If none of them are, the current one
+ * is kept.
+ */
+
+static void
+failover_select(ProxyContext * const proxy_context)
+{
+    Failover * const  failover = &proxy_context->failover;
+    FailoverResolver *resolver;
+    size_t            i;
+
+    for (i = (size_t) 0U; i < failover->resolvers_count; i++) {
+        resolver = &failover->resolvers[i];
+        if (i == failover->active) {
+            if (resolver->healthy != 0) {
+                return;
+            }
+        } else if (resolver->healthy != 0 && resolver->has_cert != 0) {
+            failover_switch(proxy_context, i);
+            return;
+        }
+    }
+}
+
+static void
+failover_check_cb(ResolverProbe * const probe, void * const proxy_context_)
+{
+    ProxyContext     * const proxy_context = proxy_context_;
+    Failover         * const failover = &proxy_context->failover;
+    FailoverResolver * const resolver = (FailoverResolver *) (void *) probe;
+    const _Bool              is_active =
+        (size_t) (resolver - failover->resolvers) == failover->active;
+
+    if (probe->state == RESOLVER_PROBE_STATE_FAILED) {
+        if (resolver->healthy != 0) {
+            logger(proxy_context, is_active ? LOG_WARNING : LOG_INFO,
+                   "[%s] failed a health check: %s",
+                   failover_resolver_name(resolver), probe->error);
+        }
+        resolver->failed_checks++;
+        resolver->has_cert = 0;
+        if (is_active == 0 || failover->query_failures > 0U ||
+            proxy_context->listeners_started == 0 ||
+            resolver->failed_checks >= FAILOVER_MAX_FAILED_CHECKS) {
+            resolver->healthy = 0;
+        }
+        failover_select(proxy_context);
+        return;
+    }
+    assert(probe->state == RESOLVER_PROBE_STATE_DONE);
+    COMPILER_ASSERT(sizeof resolver->magic_query ==
+                    sizeof probe->client.magic_query);
+    memcpy(resolver->magic_query, probe->client.magic_query,
+           sizeof resolver->magic_query);
+    memcpy(resolver->resolver_publickey, probe->resolver_publickey,
+           sizeof resolver->resolver_publickey);
+    resolver->cipher = probe->client.cipher;
+    if (resolver->healthy == 0) {
+        logger(proxy_context, LOG_INFO, "[%s] is healthy (%.1f ms)",
+               failover_resolver_name(resolver),
+               (double) probe->score / 1000.0);
+    }
+    resolver->failed_checks = 0U;
+    resolver->has_cert = 1;
+    resolver->healthy = 1;
+    failover_select(proxy_context);
+}
+
+static void
+failover_check(ProxyContext * const proxy_context, const size_t idx)
+{
+    ResolverProbe * const probe = &proxy_context->failover.resolvers[idx].probe;
+
+    if (probe->state == RESOLVER_PROBE_STATE_CERT ||
+        probe->state == RESOLVER_PROBE_STATE_QUERY) {
+        return;
+    }
+    if (resolver_probe_start(probe, proxy_context, proxy_context->event_loop,
+                             failover_check_cb, proxy_context) != 0) {
+        failover_check_cb(probe, proxy_context);
+    }
+}
+
+static void
+failover_check_timer_cb(evutil_socket_t handle, const short event,
+                        void * const proxy_context_)
+{
+    ProxyContext * const proxy_context = proxy_context_;
+    size_t               i;
+
+    (void) handle;
+    (void) event;
+    for (i = (size_t) 0U; i < proxy_context->failover.resolvers_count; i++) {
+        failover_check(proxy_context, i);
+    }
+}
+
+/*
+ * The socket used to send queries to resolvers over UDP is created for
+ * the address family of the primary resolver: standby resolvers have to
+ * use the same one.
+ */
+
+static void
+failover_remove_unusable_resolvers(ProxyContext * const proxy_context)
+{
+    struct sockaddr_storage  resolver_sockaddr;
+    Failover * const         failover = &proxy_context->failover;
+    FailoverResolver        *resolver;
+    ev_socklen_t             resolver_sockaddr_len;
+    size_t                   i = (size_t) 1U;
+
+    while (i < failover->resolvers_count) {
+        resolver = &failover->resolvers[i];
+        if (sockaddr_from_ip_and_port(&resolver_sockaddr,
+                                      &resolver_sockaddr_len,
+                                      resolver->probe.fields
+                                      [RESOLVERS_DB_FIELD_RESOLVER_ADDRESS],
+                                      DNS_DEFAULT_RESOLVER_PORT,
+                                      "Unsupported resolver address") == 0 &&
+            resolver_sockaddr.ss_family ==
+            proxy_context->resolver_sockaddr.ss_family) {
+            i++;
+            continue;
+        }
+        logger(proxy_context, LOG_WARNING,
+               "Standby resolver [%s] can't be reached from the socket "
+               "used for [%s] - ignoring it",
+               failover_resolver_name(resolver),
+               failover_resolver_name(&failover->resolvers[0]));
+        resolver_probe_free(&resolver->probe);
+        memmove(resolver, resolver + 1U,
+                (failover->resolvers_count - i - 1U) * sizeof *resolver);
+        failover->resolvers_count--;
+    }
+}
+
+int
+failover_start(ProxyContext * const proxy_context)
+{
+    Failover * const     failover = &proxy_context->failover;
+    const struct timeval tv = {
+        .tv_sec = (time_t) FAILOVER_CHECK_INTERVAL, .tv_usec = 0
+    };
+
+    if (proxy_context->test_only != 0) {
+        return 0;
+    }
+    failover_remove_unusable_resolvers(proxy_context);
+    if (failover->resolvers_count < (size_t) 2U) {
+        return 0;
+    }
+    assert(failover->check_timer == NULL);
+    if ((failover->check_timer =
+         event_new(proxy_context->event_loop, -1, EV_PERSIST,
+                   failover_check_timer_cb, proxy_context)) == NULL ||
+        event_add(failover->check_timer, &tv) != 0) {
+        return -1;
+    }
+    logger(proxy_context, LOG_INFO,
+           "%lu standby resolvers will be used if [%s] fails",
+           (unsigned long) (failover->resolvers_count - 1U),
+           failover_resolver_name(&failover->resolvers[0]));
+    failover_check_timer_cb(-1, 0, proxy_context);
+
+    return 0;
+}
+
+void
+failover_free(ProxyContext * const proxy_context)
+{
+    Failover * const failover = &proxy_context->failover;
+
+    if (failover->check_timer != NULL) {
+        event_free(failover->check_timer);
+        failover->check_timer = NULL;
+    }
+    while (failover->resolvers_count > (size_t) 0U) {
+        failover->resolvers_count--;
+        resolver_probe_stop(&failover->resolvers
+                            [failover->resolvers_count].probe);
+        resolver_probe_free(&failover->resolvers
+                            [failover->resolvers_count].probe);
+    }
+    free(failover->resolvers);
+    failover->resolvers = NULL;
+}
+
+/*
+ * Called when a query sent to the resolver in use, while generation was
+ * current, timed out or received a reply that couldn't be decrypted.
+ */
+
+void
+failover_query_failed(ProxyContext * const proxy_context,
+                      const unsigned int generation)
+{
+    Failover * const  failover = &proxy_context->failover;
+    FailoverResolver *resolver;
+
+    if (failover->check_timer == NULL || generation != failover->generation) {
+        return;
+    }
+    resolver = &failover->resolvers[failover->active];
+    if (++failover->query_failures < FAILOVER_MAX_QUERY_FAILURES) {
+        if (failover->query_failures == 1U) {
+            failover_check(proxy_context, failover->active);
+        }
+        return;
+    }
+    if (resolver->healthy != 0) {
+        logger(proxy_context, LOG_WARNING,
+               "[%s] didn't properly reply to the last %u queries",
+               failover_resolver_name(resolver), failover->query_failures);
+        resolver->healthy = 0;
+    }
+    failover_select(proxy_context);
+}
+
+void
+failover_query_succeeded(ProxyContext * const proxy_context,
+                         const unsigned int generation)
+{
+    Failover * const failover = &proxy_context->failover;
+
+    if (failover->check_timer == NULL || generation != failover->generation) {
+        return;
+    }
+    failover->query_failures = 0U;
+    failover->resolvers[failover->active].healthy = 1;
+}
@@ -0,0 +1,85 @@
+
+#ifndef __FAILOVER_H__
+#define __FAILOVER_H__ 1
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <event2/event.h>
+
+#include <sodium.h>
+
+#include "dnscrypt.h"
+#include "dnscrypt_client.h"
+#include "resolver_probe.h"
+#include "resolvers_db.h"
+
+/*
+ * Switches to a standby resolver when the one in use stops working.
+ *
+ * Every resolver, including the one in use, is checked periodically with
+ * a probe, which also keeps the certificates of the standby resolvers
+ * fresh, so that switching to one of them doesn't require fetching them.
+ *
+ * Queries that time out and replies that can't be decrypted are reported
+ * as well. The first one triggers an immediate check of the resolver in
+ * use; after FAILOVER_MAX_QUERY_FAILURES of them in a row, the resolver
+ * is considered down without waiting for the check to complete. Failures
+ * of queries that were sent to a previous resolver are ignored.
+ *
+ * A single failed check is not enough to leave the resolver in use, unless
+ * queries failed as well, or the proxy is still waiting for its first
+ * certificate: it takes FAILOVER_MAX_FAILED_CHECKS in a row. Failures to
+ * update the certificates count as failed queries.
+ *
+ * Resolvers are kept in order of preference, the primary resolver first:
+ * the first healthy one is always used.
+ */
+
+#ifndef FAILOVER_CHECK_INTERVAL
+# define FAILOVER_CHECK_INTERVAL 30
+#endif
+#ifndef FAILOVER_MAX_QUERY_FAILURES
+# define FAILOVER_MAX_QUERY_FAILURES 3U
+#endif
+#ifndef FAILOVER_MAX_FAILED_CHECKS
+# define FAILOVER_MAX_FAILED_CHECKS 2U
+#endif
+
+typedef struct FailoverResolver_ {
+    ResolverProbe probe;
+    uint8_t       magic_query[DNSCRYPT_MAGIC_QUERY_LEN];
+    uint8_t       resolver_publickey[crypto_box_PUBLICKEYBYTES];
+    Cipher        cipher;
+    unsigned int  failed_checks;
+    _Bool         has_cert;
+    _Bool         healthy;
+} FailoverResolver;
+
+typedef struct Failover_ {
+    FailoverResolver *resolvers;
+    struct event     *check_timer;
+    size_t            resolvers_count;
+    size_t            active;
+    unsigned int      generation;
+    unsigned int      query_failures;
+} Failover;
+
+struct ProxyContext_;
+
+int failover_add_resolver(struct ProxyContext_ * const proxy_context,
+                          const ResolversDBEntry * const entry);
+
+int failover_start(struct ProxyContext_ * const proxy_context);
+
+void failover_free(struct ProxyContext_ * const proxy_context);
+
+void failover_query_failed(struct ProxyContext_ * const proxy_context,
+                           const unsigned int generation);
+
+void failover_query_succeeded(struct ProxyContext_ * const proxy_context,
+                              const unsigned int generation);
+
+#endif
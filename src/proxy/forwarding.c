@@ -0,0 +1,488 @@
+
+#include <config.h>
+#include <sys/types.h>
+#ifdef _WIN32
+# include <winsock2.h>
+#else
+# include <sys/socket.h>
+#endif
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <event2/event.h>
+#include <event2/util.h>
+
+#include <sodium.h>
+
+#include "cert.h"
+#include "dnscrypt_client.h"
+#include "dnscrypt_proxy.h"
+#include "forwarding.h"
+#include "fpst.h"
+#include "logger.h"
+#include "resolver_probe.h"
+#include "resolvers_db.h"
+#include "utils.h"
+
+static inline char
+forwarding_tolower(const char c)
+{
+    if (c >= 'A' && c <= 'Z') {
+        return (char) (c - 'A' + 'a');
+    }
+    return c;
+}
+
+/*
+ * Turns the name of a domain into the key of its rule: "Corp.Example."
+ * becomes "example.corp.". Returns NULL if the name is not valid; the
+ * root domain is not accepted.
+ */
+
+static char *
+forwarding_domain_key(const char * const domain)
+{
+    const char *labels[FORWARDING_MAX_LABELS];
+    size_t      labels_len[FORWARDING_MAX_LABELS];
+    const char *label = domain;
+    const char *sep;
+    char       *key;
+    size_t      j;
+    size_t      key_len = (size_t) 0U;
+    size_t      label_len;
+    size_t      labels_count = (size_t) 0U;
+
+    for (;;) {
+        if ((sep = strchr(label, '.')) == NULL) {
+            label_len = strlen(label);
+        } else {
+            label_len = (size_t) (sep - label);
+        }
+        if (label_len <= (size_t) 0U) {
+            if (sep == NULL && labels_count > (size_t) 0U) {
+                break;
+            }
+            return NULL;
+        }
+        if (label_len > (size_t) 63U || labels_count >= FORWARDING_MAX_LABELS) {
+            return NULL;
+        }
+        labels[labels_count] = label;
+        labels_len[labels_count++] = label_len;
+        key_len += label_len + 1U;
+        if (sep == NULL) {
+            break;
+        }
+        label = sep + 1;
+    }
+    if (key_len >= FORWARDING_KEY_MAX_LEN || (key = malloc(key_len + 1U)) == NULL) {
+        return NULL;
+    }
+    key_len = (size_t) 0U;
+    while (labels_count > (size_t) 0U) {
+        labels_count--;
+        for (j = (size_t) 0U; j < labels_len[labels_count]; j++) {
+            key[key_len++] = forwarding_tolower(labels[labels_count][j]);
+        }
+        key[key_len++] = '.';
+    }
+    key[key_len] = 0;
+
+    return key;
+}
+
+/*
+ * Builds the key of the name in the question of a DNS packet, the same
+ * way forwarding_domain_key() does for rules. Names with more than one
+ * question, compressed names, and names with dots or NUL characters in
+ * labels are rejected. Returns the length of the key, and stores the
+ * offset right after the question in *question_end_p.
+ */
+
+static ssize_t
+forwarding_question_key(char key[FORWARDING_KEY_MAX_LEN + 1U],
+                        const uint8_t * const dns_packet,
+                        const size_t dns_packet_len,
+                        size_t * const question_end_p)
+{
+    size_t labels_pos[FORWARDING_MAX_LABELS];
+    size_t i = DNS_OFFSET_QUESTION;
+    size_t j;
+    size_t key_len = (size_t) 0U;
+    size_t label_len;
+    size_t labels_count = (size_t) 0U;
+    int    c;
+
+    if (dns_packet_len <= DNS_HEADER_SIZE ||
+        dns_packet[DNS_OFFSET_QDCOUNT] != 0U ||
+        dns_packet[DNS_OFFSET_QDCOUNT + 1U] != 1U) {
+        return (ssize_t) -1;
+    }
+    while ((label_len = (size_t) dns_packet[i]) != 0U) {
+        if (label_len > (size_t) 63U || labels_count >= FORWARDING_MAX_LABELS ||
+            dns_packet_len - i <= label_len + 1U) {
+            return (ssize_t) -1;
+        }
+        labels_pos[labels_count++] = i;
+        key_len += label_len + 1U;
+        i += label_len + 1U;
+    }
+    if (key_len >= FORWARDING_KEY_MAX_LEN || dns_packet_len - i < 5U) {
+        return (ssize_t) -1;
+    }
+    *question_end_p = i + 5U;
+    key_len = (size_t) 0U;
+    while (labels_count > (size_t) 0U) {
+        i = labels_pos[--labels_count];
+        label_len = (size_t) dns_packet[i++];
+        for (j = (size_t) 0U; j < label_len; j++) {
+            c = dns_packet[i + j];
+            if (c == 0 || c == '.') {
+                return (ssize_t) -1;
+            }
+            key[key_len++] = forwarding_tolower((char) c);
+        }
+        key[key_len++] = '.';
+    }
+    key[key_len] = 0;
+
+    return (ssize_t) key_len;
+}
+
+/*
+ * Returns the target of the rule for the longest suffix of the name in
+ * the question, or NULL if no rules match. fpst only finds the longest
+ * key that is a prefix of a string if no other key diverges from the
+ * string at a later position, so every label boundary is looked up as
+ * an exact key, starting with the whole name.
+ */
+
+ForwardingTarget *
+forwarding_target_for_query(const Forwarding * const forwarding,
+                            const uint8_t * const dns_query,
+                            const size_t dns_query_len)
+{
+    char     key[FORWARDING_KEY_MAX_LEN + 1U];
+    uint64_t target_idx;
+    size_t   key_len;
+    size_t   question_end;
+    ssize_t  ret;
+
+    if (forwarding->rules == NULL ||
+        (ret = forwarding_question_key(key, dns_query, dns_query_len,
+                                       &question_end)) <= 0) {
+        return NULL;
+    }
+    key_len = (size_t) ret;
+    do {
+        if (fpst_has_key(forwarding->rules, key, key_len, &target_idx) != 0) {
+            assert(target_idx < forwarding->targets_count);
+            return &forwarding->targets[target_idx];
+        }
+        do {
+            key_len--;
+        } while (key_len > (size_t) 0U && key[key_len - 1U] != '.');
+        key[key_len] = 0;
+    } while (key_len > (size_t) 0U);
+
+    return NULL;
+}
+
+/*
+ * Hashes the question of a DNS packet, so that replies from plain DNS
+ * resolvers can be checked against the query they are supposed to
+ * answer without keeping a copy of it. The case of the name doesn't
+ * matter.
+ */
+
+int
+forwarding_question_hash(const Forwarding * const forwarding,
+                         const uint8_t * const dns_packet,
+                         const size_t dns_packet_len,
+                         uint64_t * const hash_p)
+{
+    unsigned char hash[crypto_shorthash_BYTES];
+    char          question[FORWARDING_KEY_MAX_LEN + 1U + 4U];
+    size_t        question_end;
+    ssize_t       key_len;
+
+    COMPILER_ASSERT(sizeof hash == sizeof *hash_p);
+    if ((key_len = forwarding_question_key(question, dns_packet,
+                                           dns_packet_len,
+                                           &question_end)) < 0) {
+        return -1;
+    }
+    memcpy(question + key_len, dns_packet + question_end - 4U, 4U);
+    crypto_shorthash(hash, (const unsigned char *) question,
+                     (unsigned long long) key_len + 4U,
+                     forwarding->question_key);
+    memcpy(hash_p, hash, sizeof *hash_p);
+
+    return 0;
+}
+
+static int
+forwarding_add_target(ProxyContext * const proxy_context,
+                      const char * const target_name,
+                      const ResolversDBEntry * const entry)
+{
+    Forwarding * const forwarding = &proxy_context->forwarding;
+    ForwardingTarget  *target;
+    ForwardingTarget  *targets;
+
+    if ((targets = realloc(forwarding->targets,
+                           (forwarding->targets_count + 1U) *
+                           sizeof *targets)) == NULL) {
+        return -1;
+    }
+    forwarding->targets = targets;
+    target = &targets[forwarding->targets_count];
+    memset(target, 0, sizeof *target);
+    target->udp_resolver_handle = (evutil_socket_t) -1;
+    target->udp_current_max_size = DNS_MAX_PACKET_SIZE_UDP_NO_EDNS_SEND;
+    if (entry == NULL) {
+        target->type = FORWARDING_TARGET_PLAIN;
+        if (sockaddr_from_ip_and_port(&target->resolver_sockaddr,
+                                      &target->resolver_sockaddr_len,
+                                      target_name,
+                                      DNS_DEFAULT_STANDARD_DNS_PORT,
+                                      "Unsupported forwarding address") != 0) {
+            return -1;
+        }
+    } else {
+        target->type = FORWARDING_TARGET_DNSCRYPT;
+        if (sockaddr_from_ip_and_port(&target->resolver_sockaddr,
+                                      &target->resolver_sockaddr_len,
+                                      entry->fields
+                                      [RESOLVERS_DB_FIELD_RESOLVER_ADDRESS],
+                                      DNS_DEFAULT_RESOLVER_PORT,
+                                      "Unsupported resolver address") != 0 ||
+            resolver_probe_init(&target->probe, entry) != 0) {
+            return -1;
+        }
+    }
+    if ((target->name = strdup(target_name)) == NULL) {
+        if (target->type == FORWARDING_TARGET_DNSCRYPT) {
+            resolver_probe_free(&target->probe);
+        }
+        return -1;
+    }
+    forwarding->targets_count++;
+
+    return 0;
+}
+
+/*
+ * Adds a rule sending queries for domain, and for the names below it, to
+ * a target. entry is the entry of the target in the resolvers list, or
+ * NULL if target_name is the address of a plain DNS resolver. Targets
+ * are shared by all the rules that use the same name.
+ */
+
+int
+forwarding_add_rule(ProxyContext * const proxy_context,
+                    const char * const domain,
+                    const char * const target_name,
+                    const ResolversDBEntry * const entry)
+{
+    Forwarding * const forwarding = &proxy_context->forwarding;
+    FPST              *rules;
+    char              *key;
+    size_t             target_idx;
+
+    if ((key = forwarding_domain_key(domain)) == NULL) {
+        logger(proxy_context, LOG_ERR,
+               "[%s] is not a valid domain name", domain);
+        return -1;
+    }
+    if (fpst_has_key_str(forwarding->rules, key, NULL) != 0) {
+        logger(proxy_context, LOG_ERR,
+               "More than one forwarding rule for [%s]", domain);
+        free(key);
+        return -1;
+    }
+    for (target_idx = (size_t) 0U; target_idx < forwarding->targets_count;
+         target_idx++) {
+        if (evutil_ascii_strcasecmp(forwarding->targets[target_idx].name,
+                                    target_name) == 0) {
+            break;
+        }
+    }
+    if (target_idx >= forwarding->targets_count &&
+        forwarding_add_target(proxy_context, target_name, entry) != 0) {
+        free(key);
+        return -1;
+    }
+    if ((rules = fpst_insert_str(forwarding->rules, key,
+                                 (uint64_t) target_idx)) == NULL) {
+        free(key);
+        return -1;
+    }
+    forwarding->rules = rules;
+    forwarding->rules_count++;
+    forwarding->targets[target_idx].rules_count++;
+    logger(proxy_context, LOG_INFO, "Queries for [%s] will be sent to [%s]",
+           domain, target_name);
+
+    return 0;
+}
+
+static void forwarding_cert_update(ForwardingTarget * const target);
+
+static void
+forwarding_cert_timer_cb(evutil_socket_t handle, const short event,
+                         void * const target)
+{
+    (void) handle;
+    (void) event;
+    forwarding_cert_update(target);
+}
+
+static void
+forwarding_cert_retry(ForwardingTarget * const target,
+                      const char * const error)
+{
+    struct timeval tv;
+
+    if (target->cert_retry_step == 0U) {
+        logger(target->proxy_context, LOG_WARNING,
+               "Unable to retrieve the certificates of [%s]: %s",
+               target->name, error);
+    }
+    tv.tv_sec = (time_t) CERT_QUERY_RETRY_MIN_DELAY +
+        (time_t) target->cert_retry_step *
+        (CERT_QUERY_RETRY_MAX_DELAY - CERT_QUERY_RETRY_MIN_DELAY) /
+        CERT_QUERY_RETRY_STEPS;
+    tv.tv_usec = 0;
+    if (target->cert_retry_step < CERT_QUERY_RETRY_STEPS) {
+        target->cert_retry_step++;
+    }
+    evtimer_add(target->cert_timer, &tv);
+}
+
+/*
+ * The certificates of a target are refreshed as often as the ones of the
+ * resolver in use. A target keeps using its previous certificates while
+ * new ones can't be retrieved.
+ */
+
+static void
+forwarding_cert_cb(ResolverProbe * const probe, void * const target_)
+{
+    ForwardingTarget * const target = target_;
+    struct timeval           tv;
+
+    if (probe->state != RESOLVER_PROBE_STATE_DONE) {
+        forwarding_cert_retry(target, probe->error);
+        return;
+    }
+    dnscrypt_client_init_magic_query(&target->client,
+                                     probe->client.magic_query,
+                                     probe->client.cipher);
+    if (dnscrypt_client_init_resolver_publickey
+        (&target->client, probe->resolver_publickey) != 0) {
+        target->has_cert = 0;
+        forwarding_cert_retry(target, "suspicious public key");
+        return;
+    }
+    if (target->has_cert == 0) {
+        logger(target->proxy_context, LOG_INFO,
+               "[%s] can now be used for forwarded queries (%.1f ms)",
+               target->name, (double) probe->score / 1000.0);
+    }
+    target->has_cert = 1;
+    target->cert_retry_step = 0U;
+    tv.tv_sec = (time_t) CERT_QUERY_RETRY_DELAY_AFTER_SUCCESS_MIN_DELAY +
+        (time_t) randombytes_uniform
+        (CERT_QUERY_RETRY_DELAY_AFTER_SUCCESS_JITTER);
+    tv.tv_usec = 0;
+    evtimer_add(target->cert_timer, &tv);
+}
+
+static void
+forwarding_cert_update(ForwardingTarget * const target)
+{
+    ProxyContext * const proxy_context = target->proxy_context;
+
+    if (resolver_probe_start(&target->probe, proxy_context,
+                             proxy_context->event_loop,
+                             forwarding_cert_cb, target) != 0) {
+        forwarding_cert_cb(&target->probe, target);
+    }
+}
+
+int
+forwarding_start(ProxyContext * const proxy_context)
+{
+    Forwarding * const forwarding = &proxy_context->forwarding;
+    ForwardingTarget  *target;
+    size_t             i;
+
+    if (proxy_context->test_only != 0 ||
+        forwarding->targets_count <= (size_t) 0U) {
+        return 0;
+    }
+    randombytes_buf(forwarding->question_key,
+                    sizeof forwarding->question_key);
+    for (i = (size_t) 0U; i < forwarding->targets_count; i++) {
+        target = &forwarding->targets[i];
+        target->proxy_context = proxy_context;
+        if (target->type == FORWARDING_TARGET_PLAIN) {
+            logger(proxy_context, LOG_NOTICE,
+                   "Queries sent to [%s] will not be encrypted",
+                   target->name);
+            continue;
+        }
+        target->client = proxy_context->dnscrypt_client;
+        sodium_mlock(&target->client, sizeof target->client);
+        assert(target->cert_timer == NULL);
+        if ((target->cert_timer =
+             evtimer_new(proxy_context->event_loop,
+                         forwarding_cert_timer_cb, target)) == NULL) {
+            return -1;
+        }
+        forwarding_cert_update(target);
+    }
+    return 0;
+}
+
+static void
+forwarding_free_rule(const char *key, uint64_t target_idx)
+{
+    (void) target_idx;
+    free((void *) key);
+}
+
+void
+forwarding_free(ProxyContext * const proxy_context)
+{
+    Forwarding * const forwarding = &proxy_context->forwarding;
+    ForwardingTarget  *target;
+
+    while (forwarding->targets_count > (size_t) 0U) {
+        target = &forwarding->targets[--forwarding->targets_count];
+        if (target->cert_timer != NULL) {
+            event_free(target->cert_timer);
+        }
+        if (target->udp_resolver_event != NULL) {
+            event_free(target->udp_resolver_event);
+        }
+        if (target->udp_resolver_handle != (evutil_socket_t) -1) {
+            evutil_closesocket(target->udp_resolver_handle);
+        }
+        if (target->type == FORWARDING_TARGET_DNSCRYPT) {
+            resolver_probe_stop(&target->probe);
+            resolver_probe_free(&target->probe);
+            sodium_munlock(&target->client, sizeof target->client);
+        }
+        free(target->name);
+    }
+    free(forwarding->targets);
+    forwarding->targets = NULL;
+    fpst_free(forwarding->rules, forwarding_free_rule);
+    forwarding->rules = NULL;
+    forwarding->rules_count = (size_t) 0U;
+}
@@ -0,0 +1,103 @@
+
+#ifndef __FORWARDING_H__
+#define __FORWARDING_H__ 1
+
+#include <sys/types.h>
+#ifdef _WIN32
+# include <winsock2.h>
+#else
+# include <sys/socket.h>
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <event2/event.h>
+#include <event2/util.h>
+
+#include <sodium.h>
+
+#include "dnscrypt_client.h"
+#include "queue.h"
+#include "resolver_probe.h"
+#include "resolvers_db.h"
+
+/*
+ * Sends queries for some domains to other resolvers than the one in use.
+ *
+ * A rule maps a domain, and everything below it, to a target: either a
+ * resolver from the resolvers list, queried with DNSCrypt, or a plain
+ * DNS resolver, typically for local zones. Queries that don't match any
+ * rule are sent to the resolver in use, as usual.
+ *
+ * Rules are stored in a trie, keyed by the labels of the domain in
+ * reverse order, each followed by a dot: "corp.example" is stored as
+ * "example.corp.". A query name is turned into the same form, and its
+ * longest suffix that has a rule wins.
+ *
+ * Every target has its own UDP socket and its own list of queries in
+ * flight, that replies received on that socket are matched against.
+ * Queries sent to plain DNS resolvers get a new ID, and replies must
+ * have the same question. The certificates of DNSCrypt targets are
+ * fetched and refreshed independently of the ones of the resolver in
+ * use, and queries for a target whose certificates are not known yet
+ * are dropped rather than sent somewhere else.
+ */
+
+#define FORWARDING_KEY_MAX_LEN 256U
+#define FORWARDING_MAX_LABELS  128U
+
+typedef enum ForwardingTargetType_ {
+    FORWARDING_TARGET_PLAIN,
+    FORWARDING_TARGET_DNSCRYPT
+} ForwardingTargetType;
+
+union FPST;
+struct ProxyContext_;
+struct UDPRequest_;
+
+typedef struct ForwardingTarget_ {
+    DNSCryptClient           client;
+    ResolverProbe            probe;
+    TAILQ_HEAD(ForwardingTargetRequests_, UDPRequest_) udp_request_queue;
+    struct sockaddr_storage  resolver_sockaddr;
+    struct ProxyContext_    *proxy_context;
+    char                    *name;
+    struct event            *cert_timer;
+    struct event            *udp_resolver_event;
+    ev_socklen_t             resolver_sockaddr_len;
+    evutil_socket_t          udp_resolver_handle;
+    size_t                   udp_current_max_size;
+    size_t                   rules_count;
+    unsigned int             cert_retry_step;
+    ForwardingTargetType     type;
+    _Bool                    has_cert;
+} ForwardingTarget;
+
+typedef struct Forwarding_ {
+    uint8_t           question_key[crypto_shorthash_KEYBYTES];
+    union FPST       *rules;
+    ForwardingTarget *targets;
+    size_t            targets_count;
+    size_t            rules_count;
+} Forwarding;
+
+int forwarding_add_rule(struct ProxyContext_ * const proxy_context,
+                        const char * const domain,
+                        const char * const target_name,
+                        const ResolversDBEntry * const entry);
+
+int forwarding_start(struct ProxyContext_ * const proxy_context);
+
+void forwarding_free(struct ProxyContext_ * const proxy_context);
+
+ForwardingTarget *forwarding_target_for_query(const Forwarding * const forwarding,
+                                              const uint8_t * const dns_query,
+                                              const size_t dns_query_len);
+
+int forwarding_question_hash(const Forwarding * const forwarding,
+                             const uint8_t * const dns_packet,
+                             const size_t dns_packet_len,
+                             uint64_t * const hash_p);
+
+#endif
@@ -0,0 +1,704 @@
+
+/*
+ * Time spent in the functions that dominate the proxy's CPU usage,
+ * with realistic packet sizes and blocklist sizes.
+ *
+ * make bench
+ * ./hotpath-bench [<milliseconds per benchmark> [<name prefix>]]
+ *
+ * Each benchmark runs for at least the given time (default: 200 ms),
+ * and results are printed as tab-separated values: name, parameters,
+ * iterations, nanoseconds per operation. Lines starting with '#' are
+ * comments. To compare two commits, save the output of each one and:
+ *
+ * paste before.tsv after.tsv | awk -F '\t' '!/^#/ { print $1, $2, $4, $8 }'
+ */
+
+#include <config.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <dnscrypt/plugin.h>
+#include <sodium.h>
+
+#include "dnscrypt.h"
+#include "dnscrypt_client.h"
+#include "dnscrypt_proxy.h"
+#include "edns.h"
+#include "fpst.h"
+#include "minicsv.h"
+#include "resolvers_db.h"
+#include "utils.h"
+
+#define DEFAULT_MIN_MS 200UL
+#define MAX_PACKET_SIZE 4096U
+#define NAMES_COUNT 1024U
+#define BLOCKLIST_KEY_SIZE 64U
+
+#define OPT_RR "\x00\x00\x29\x04\xe4\x00\x00\x00\x00\x00\x00"
+#define ANSWER_RR \
+    "\xc0\x0c\x00\x01\x00\x01\x00\x00\x0e\x10\x00\x04\xc0\x00\x02\x01"
+
+typedef struct BenchState_ {
+    DNSCryptClient    client;
+    DNSCryptClient    client_ephemeral;
+    ProxyContext      proxy_context;
+    DCPlugin          cache_plugin;
+    uint8_t           client_nonce[crypto_box_HALF_NONCEBYTES];
+    uint8_t           packet[MAX_PACKET_SIZE];
+    uint8_t           response[MAX_PACKET_SIZE];
+    uint8_t           query[MAX_PACKET_SIZE];
+    char              csv_line[MAX_PACKET_SIZE];
+    char             *names[NAMES_COUNT];
+    char             *blocklist_keys;
+    FPST             *blocklist;
+    ResolversDB       resolvers_db;
+    size_t            response_len;
+    size_t            query_len;
+    size_t            csv_line_len;
+    size_t            len;
+    size_t            max_len;
+    size_t            names_len[NAMES_COUNT];
+    unsigned int      next_name;
+} BenchState;
+
+typedef struct Bench_ {
+    const char *name;
+    int       (*setup)(BenchState * const state, const size_t param);
+    void      (*run)(BenchState * const state);
+    void      (*teardown)(BenchState * const state);
+    const char *param_name;
+    size_t      params[4];
+    size_t      params_count;
+} Bench;
+
+static BenchState bench_state;
+static volatile size_t sink;
+
+static const char csv_line[] =
+    "adguard-dns-family-ns1,Adguard DNS Family Protection 1,"
+    "Adguard DNS with safesearch and adult content blocking,Anycast,,"
+    "https://adguard.com/en/adguard-dns/overview.html,1,no,yes,no,"
+    "176.103.130.132:5443,2.dnscrypt.family.ns1.adguard.com,"
+    "B831:5DD7:B14B:6EE3:20A4:70DC:2ED6:B1AA:398C:C9E5:86F8:5D45:45D6:"
+    "B8C9:B500:5ABA,pk.family.ns1.adguard.com\n";
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (double) tv.tv_sec + (double) tv.tv_usec / 1e6;
+}
+
+/* Used by dnscrypt_client.c for nonces; utils.c would pull in the logger */
+
+uint64_t
+dnscrypt_hrtime(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (uint64_t) tv.tv_sec * 1000000U + (uint64_t) tv.tv_usec;
+}
+
+/* A query for qname with qtype A, padded with a random label to len */
+
+static size_t
+make_query(uint8_t * const packet, const char *qname, size_t len)
+{
+    size_t pos = 12U;
+    size_t label_len;
+    size_t qname_len = strlen(qname);
+
+    memset(packet, 0, 12U);
+    packet[0] = 0x12;
+    packet[1] = 0x34;
+    packet[2] = 0x01;
+    packet[5] = 0x01;
+    if (len < pos + qname_len + 2U + 4U) {
+        len = pos + qname_len + 2U + 4U;
+    }
+    label_len = len - (pos + qname_len + 2U + 4U);
+    while (label_len > 0U) {
+        const size_t l = label_len > 64U ? 63U : label_len - 1U;
+
+        packet[pos++] = (uint8_t) l;
+        memset(&packet[pos], 'x', l);
+        pos += l;
+        label_len -= l + 1U;
+    }
+    for (;;) {
+        const char  *dot = strchr(qname, '.');
+        const size_t l = dot == NULL ? strlen(qname) : (size_t) (dot - qname);
+
+        packet[pos++] = (uint8_t) l;
+        memcpy(&packet[pos], qname, l);
+        pos += l;
+        if (dot == NULL) {
+            break;
+        }
+        qname = dot + 1;
+    }
+    packet[pos++] = 0U;
+    packet[pos++] = 0U;
+    packet[pos++] = 1U;
+    packet[pos++] = 0U;
+    packet[pos++] = 1U;
+
+    return pos;
+}
+
+static int
+setup_client(DNSCryptClient * const client, const _Bool ephemeral_keys)
+{
+    uint8_t resolver_publickey[crypto_box_PUBLICKEYBYTES];
+    uint8_t resolver_secretkey[crypto_box_SECRETKEYBYTES];
+    uint8_t magic_query[DNSCRYPT_MAGIC_QUERY_LEN];
+
+    memset(client, 0, sizeof *client);
+    client->ephemeral_keys = ephemeral_keys;
+    crypto_box_keypair(resolver_publickey, resolver_secretkey);
+    randombytes_buf(magic_query, sizeof magic_query);
+    if (ephemeral_keys != 0) {
+        dnscrypt_client_init_with_new_session_key(client);
+    } else {
+        dnscrypt_client_init_with_new_key_pair(client);
+    }
+    dnscrypt_client_init_magic_query(client, magic_query,
+                                     CIPHER_XSALSA20POLY1305);
+
+    return dnscrypt_client_init_resolver_publickey(client, resolver_publickey);
+}
+
+static int
+curve_setup(BenchState * const state, const size_t param)
+{
+    state->query_len = make_query(state->query, "www.example.com", 40U);
+    state->max_len = param;
+
+    return setup_client(&state->client, 0);
+}
+
+static void
+curve_run(BenchState * const state)
+{
+    memcpy(state->packet, state->query, state->query_len);
+    sink += (size_t) dnscrypt_client_curve(&state->client, state->client_nonce,
+                                           state->packet, state->query_len,
+                                           state->max_len);
+}
+
+static int
+curve_ephemeral_setup(BenchState * const state, const size_t param)
+{
+    state->query_len = make_query(state->query, "www.example.com", 40U);
+    state->max_len = param;
+
+    return setup_client(&state->client_ephemeral, 1);
+}
+
+static void
+curve_ephemeral_run(BenchState * const state)
+{
+    memcpy(state->packet, state->query, state->query_len);
+    sink += (size_t) dnscrypt_client_curve(&state->client_ephemeral,
+                                           state->client_nonce,
+                                           state->packet, state->query_len,
+                                           state->max_len);
+}
+
+/*
+ * A reply to a query of the client, encrypted the way a resolver does,
+ * with the shared key the client computed.
+ */
+
+static int
+uncurve_setup(BenchState * const state, const size_t param)
+{
+    uint8_t      nonce[crypto_box_NONCEBYTES];
+    uint8_t      reply[MAX_PACKET_SIZE];
+    const size_t magic_len = sizeof DNSCRYPT_MAGIC_RESPONSE - 1U;
+    size_t       reply_len;
+
+    if (setup_client(&state->client, 0) != 0) {
+        return -1;
+    }
+    reply_len = make_query(reply, "www.example.com", param);
+    reply[2] |= 0x80;
+    reply_len = dnscrypt_pad(reply, reply_len,
+                             (reply_len + DNSCRYPT_MIN_PAD_LEN +
+                              DNSCRYPT_BLOCK_SIZE - 1U) &
+                             ~ (size_t) (DNSCRYPT_BLOCK_SIZE - 1U));
+    randombytes_buf(nonce, sizeof nonce);
+    memcpy(state->client_nonce, nonce, crypto_box_HALF_NONCEBYTES);
+    memcpy(state->response, DNSCRYPT_MAGIC_RESPONSE, magic_len);
+    memcpy(state->response + magic_len, nonce, sizeof nonce);
+    if (crypto_box_easy_afternm(state->response + magic_len + sizeof nonce,
+                                reply, reply_len, nonce,
+                                state->client.nmkey) != 0) {
+        return -1;
+    }
+    state->response_len = magic_len + sizeof nonce +
+        crypto_box_MACBYTES + reply_len;
+    memcpy(state->packet, state->response, state->response_len);
+    state->len = state->response_len;
+
+    return dnscrypt_client_uncurve(&state->client, state->client_nonce,
+                                   state->packet, &state->len);
+}
+
+static void
+uncurve_run(BenchState * const state)
+{
+    memcpy(state->packet, state->response, state->response_len);
+    state->len = state->response_len;
+    sink += (size_t) dnscrypt_client_uncurve(&state->client,
+                                             state->client_nonce,
+                                             state->packet, &state->len);
+}
+
+static int
+pad_setup(BenchState * const state, const size_t param)
+{
+    state->len = make_query(state->packet, "www.example.com", 40U);
+    state->max_len = param;
+
+    return 0;
+}
+
+static void
+pad_run(BenchState * const state)
+{
+    sink += dnscrypt_pad(state->packet, state->len, state->max_len);
+}
+
+static int
+cmp_client_nonce_setup(BenchState * const state, const size_t param)
+{
+    const size_t magic_len = sizeof DNSCRYPT_MAGIC_RESPONSE - 1U;
+
+    randombytes_buf(state->client_nonce, sizeof state->client_nonce);
+    memcpy(state->packet, DNSCRYPT_MAGIC_RESPONSE, magic_len);
+    memcpy(state->packet + magic_len, state->client_nonce,
+           sizeof state->client_nonce);
+    if (param == 0U) {
+        state->packet[magic_len] ^= 1U;
+    }
+    state->len = 512U;
+
+    return 0;
+}
+
+static void
+cmp_client_nonce_run(BenchState * const state)
+{
+    sink += (size_t) dnscrypt_cmp_client_nonce(state->client_nonce,
+                                               state->packet, state->len);
+}
+
+static int
+edns_add_section_setup(BenchState * const state, const size_t param)
+{
+    state->proxy_context.edns_payload_size = param;
+    state->query_len = make_query(state->query, "www.example.com", 40U);
+
+    return 0;
+}
+
+static void
+edns_add_section_run(BenchState * const state)
+{
+    size_t request_edns_payload_size;
+
+    memcpy(state->packet, state->query, state->query_len);
+    state->len = state->query_len;
+    sink += (size_t) edns_add_section(&state->proxy_context, state->packet,
+                                      &state->len, sizeof state->packet,
+                                      &request_edns_payload_size);
+}
+
+static void
+str_reverse(char * const str)
+{
+    size_t i = 0U;
+    size_t j = strlen(str);
+    char   c;
+
+    while (j > i + 1U) {
+        c = str[i];
+        str[i++] = str[--j];
+        str[j] = c;
+    }
+}
+
+/*
+ * Suffixes are stored reversed, like the blocking plugin does; half of
+ * the names that are looked up are blocked.
+ */
+
+static int
+fpst_setup(BenchState * const state, const size_t param)
+{
+    char   name[256];
+    char  *key;
+    size_t i;
+
+    if ((state->blocklist_keys = calloc(param, BLOCKLIST_KEY_SIZE)) == NULL) {
+        return -1;
+    }
+    state->blocklist = fpst_new();
+    for (i = 0U; i < param; i++) {
+        key = &state->blocklist_keys[i * BLOCKLIST_KEY_SIZE];
+        snprintf(key, BLOCKLIST_KEY_SIZE, "ads%lu.tracker%lu.com",
+                 (unsigned long) i, (unsigned long) (i % 997U));
+        str_reverse(key);
+        if ((state->blocklist = fpst_insert_str(state->blocklist, key,
+                                                (uint64_t) i)) == NULL) {
+            return -1;
+        }
+    }
+    for (i = 0U; i < NAMES_COUNT; i++) {
+        if (i % 2U == 0U) {
+            snprintf(name, sizeof name, "www.ads%lu.tracker%lu.com",
+                     (unsigned long) (i * 7U % param),
+                     (unsigned long) (i * 7U % param % 997U));
+        } else {
+            snprintf(name, sizeof name, "www.site%lu.example.org",
+                     (unsigned long) i);
+        }
+        str_reverse(name);
+        if ((state->names[i] = strdup(name)) == NULL) {
+            return -1;
+        }
+        state->names_len[i] = strlen(name);
+    }
+    state->next_name = 0U;
+
+    return 0;
+}
+
+static void
+fpst_run(BenchState * const state)
+{
+    const char  *found_key;
+    uint64_t     found_val;
+    unsigned int i = state->next_name++ % NAMES_COUNT;
+
+    sink += (size_t) fpst_starts_with_existing_key(state->blocklist,
+                                                   state->names[i],
+                                                   state->names_len[i],
+                                                   &found_key, &found_val);
+}
+
+static void
+fpst_teardown(BenchState * const state)
+{
+    unsigned int i;
+
+    fpst_free(state->blocklist, NULL);
+    state->blocklist = NULL;
+    free(state->blocklist_keys);
+    state->blocklist_keys = NULL;
+    for (i = 0U; i < NAMES_COUNT; i++) {
+        free(state->names[i]);
+        state->names[i] = NULL;
+    }
+}
+
+static int
+minicsv_setup(BenchState * const state, const size_t param)
+{
+    (void) param;
+    state->csv_line_len = sizeof csv_line - 1U;
+    assert(state->csv_line_len < sizeof state->csv_line);
+
+    return 0;
+}
+
+static void
+minicsv_run(BenchState * const state)
+{
+    char   *cols[16];
+    size_t  cols_count;
+
+    memcpy(state->csv_line, csv_line, state->csv_line_len + 1U);
+    minicsv_parse_line(state->csv_line, cols, &cols_count,
+                       sizeof cols / sizeof cols[0]);
+    sink += cols_count;
+}
+
+/*
+ * A compiled resolvers list with param entries, half of the names that
+ * are looked up being missing. The temporary file also stands for the
+ * CSV file the list was compiled from.
+ */
+
+static int
+resolvers_db_setup(BenchState * const state, const size_t param)
+{
+    char                db_file[] = "/tmp/hotpath-bench-XXXXXX";
+    char                fields[RESOLVERS_DB_FIELDS][64];
+    ResolversDBBuilder *builder;
+    ResolversDBEntry    entry;
+    size_t              i;
+    unsigned int        j;
+    int                 fd;
+
+    if ((fd = mkstemp(db_file)) == -1) {
+        return -1;
+    }
+    (void) close(fd);
+    if ((builder = resolvers_db_builder_new()) == NULL) {
+        return -1;
+    }
+    for (i = 0U; i < param; i++) {
+        for (j = 0U; j < RESOLVERS_DB_FIELDS; j++) {
+            snprintf(fields[j], sizeof fields[j], "resolver%lu-field%u",
+                     (unsigned long) i, j);
+            entry.fields[j] = fields[j];
+        }
+        if (resolvers_db_builder_add(builder, &entry) != 0) {
+            return -1;
+        }
+    }
+    if (resolvers_db_builder_write(builder, db_file, db_file) != 0 ||
+        resolvers_db_open(&state->resolvers_db, db_file) != 0) {
+        return -1;
+    }
+    resolvers_db_builder_free(builder);
+    (void) unlink(db_file);
+    for (i = 0U; i < NAMES_COUNT; i++) {
+        snprintf(fields[0], sizeof fields[0], "Resolver%lu-field0",
+                 (unsigned long) (i % 2U == 0U ? i * 7U % param : param + i));
+        if ((state->names[i] = strdup(fields[0])) == NULL) {
+            return -1;
+        }
+    }
+    state->next_name = 0U;
+
+    return 0;
+}
+
+static void
+resolvers_db_run(BenchState * const state)
+{
+    ResolversDBEntry entry;
+    unsigned int     i = state->next_name++ % NAMES_COUNT;
+
+    sink += (size_t) resolvers_db_lookup(&state->resolvers_db,
+                                         state->names[i], &entry);
+}
+
+static void
+resolvers_db_teardown(BenchState * const state)
+{
+    unsigned int i;
+
+    resolvers_db_close(&state->resolvers_db);
+    for (i = 0U; i < NAMES_COUNT; i++) {
+        free(state->names[i]);
+        state->names[i] = NULL;
+    }
+}
+
+/* Queries reach plugins with the OPT record added by the proxy */
+
+static size_t
+make_cache_query(uint8_t * const packet, const char * const qname)
+{
+    size_t len = make_query(packet, qname, 0U);
+
+    packet[11] = 1U;
+    memcpy(packet + len, OPT_RR, sizeof OPT_RR - 1U);
+
+    return len + sizeof OPT_RR - 1U;
+}
+
+static DCPluginSyncFilterResult
+cache_lookup(BenchState * const state)
+{
+    DCPluginDNSPacket dcp_packet;
+    size_t            len = state->query_len;
+
+    memcpy(state->packet, state->query, state->query_len);
+    dcp_packet.client_sockaddr = NULL;
+    dcp_packet.client_sockaddr_len_s = (size_t) 0U;
+    dcp_packet.dns_packet = state->packet;
+    dcp_packet.dns_packet_len_p = &len;
+    dcp_packet.dns_packet_max_len = sizeof state->packet;
+    dcp_packet.request_id = 0U;
+
+    return dcplugin_sync_pre_filter(&state->cache_plugin, &dcp_packet);
+}
+
+/*
+ * The cache plugin keeps a list of up to 50 entries, most recent first.
+ * param is the position of the entry that matches the query; a query
+ * for the name past the last entry is a miss. Entries are added the way
+ * the proxy does, with a pre-filter call before the post-filter call,
+ * since the former is what updates the plugin's clock.
+ */
+
+static int
+cache_setup(BenchState * const state, const size_t param)
+{
+    DCPluginDNSPacket        dcp_packet;
+    DCPluginSyncFilterResult expected;
+    char                     name[256];
+    size_t                   len;
+    unsigned int             i;
+
+    if (dcplugin_init(&state->cache_plugin, 0, NULL) != 0) {
+        return -1;
+    }
+    memset(&dcp_packet, 0, sizeof dcp_packet);
+    dcp_packet.dns_packet = state->packet;
+    dcp_packet.dns_packet_len_p = &len;
+    dcp_packet.dns_packet_max_len = sizeof state->packet;
+    for (i = 50U; i > 0U; i--) {
+        snprintf(name, sizeof name, "www.site%u.example.com", i);
+        len = make_cache_query(state->packet, name);
+        dcplugin_sync_pre_filter(&state->cache_plugin, &dcp_packet);
+        len -= sizeof OPT_RR - 1U;
+        state->packet[2] |= 0x80;
+        state->packet[7] = 1U;
+        state->packet[11] = 0U;
+        memcpy(state->packet + len, ANSWER_RR, sizeof ANSWER_RR - 1U);
+        len += sizeof ANSWER_RR - 1U;
+        if (dcplugin_sync_post_filter(&state->cache_plugin,
+                                      &dcp_packet) != DCP_SYNC_FILTER_RESULT_OK) {
+            return -1;
+        }
+    }
+    snprintf(name, sizeof name, "www.site%u.example.com", (unsigned int) param);
+    state->query_len = make_cache_query(state->query, name);
+    expected = param <= 50U ?
+        DCP_SYNC_FILTER_RESULT_DIRECT : DCP_SYNC_FILTER_RESULT_OK;
+
+    return cache_lookup(state) == expected ? 0 : -1;
+}
+
+static void
+cache_run(BenchState * const state)
+{
+    const DCPluginSyncFilterResult result = cache_lookup(state);
+
+    sink += (size_t) result;
+}
+
+static void
+cache_teardown(BenchState * const state)
+{
+    dcplugin_destroy(&state->cache_plugin);
+}
+
+static const Bench benches[] = {
+    { "dnscrypt_client_curve", curve_setup, curve_run, NULL,
+      "max_len", { 512U, 1252U }, 2U },
+    { "dnscrypt_client_curve_ephemeral", curve_ephemeral_setup,
+      curve_ephemeral_run, NULL, "max_len", { 512U }, 1U },
+    { "dnscrypt_client_uncurve", uncurve_setup, uncurve_run, NULL,
+      "len", { 64U, 512U, 1252U, 4000U }, 4U },
+    { "dnscrypt_pad", pad_setup, pad_run, NULL,
+      "max_len", { 512U, 1252U }, 2U },
+    { "dnscrypt_cmp_client_nonce", cmp_client_nonce_setup,
+      cmp_client_nonce_run, NULL, "match", { 1U, 0U }, 2U },
+    { "edns_add_section", edns_add_section_setup, edns_add_section_run,
+      NULL, "payload_size", { 1252U, 4096U }, 2U },
+    { "fpst_starts_with_existing_key", fpst_setup, fpst_run, fpst_teardown,
+      "keys", { 1000U, 10000U, 100000U }, 3U },
+    { "minicsv_parse_line", minicsv_setup, minicsv_run, NULL,
+      "cols", { 14U }, 1U },
+    { "resolvers_db_lookup", resolvers_db_setup, resolvers_db_run,
+      resolvers_db_teardown, "entries", { 100U, 10000U, 100000U }, 3U },
+    { "cache_lookup", cache_setup, cache_run, cache_teardown,
+      "entry", { 1U, 25U, 50U, 51U }, 4U }
+};
+
+static unsigned long
+bench_run(const Bench * const bench, const double min_time,
+          double * const ns_per_op)
+{
+    unsigned long iterations = 1UL;
+    unsigned long i;
+    double        started;
+    double        elapsed;
+
+    for (;;) {
+        started = now();
+        for (i = 0UL; i < iterations; i++) {
+            bench->run(&bench_state);
+        }
+        elapsed = now() - started;
+        if (elapsed >= min_time || iterations >= 1UL << 40) {
+            break;
+        }
+        if (elapsed < min_time / 100.0) {
+            iterations *= 100UL;
+        } else {
+            iterations = (unsigned long)
+                ((double) iterations * min_time * 1.2 / elapsed) + 1UL;
+        }
+    }
+    *ns_per_op = elapsed * 1e9 / (double) iterations;
+
+    return iterations;
+}
+
+int
+main(int argc, char *argv[])
+{
+    const Bench   *bench;
+    const char    *prefix = NULL;
+    double         ns_per_op;
+    unsigned long  min_ms = DEFAULT_MIN_MS;
+    unsigned long  iterations;
+    size_t         i;
+    size_t         j;
+
+    if (argc > 1 && (min_ms = strtoul(argv[1], NULL, 10)) == 0UL) {
+        fputs("Usage: hotpath-bench [<milliseconds per benchmark> "
+              "[<name prefix>]]\n", stderr);
+        return 1;
+    }
+    if (argc > 2) {
+        prefix = argv[2];
+    }
+    if (sodium_init() < 0) {
+        return 1;
+    }
+    printf("# benchmark\tparameters\titerations\tns/op\n");
+    for (i = 0U; i < sizeof benches / sizeof benches[0]; i++) {
+        bench = &benches[i];
+        if (prefix != NULL &&
+            strncmp(bench->name, prefix, strlen(prefix)) != 0) {
+            continue;
+        }
+        for (j = 0U; j < bench->params_count; j++) {
+            if (bench->setup(&bench_state, bench->params[j]) != 0) {
+                fprintf(stderr, "%s: setup failed\n", bench->name);
+                return 1;
+            }
+            iterations = bench_run(bench, (double) min_ms / 1000.0,
+                                   &ns_per_op);
+            if (bench->teardown != NULL) {
+                bench->teardown(&bench_state);
+            }
+            printf("%s\t%s=%lu\t%lu\t%.1f\n", bench->name, bench->param_name,
+                   (unsigned long) bench->params[j], iterations, ns_per_op);
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
@@ -10,9 +10,14 @@
 # include <syslog.h>
 #endif
 #include <stdarg.h>
+#include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
 
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
 #ifdef HAVE_LIBSYSTEMD
 # include <sys/socket.h>
 # include <systemd/sd-daemon.h>
@@ -23,6 +28,7 @@
 #include "dnscrypt_proxy.h"
 #include "logger.h"
 #include "safe_rw.h"
+#include "utils.h"
 
 int
 logger_open_syslog(struct ProxyContext_ * const context)
@@ -34,50 +40,94 @@ logger_open_syslog(struct ProxyContext_ * const context)
     return 0;
 }
 
+#if defined(HAVE_PTHREAD) && defined(HAVE_ATOMIC_BUILTINS) && !defined(_WIN32)
+# define LOGGER_ASYNC 1
+#endif
+
+#ifdef LOGGER_ASYNC
+typedef struct LoggerEntry_ {
+    size_t                seq;
+    struct ProxyContext_ *context;
+    time_t                ts;
+    int                   crit;
+    char                  line[MAX_LOG_LINE];
+} LoggerEntry;
+
+typedef struct LoggerQueue_ {
+    LoggerEntry           entries[LOGGER_QUEUE_SIZE];
+    struct ProxyContext_ *context;
+    size_t                enqueue_pos;
+    size_t                dequeue_pos;
+    size_t                dropped;
+    pthread_t             writer;
+    pthread_cond_t        cond;
+    pthread_mutex_t       mutex;
+    _Bool                 stop;
+    _Bool                 writer_sleeping;
+} LoggerQueue;
+
+static LoggerQueue  logger_queue_storage;
+static LoggerQueue *logger_queue;
+#endif
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t logger_write_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 static int
-timestamp_fprint(FILE * const fp)
+timestamp_fprint(FILE * const fp, const time_t now)
 {
-    char now_s[128];
+    static char   now_s[128];
+    static time_t now_s_ts = (time_t) -1;
+    struct tm    *tm;
 
-    time_t     now;
-    struct tm *tm;
-
-    if (time(&now) == (time_t) -1) {
+    if (now == (time_t) -1) {
         fprintf(fp, "- ");
         return -1;
     }
-    tm = localtime(&now);
-    strftime(now_s, sizeof now_s, "%c", tm);
+    if (now != now_s_ts) {
+        tm = localtime(&now);
+        strftime(now_s, sizeof now_s, "%c", tm);
+        now_s_ts = now;
+    }
     fprintf(fp, "%s ", now_s);
 
     return 0;
 }
 
-int
-logger(struct ProxyContext_ * const context,
-       const int crit, const char * const format, ...)
+static int
+logger_write(struct ProxyContext_ * const context, const int crit,
+             const time_t now, const char * const line, const size_t len,
+             const _Bool flush)
 {
     static char         previous_line[MAX_LOG_LINE];
     static time_t       last_log_ts = (time_t) 0;
     static unsigned int burst_counter = 0U;
-    char                line[MAX_LOG_LINE];
     FILE               *log_fp;
     const char         *urgency;
-    va_list             va;
-    time_t              now = time(NULL);
-    size_t              len;
 
-    if (context != NULL) {
-        if (crit > context->max_log_level) {
-            return 0;
-        }
-    } else {
-#ifndef DEBUG
-        if (crit > LOG_INFO) {
-            return 0;
+#ifndef _WIN32
+    if (context != NULL && context->log_fp == NULL && context->syslog != 0) {
+        if (context->syslog_prefix != NULL) {
+            syslog(crit, "%s %s", context->syslog_prefix, line);
+        } else {
+            syslog(crit, "%s", line);
         }
+        return 0;
+    }
 #endif
+    if (memcmp(previous_line, line, len) == 0) {
+        burst_counter++;
+        if (burst_counter > LOGGER_ALLOWED_BURST_FOR_IDENTICAL_LOG_ENTRIES &&
+            now - last_log_ts < LOGGER_DELAY_BETWEEN_IDENTICAL_LOG_ENTRIES) {
+            return 1;
+        }
+    } else {
+        burst_counter = 0U;
     }
+    last_log_ts = now;
+    assert(sizeof previous_line >= len);
+    memcpy(previous_line, line, len);
     switch (crit) {
     case LOG_INFO:
         urgency = "[INFO] ";
@@ -97,53 +147,271 @@ logger(struct ProxyContext_ * const context,
     default:
         urgency = "";
     }
-    va_start(va, format);
-    len = (size_t) evutil_vsnprintf(line, sizeof line, format, va);
-    va_end(va);
+    if (context == NULL || context->log_fp == NULL) {
+        log_fp = stdout;
+    } else {
+        log_fp = context->log_fp;
+    }
+    timestamp_fprint(log_fp, now);
+    if (context != NULL && context->syslog_prefix) {
+        fprintf(log_fp, "%s%s %s\n", urgency, context->syslog_prefix, line);
+    } else {
+        fprintf(log_fp, "%s%s\n", urgency, line);
+    }
+    if (flush != 0) {
+        fflush(log_fp);
+    }
+    return 0;
+}
+
+static int
+logger_write_locked(struct ProxyContext_ * const context, const int crit,
+                    const time_t now, const char * const line,
+                    const size_t len, const _Bool flush)
+{
+    int ret;
 
-    if (len >= sizeof line) {
-        assert(sizeof line > (size_t) 0U);
-        len = sizeof line - (size_t) 1U;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&logger_write_lock);
+#endif
+    ret = logger_write(context, crit, now, line, len, flush);
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&logger_write_lock);
+#endif
+    return ret;
+}
+
+static size_t
+logger_format(char * const line, const size_t sizeof_line,
+              const char * const format, va_list va)
+{
+    size_t len;
+
+    len = (size_t) evutil_vsnprintf(line, sizeof_line, format, va);
+    if (len >= sizeof_line) {
+        assert(sizeof_line > (size_t) 0U);
+        len = sizeof_line - (size_t) 1U;
     }
     line[len++] = 0;
-#ifndef _WIN32
-    if (context != NULL && context->log_fp == NULL && context->syslog != 0) {
-        if (context->syslog_prefix != NULL) {
-            syslog(crit, "%s %s", context->syslog_prefix, line);
+
+    return len;
+}
+
+#ifdef LOGGER_ASYNC
+static int
+logger_enqueue(LoggerQueue * const queue,
+               struct ProxyContext_ * const context, const int crit,
+               const time_t now, const char * const format, va_list va)
+{
+    LoggerEntry *entry;
+    size_t       pos;
+    size_t       seq;
+
+    pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        entry = &queue->entries[pos & (LOGGER_QUEUE_SIZE - 1U)];
+        seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos,
+                                            pos + 1U, 1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if ((ssize_t) (seq - pos) < (ssize_t) 0) {
+            __atomic_add_fetch(&queue->dropped, (size_t) 1U,
+                               __ATOMIC_RELAXED);
+            return -1;
         } else {
-            syslog(crit, "%s", line);
+            pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
         }
+    }
+    entry->context = context;
+    entry->crit = crit;
+    entry->ts = now;
+    logger_format(entry->line, sizeof entry->line, format, va);
+    __atomic_store_n(&entry->seq, pos + 1U, __ATOMIC_RELEASE);
+    if (__atomic_load_n(&queue->writer_sleeping, __ATOMIC_ACQUIRE) != 0) {
+        pthread_cond_signal(&queue->cond);
+    }
+    return 0;
+}
+
+static _Bool
+logger_dequeue_and_write(LoggerQueue * const queue)
+{
+    LoggerEntry *entry;
+    const size_t pos = queue->dequeue_pos;
+
+    entry = &queue->entries[pos & (LOGGER_QUEUE_SIZE - 1U)];
+    if (__atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) != pos + 1U) {
         return 0;
     }
-#endif
-    if (memcmp(previous_line, line, len) == 0) {
-        burst_counter++;
-        if (burst_counter > LOGGER_ALLOWED_BURST_FOR_IDENTICAL_LOG_ENTRIES &&
-            now - last_log_ts < LOGGER_DELAY_BETWEEN_IDENTICAL_LOG_ENTRIES) {
-            return 1;
-        }
-    } else {
-        burst_counter = 0U;
+    logger_write_locked(entry->context, entry->crit, entry->ts,
+                        entry->line, strlen(entry->line) + 1U, 0);
+    queue->dequeue_pos = pos + 1U;
+    __atomic_store_n(&entry->seq, pos + LOGGER_QUEUE_SIZE, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+/*
+ * Only the stream the writer itself writes to is flushed: other streams,
+ * such as the ones of plugins, are written to by other threads, without
+ * the logger's lock.
+ */
+
+static void
+logger_flush_locked(struct ProxyContext_ * const context)
+{
+    if (context != NULL && context->log_fp == NULL && context->syslog != 0) {
+        return;
     }
-    last_log_ts = now;
-    assert(sizeof previous_line >= sizeof line);
-    memcpy(previous_line, line, len);
+    pthread_mutex_lock(&logger_write_lock);
     if (context == NULL || context->log_fp == NULL) {
-        log_fp = stdout;
+        fflush(stdout);
     } else {
-        log_fp = context->log_fp;
+        fflush(context->log_fp);
     }
-    timestamp_fprint(log_fp);
-    if (context != NULL && context->syslog_prefix) {
-        fprintf(log_fp, "%s%s %s\n", urgency, context->syslog_prefix, line);
-    } else {
-        fprintf(log_fp, "%s%s\n", urgency, line);
+    pthread_mutex_unlock(&logger_write_lock);
+}
+
+static void *
+logger_writer(void *queue_)
+{
+    LoggerQueue     *queue = queue_;
+    struct timespec  deadline;
+    size_t           dropped;
+    char             line[MAX_LOG_LINE];
+
+    for (;;) {
+        while (logger_dequeue_and_write(queue) != 0) { }
+        if ((dropped = __atomic_exchange_n(&queue->dropped, (size_t) 0U,
+                                           __ATOMIC_RELAXED)) > (size_t) 0U) {
+            evutil_snprintf(line, sizeof line,
+                            "%lu log messages were dropped",
+                            (unsigned long) dropped);
+            logger_write_locked(queue->context, LOG_WARNING, time(NULL),
+                                line, strlen(line) + 1U, 0);
+        }
+        logger_flush_locked(queue->context);
+        pthread_mutex_lock(&queue->mutex);
+        if (queue->stop != 0) {
+            pthread_mutex_unlock(&queue->mutex);
+            break;
+        }
+        __atomic_store_n(&queue->writer_sleeping, 1, __ATOMIC_RELEASE);
+        deadline.tv_sec = time(NULL) + 1;
+        deadline.tv_nsec = 0;
+        pthread_cond_timedwait(&queue->cond, &queue->mutex, &deadline);
+        __atomic_store_n(&queue->writer_sleeping, 0, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&queue->mutex);
     }
-    fflush(log_fp);
+    while (logger_dequeue_and_write(queue) != 0) { }
+    logger_flush_locked(queue->context);
+
+    return NULL;
+}
+#endif
 
+int
+logger_async_start(struct ProxyContext_ * const context)
+{
+#ifdef LOGGER_ASYNC
+    LoggerQueue *queue = &logger_queue_storage;
+    size_t       i;
+
+    COMPILER_ASSERT((LOGGER_QUEUE_SIZE & (LOGGER_QUEUE_SIZE - 1U)) == 0U);
+    if (logger_queue != NULL) {
+        return 0;
+    }
+    for (i = (size_t) 0U; i < LOGGER_QUEUE_SIZE; i++) {
+        queue->entries[i].seq = i;
+    }
+    queue->enqueue_pos = queue->dequeue_pos = (size_t) 0U;
+    queue->context = context;
+    queue->dropped = (size_t) 0U;
+    queue->stop = 0;
+    queue->writer_sleeping = 0;
+    if (pthread_mutex_init(&queue->mutex, NULL) != 0) {
+        return -1;
+    }
+    if (pthread_cond_init(&queue->cond, NULL) != 0) {
+        pthread_mutex_destroy(&queue->mutex);
+        return -1;
+    }
+    if (pthread_create(&queue->writer, NULL, logger_writer, queue) != 0) {
+        pthread_cond_destroy(&queue->cond);
+        pthread_mutex_destroy(&queue->mutex);
+        return -1;
+    }
+    __atomic_store_n(&logger_queue, queue, __ATOMIC_RELEASE);
+    atexit(logger_async_stop);
+#else
+    (void) context;
+#endif
     return 0;
 }
 
+void
+logger_async_stop(void)
+{
+#ifdef LOGGER_ASYNC
+    LoggerQueue *queue;
+
+    if ((queue = __atomic_exchange_n(&logger_queue, NULL,
+                                     __ATOMIC_ACQ_REL)) == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&queue->mutex);
+    queue->stop = 1;
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+    pthread_join(queue->writer, NULL);
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->mutex);
+#endif
+}
+
+int
+logger(struct ProxyContext_ * const context,
+       const int crit, const char * const format, ...)
+{
+    char     line[MAX_LOG_LINE];
+    va_list  va;
+    time_t   now = time(NULL);
+    size_t   len;
+#ifdef LOGGER_ASYNC
+    LoggerQueue *queue;
+    int          ret;
+#endif
+
+    if (context != NULL) {
+        if (crit > context->max_log_level) {
+            return 0;
+        }
+    } else {
+#ifndef DEBUG
+        if (crit > LOG_INFO) {
+            return 0;
+        }
+#endif
+    }
+#ifdef LOGGER_ASYNC
+    if ((queue = __atomic_load_n(&logger_queue, __ATOMIC_ACQUIRE)) != NULL) {
+        va_start(va, format);
+        ret = logger_enqueue(queue, context, crit, now, format, va);
+        va_end(va);
+
+        return ret;
+    }
+#endif
+    va_start(va, format);
+    len = logger_format(line, sizeof line, format, va);
+    va_end(va);
+
+    return logger_write_locked(context, crit, now, line, len, 1);
+}
+
 int
 logger_noformat(struct ProxyContext_ * const context,
                  const int crit, const char * const msg)
@@ -174,6 +442,7 @@ void systemd_notify(struct ProxyContext_ * const context,
 int
 logger_close(struct ProxyContext_ * const context)
 {
+    logger_async_stop();
 #ifndef _WIN32
     if (context->syslog != 0) {
         closelog();
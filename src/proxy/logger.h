@@ -17,6 +17,10 @@
 # define LOGGER_ALLOWED_BURST_FOR_IDENTICAL_LOG_ENTRIES 5U
 #endif
 
+#ifndef LOGGER_QUEUE_SIZE
+# define LOGGER_QUEUE_SIZE 1024U
+#endif
+
 #ifdef DEBUG
 # define XDEBUG(X) do { X; } while(0)
 #else
@@ -42,6 +46,10 @@ int logger(struct ProxyContext_ * const context,
            const int crit, const char * const format, ...)
            __attribute__ ((format(printf, 3, 4)));
 
+int logger_async_start(struct ProxyContext_ * const context);
+
+void logger_async_stop(void);
+
 int logger_noformat(struct ProxyContext_ * const context,
                     const int crit, const char * const msg);
 
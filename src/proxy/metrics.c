@@ -0,0 +1,854 @@
+
+#include <config.h>
+#include <sys/types.h>
+#ifdef _WIN32
+# include <winsock2.h>
+#else
+# include <sys/socket.h>
+# include <sys/stat.h>
+# include <sys/un.h>
+#endif
+#ifdef HAVE_LINUX_SOCK_DIAG_H
+# include <linux/sock_diag.h>
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+#include <event2/listener.h>
+#include <event2/util.h>
+
+#include "dnscrypt_proxy.h"
+#include "logger.h"
+#include "metrics.h"
+#include "utils.h"
+
+static const struct {
+    const char *le;
+    uint64_t    usec;
+} metrics_histogram_bounds[] = {
+    { "0.0001", 100U },
+    { "0.00025", 250U },
+    { "0.0005", 500U },
+    { "0.001", 1000U },
+    { "0.0025", 2500U },
+    { "0.005", 5000U },
+    { "0.01", 10000U },
+    { "0.025", 25000U },
+    { "0.05", 50000U },
+    { "0.1", 100000U },
+    { "0.25", 250000U },
+    { "0.5", 500000U },
+    { "1", 1000000U },
+    { "2.5", 2500000U },
+    { "5", 5000000U },
+    { "10", 10000000U }
+};
+
+static const struct {
+    const char *name;
+    double      quantile;
+} metrics_quantiles[] = {
+    { "0.5", 0.5 },
+    { "0.9", 0.9 },
+    { "0.99", 0.99 },
+    { "0.999", 0.999 }
+};
+
+uint64_t
+metrics_now(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+        return (uint64_t) ts.tv_sec * 1000000U +
+            (uint64_t) ts.tv_nsec / 1000U;
+    }
+#endif
+    return dnscrypt_hrtime();
+}
+
+static unsigned int
+metrics_msb(uint64_t value)
+{
+    unsigned int msb = 0U;
+
+    while ((value >>= 1) != 0U) {
+        msb++;
+    }
+    return msb;
+}
+
+static size_t
+metrics_histogram_index(uint64_t value)
+{
+    unsigned int shift;
+
+    if (value >= ((uint64_t) 1U << METRICS_HISTOGRAM_MAX_BITS)) {
+        value = ((uint64_t) 1U << METRICS_HISTOGRAM_MAX_BITS) - 1U;
+    }
+    if (value < 2U * METRICS_HISTOGRAM_SUB_BUCKETS) {
+        return (size_t) value;
+    }
+    shift = metrics_msb(value) - METRICS_HISTOGRAM_SUB_BUCKETS_BITS;
+
+    return (size_t) shift * METRICS_HISTOGRAM_SUB_BUCKETS +
+        (size_t) (value >> shift);
+}
+
+static uint64_t
+metrics_histogram_bucket_max(const size_t idx)
+{
+    unsigned int shift;
+    uint64_t     sub;
+
+    if (idx < 2U * METRICS_HISTOGRAM_SUB_BUCKETS) {
+        return (uint64_t) idx;
+    }
+    shift = (unsigned int) (idx / METRICS_HISTOGRAM_SUB_BUCKETS) - 1U;
+    sub = (uint64_t) (idx % METRICS_HISTOGRAM_SUB_BUCKETS) +
+        METRICS_HISTOGRAM_SUB_BUCKETS;
+
+    return ((sub + 1U) << shift) - 1U;
+}
+
+void
+metrics_histogram_record(MetricsHistogram * const histogram,
+                         const uint64_t value)
+{
+    const size_t idx = metrics_histogram_index(value);
+
+    assert(idx < METRICS_HISTOGRAM_BUCKETS);
+    histogram->buckets[idx]++;
+    histogram->count++;
+    histogram->sum += value;
+}
+
+uint64_t
+metrics_histogram_quantile(const MetricsHistogram * const histogram,
+                           const double quantile)
+{
+    uint64_t rank;
+    uint64_t seen = 0U;
+    size_t   i;
+
+    if (histogram->count == 0U) {
+        return 0U;
+    }
+    rank = (uint64_t) (quantile * (double) histogram->count);
+    if (rank >= histogram->count) {
+        rank = histogram->count - 1U;
+    }
+    for (i = 0U; i < METRICS_HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen > rank) {
+            break;
+        }
+    }
+    return metrics_histogram_bucket_max(i);
+}
+
+void
+metrics_callback_done(Metrics * const metrics,
+                      const MetricsCallback callback,
+                      const uint64_t started)
+{
+    MetricsCallbackStats * const stats = &metrics->callbacks[callback];
+    const uint64_t               elapsed = metrics_now() - started;
+
+    stats->calls++;
+    stats->usec += elapsed;
+    if (elapsed > stats->max_usec) {
+        stats->max_usec = elapsed;
+    }
+}
+
+static const char *request_stage_names[REQUEST_STAGES] = {
+    "received", "plugins_pre", "curve", "upstream_send", "upstream",
+    "uncurve", "plugins_post", "send"
+};
+
+static void
+metrics_slow_query_log(ProxyContext * const proxy_context,
+                       const RequestTrace * const trace,
+                       const char * const transport,
+                       const uint64_t request_id, const uint64_t now)
+{
+    char          line[512];
+    size_t        pos;
+    uint64_t      elapsed;
+    uint64_t      last;
+    unsigned int  stage;
+    int           len;
+
+    last = trace->ts[REQUEST_STAGE_RECEIVED];
+    elapsed = now - last;
+    len = evutil_snprintf(line, sizeof line,
+                          "%s id=%" PRIu64 " total=%" PRIu64 ".%03u %s",
+                          transport, request_id, elapsed / 1000U,
+                          (unsigned int) (elapsed % 1000U),
+                          trace->ts[REQUEST_STAGE_REPLIED] != 0U ?
+                          "replied" : "dropped");
+    assert(len > 0 && (size_t) len < sizeof line);
+    pos = (size_t) len;
+    for (stage = REQUEST_STAGE_RECEIVED + 1U; stage < REQUEST_STAGES;
+         stage++) {
+        if (trace->ts[stage] == 0U) {
+            len = evutil_snprintf(line + pos, sizeof line - pos, " %s=-",
+                                  request_stage_names[stage]);
+        } else {
+            elapsed = trace->ts[stage] - last;
+            last = trace->ts[stage];
+            len = evutil_snprintf(line + pos, sizeof line - pos,
+                                  " %s=%" PRIu64 ".%03u",
+                                  request_stage_names[stage],
+                                  elapsed / 1000U,
+                                  (unsigned int) (elapsed % 1000U));
+        }
+        assert(len > 0 && (size_t) len < sizeof line - pos);
+        pos += (size_t) len;
+    }
+    if (proxy_context->slow_query_log_fp == NULL) {
+        logger(proxy_context, LOG_NOTICE, "Slow query: %s", line);
+        return;
+    }
+    fprintf(proxy_context->slow_query_log_fp, "%lu\t%s\n",
+            (unsigned long) time(NULL), line);
+    fflush(proxy_context->slow_query_log_fp);
+}
+
+/*
+ * Called when a request is freed, whether a reply was sent or not.
+ * Requests that took longer than --slow-query-threshold are logged
+ * with the time spent in every stage, in milliseconds.
+ */
+
+void
+metrics_request_done(ProxyContext * const proxy_context,
+                     const RequestTrace * const trace,
+                     const char * const transport,
+                     const uint64_t request_id)
+{
+    Metrics  *metrics = &proxy_context->metrics;
+    uint64_t  end;
+
+    if (trace->ts[REQUEST_STAGE_RECEIVED] == 0U) {
+        return;
+    }
+    if (trace->ts[REQUEST_STAGE_UPSTREAM_REPLIED] != 0U &&
+        trace->ts[REQUEST_STAGE_UPSTREAM_SENT] != 0U) {
+        metrics_histogram_record(&metrics->upstream_rtt,
+                                 REQUEST_TRACE_ELAPSED
+                                 (trace, REQUEST_STAGE_UPSTREAM_SENT,
+                                  REQUEST_STAGE_UPSTREAM_REPLIED));
+    }
+    if ((end = trace->ts[REQUEST_STAGE_REPLIED]) != 0U) {
+        metrics_histogram_record(&metrics->latency,
+                                 REQUEST_TRACE_ELAPSED
+                                 (trace, REQUEST_STAGE_RECEIVED,
+                                  REQUEST_STAGE_REPLIED));
+    }
+    if (proxy_context->slow_query_threshold == 0U) {
+        return;
+    }
+    if (end == 0U) {
+        end = metrics_now();
+    }
+    if (end - trace->ts[REQUEST_STAGE_RECEIVED] >=
+        proxy_context->slow_query_threshold) {
+        metrics_slow_query_log(proxy_context, trace, transport, request_id,
+                               end);
+    }
+}
+
+static void
+metrics_print_counter(struct evbuffer * const buf, const char * const name,
+                      const char * const help, const uint64_t value)
+{
+    evbuffer_add_printf(buf,
+                        "# HELP dnscrypt_proxy_%s %s\n"
+                        "# TYPE dnscrypt_proxy_%s counter\n"
+                        "dnscrypt_proxy_%s %" PRIu64 "\n",
+                        name, help, name, name, value);
+}
+
+static void
+metrics_print_transport_counter(struct evbuffer * const buf,
+                                const char * const name,
+                                const char * const help,
+                                const uint64_t udp_value,
+                                const uint64_t tcp_value)
+{
+    evbuffer_add_printf(buf,
+                        "# HELP dnscrypt_proxy_%s %s\n"
+                        "# TYPE dnscrypt_proxy_%s counter\n"
+                        "dnscrypt_proxy_%s{transport=\"udp\"} %" PRIu64 "\n"
+                        "dnscrypt_proxy_%s{transport=\"tcp\"} %" PRIu64 "\n",
+                        name, help, name, name, udp_value, name, tcp_value);
+}
+
+/*
+ * Bucket boundaries don't exactly match the exported "le" values,
+ * so that cumulative counts can be off by the histogram precision.
+ */
+
+static void
+metrics_print_histogram(struct evbuffer * const buf, const char * const name,
+                        const char * const help,
+                        const MetricsHistogram * const histogram)
+{
+    uint64_t cumulative = 0U;
+    size_t   i = 0U;
+    size_t   j;
+
+    evbuffer_add_printf(buf,
+                        "# HELP dnscrypt_proxy_%s_seconds %s\n"
+                        "# TYPE dnscrypt_proxy_%s_seconds histogram\n",
+                        name, help, name);
+    for (j = 0U; j < sizeof metrics_histogram_bounds /
+             sizeof metrics_histogram_bounds[0]; j++) {
+        while (i < METRICS_HISTOGRAM_BUCKETS &&
+               metrics_histogram_bucket_max(i) <=
+               metrics_histogram_bounds[j].usec) {
+            cumulative += histogram->buckets[i++];
+        }
+        evbuffer_add_printf(buf,
+                            "dnscrypt_proxy_%s_seconds_bucket{le=\"%s\"} %"
+                            PRIu64 "\n",
+                            name, metrics_histogram_bounds[j].le, cumulative);
+    }
+    evbuffer_add_printf(buf,
+                        "dnscrypt_proxy_%s_seconds_bucket{le=\"+Inf\"} %"
+                        PRIu64 "\n"
+                        "dnscrypt_proxy_%s_seconds_sum %" PRIu64 ".%06u\n"
+                        "dnscrypt_proxy_%s_seconds_count %" PRIu64 "\n",
+                        name, histogram->count,
+                        name, histogram->sum / 1000000U,
+                        (unsigned int) (histogram->sum % 1000000U),
+                        name, histogram->count);
+    evbuffer_add_printf(buf,
+                        "# HELP dnscrypt_proxy_%s_quantile_seconds %s "
+                        "(quantiles)\n"
+                        "# TYPE dnscrypt_proxy_%s_quantile_seconds gauge\n",
+                        name, help, name);
+    for (j = 0U; j < sizeof metrics_quantiles /
+             sizeof metrics_quantiles[0]; j++) {
+        const uint64_t value =
+            metrics_histogram_quantile(histogram,
+                                       metrics_quantiles[j].quantile);
+
+        evbuffer_add_printf(buf,
+                            "dnscrypt_proxy_%s_quantile_seconds"
+                            "{quantile=\"%s\"} %" PRIu64 ".%06u\n",
+                            name, metrics_quantiles[j].name,
+                            value / 1000000U,
+                            (unsigned int) (value % 1000000U));
+    }
+}
+
+static void
+metrics_print_callbacks(struct evbuffer * const buf,
+                        const Metrics * const metrics)
+{
+    static const char *names[METRICS_CALLBACKS] = {
+        "udp_client", "udp_resolver", "tcp_connection", "cert"
+    };
+    const MetricsCallbackStats *stats;
+    unsigned int                i;
+
+    evbuffer_add_printf(buf,
+                        "# HELP dnscrypt_proxy_callback_calls_total "
+                        "Event loop callback invocations\n"
+                        "# TYPE dnscrypt_proxy_callback_calls_total counter\n");
+    for (i = 0U; i < METRICS_CALLBACKS; i++) {
+        evbuffer_add_printf(buf,
+                            "dnscrypt_proxy_callback_calls_total"
+                            "{callback=\"%s\"} %" PRIu64 "\n",
+                            names[i], metrics->callbacks[i].calls);
+    }
+    evbuffer_add_printf(buf,
+                        "# HELP dnscrypt_proxy_callback_seconds_total "
+                        "Time spent in event loop callbacks\n"
+                        "# TYPE dnscrypt_proxy_callback_seconds_total "
+                        "counter\n");
+    for (i = 0U; i < METRICS_CALLBACKS; i++) {
+        stats = &metrics->callbacks[i];
+        evbuffer_add_printf(buf,
+                            "dnscrypt_proxy_callback_seconds_total"
+                            "{callback=\"%s\"} %" PRIu64 ".%06u\n",
+                            names[i], stats->usec / 1000000U,
+                            (unsigned int) (stats->usec % 1000000U));
+    }
+    evbuffer_add_printf(buf,
+                        "# HELP dnscrypt_proxy_callback_max_seconds "
+                        "Longest event loop callback run\n"
+                        "# TYPE dnscrypt_proxy_callback_max_seconds gauge\n");
+    for (i = 0U; i < METRICS_CALLBACKS; i++) {
+        stats = &metrics->callbacks[i];
+        evbuffer_add_printf(buf,
+                            "dnscrypt_proxy_callback_max_seconds"
+                            "{callback=\"%s\"} %" PRIu64 ".%06u\n",
+                            names[i], stats->max_usec / 1000000U,
+                            (unsigned int) (stats->max_usec % 1000000U));
+    }
+}
+
+static void
+metrics_print_receive_queues(struct evbuffer * const buf,
+                             const ProxyContext * const proxy_context)
+{
+#if defined(HAVE_LINUX_SOCK_DIAG_H) && defined(SO_MEMINFO)
+    uint32_t  client_meminfo[SK_MEMINFO_VARS];
+    uint32_t  resolver_meminfo[SK_MEMINFO_VARS];
+    socklen_t client_meminfo_len = (socklen_t) sizeof client_meminfo;
+    socklen_t resolver_meminfo_len = (socklen_t) sizeof resolver_meminfo;
+
+    if (proxy_context->udp_listener_handle == -1 ||
+        proxy_context->udp_proxy_resolver_handle == -1 ||
+        getsockopt(proxy_context->udp_listener_handle, SOL_SOCKET,
+                   SO_MEMINFO, client_meminfo, &client_meminfo_len) != 0 ||
+        getsockopt(proxy_context->udp_proxy_resolver_handle, SOL_SOCKET,
+                   SO_MEMINFO, resolver_meminfo, &resolver_meminfo_len) != 0) {
+        return;
+    }
+    evbuffer_add_printf(buf,
+                        "# HELP dnscrypt_proxy_udp_receive_queue_bytes "
+                        "Memory used by datagrams waiting to be read\n"
+                        "# TYPE dnscrypt_proxy_udp_receive_queue_bytes gauge\n"
+                        "dnscrypt_proxy_udp_receive_queue_bytes"
+                        "{socket=\"client\"} %lu\n"
+                        "dnscrypt_proxy_udp_receive_queue_bytes"
+                        "{socket=\"resolver\"} %lu\n"
+                        "# HELP dnscrypt_proxy_udp_receive_buffer_bytes "
+                        "Receive buffer size\n"
+                        "# TYPE dnscrypt_proxy_udp_receive_buffer_bytes gauge\n"
+                        "dnscrypt_proxy_udp_receive_buffer_bytes"
+                        "{socket=\"client\"} %lu\n"
+                        "dnscrypt_proxy_udp_receive_buffer_bytes"
+                        "{socket=\"resolver\"} %lu\n",
+                        (unsigned long) client_meminfo[SK_MEMINFO_RMEM_ALLOC],
+                        (unsigned long) resolver_meminfo[SK_MEMINFO_RMEM_ALLOC],
+                        (unsigned long) client_meminfo[SK_MEMINFO_RCVBUF],
+                        (unsigned long) resolver_meminfo[SK_MEMINFO_RCVBUF]);
+#else
+    (void) buf;
+    (void) proxy_context;
+#endif
+}
+
+static void
+metrics_print_overload_shed(struct evbuffer * const buf,
+                            const Admission * const admission)
+{
+    unsigned int i;
+
+    evbuffer_add_printf(buf,
+                        "# HELP dnscrypt_proxy_overload_shed_total "
+                        "Shedding decisions taken while overloaded\n"
+                        "# TYPE dnscrypt_proxy_overload_shed_total counter\n");
+    for (i = 0U; i < ADMISSION_SHED_REASONS; i++) {
+        evbuffer_add_printf(buf,
+                            "dnscrypt_proxy_overload_shed_total"
+                            "{reason=\"%s\"} %" PRIu64 "\n",
+                            admission_shed_reason_name((AdmissionShedReason) i),
+                            admission->shed[i]);
+    }
+    evbuffer_add_printf(buf,
+                        "# HELP dnscrypt_proxy_active_client_networks "
+                        "Client networks with active requests\n"
+                        "# TYPE dnscrypt_proxy_active_client_networks gauge\n"
+                        "dnscrypt_proxy_active_client_networks %u\n",
+                        admission->active_buckets);
+}
+
+static void
+metrics_print_rate_limited(struct evbuffer * const buf, const RRL * const rrl)
+{
+    unsigned int i;
+
+    evbuffer_add_printf(buf,
+                        "# HELP dnscrypt_proxy_rate_limited_total "
+                        "UDP queries over the per-network rate limit\n"
+                        "# TYPE dnscrypt_proxy_rate_limited_total counter\n");
+    for (i = 0U; i < RRL_ACTIONS; i++) {
+        evbuffer_add_printf(buf,
+                            "dnscrypt_proxy_rate_limited_total"
+                            "{action=\"%s\"} %" PRIu64 "\n",
+                            rrl_action_name((RRLAction) i), rrl->limited[i]);
+    }
+    metrics_print_counter(buf, "rate_limited_clients_total",
+                          "Times a client network went over the rate limit",
+                          rrl->limited_clients);
+}
+
+static void
+metrics_print(struct evbuffer * const buf,
+              const ProxyContext * const proxy_context)
+{
+    const Metrics * const metrics = &proxy_context->metrics;
+
+    metrics_print_transport_counter(buf, "queries_total",
+                                    "Queries received from clients",
+                                    metrics->queries_udp,
+                                    metrics->queries_tcp);
+    metrics_print_transport_counter(buf, "local_replies_total",
+                                    "Queries answered by a plugin without "
+                                    "contacting the resolver",
+                                    metrics->local_replies_udp,
+                                    metrics->local_replies_tcp);
+    metrics_print_transport_counter(buf, "upstream_queries_total",
+                                    "Queries sent to the resolver",
+                                    metrics->upstream_queries_udp,
+                                    metrics->upstream_queries_tcp);
+    metrics_print_transport_counter(buf, "forwarded_queries_total",
+                                    "Queries sent to a resolver chosen by "
+                                    "a forwarding rule",
+                                    metrics->forwarded_queries_udp,
+                                    metrics->forwarded_queries_tcp);
+    metrics_print_transport_counter(buf, "upstream_sent_bytes_total",
+                                    "Encrypted bytes sent to the resolver",
+                                    metrics->upstream_bytes_sent_udp,
+                                    metrics->upstream_bytes_sent_tcp);
+    metrics_print_transport_counter(buf, "upstream_received_bytes_total",
+                                    "Encrypted bytes received from the "
+                                    "resolver",
+                                    metrics->upstream_bytes_received_udp,
+                                    metrics->upstream_bytes_received_tcp);
+    metrics_print_counter(buf, "truncated_total",
+                          "Truncated replies sent to UDP clients",
+                          metrics->truncated);
+    metrics_print_transport_counter(buf, "timeouts_total",
+                                    "Queries the resolver didn't reply to",
+                                    metrics->timeouts_udp,
+                                    metrics->timeouts_tcp);
+    metrics_print_counter(buf, "uncurve_errors_total",
+                          "Resolver replies that couldn't be decrypted",
+                          metrics->uncurve_errors);
+    metrics_print_transport_counter(buf, "overload_kills_total",
+                                    "Active requests dropped to make room "
+                                    "for a new query",
+                                    metrics->overload_kills_udp,
+                                    metrics->overload_kills_tcp);
+    metrics_print_overload_shed(buf, &proxy_context->admission);
+    metrics_print_rate_limited(buf, &proxy_context->rrl);
+    metrics_print_counter(buf, "cert_updates_total",
+                          "Successful certificate updates",
+                          metrics->cert_updates);
+    metrics_print_counter(buf, "failovers_total",
+                          "Switches to a different resolver",
+                          metrics->failovers);
+    evbuffer_add_printf(buf,
+                        "# HELP dnscrypt_proxy_active_requests "
+                        "Requests being processed\n"
+                        "# TYPE dnscrypt_proxy_active_requests gauge\n"
+                        "dnscrypt_proxy_active_requests %u\n"
+                        "# HELP dnscrypt_proxy_max_active_requests "
+                        "Maximum number of simultaneous requests\n"
+                        "# TYPE dnscrypt_proxy_max_active_requests gauge\n"
+                        "dnscrypt_proxy_max_active_requests %u\n",
+                        proxy_context->connections_count,
+                        proxy_context->connections_count_max);
+    metrics_print_histogram(buf, "upstream_rtt",
+                            "Round-trip time to the resolver",
+                            &metrics->upstream_rtt);
+    metrics_print_histogram(buf, "latency",
+                            "Time to reply to a client query",
+                            &metrics->latency);
+    metrics_print_callbacks(buf, metrics);
+    if (metrics->loop_lag_timer != NULL) {
+        metrics_print_histogram(buf, "loop_lag",
+                                "Delay before a timer actually fires",
+                                &metrics->loop_lag);
+    }
+    evbuffer_add_printf(buf,
+                        "# HELP dnscrypt_proxy_udp_receive_drops_total "
+                        "Datagrams dropped because a receive queue was full\n"
+                        "# TYPE dnscrypt_proxy_udp_receive_drops_total "
+                        "counter\n"
+                        "dnscrypt_proxy_udp_receive_drops_total"
+                        "{socket=\"client\"} %lu\n"
+                        "dnscrypt_proxy_udp_receive_drops_total"
+                        "{socket=\"resolver\"} %lu\n",
+                        (unsigned long) metrics->udp_client_drops,
+                        (unsigned long) metrics->udp_resolver_drops);
+    metrics_print_receive_queues(buf, proxy_context);
+}
+
+static void
+metrics_conn_write_cb(struct bufferevent * const bev, void * const fodder)
+{
+    (void) fodder;
+    bufferevent_free(bev);
+}
+
+static void
+metrics_conn_event_cb(struct bufferevent * const bev, const short events,
+                      void * const fodder)
+{
+    (void) events;
+    (void) fodder;
+    bufferevent_free(bev);
+}
+
+static int
+metrics_request_path_matches(const char *request_line, _Bool * const head)
+{
+    static const char path[] = "/metrics";
+
+    *head = 0;
+    if (strncmp(request_line, "GET ", sizeof "GET " - 1U) == 0) {
+        request_line += sizeof "GET " - 1U;
+    } else if (strncmp(request_line, "HEAD ", sizeof "HEAD " - 1U) == 0) {
+        request_line += sizeof "HEAD " - 1U;
+        *head = 1;
+    } else {
+        return 0;
+    }
+    if (strncmp(request_line, path, sizeof path - 1U) != 0) {
+        return 0;
+    }
+    request_line += sizeof path - 1U;
+
+    return *request_line == ' ' || *request_line == '?' || *request_line == 0;
+}
+
+/*
+ * A minimal HTTP/1.0 responder: the request line is only looked at once
+ * the whole header has been received, and the connection is closed after
+ * the reply has been sent.
+ */
+
+static void
+metrics_conn_read_cb(struct bufferevent * const bev,
+                     void * const proxy_context_)
+{
+    ProxyContext    *proxy_context = proxy_context_;
+    struct evbuffer *input = bufferevent_get_input(bev);
+    struct evbuffer *output = bufferevent_get_output(bev);
+    struct evbuffer *body;
+    char            *request_line;
+    _Bool            head;
+
+    if (evbuffer_search(input, "\r\n\r\n", sizeof "\r\n\r\n" - 1U,
+                        NULL).pos < 0 &&
+        evbuffer_search(input, "\n\n", sizeof "\n\n" - 1U, NULL).pos < 0) {
+        if (evbuffer_get_length(input) > METRICS_MAX_REQUEST_SIZE) {
+            bufferevent_free(bev);
+        }
+        return;
+    }
+    bufferevent_disable(bev, EV_READ);
+    if ((request_line = evbuffer_readln(input, NULL,
+                                        EVBUFFER_EOL_CRLF)) == NULL) {
+        bufferevent_free(bev);
+        return;
+    }
+    if (metrics_request_path_matches(request_line, &head) == 0) {
+        free(request_line);
+        evbuffer_add_printf(output,
+                            "HTTP/1.0 404 Not Found\r\n"
+                            "Content-Length: 0\r\n"
+                            "Connection: close\r\n\r\n");
+        return;
+    }
+    free(request_line);
+    if ((body = evbuffer_new()) == NULL) {
+        bufferevent_free(bev);
+        return;
+    }
+    metrics_print(body, proxy_context);
+    evbuffer_add_printf(output,
+                        "HTTP/1.0 200 OK\r\n"
+                        "Content-Type: text/plain; version=0.0.4\r\n"
+                        "Content-Length: %lu\r\n"
+                        "Connection: close\r\n\r\n",
+                        (unsigned long) evbuffer_get_length(body));
+    if (head == 0) {
+        evbuffer_add_buffer(output, body);
+    }
+    evbuffer_free(body);
+}
+
+static void
+metrics_accept_cb(struct evconnlistener * const listener,
+                  evutil_socket_t handle, struct sockaddr * const sa,
+                  const int sa_len, void * const proxy_context_)
+{
+    ProxyContext       *proxy_context = proxy_context_;
+    struct bufferevent *bev;
+    const struct timeval tv = {
+        .tv_sec = (time_t) METRICS_REQUEST_TIMEOUT, .tv_usec = 0
+    };
+
+    (void) listener;
+    (void) sa;
+    (void) sa_len;
+    if ((bev = bufferevent_socket_new(proxy_context->event_loop, handle,
+                                      BEV_OPT_CLOSE_ON_FREE)) == NULL) {
+        evutil_closesocket(handle);
+        return;
+    }
+    bufferevent_setcb(bev, metrics_conn_read_cb, metrics_conn_write_cb,
+                      metrics_conn_event_cb, proxy_context);
+    bufferevent_set_timeouts(bev, &tv, &tv);
+    bufferevent_enable(bev, EV_READ);
+}
+
+static void
+metrics_loop_lag_schedule(Metrics * const metrics)
+{
+    const struct timeval tv = {
+        .tv_sec = (time_t) (METRICS_LOOP_LAG_INTERVAL_MS / 1000U),
+        .tv_usec = (suseconds_t) (METRICS_LOOP_LAG_INTERVAL_MS % 1000U) * 1000
+    };
+
+    metrics->loop_lag_expected =
+        metrics_now() + METRICS_LOOP_LAG_INTERVAL_MS * 1000U;
+    evtimer_add(metrics->loop_lag_timer, &tv);
+}
+
+static void
+metrics_loop_lag_cb(evutil_socket_t handle, const short event,
+                    void * const metrics_)
+{
+    Metrics * const metrics = metrics_;
+    const uint64_t  now = metrics_now();
+
+    (void) handle;
+    (void) event;
+    metrics_histogram_record(&metrics->loop_lag,
+                             now > metrics->loop_lag_expected ?
+                             now - metrics->loop_lag_expected : 0U);
+    metrics_loop_lag_schedule(metrics);
+}
+
+#ifndef _WIN32
+static evutil_socket_t
+metrics_unix_socket(ProxyContext * const proxy_context,
+                    const char * const path)
+{
+    struct sockaddr_un sa_un;
+    struct stat        st;
+    evutil_socket_t    handle;
+
+    memset(&sa_un, 0, sizeof sa_un);
+    sa_un.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof sa_un.sun_path) {
+        logger(proxy_context, LOG_ERR, "Metrics socket path too long: [%s]",
+               path);
+        return -1;
+    }
+    strcpy(sa_un.sun_path, path);
+
+    /*
+     * A socket left over by a previous instance is replaced, but anything
+     * else at that path is left alone.
+     */
+    if (lstat(path, &st) == 0) {
+        if (! S_ISSOCK(st.st_mode)) {
+            logger(proxy_context, LOG_ERR,
+                   "[%s] already exists and is not a socket", path);
+            return -1;
+        }
+        if (unlink(path) != 0) {
+            logger_error(proxy_context, "unlink()");
+            return -1;
+        }
+    } else if (errno != ENOENT) {
+        logger_error(proxy_context, "lstat()");
+        return -1;
+    }
+    if ((handle = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        logger_error(proxy_context, "socket(AF_UNIX)");
+        return -1;
+    }
+    if (bind(handle, (struct sockaddr *) &sa_un, sizeof sa_un) != 0) {
+        logger(proxy_context, LOG_ERR, "Unable to bind the metrics socket [%s]",
+               path);
+        evutil_closesocket(handle);
+        return -1;
+    }
+    evutil_make_socket_closeonexec(handle);
+    evutil_make_socket_nonblocking(handle);
+
+    return handle;
+}
+#endif
+
+int
+metrics_bind(ProxyContext * const proxy_context)
+{
+    Metrics    *metrics = &proxy_context->metrics;
+    const char *address = proxy_context->metrics_address;
+
+    if (address == NULL) {
+        return 0;
+    }
+    assert(metrics->listener == NULL);
+    if (strncmp(address, METRICS_UNIX_PREFIX,
+                sizeof METRICS_UNIX_PREFIX - 1U) == 0) {
+#ifdef _WIN32
+        logger_noformat(proxy_context, LOG_ERR,
+                        "Unix sockets are not supported on this platform");
+        return -1;
+#else
+        evutil_socket_t handle;
+
+        if ((handle = metrics_unix_socket
+             (proxy_context, address + sizeof METRICS_UNIX_PREFIX - 1U)) == -1) {
+            return -1;
+        }
+        if ((metrics->listener = evconnlistener_new
+             (proxy_context->event_loop, metrics_accept_cb, proxy_context,
+              LEV_OPT_CLOSE_ON_FREE | LEV_OPT_CLOSE_ON_EXEC,
+              METRICS_LISTEN_BACKLOG, handle)) == NULL) {
+            evutil_closesocket(handle);
+            return -1;
+        }
+#endif
+    } else if ((metrics->listener = evconnlistener_new_bind
+                (proxy_context->event_loop, metrics_accept_cb, proxy_context,
+                 LEV_OPT_CLOSE_ON_FREE | LEV_OPT_CLOSE_ON_EXEC |
+                 LEV_OPT_REUSEABLE, METRICS_LISTEN_BACKLOG,
+                 (struct sockaddr *) &proxy_context->metrics_sockaddr,
+                 (int) proxy_context->metrics_sockaddr_len)) == NULL) {
+        logger(proxy_context, LOG_ERR,
+               "Unable to bind the metrics endpoint [%s]", address);
+        return -1;
+    }
+    if ((metrics->loop_lag_timer =
+         evtimer_new(proxy_context->event_loop,
+                     metrics_loop_lag_cb, metrics)) != NULL) {
+        metrics_loop_lag_schedule(metrics);
+    }
+    logger(proxy_context, LOG_INFO, "Metrics available at [%s]", address);
+
+    return 0;
+}
+
+void
+metrics_stop(ProxyContext * const proxy_context)
+{
+    Metrics *metrics = &proxy_context->metrics;
+
+    if (metrics->loop_lag_timer != NULL) {
+        event_free(metrics->loop_lag_timer);
+        metrics->loop_lag_timer = NULL;
+    }
+    if (metrics->listener == NULL) {
+        return;
+    }
+    evconnlistener_free(metrics->listener);
+    metrics->listener = NULL;
+}
@@ -0,0 +1,146 @@
+
+#ifndef __METRICS_H__
+#define __METRICS_H__ 1
+
+#include <stdint.h>
+
+/*
+ * Latencies are recorded in microseconds into log-linear buckets:
+ * values below 2 * METRICS_HISTOGRAM_SUB_BUCKETS get their own bucket,
+ * larger values share a bucket with values having the same
+ * METRICS_HISTOGRAM_SUB_BUCKETS_BITS + 1 most significant bits,
+ * so that the relative error never exceeds 1/16th.
+ */
+#define METRICS_HISTOGRAM_SUB_BUCKETS_BITS 4U
+#define METRICS_HISTOGRAM_SUB_BUCKETS (1U << METRICS_HISTOGRAM_SUB_BUCKETS_BITS)
+#define METRICS_HISTOGRAM_MAX_BITS 32U
+#define METRICS_HISTOGRAM_BUCKETS \
+    ((METRICS_HISTOGRAM_MAX_BITS - METRICS_HISTOGRAM_SUB_BUCKETS_BITS + 1U) * \
+     METRICS_HISTOGRAM_SUB_BUCKETS)
+
+#define METRICS_UNIX_PREFIX "unix:"
+
+#ifndef METRICS_DEFAULT_PORT
+# define METRICS_DEFAULT_PORT "9153"
+#endif
+
+#ifndef METRICS_LISTEN_BACKLOG
+# define METRICS_LISTEN_BACKLOG 16
+#endif
+
+#ifndef METRICS_REQUEST_TIMEOUT
+# define METRICS_REQUEST_TIMEOUT 5
+#endif
+
+#define METRICS_MAX_REQUEST_SIZE 8192U
+
+#ifndef METRICS_LOOP_LAG_INTERVAL_MS
+# define METRICS_LOOP_LAG_INTERVAL_MS 100U
+#endif
+
+typedef struct MetricsHistogram_ {
+    uint64_t buckets[METRICS_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+} MetricsHistogram;
+
+/*
+ * Monotonic timestamps of the stages a request went through, used to
+ * find out where the time was spent when a request is slow.
+ * A zero timestamp means that the stage hasn't been reached.
+ */
+
+typedef enum RequestStage_ {
+    REQUEST_STAGE_RECEIVED,
+    REQUEST_STAGE_PLUGINS_PRE_DONE,
+    REQUEST_STAGE_CURVE_DONE,
+    REQUEST_STAGE_UPSTREAM_SENT,
+    REQUEST_STAGE_UPSTREAM_REPLIED,
+    REQUEST_STAGE_UNCURVE_DONE,
+    REQUEST_STAGE_PLUGINS_POST_DONE,
+    REQUEST_STAGE_REPLIED,
+    REQUEST_STAGES
+} RequestStage;
+
+typedef struct RequestTrace_ {
+    uint64_t ts[REQUEST_STAGES];
+} RequestTrace;
+
+#define REQUEST_TRACE_MARK(T, S) ((T)->ts[(S)] = metrics_now())
+
+#define REQUEST_TRACE_ELAPSED(T, FROM, TO) ((T)->ts[(TO)] - (T)->ts[(FROM)])
+
+/*
+ * Event loop callbacks whose running time is accounted for.
+ * Everything runs in a single thread, so the time spent in a callback
+ * delays all other timers and sockets.
+ */
+
+typedef enum MetricsCallback_ {
+    METRICS_CALLBACK_UDP_CLIENT,
+    METRICS_CALLBACK_UDP_RESOLVER,
+    METRICS_CALLBACK_TCP_CONNECTION,
+    METRICS_CALLBACK_CERT,
+    METRICS_CALLBACKS
+} MetricsCallback;
+
+typedef struct MetricsCallbackStats_ {
+    uint64_t calls;
+    uint64_t usec;
+    uint64_t max_usec;
+} MetricsCallbackStats;
+
+typedef struct Metrics_ {
+    MetricsHistogram       upstream_rtt;
+    MetricsHistogram       latency;
+    MetricsHistogram       loop_lag;
+    MetricsCallbackStats   callbacks[METRICS_CALLBACKS];
+    struct evconnlistener *listener;
+    struct event          *loop_lag_timer;
+    uint64_t               loop_lag_expected;
+    uint64_t               queries_udp;
+    uint64_t               queries_tcp;
+    uint64_t               truncated;
+    uint64_t               timeouts_udp;
+    uint64_t               timeouts_tcp;
+    uint64_t               uncurve_errors;
+    uint64_t               overload_kills_udp;
+    uint64_t               overload_kills_tcp;
+    uint64_t               cert_updates;
+    uint64_t               failovers;
+    uint64_t               local_replies_udp;
+    uint64_t               local_replies_tcp;
+    uint64_t               upstream_queries_udp;
+    uint64_t               upstream_queries_tcp;
+    uint64_t               forwarded_queries_udp;
+    uint64_t               forwarded_queries_tcp;
+    uint64_t               upstream_bytes_sent_udp;
+    uint64_t               upstream_bytes_sent_tcp;
+    uint64_t               upstream_bytes_received_udp;
+    uint64_t               upstream_bytes_received_tcp;
+    uint32_t               udp_client_drops;
+    uint32_t               udp_resolver_drops;
+} Metrics;
+
+uint64_t metrics_now(void);
+
+void metrics_histogram_record(MetricsHistogram * const histogram,
+                              const uint64_t value);
+
+uint64_t metrics_histogram_quantile(const MetricsHistogram * const histogram,
+                                    const double quantile);
+
+void metrics_callback_done(Metrics * const metrics,
+                           const MetricsCallback callback,
+                           const uint64_t started);
+
+struct ProxyContext_;
+void metrics_request_done(struct ProxyContext_ * const proxy_context,
+                          const RequestTrace * const trace,
+                          const char * const transport,
+                          const uint64_t request_id);
+
+int metrics_bind(struct ProxyContext_ * const proxy_context);
+void metrics_stop(struct ProxyContext_ * const proxy_context);
+
+#endif
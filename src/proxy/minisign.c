@@ -0,0 +1,197 @@
+
+#include <config.h>
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sodium.h>
+
+#include "minisign.h"
+#include "utils.h"
+
+#define MINISIGN_ALG_LEGACY    "Ed"
+#define MINISIGN_ALG_PREHASHED "ED"
+#define MINISIGN_ALG_BYTES     2U
+#define MINISIGN_PREHASH_BYTES 64U
+
+#define MINISIGN_UNTRUSTED_PREFIX "untrusted comment: "
+#define MINISIGN_TRUSTED_PREFIX   "trusted comment: "
+
+typedef struct MinisignPublicKey_ {
+    unsigned char alg[MINISIGN_ALG_BYTES];
+    unsigned char key_id[MINISIGN_KEY_ID_BYTES];
+    unsigned char key[crypto_sign_ed25519_PUBLICKEYBYTES];
+} MinisignPublicKey;
+
+typedef struct MinisignSignature_ {
+    unsigned char alg[MINISIGN_ALG_BYTES];
+    unsigned char key_id[MINISIGN_KEY_ID_BYTES];
+    unsigned char sig[crypto_sign_ed25519_BYTES];
+} MinisignSignature;
+
+static int
+minisign_base64_value(const int c)
+{
+    if (c >= 'A' && c <= 'Z') {
+        return c - 'A';
+    }
+    if (c >= 'a' && c <= 'z') {
+        return c - 'a' + 26;
+    }
+    if (c >= '0' && c <= '9') {
+        return c - '0' + 52;
+    }
+    if (c == '+') {
+        return 62;
+    }
+    if (c == '/') {
+        return 63;
+    }
+    return -1;
+}
+
+/* Padded base64, as written by minisign; decodes exactly bin_len bytes */
+
+static int
+minisign_base64_decode(unsigned char * const bin, const size_t bin_len,
+                       const char * const b64, size_t b64_len)
+{
+    uint32_t acc = 0U;
+    size_t   acc_bits = (size_t) 0U;
+    size_t   i;
+    size_t   pos = (size_t) 0U;
+    int      value;
+
+    while (b64_len > (size_t) 0U && b64[b64_len - 1U] == '=') {
+        b64_len--;
+    }
+    for (i = (size_t) 0U; i < b64_len; i++) {
+        if ((value = minisign_base64_value((unsigned char) b64[i])) < 0) {
+            return -1;
+        }
+        acc = (acc << 6) | (uint32_t) value;
+        acc_bits += 6U;
+        if (acc_bits >= 8U) {
+            acc_bits -= 8U;
+            if (pos >= bin_len) {
+                return -1;
+            }
+            bin[pos++] = (unsigned char) (acc >> acc_bits);
+        }
+    }
+    if (pos != bin_len) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Returns the length of the line starting at line, and where the next one starts */
+
+static size_t
+minisign_line(const char * const line, const char ** const next_p)
+{
+    size_t line_len = strcspn(line, "\n");
+
+    *next_p = line + line_len + (line[line_len] == '\n');
+    if (line_len > (size_t) 0U && line[line_len - 1U] == '\r') {
+        line_len--;
+    }
+    return line_len;
+}
+
+int
+minisign_verify(const char * const pubkey_s,
+                const unsigned char * const message, const size_t message_len,
+                const char * const sig_s,
+                char trusted_comment[MINISIGN_MAX_COMMENT_LEN],
+                const char ** const error_p)
+{
+    unsigned char      global_signed[crypto_sign_ed25519_BYTES +
+                                     MINISIGN_MAX_COMMENT_LEN];
+    unsigned char      global_sig[crypto_sign_ed25519_BYTES];
+    unsigned char      prehash[MINISIGN_PREHASH_BYTES];
+    MinisignPublicKey  pk;
+    MinisignSignature  sig;
+    const char        *line = sig_s;
+    const char        *next;
+    size_t             line_len;
+    size_t             comment_len;
+
+    COMPILER_ASSERT(sizeof pk == MINISIGN_ALG_BYTES + MINISIGN_KEY_ID_BYTES +
+                    crypto_sign_ed25519_PUBLICKEYBYTES);
+    COMPILER_ASSERT(sizeof sig == MINISIGN_ALG_BYTES + MINISIGN_KEY_ID_BYTES +
+                    crypto_sign_ed25519_BYTES);
+    *trusted_comment = 0;
+    if (minisign_base64_decode((unsigned char *) (void *) &pk, sizeof pk,
+                               pubkey_s, strlen(pubkey_s)) != 0 ||
+        memcmp(pk.alg, MINISIGN_ALG_LEGACY, MINISIGN_ALG_BYTES) != 0) {
+        *error_p = "Unsupported public key";
+        return -1;
+    }
+    line_len = minisign_line(line, &next);
+    if (line_len < sizeof MINISIGN_UNTRUSTED_PREFIX - 1U ||
+        memcmp(line, MINISIGN_UNTRUSTED_PREFIX,
+               sizeof MINISIGN_UNTRUSTED_PREFIX - 1U) != 0) {
+        *error_p = "Unsupported signature format";
+        return -1;
+    }
+    line = next;
+    line_len = minisign_line(line, &next);
+    if (minisign_base64_decode((unsigned char *) (void *) &sig, sizeof sig,
+                               line, line_len) != 0 ||
+        (memcmp(sig.alg, MINISIGN_ALG_LEGACY, MINISIGN_ALG_BYTES) != 0 &&
+         memcmp(sig.alg, MINISIGN_ALG_PREHASHED, MINISIGN_ALG_BYTES) != 0)) {
+        *error_p = "Unsupported signature format";
+        return -1;
+    }
+    line = next;
+    line_len = minisign_line(line, &next);
+    if (line_len < sizeof MINISIGN_TRUSTED_PREFIX - 1U ||
+        memcmp(line, MINISIGN_TRUSTED_PREFIX,
+               sizeof MINISIGN_TRUSTED_PREFIX - 1U) != 0 ||
+        (comment_len = line_len - (sizeof MINISIGN_TRUSTED_PREFIX - 1U)) >=
+        MINISIGN_MAX_COMMENT_LEN) {
+        *error_p = "Unsupported signature format";
+        return -1;
+    }
+    memcpy(global_signed + sizeof sig.sig,
+           line + sizeof MINISIGN_TRUSTED_PREFIX - 1U, comment_len);
+    line = next;
+    line_len = minisign_line(line, &next);
+    if (minisign_base64_decode(global_sig, sizeof global_sig,
+                               line, line_len) != 0) {
+        *error_p = "Unsupported signature format";
+        return -1;
+    }
+    if (memcmp(sig.key_id, pk.key_id, MINISIGN_KEY_ID_BYTES) != 0) {
+        *error_p = "Signature made with a different key";
+        return -1;
+    }
+    if (memcmp(sig.alg, MINISIGN_ALG_PREHASHED, MINISIGN_ALG_BYTES) == 0) {
+        crypto_generichash(prehash, sizeof prehash, message,
+                           (unsigned long long) message_len, NULL, 0U);
+        if (crypto_sign_ed25519_verify_detached(sig.sig, prehash,
+                                                sizeof prehash, pk.key) != 0) {
+            *error_p = "Invalid signature";
+            return -1;
+        }
+    } else if (crypto_sign_ed25519_verify_detached
+               (sig.sig, message, (unsigned long long) message_len,
+                pk.key) != 0) {
+        *error_p = "Invalid signature";
+        return -1;
+    }
+    memcpy(global_signed, sig.sig, sizeof sig.sig);
+    if (crypto_sign_ed25519_verify_detached
+        (global_sig, global_signed,
+         (unsigned long long) (sizeof sig.sig + comment_len), pk.key) != 0) {
+        *error_p = "Invalid trusted comment signature";
+        return -1;
+    }
+    memcpy(trusted_comment, global_signed + sizeof sig.sig, comment_len);
+    trusted_comment[comment_len] = 0;
+
+    return 0;
+}
@@ -0,0 +1,24 @@
+
+#ifndef __MINISIGN_H__
+#define __MINISIGN_H__ 1
+
+#include <stdlib.h>
+
+/*
+ * Verification of minisign signatures, as published alongside the
+ * resolvers list. Both the legacy signatures (computed over the file
+ * itself) and the prehashed ones (computed over its BLAKE2b-512 hash)
+ * are supported, and the trusted comment has to be signed as well.
+ */
+
+#define MINISIGN_KEY_ID_BYTES 8U
+#define MINISIGN_MAX_COMMENT_LEN 1024U
+
+int minisign_verify(const char * const pubkey_s,
+                    const unsigned char * const message,
+                    const size_t message_len,
+                    const char * const sig_s,
+                    char trusted_comment[MINISIGN_MAX_COMMENT_LEN],
+                    const char ** const error_p);
+
+#endif
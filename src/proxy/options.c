@@ -5,6 +5,8 @@
 # include <winsock2.h>
 #else
 # include <sys/socket.h>
+# include <netinet/in.h>
+# include <netinet/tcp.h>
 #endif
 
 #include <assert.h>
@@ -25,7 +27,10 @@
 #include "options.h"
 #include "logger.h"
 #include "minicsv.h"
+#include "minisign.h"
 #include "pid_file.h"
+#include "resolver_probe.h"
+#include "resolvers_db.h"
 #include "simpleconf.h"
 #include "simpleconf_dnscrypt.h"
 #include "utils.h"
@@ -43,8 +48,13 @@ static struct option getopt_long_options[] = {
     { "ephemeral-keys", 0, NULL, 'E' },
     { "client-key", 1, NULL, 'K' },
     { "resolvers-list", 1, NULL, 'L' },
+    { "resolvers-list-pubkey", 1, NULL, OPTION_RESOLVERS_LIST_PUBKEY },
+    { "compile-resolvers-list", 0, NULL, OPTION_COMPILE_RESOLVERS_LIST },
+    { "standby-resolvers", 1, NULL, OPTION_STANDBY_RESOLVERS },
+    { "forwarding-rules", 1, NULL, OPTION_FORWARDING_RULES },
     { "logfile", 1, NULL, 'l' },
     { "loglevel", 1, NULL, 'm' },
+    { "metrics", 1, NULL, 'M' },
 #ifndef _WIN32
     { "pidfile", 1, NULL, 'p' },
 #endif
@@ -61,6 +71,15 @@ static struct option getopt_long_options[] = {
     { "test", 1, NULL, 't' },
     { "tcp-only", 0, NULL, 'T' },
     { "edns-payload-size", 1, NULL, 'e' },
+    { "slow-query-log", 1, NULL, OPTION_SLOW_QUERY_LOG },
+    { "slow-query-threshold", 1, NULL, OPTION_SLOW_QUERY_THRESHOLD },
+    { "tcp-idle-timeout", 1, NULL, OPTION_TCP_IDLE_TIMEOUT },
+    { "tcp-fast-open", 0, NULL, OPTION_TCP_FAST_OPEN },
+    { "overload-delay-target", 1, NULL, OPTION_OVERLOAD_DELAY_TARGET },
+    { "rate-limit", 1, NULL, OPTION_RATE_LIMIT },
+    { "rate-limit-ipv4-prefix", 1, NULL, OPTION_RATE_LIMIT_IPV4_PREFIX },
+    { "rate-limit-ipv6-prefix", 1, NULL, OPTION_RATE_LIMIT_IPV6_PREFIX },
+    { "rate-limit-action", 1, NULL, OPTION_RATE_LIMIT_ACTION },
     { "ignore-timestamps", 0, NULL, 'I' },
     { "version", 0, NULL, 'V' },
     { "help", 0, NULL, 'h' },
@@ -75,9 +94,9 @@ static struct option getopt_long_options[] = {
     { NULL, 0, NULL, 0 }
 };
 #ifndef _WIN32
-static const char *getopt_options = "a:de:EhIk:K:L:l:m:n:p:r:R:St:u:N:TVX:Z:";
+static const char *getopt_options = "a:de:EhIk:K:L:l:m:M:n:p:r:R:St:u:N:TVX:Z:";
 #else
-static const char *getopt_options = "a:e:EhIk:K:L:l:m:n:r:R:t:u:N:TVX:";
+static const char *getopt_options = "a:e:EhIk:K:L:l:m:M:n:r:R:t:u:N:TVX:";
 #endif
 
 #ifndef DEFAULT_CONNECTIONS_COUNT_MAX
@@ -118,28 +137,43 @@ void options_init_with_default(AppContext * const app_context,
     proxy_context->app_context = app_context;
     proxy_context->connections_count = 0U;
     proxy_context->connections_count_max = DEFAULT_CONNECTIONS_COUNT_MAX;
+    proxy_context->overload_delay_target = ADMISSION_DELAY_TARGET_MS;
+    proxy_context->rate_limit = 0U;
+    proxy_context->rate_limit_ipv4_prefix = RRL_IPV4_PREFIX;
+    proxy_context->rate_limit_ipv6_prefix = RRL_IPV6_PREFIX;
+    proxy_context->rate_limit_action = RRL_ACTION_TRUNCATE;
     proxy_context->edns_payload_size = (size_t) DNS_DEFAULT_EDNS_PAYLOAD_SIZE;
     proxy_context->client_key_file = NULL;
+    proxy_context->forwarding_rules = NULL;
     proxy_context->local_ip = "127.0.0.1:53";
     proxy_context->log_fp = NULL;
     proxy_context->log_file = NULL;
+    proxy_context->metrics_address = NULL;
     proxy_context->pid_file = NULL;
     proxy_context->resolvers_list = DEFAULT_RESOLVERS_LIST;
+    proxy_context->resolvers_list_pubkey = DEFAULT_RESOLVERS_LIST_PUBKEY;
     proxy_context->resolver_name = DEFAULT_RESOLVER_NAME;
     proxy_context->provider_name = NULL;
     proxy_context->provider_publickey_s = NULL;
     proxy_context->resolver_ip = NULL;
+    proxy_context->slow_query_log_fp = NULL;
+    proxy_context->slow_query_log_file = NULL;
+    proxy_context->slow_query_threshold = (uint64_t) 0U;
+    proxy_context->standby_resolvers = NULL;
     proxy_context->syslog = 0;
     proxy_context->syslog_prefix = NULL;
+    proxy_context->tcp_idle_timeout = (time_t) TCP_IDLE_TIMEOUT;
 #ifndef _WIN32
     proxy_context->user_name = NULL;
     proxy_context->user_id = (uid_t) 0;
     proxy_context->user_group = (uid_t) 0;
     proxy_context->user_dir = NULL;
 #endif
+    proxy_context->compile_resolvers_list = 0;
     proxy_context->daemonize = 0;
     proxy_context->test_cert_margin = (time_t) -1;
     proxy_context->test_only = 0;
+    proxy_context->tcp_fast_open = 0;
     proxy_context->tcp_only = 0;
     proxy_context->ephemeral_keys = 0;
     proxy_context->ignore_timestamps = 0;
@@ -160,7 +194,7 @@ options_check_protocol_versions(const char * const provider_name)
 }
 
 static char *
-options_read_file(const char * const file_name)
+options_read_file(const char * const file_name, size_t * const file_size_p)
 {
     FILE   *fp;
     char   *file_buf;
@@ -170,7 +204,7 @@ options_read_file(const char * const file_name)
     if ((fp = fopen(file_name, "rb")) == NULL) {
         return NULL;
     }
-    while (fgetc(fp) != EOF && file_size < SIZE_MAX) {
+    while (fgetc(fp) != EOF && file_size < SIZE_MAX - 1U) {
         file_size++;
     }
     if (feof(fp) == 0 || file_size <= (size_t) 0U) {
@@ -178,7 +212,7 @@ options_read_file(const char * const file_name)
         return NULL;
     }
     rewind(fp);
-    if ((file_buf = malloc(file_size)) == NULL) {
+    if ((file_buf = malloc(file_size + 1U)) == NULL) {
         fclose(fp);
         return NULL;
     }
@@ -188,6 +222,10 @@ options_read_file(const char * const file_name)
         return NULL;
     }
     (void) fclose(fp);
+    file_buf[file_size] = 0;
+    if (file_size_p != NULL) {
+        *file_size_p = file_size;
+    }
 
     return file_buf;
 }
@@ -212,40 +250,18 @@ options_get_col(char * const * const headers, const size_t headers_count,
 }
 
 static int
-options_parse_resolver(ProxyContext * const proxy_context,
-                       char * const * const headers, const size_t headers_count,
-                       char * const * const cols, const size_t cols_count)
-{
-    const char *dnssec;
-    const char *namecoin;
-    const char *nologs;
-    const char *provider_name;
-    const char *provider_publickey_s;
-    const char *resolver_ip;
-    const char *resolver_name;
-
-    resolver_name = options_get_col(headers, headers_count,
-                                    cols, cols_count, "Name");
-    if (resolver_name == NULL) {
-        logger(proxy_context, LOG_ERR,
-               "Invalid resolvers list file: missing 'Name' column");
-        exit(1);
-    }
-    if (*resolver_name == 0) {
-        logger(proxy_context, LOG_ERR, "Resolver with an empty name");
-        return -1;
-    }
-    if (evutil_ascii_strcasecmp(resolver_name,
-                                proxy_context->resolver_name) != 0) {
-        return 0;
-    }
-    provider_name = options_get_col(headers, headers_count,
-                                    cols, cols_count, "Provider name");
-    provider_publickey_s = options_get_col(headers, headers_count,
-                                           cols, cols_count,
-                                           "Provider public key");
-    resolver_ip = options_get_col(headers, headers_count,
-                                  cols, cols_count, "Resolver address");
+options_use_resolver(ProxyContext * const proxy_context,
+                     const ResolversDBEntry * const entry)
+{
+    const char *dnssec = entry->fields[RESOLVERS_DB_FIELD_DNSSEC];
+    const char *namecoin = entry->fields[RESOLVERS_DB_FIELD_NAMECOIN];
+    const char *nologs = entry->fields[RESOLVERS_DB_FIELD_NOLOGS];
+    const char *provider_name = entry->fields[RESOLVERS_DB_FIELD_PROVIDER_NAME];
+    const char *provider_publickey_s =
+        entry->fields[RESOLVERS_DB_FIELD_PROVIDER_PUBLICKEY];
+    const char *resolver_ip = entry->fields[RESOLVERS_DB_FIELD_RESOLVER_ADDRESS];
+    const char *resolver_name = entry->fields[RESOLVERS_DB_FIELD_NAME];
+
     if (provider_name == NULL || *provider_name == 0) {
         logger(proxy_context, LOG_ERR,
                "Resolvers list is missing a provider name for [%s]",
@@ -264,8 +280,6 @@ options_parse_resolver(ProxyContext * const proxy_context,
                resolver_name);
         return -1;
     }
-    dnssec = options_get_col(headers, headers_count,
-                             cols, cols_count, "DNSSEC validation");
     if (dnssec != NULL && evutil_ascii_strcasecmp(dnssec, "yes") != 0) {
         logger(proxy_context, LOG_INFO,
                "- [%s] does not support DNS Security Extensions",
@@ -274,14 +288,10 @@ options_parse_resolver(ProxyContext * const proxy_context,
         logger(proxy_context, LOG_INFO,
                "+ DNS Security Extensions are supported");
     }
-    namecoin = options_get_col(headers, headers_count,
-                               cols, cols_count, "Namecoin");
     if (namecoin != NULL && evutil_ascii_strcasecmp(namecoin, "yes") == 0) {
         logger(proxy_context, LOG_INFO,
                "+ Namecoin domains can be resolved");
     }
-    nologs = options_get_col(headers, headers_count,
-                             cols, cols_count, "No logs");
     if (nologs != NULL && evutil_ascii_strcasecmp(nologs, "no") == 0) {
         logger(proxy_context, LOG_WARNING,
                "- [%s] logs your activity - "
@@ -297,22 +307,67 @@ options_parse_resolver(ProxyContext * const proxy_context,
     proxy_context->resolver_ip = strdup(resolver_ip);
     if (proxy_context->provider_name == NULL ||
         proxy_context->provider_publickey_s == NULL ||
-        proxy_context->resolver_ip == NULL) {
+        proxy_context->resolver_ip == NULL ||
+        failover_add_resolver(proxy_context, entry) != 0) {
         logger_noformat(proxy_context, LOG_EMERG, "Out of memory");
         exit(1);
     }
     return 1;
 }
 
+typedef int (*OptionsResolverCallback)(ProxyContext * const proxy_context,
+                                       const ResolversDBEntry * const entry,
+                                       void * const user_data);
+
+static int
+options_parse_resolver(ProxyContext * const proxy_context,
+                       char * const * const headers, const size_t headers_count,
+                       char * const * const cols, const size_t cols_count,
+                       OptionsResolverCallback cb, void * const user_data)
+{
+    static const char * const headers_names[RESOLVERS_DB_FIELDS] = {
+        [RESOLVERS_DB_FIELD_NAME] = "Name",
+        [RESOLVERS_DB_FIELD_PROVIDER_NAME] = "Provider name",
+        [RESOLVERS_DB_FIELD_PROVIDER_PUBLICKEY] = "Provider public key",
+        [RESOLVERS_DB_FIELD_RESOLVER_ADDRESS] = "Resolver address",
+        [RESOLVERS_DB_FIELD_DNSSEC] = "DNSSEC validation",
+        [RESOLVERS_DB_FIELD_NAMECOIN] = "Namecoin",
+        [RESOLVERS_DB_FIELD_NOLOGS] = "No logs"
+    };
+    ResolversDBEntry entry;
+    unsigned int     i;
+
+    for (i = 0U; i < RESOLVERS_DB_FIELDS; i++) {
+        entry.fields[i] = options_get_col(headers, headers_count,
+                                          cols, cols_count, headers_names[i]);
+    }
+    if (entry.fields[RESOLVERS_DB_FIELD_NAME] == NULL) {
+        logger(proxy_context, LOG_ERR,
+               "Invalid resolvers list file: missing 'Name' column");
+        exit(1);
+    }
+    if (*entry.fields[RESOLVERS_DB_FIELD_NAME] == 0) {
+        logger(proxy_context, LOG_ERR, "Resolver with an empty name");
+        return -1;
+    }
+    return cb(proxy_context, &entry, user_data);
+}
+
+/*
+ * Calls cb() for every resolver of the list, until it returns a positive
+ * value. Returns 1 if it did, 0 if the end of the list was reached, and
+ * -1 if the file doesn't look like a resolvers list.
+ */
+
 static int
-options_parse_resolvers_list(ProxyContext * const proxy_context, char *buf)
+options_parse_resolvers_list(ProxyContext * const proxy_context, char *buf,
+                             OptionsResolverCallback cb, void * const user_data)
 {
     char   *cols[OPTIONS_RESOLVERS_LIST_MAX_COLS];
     char   *headers[OPTIONS_RESOLVERS_LIST_MAX_COLS];
     size_t  cols_count;
     size_t  headers_count;
 
-    assert(proxy_context->resolver_name != NULL);
     buf = minicsv_parse_line(buf, headers, &headers_count,
                              sizeof headers / sizeof headers[0]);
     if (headers_count < 4U || headers_count > OPTIONS_RESOLVERS_LIST_MAX_COLS) {
@@ -329,12 +384,643 @@ options_parse_resolvers_list(ProxyContext * const proxy_context, char *buf)
             continue;
         }
         if (options_parse_resolver(proxy_context, headers, headers_count,
-                                   cols, cols_count) > 0) {
-            return 0;
+                                   cols, cols_count, cb, user_data) > 0) {
+            return 1;
         }
     } while (*buf != 0);
 
-    return -1;
+    return 0;
+}
+
+static int
+options_match_resolver(ProxyContext * const proxy_context,
+                       const ResolversDBEntry * const entry,
+                       void * const user_data)
+{
+    (void) user_data;
+    assert(proxy_context->resolver_name != NULL);
+    if (evutil_ascii_strcasecmp(entry->fields[RESOLVERS_DB_FIELD_NAME],
+                                proxy_context->resolver_name) != 0) {
+        return 0;
+    }
+    return options_use_resolver(proxy_context, entry);
+}
+
+static int
+options_add_resolver(ProxyContext * const proxy_context,
+                     const ResolversDBEntry * const entry,
+                     void * const user_data)
+{
+    ResolversDBBuilder * const builder = user_data;
+
+    if (resolvers_db_builder_add(builder, entry) != 0) {
+        logger_noformat(proxy_context, LOG_EMERG, "Out of memory");
+        exit(1);
+    }
+    return 0;
+}
+
+/*
+ * Opens the compiled version of the resolvers list. Returns 1 if it can
+ * be used, 0 if the CSV file has to be parsed instead.
+ */
+
+static int
+options_open_resolvers_db(ProxyContext * const proxy_context,
+                          const char * const resolvers_list,
+                          ResolversDB * const db, char ** const db_file_p)
+{
+    char  *db_file;
+    _Bool  db_only;
+
+    if ((db_file = resolvers_db_path(resolvers_list)) == NULL) {
+        logger_noformat(proxy_context, LOG_EMERG, "Out of memory");
+        exit(1);
+    }
+    db_only = strcmp(db_file, resolvers_list) == 0;
+    if (resolvers_db_open(db, db_file) != 0) {
+        if (db_only) {
+            logger(proxy_context, LOG_ERR,
+                   "Unable to read the compiled resolvers list [%s]", db_file);
+            exit(1);
+        }
+        free(db_file);
+        return 0;
+    }
+    if (db_only == 0 && resolvers_db_is_fresh(db, resolvers_list) == 0) {
+        logger(proxy_context, LOG_NOTICE,
+               "[%s] is outdated - run dnscrypt-proxy with "
+               "--compile-resolvers-list to update it", db_file);
+        resolvers_db_close(db);
+        free(db_file);
+        return 0;
+    }
+    *db_file_p = db_file;
+
+    return 1;
+}
+
+/*
+ * Returns 1 if the resolver was found in the compiled list, 0 if the
+ * CSV file has to be parsed instead.
+ */
+
+static int
+options_use_resolvers_db(ProxyContext * const proxy_context,
+                         const char * const resolvers_list)
+{
+    ResolversDB       db;
+    ResolversDBEntry  entry;
+    char             *db_file;
+
+    if (options_open_resolvers_db(proxy_context, resolvers_list,
+                                  &db, &db_file) == 0) {
+        return 0;
+    }
+    assert(proxy_context->resolver_name != NULL);
+    if (resolvers_db_lookup(&db, proxy_context->resolver_name, &entry) != 0) {
+        logger(proxy_context, LOG_ERR,
+               "No resolver named [%s] found in the [%s] list",
+               proxy_context->resolver_name, db_file);
+        exit(1);
+    }
+    if (options_use_resolver(proxy_context, &entry) <= 0) {
+        exit(1);
+    }
+    resolvers_db_close(&db);
+    free(db_file);
+
+    return 1;
+}
+
+typedef struct OptionsProbes_ {
+    ResolverProbe *probes;
+    size_t         probes_count;
+    size_t         probes_max;
+    unsigned int   filter;
+} OptionsProbes;
+
+static unsigned int
+options_parse_resolver_filter(ProxyContext * const proxy_context,
+                              const char * const filter_s)
+{
+    static const struct {
+        const char   *name;
+        unsigned int  flag;
+    } filters[] = {
+        { "dnssec", OPTIONS_RESOLVER_FILTER_DNSSEC },
+        { "namecoin", OPTIONS_RESOLVER_FILTER_NAMECOIN },
+        { "nologs", OPTIONS_RESOLVER_FILTER_NOLOGS }
+    };
+    const char   *name = filter_s;
+    size_t        name_len;
+    size_t        i;
+    unsigned int  filter = 0U;
+
+    while (*name != 0) {
+        name_len = strcspn(name, ",");
+        for (i = (size_t) 0U; i < sizeof filters / sizeof filters[0]; i++) {
+            if (strlen(filters[i].name) == name_len &&
+                evutil_ascii_strncasecmp(name, filters[i].name,
+                                         name_len) == 0) {
+                filter |= filters[i].flag;
+                break;
+            }
+        }
+        if (i >= sizeof filters / sizeof filters[0]) {
+            logger(proxy_context, LOG_ERR,
+                   "Unsupported resolver filter in [%s] - "
+                   "supported filters are dnssec, namecoin and nologs",
+                   filter_s);
+            exit(1);
+        }
+        name += name_len;
+        if (*name == ',') {
+            name++;
+        }
+    }
+    return filter;
+}
+
+static _Bool
+options_resolver_has(const ResolversDBEntry * const entry,
+                     const ResolversDBField field)
+{
+    return entry->fields[field] != NULL &&
+        evutil_ascii_strcasecmp(entry->fields[field], "yes") == 0;
+}
+
+static int
+options_add_probe(ProxyContext * const proxy_context,
+                  const ResolversDBEntry * const entry,
+                  void * const user_data)
+{
+    OptionsProbes * const options_probes = user_data;
+    ResolverProbe        *probes;
+    const char           *provider_name;
+    const unsigned int    filter = options_probes->filter;
+
+    provider_name = entry->fields[RESOLVERS_DB_FIELD_PROVIDER_NAME];
+    if (provider_name == NULL || *provider_name == 0 ||
+        options_check_protocol_versions(provider_name) != 0 ||
+        entry->fields[RESOLVERS_DB_FIELD_PROVIDER_PUBLICKEY] == NULL ||
+        entry->fields[RESOLVERS_DB_FIELD_RESOLVER_ADDRESS] == NULL ||
+        *entry->fields[RESOLVERS_DB_FIELD_RESOLVER_ADDRESS] == 0) {
+        return 0;
+    }
+    if (((filter & OPTIONS_RESOLVER_FILTER_DNSSEC) != 0U &&
+         options_resolver_has(entry, RESOLVERS_DB_FIELD_DNSSEC) == 0) ||
+        ((filter & OPTIONS_RESOLVER_FILTER_NAMECOIN) != 0U &&
+         options_resolver_has(entry, RESOLVERS_DB_FIELD_NAMECOIN) == 0) ||
+        ((filter & OPTIONS_RESOLVER_FILTER_NOLOGS) != 0U &&
+         options_resolver_has(entry, RESOLVERS_DB_FIELD_NOLOGS) == 0)) {
+        return 0;
+    }
+    if (options_probes->probes_count >= options_probes->probes_max) {
+        options_probes->probes_max = options_probes->probes_max * 2U + 16U;
+        if ((probes = realloc(options_probes->probes,
+                              options_probes->probes_max *
+                              sizeof *probes)) == NULL) {
+            logger_noformat(proxy_context, LOG_EMERG, "Out of memory");
+            exit(1);
+        }
+        options_probes->probes = probes;
+    }
+    if (resolver_probe_init(&options_probes->probes
+                            [options_probes->probes_count], entry) != 0) {
+        logger_noformat(proxy_context, LOG_EMERG, "Out of memory");
+        exit(1);
+    }
+    options_probes->probes_count++;
+
+    return 0;
+}
+
+/*
+ * --resolver-name=auto[:filter,...] probes all the resolvers of the list
+ * that match the filters, and uses the fastest one. The next ones are
+ * kept as standby resolvers, unless --standby-resolvers was given.
+ */
+
+static void
+options_use_fastest_resolver(ProxyContext * const proxy_context,
+                             const char * const resolvers_list)
+{
+    OptionsProbes     options_probes;
+    ResolversDB       db;
+    ResolversDBEntry  entry;
+    ResolverProbe    *probe;
+    const char       *filter_s;
+    char             *db_file;
+    char             *file_buf;
+    size_t            i;
+    size_t            standby_count = (size_t) 0U;
+    size_t            usable;
+    uint32_t          entry_idx;
+
+    memset(&options_probes, 0, sizeof options_probes);
+    filter_s = proxy_context->resolver_name +
+        sizeof OPTIONS_RESOLVER_NAME_AUTO - 1U;
+    if (*filter_s == ':') {
+        options_probes.filter =
+            options_parse_resolver_filter(proxy_context, filter_s + 1U);
+    }
+    if (options_open_resolvers_db(proxy_context, resolvers_list,
+                                  &db, &db_file) != 0) {
+        for (entry_idx = 0U; entry_idx < db.entries_count; entry_idx++) {
+            if (resolvers_db_entry(&db, entry_idx, &entry) == 0) {
+                options_add_probe(proxy_context, &entry, &options_probes);
+            }
+        }
+        resolvers_db_close(&db);
+        free(db_file);
+    } else {
+        if ((file_buf = options_read_file(resolvers_list, NULL)) == NULL) {
+            logger(proxy_context, LOG_ERR, "Unable to read [%s]",
+                   resolvers_list);
+            exit(1);
+        }
+        (void) options_parse_resolvers_list(proxy_context, file_buf,
+                                            options_add_probe,
+                                            &options_probes);
+        free(file_buf);
+    }
+    if (options_probes.probes_count <= (size_t) 0U) {
+        logger(proxy_context, LOG_ERR,
+               "No resolvers matching [%s] found in the [%s] list",
+               proxy_context->resolver_name, resolvers_list);
+        exit(1);
+    }
+    logger(proxy_context, LOG_NOTICE, "Probing %lu resolvers",
+           (unsigned long) options_probes.probes_count);
+    usable = resolver_probe_run(proxy_context, options_probes.probes,
+                                options_probes.probes_count);
+    if (usable <= (size_t) 0U) {
+        logger_noformat(proxy_context, LOG_ERR,
+                        "None of the resolvers could be reached");
+        exit(1);
+    }
+    probe = &options_probes.probes[0];
+    logger(proxy_context, LOG_NOTICE,
+           "[%s] is the fastest of %lu resolvers (%.1f ms)",
+           probe->fields[RESOLVERS_DB_FIELD_NAME], (unsigned long) usable,
+           (double) probe->score / 1000.0);
+    resolver_probe_entry(probe, &entry);
+    if (options_use_resolver(proxy_context, &entry) <= 0) {
+        exit(1);
+    }
+    if (proxy_context->standby_resolvers == NULL) {
+        standby_count = usable - (size_t) 1U;
+    }
+    if (standby_count > (size_t) OPTIONS_AUTO_STANDBY_RESOLVERS) {
+        standby_count = (size_t) OPTIONS_AUTO_STANDBY_RESOLVERS;
+    }
+    for (i = (size_t) 0U; i < standby_count; i++) {
+        probe = &options_probes.probes[i + 1U];
+        resolver_probe_entry(probe, &entry);
+        if (failover_add_resolver(proxy_context, &entry) != 0) {
+            logger_noformat(proxy_context, LOG_EMERG, "Out of memory");
+            exit(1);
+        }
+        logger(proxy_context, LOG_INFO, "Standby resolver: [%s] (%.1f ms)",
+               probe->fields[RESOLVERS_DB_FIELD_NAME],
+               (double) probe->score / 1000.0);
+    }
+    for (i = (size_t) 0U; i < options_probes.probes_count; i++) {
+        resolver_probe_free(&options_probes.probes[i]);
+    }
+    free(options_probes.probes);
+}
+
+/*
+ * Finds resolvers by name, in the compiled resolvers list if there is
+ * one, or in the CSV file. The entries point to the list, and remain
+ * valid until options_lookup_resolvers_free() is called.
+ */
+
+typedef struct OptionsResolversLookup_ {
+    ResolversDB        db;
+    ResolversDBEntry  *entries;
+    const char       **names;
+    char              *db_file;
+    char              *file_buf;
+    char              *resolvers_list;
+    size_t             names_count;
+} OptionsResolversLookup;
+
+static int
+options_match_looked_up_resolver(ProxyContext * const proxy_context,
+                                 const ResolversDBEntry * const entry,
+                                 void * const user_data)
+{
+    OptionsResolversLookup * const lookup = user_data;
+    size_t                         i;
+
+    (void) proxy_context;
+    for (i = (size_t) 0U; i < lookup->names_count; i++) {
+        if (evutil_ascii_strcasecmp(entry->fields[RESOLVERS_DB_FIELD_NAME],
+                                    lookup->names[i]) == 0) {
+            lookup->entries[i] = *entry;
+        }
+    }
+    return 0;
+}
+
+static void
+options_lookup_resolvers(ProxyContext * const proxy_context,
+                         OptionsResolversLookup * const lookup)
+{
+    size_t i;
+
+    if ((lookup->entries = calloc(lookup->names_count + 1U,
+                                  sizeof *lookup->entries)) == NULL ||
+        (lookup->resolvers_list =
+         path_from_app_folder(proxy_context->resolvers_list)) == NULL) {
+        logger_noformat(proxy_context, LOG_EMERG, "Out of memory");
+        exit(1);
+    }
+    if (options_open_resolvers_db(proxy_context, lookup->resolvers_list,
+                                  &lookup->db, &lookup->db_file) != 0) {
+        for (i = (size_t) 0U; i < lookup->names_count; i++) {
+            if (resolvers_db_lookup(&lookup->db, lookup->names[i],
+                                    &lookup->entries[i]) != 0) {
+                memset(&lookup->entries[i], 0, sizeof lookup->entries[i]);
+            }
+        }
+    } else {
+        if ((lookup->file_buf = options_read_file(lookup->resolvers_list,
+                                                  NULL)) == NULL) {
+            logger(proxy_context, LOG_ERR, "Unable to read [%s]",
+                   lookup->resolvers_list);
+            exit(1);
+        }
+        (void) options_parse_resolvers_list(proxy_context, lookup->file_buf,
+                                            options_match_looked_up_resolver,
+                                            lookup);
+    }
+    for (i = (size_t) 0U; i < lookup->names_count; i++) {
+        if (lookup->entries[i].fields[RESOLVERS_DB_FIELD_NAME] == NULL) {
+            logger(proxy_context, LOG_ERR,
+                   "No resolver named [%s] found in the [%s] list",
+                   lookup->names[i], lookup->resolvers_list);
+            exit(1);
+        }
+    }
+}
+
+static void
+options_lookup_resolvers_free(OptionsResolversLookup * const lookup)
+{
+    if (lookup->db_file != NULL) {
+        resolvers_db_close(&lookup->db);
+        free(lookup->db_file);
+        lookup->db_file = NULL;
+    }
+    free(lookup->file_buf);
+    lookup->file_buf = NULL;
+    free(lookup->entries);
+    lookup->entries = NULL;
+    free(lookup->resolvers_list);
+    lookup->resolvers_list = NULL;
+}
+
+/*
+ * Checks that an entry of the resolvers list has everything required to
+ * retrieve the certificates of the resolver.
+ */
+
+static int
+options_check_resolver_entry(const ResolversDBEntry * const entry)
+{
+    uint8_t     provider_publickey[crypto_sign_ed25519_PUBLICKEYBYTES];
+    const char *provider_name = entry->fields[RESOLVERS_DB_FIELD_PROVIDER_NAME];
+    const char *provider_publickey_s =
+        entry->fields[RESOLVERS_DB_FIELD_PROVIDER_PUBLICKEY];
+    const char *resolver_ip = entry->fields[RESOLVERS_DB_FIELD_RESOLVER_ADDRESS];
+
+    if (provider_name == NULL || *provider_name == 0 ||
+        options_check_protocol_versions(provider_name) != 0 ||
+        provider_publickey_s == NULL ||
+        dnscrypt_fingerprint_to_key(provider_publickey_s,
+                                    provider_publickey) != 0 ||
+        resolver_ip == NULL || *resolver_ip == 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static void
+options_add_standby_resolver(ProxyContext * const proxy_context,
+                             const ResolversDBEntry * const entry)
+{
+    const char *resolver_name = entry->fields[RESOLVERS_DB_FIELD_NAME];
+
+    if (options_check_resolver_entry(entry) != 0) {
+        logger(proxy_context, LOG_ERR,
+               "[%s] can't be used as a standby resolver", resolver_name);
+        exit(1);
+    }
+    if (failover_add_resolver(proxy_context, entry) != 0) {
+        logger_noformat(proxy_context, LOG_EMERG, "Out of memory");
+        exit(1);
+    }
+    logger(proxy_context, LOG_INFO, "Standby resolver: [%s]", resolver_name);
+}
+
+/*
+ * --standby-resolvers=name[,name...] lists the resolvers to switch to
+ * when the primary resolver stops working, in order of preference.
+ */
+
+static void
+options_use_standby_resolvers(ProxyContext * const proxy_context)
+{
+    OptionsResolversLookup  lookup;
+    ResolversDBEntry        primary;
+    char                   *name;
+    char                   *names;
+    char                   *sep;
+    size_t                  i;
+
+    if (proxy_context->failover.resolvers_count <= (size_t) 0U) {
+        memset(&primary, 0, sizeof primary);
+        primary.fields[RESOLVERS_DB_FIELD_NAME] = proxy_context->resolver_ip;
+        primary.fields[RESOLVERS_DB_FIELD_PROVIDER_NAME] =
+            proxy_context->provider_name;
+        primary.fields[RESOLVERS_DB_FIELD_PROVIDER_PUBLICKEY] =
+            proxy_context->provider_publickey_s;
+        primary.fields[RESOLVERS_DB_FIELD_RESOLVER_ADDRESS] =
+            proxy_context->resolver_ip;
+        if (failover_add_resolver(proxy_context, &primary) != 0) {
+            logger_noformat(proxy_context, LOG_EMERG, "Out of memory");
+            exit(1);
+        }
+    }
+    memset(&lookup, 0, sizeof lookup);
+    if ((names = strdup(proxy_context->standby_resolvers)) == NULL ||
+        (lookup.names = calloc(strlen(names) / 2U + 1U,
+                               sizeof *lookup.names)) == NULL) {
+        logger_noformat(proxy_context, LOG_EMERG, "Out of memory");
+        exit(1);
+    }
+    for (name = names; name != NULL; name = sep) {
+        if ((sep = strchr(name, ',')) != NULL) {
+            *sep++ = 0;
+        }
+        if (*name != 0) {
+            lookup.names[lookup.names_count++] = name;
+        }
+    }
+    options_lookup_resolvers(proxy_context, &lookup);
+    for (i = (size_t) 0U; i < lookup.names_count; i++) {
+        options_add_standby_resolver(proxy_context, &lookup.entries[i]);
+    }
+    options_lookup_resolvers_free(&lookup);
+    free(lookup.names);
+    free(names);
+}
+
+/*
+ * Splits a line of a forwarding rules file into its words. Everything
+ * after a '#' is a comment. Returns the number of words, which can be
+ * larger than max_words.
+ */
+
+static size_t
+options_split_rule(char *line, char **words, const size_t max_words)
+{
+    static const char *blanks = " \t\r";
+    size_t             words_count = (size_t) 0U;
+
+    line[strcspn(line, "#")] = 0;
+    for (;;) {
+        line += strspn(line, blanks);
+        if (*line == 0) {
+            break;
+        }
+        if (words_count < max_words) {
+            words[words_count] = line;
+        }
+        words_count++;
+        line += strcspn(line, blanks);
+        if (*line != 0) {
+            *line++ = 0;
+        }
+    }
+    return words_count;
+}
+
+/*
+ * --forwarding-rules=<file> reads rules sending queries for some domains
+ * to other resolvers, one per line:
+ *
+ * <domain> <resolver name or address>
+ *
+ * A resolver name refers to the resolvers list, and queries are sent
+ * using DNSCrypt. An IP address, optionally followed by a port, is a
+ * plain DNS resolver, typically for a local zone.
+ */
+
+static void
+options_use_forwarding_rules(ProxyContext * const proxy_context)
+{
+    struct sockaddr_storage  target_sockaddr;
+    OptionsResolversLookup   lookup;
+    const ResolversDBEntry  *entry;
+    char                   **domains;
+    char                    *file_buf;
+    char                    *line;
+    char                    *next;
+    char                   **targets;
+    char                    *words[2];
+    size_t                  *lookup_idx;
+    size_t                   i;
+    size_t                   line_no = (size_t) 0U;
+    size_t                   max_rules = (size_t) 1U;
+    size_t                   rules_count = (size_t) 0U;
+    int                      target_sockaddr_len;
+
+    if ((file_buf = options_read_file(proxy_context->forwarding_rules,
+                                      NULL)) == NULL) {
+        logger(proxy_context, LOG_ERR, "Unable to read [%s]",
+               proxy_context->forwarding_rules);
+        exit(1);
+    }
+    for (line = file_buf; (line = strchr(line, '\n')) != NULL; line++) {
+        max_rules++;
+    }
+    memset(&lookup, 0, sizeof lookup);
+    if ((domains = calloc(max_rules, sizeof *domains)) == NULL ||
+        (targets = calloc(max_rules, sizeof *targets)) == NULL ||
+        (lookup_idx = calloc(max_rules, sizeof *lookup_idx)) == NULL ||
+        (lookup.names = calloc(max_rules, sizeof *lookup.names)) == NULL) {
+        logger_noformat(proxy_context, LOG_EMERG, "Out of memory");
+        exit(1);
+    }
+    for (line = file_buf; line != NULL; line = next) {
+        line_no++;
+        if ((next = strchr(line, '\n')) != NULL) {
+            *next++ = 0;
+        }
+        switch (options_split_rule(line, words, 2U)) {
+        case 0U:
+            continue;
+        case 2U:
+            break;
+        default:
+            logger(proxy_context, LOG_ERR, "Syntax error on line %lu of [%s]",
+                   (unsigned long) line_no, proxy_context->forwarding_rules);
+            exit(1);
+        }
+        assert(rules_count < max_rules);
+        domains[rules_count] = words[0];
+        targets[rules_count] = words[1];
+        target_sockaddr_len = (int) sizeof target_sockaddr;
+        if (evutil_parse_sockaddr_port(words[1], (struct sockaddr *)
+                                       &target_sockaddr,
+                                       &target_sockaddr_len) == 0) {
+            lookup_idx[rules_count] = (size_t) -1;
+        } else {
+            lookup_idx[rules_count] = lookup.names_count;
+            lookup.names[lookup.names_count++] = words[1];
+        }
+        rules_count++;
+    }
+    if (lookup.names_count > (size_t) 0U) {
+        options_lookup_resolvers(proxy_context, &lookup);
+    }
+    for (i = (size_t) 0U; i < rules_count; i++) {
+        if (lookup_idx[i] == (size_t) -1) {
+            entry = NULL;
+        } else {
+            entry = &lookup.entries[lookup_idx[i]];
+            if (options_check_resolver_entry(entry) != 0) {
+                logger(proxy_context, LOG_ERR,
+                       "[%s] can't be used for forwarding", targets[i]);
+                exit(1);
+            }
+        }
+        if (forwarding_add_rule(proxy_context, domains[i], targets[i],
+                                entry) != 0) {
+            exit(1);
+        }
+    }
+    options_lookup_resolvers_free(&lookup);
+    free(lookup.names);
+    free(lookup_idx);
+    free(targets);
+    free(domains);
+    free(file_buf);
+}
+
+static _Bool
+options_resolver_name_is_auto(const char * const resolver_name)
+{
+    const size_t auto_len = sizeof OPTIONS_RESOLVER_NAME_AUTO - 1U;
+
+    return evutil_ascii_strncasecmp(resolver_name, OPTIONS_RESOLVER_NAME_AUTO,
+                                    auto_len) == 0 &&
+        (resolver_name[auto_len] == 0 || resolver_name[auto_len] == ':');
 }
 
 static int
@@ -348,14 +1034,25 @@ options_use_resolver_name(ProxyContext * const proxy_context)
         logger_noformat(proxy_context, LOG_EMERG, "Out of memory");
         exit(1);
     }
-    file_buf = options_read_file(resolvers_list_rebased);
+    assert(proxy_context->resolver_name != NULL);
+    if (options_resolver_name_is_auto(proxy_context->resolver_name)) {
+        options_use_fastest_resolver(proxy_context, resolvers_list_rebased);
+        free(resolvers_list_rebased);
+        return 0;
+    }
+    if (options_use_resolvers_db(proxy_context, resolvers_list_rebased) > 0) {
+        free(resolvers_list_rebased);
+        return 0;
+    }
+    file_buf = options_read_file(resolvers_list_rebased, NULL);
     if (file_buf == NULL) {
         logger(proxy_context, LOG_ERR, "Unable to read [%s]",
                resolvers_list_rebased);
         exit(1);
     }
     assert(proxy_context->resolver_name != NULL);
-    if (options_parse_resolvers_list(proxy_context, file_buf) < 0) {
+    if (options_parse_resolvers_list(proxy_context, file_buf,
+                                     options_match_resolver, NULL) <= 0) {
         logger(proxy_context, LOG_ERR,
                "No resolver named [%s] found in the [%s] list",
                proxy_context->resolver_name, resolvers_list_rebased);
@@ -367,15 +1064,100 @@ options_use_resolver_name(ProxyContext * const proxy_context)
     return 0;
 }
 
+static int
+options_compile_resolvers_list(ProxyContext * const proxy_context)
+{
+    char                trusted_comment[MINISIGN_MAX_COMMENT_LEN];
+    ResolversDBBuilder *builder;
+    const char         *error = NULL;
+    char               *db_file;
+    char               *file_buf = NULL;
+    char               *resolvers_list_rebased;
+    char               *sig_buf = NULL;
+    char               *sig_file = NULL;
+    size_t              file_size;
+    size_t              resolvers_list_len;
+    int                 ret = -1;
+
+    if ((resolvers_list_rebased =
+         path_from_app_folder(proxy_context->resolvers_list)) == NULL ||
+        (db_file = resolvers_db_path(resolvers_list_rebased)) == NULL) {
+        logger_noformat(proxy_context, LOG_EMERG, "Out of memory");
+        exit(1);
+    }
+    if (strcmp(db_file, resolvers_list_rebased) == 0) {
+        logger(proxy_context, LOG_ERR,
+               "[%s] is already a compiled resolvers list",
+               resolvers_list_rebased);
+        goto bye;
+    }
+    resolvers_list_len = strlen(resolvers_list_rebased);
+    if ((sig_file = malloc(resolvers_list_len +
+                           sizeof OPTIONS_RESOLVERS_LIST_SIG_SUFFIX)) == NULL) {
+        logger_noformat(proxy_context, LOG_EMERG, "Out of memory");
+        exit(1);
+    }
+    memcpy(sig_file, resolvers_list_rebased, resolvers_list_len);
+    memcpy(sig_file + resolvers_list_len, OPTIONS_RESOLVERS_LIST_SIG_SUFFIX,
+           sizeof OPTIONS_RESOLVERS_LIST_SIG_SUFFIX);
+    if ((file_buf = options_read_file(resolvers_list_rebased,
+                                      &file_size)) == NULL) {
+        logger(proxy_context, LOG_ERR, "Unable to read [%s]",
+               resolvers_list_rebased);
+        goto bye;
+    }
+    if ((sig_buf = options_read_file(sig_file, NULL)) == NULL) {
+        logger(proxy_context, LOG_ERR, "Unable to read [%s]", sig_file);
+        goto bye;
+    }
+    if (minisign_verify(proxy_context->resolvers_list_pubkey,
+                        (const unsigned char *) file_buf, file_size,
+                        sig_buf, trusted_comment, &error) != 0) {
+        logger(proxy_context, LOG_ERR, "[%s]: %s",
+               resolvers_list_rebased, error);
+        goto bye;
+    }
+    logger(proxy_context, LOG_INFO, "Signature verified - trusted comment: [%s]",
+           trusted_comment);
+    if ((builder = resolvers_db_builder_new()) == NULL) {
+        logger_noformat(proxy_context, LOG_EMERG, "Out of memory");
+        exit(1);
+    }
+    if (options_parse_resolvers_list(proxy_context, file_buf,
+                                     options_add_resolver, builder) < 0 ||
+        resolvers_db_builder_write(builder, db_file,
+                                   resolvers_list_rebased) != 0) {
+        logger(proxy_context, LOG_ERR,
+               "Unable to compile [%s] into [%s]",
+               resolvers_list_rebased, db_file);
+        resolvers_db_builder_free(builder);
+        goto bye;
+    }
+    resolvers_db_builder_free(builder);
+    logger(proxy_context, LOG_INFO, "[%s] has been compiled into [%s]",
+           resolvers_list_rebased, db_file);
+    ret = 0;
+bye:
+    free(sig_buf);
+    free(sig_file);
+    free(file_buf);
+    free(db_file);
+    free(resolvers_list_rebased);
+
+    return ret;
+}
+
 static int
 options_use_client_key_file(ProxyContext * const proxy_context)
 {
     unsigned char *key;
     char          *key_s;
+    const char    *key_s_end;
     const size_t   header_len = (sizeof OPTIONS_CLIENT_KEY_HEADER) - 1U;
     size_t         key_s_len;
 
-    if ((key_s = options_read_file(proxy_context->client_key_file)) == NULL) {
+    if ((key_s = options_read_file(proxy_context->client_key_file,
+                                   NULL)) == NULL) {
         logger_error(proxy_context, "Unable to read the client key file");
         return -1;
     }
@@ -385,7 +1167,9 @@ options_use_client_key_file(ProxyContext * const proxy_context)
         return -1;
     }
     if (sodium_hex2bin(key, header_len + crypto_box_SECRETKEYBYTES,
-                       key_s, strlen(key_s), ": -", &key_s_len, NULL) != 0 ||
+                       key_s, strlen(key_s), ": -", &key_s_len,
+                       &key_s_end) != 0 ||
+        key_s_end[strspn(key_s_end, " \t\r\n")] != 0 ||
         key_s_len < (header_len + crypto_box_SECRETKEYBYTES) ||
         memcmp(key, OPTIONS_CLIENT_KEY_HEADER, header_len) != 0) {
         logger_noformat(proxy_context, LOG_ERR,
@@ -408,6 +1192,14 @@ options_use_client_key_file(ProxyContext * const proxy_context)
 static int
 options_apply(ProxyContext * const proxy_context)
 {
+    if (proxy_context->compile_resolvers_list != 0) {
+        if (proxy_context->resolvers_list == NULL) {
+            logger_noformat(proxy_context, LOG_ERR,
+                            "Resolvers list (-L command-line switch) required");
+            exit(1);
+        }
+        exit(options_compile_resolvers_list(proxy_context) == 0 ? 0 : 1);
+    }
     if (proxy_context->client_key_file != NULL) {
         if (proxy_context->ephemeral_keys != 0) {
             logger_noformat(proxy_context, LOG_ERR,
@@ -485,6 +1277,12 @@ options_apply(ProxyContext * const proxy_context)
         logger_noformat(proxy_context, LOG_ERR, "Invalid provider key");
         exit(1);
     }
+    if (proxy_context->standby_resolvers != NULL) {
+        options_use_standby_resolvers(proxy_context);
+    }
+    if (proxy_context->forwarding_rules != NULL) {
+        options_use_forwarding_rules(proxy_context);
+    }
     if (proxy_context->daemonize != 0) {
         if (proxy_context->log_file == NULL) {
             proxy_context->syslog = 1;
@@ -513,6 +1311,18 @@ options_apply(ProxyContext * const proxy_context)
         assert(proxy_context->log_fp == NULL);
         logger_open_syslog(proxy_context);
     }
+    if (proxy_context->slow_query_log_file != NULL) {
+        if (proxy_context->slow_query_threshold == 0U) {
+            logger_noformat(proxy_context, LOG_ERR,
+                            "--slow-query-log requires --slow-query-threshold");
+            exit(1);
+        }
+        if ((proxy_context->slow_query_log_fp =
+             fopen(proxy_context->slow_query_log_file, "a")) == NULL) {
+            logger_error(proxy_context, "Unable to open slow query log file");
+            exit(1);
+        }
+    }
     return 0;
 }
 
@@ -617,6 +1427,9 @@ options_parse(AppContext * const app_context,
             proxy_context->max_log_level = max_log_level;
             break;
         }
+        case 'M':
+            proxy_context->metrics_address = optarg;
+            break;
         case 'n': {
             char *endptr;
             const unsigned long connections_count_max =
@@ -681,6 +1494,108 @@ options_parse(AppContext * const app_context,
         case 'V':
             options_version();
             exit(0);
+        case OPTION_SLOW_QUERY_LOG:
+            proxy_context->slow_query_log_file = optarg;
+            break;
+        case OPTION_SLOW_QUERY_THRESHOLD: {
+            char *endptr;
+            const unsigned long threshold = strtoul(optarg, &endptr, 10);
+
+            if (*optarg == 0 || *endptr != 0 || threshold <= 0U ||
+                threshold > UINT32_MAX / 1000U) {
+                logger(proxy_context, LOG_ERR,
+                       "Invalid slow query threshold: [%s]", optarg);
+                exit(1);
+            }
+            proxy_context->slow_query_threshold =
+                (uint64_t) threshold * 1000U;
+            break;
+        }
+        case OPTION_TCP_IDLE_TIMEOUT: {
+            char *endptr;
+            const unsigned long timeout = strtoul(optarg, &endptr, 10);
+
+            if (*optarg == 0 || *endptr != 0 || timeout > 86400UL) {
+                logger(proxy_context, LOG_ERR,
+                       "Invalid TCP idle timeout: [%s]", optarg);
+                exit(1);
+            }
+            proxy_context->tcp_idle_timeout = (time_t) timeout;
+            break;
+        }
+        case OPTION_OVERLOAD_DELAY_TARGET: {
+            char *endptr;
+            const unsigned long target = strtoul(optarg, &endptr, 10);
+
+            if (*optarg == 0 || *endptr != 0 ||
+                target > (unsigned long) DNS_QUERY_TIMEOUT * 1000UL) {
+                logger(proxy_context, LOG_ERR,
+                       "Invalid overload delay target: [%s]", optarg);
+                exit(1);
+            }
+            proxy_context->overload_delay_target = (unsigned int) target;
+            break;
+        }
+        case OPTION_RATE_LIMIT: {
+            char *endptr;
+            const unsigned long rate = strtoul(optarg, &endptr, 10);
+
+            if (*optarg == 0 || *endptr != 0 || rate > RRL_RATE_MAX) {
+                logger(proxy_context, LOG_ERR,
+                       "Invalid rate limit: [%s]", optarg);
+                exit(1);
+            }
+            proxy_context->rate_limit = (unsigned int) rate;
+            break;
+        }
+        case OPTION_RATE_LIMIT_IPV4_PREFIX:
+        case OPTION_RATE_LIMIT_IPV6_PREFIX: {
+            char *endptr;
+            const unsigned long prefix = strtoul(optarg, &endptr, 10);
+            const unsigned long prefix_max =
+                opt_flag == OPTION_RATE_LIMIT_IPV4_PREFIX ? 32UL : 128UL;
+
+            if (*optarg == 0 || *endptr != 0 || prefix > prefix_max) {
+                logger(proxy_context, LOG_ERR,
+                       "Invalid rate limit prefix length: [%s]", optarg);
+                exit(1);
+            }
+            if (opt_flag == OPTION_RATE_LIMIT_IPV4_PREFIX) {
+                proxy_context->rate_limit_ipv4_prefix = (unsigned int) prefix;
+            } else {
+                proxy_context->rate_limit_ipv6_prefix = (unsigned int) prefix;
+            }
+            break;
+        }
+        case OPTION_RATE_LIMIT_ACTION:
+            if (rrl_action_from_name(&proxy_context->rate_limit_action,
+                                     optarg) != 0) {
+                logger(proxy_context, LOG_ERR,
+                       "Invalid rate limit action: [%s]", optarg);
+                exit(1);
+            }
+            break;
+        case OPTION_COMPILE_RESOLVERS_LIST:
+            proxy_context->compile_resolvers_list = 1;
+            break;
+        case OPTION_RESOLVERS_LIST_PUBKEY:
+            proxy_context->resolvers_list_pubkey = optarg;
+            break;
+        case OPTION_STANDBY_RESOLVERS:
+            proxy_context->standby_resolvers = optarg;
+            break;
+        case OPTION_FORWARDING_RULES:
+            proxy_context->forwarding_rules = optarg;
+            break;
+        case OPTION_TCP_FAST_OPEN:
+#ifndef TCP_FASTOPEN_CONNECT
+            logger_noformat(proxy_context, LOG_ERR,
+                            "TCP Fast Open is not supported on this system");
+            exit(1);
+#else
+            proxy_context->tcp_fast_open = 1;
+            break;
+#endif
         case 'X':
 #ifndef PLUGINS
             logger_noformat(proxy_context, LOG_ERR,
@@ -777,4 +1692,6 @@ options_free(ProxyContext * const proxy_context)
     proxy_context->provider_publickey_s = NULL;
     free((void *) proxy_context->resolver_ip);
     proxy_context->resolver_ip = NULL;
+    failover_free(proxy_context);
+    forwarding_free(proxy_context);
 }
@@ -7,7 +7,33 @@ int options_parse(AppContext * const app_context,
 
 void options_free(ProxyContext * const proxy_context);
 
+typedef enum LongOption_ {
+    OPTION_SLOW_QUERY_LOG = 512,
+    OPTION_SLOW_QUERY_THRESHOLD,
+    OPTION_TCP_IDLE_TIMEOUT,
+    OPTION_TCP_FAST_OPEN,
+    OPTION_OVERLOAD_DELAY_TARGET,
+    OPTION_RATE_LIMIT,
+    OPTION_RATE_LIMIT_IPV4_PREFIX,
+    OPTION_RATE_LIMIT_IPV6_PREFIX,
+    OPTION_RATE_LIMIT_ACTION,
+    OPTION_COMPILE_RESOLVERS_LIST,
+    OPTION_RESOLVERS_LIST_PUBKEY,
+    OPTION_STANDBY_RESOLVERS,
+    OPTION_FORWARDING_RULES
+} LongOption;
+
 #define OPTIONS_RESOLVERS_LIST_MAX_COLS 50
 #define OPTIONS_CLIENT_KEY_HEADER "\01\01"
+#define OPTIONS_RESOLVERS_LIST_SIG_SUFFIX ".minisig"
+#define OPTIONS_RESOLVER_NAME_AUTO "auto"
+
+#define OPTIONS_RESOLVER_FILTER_DNSSEC   1U
+#define OPTIONS_RESOLVER_FILTER_NAMECOIN 2U
+#define OPTIONS_RESOLVER_FILTER_NOLOGS   4U
+
+#ifndef OPTIONS_AUTO_STANDBY_RESOLVERS
+# define OPTIONS_AUTO_STANDBY_RESOLVERS 2U
+#endif
 
 #endif
@@ -106,6 +106,8 @@ plugin_support_call_init(DCPluginSupport * const dcps)
         plugin_support_load_symbol(dcps, "dcplugin_sync_post_filter");
     dcps->sync_pre_filter =
         plugin_support_load_symbol(dcps, "dcplugin_sync_pre_filter");
+    dcps->sync_pre_filter_done =
+        plugin_support_load_symbol(dcps, "dcplugin_sync_pre_filter_done");
     if ((description = plugin_support_description(dcps)) == NULL) {
         logger_noformat(NULL, LOG_INFO, "Plugin loaded");
     } else {
@@ -262,6 +264,7 @@ plugin_support_new(const char * const plugin_file)
     dcps->handle = NULL;
     dcps->sync_post_filter = NULL;
     dcps->sync_pre_filter = NULL;
+    dcps->sync_pre_filter_done = NULL;
 
     return dcps;
 }
@@ -320,6 +323,7 @@ plugin_support_context_free(DCPluginSupportContext * const dcps_context)
     DCPluginSupport *dcps;
     DCPluginSupport *dcps_tmp;
 
+    (void) plugin_support_context_load_wait(dcps_context, NULL);
     SLIST_FOREACH_SAFE(dcps, &dcps_context->dcps_list, next, dcps_tmp) {
         plugin_support_free(dcps);
     }
@@ -329,8 +333,8 @@ plugin_support_context_free(DCPluginSupportContext * const dcps_context)
     free(dcps_context);
 }
 
-int
-plugin_support_context_load(DCPluginSupportContext * const dcps_context)
+static int
+plugin_support_context_load_all(DCPluginSupportContext * const dcps_context)
 {
     DCPluginSupport *dcps;
     _Bool            failed = 0;
@@ -350,6 +354,68 @@ plugin_support_context_load(DCPluginSupportContext * const dcps_context)
     return 0;
 }
 
+static void *
+plugin_support_context_loader(void * const dcps_context_)
+{
+    DCPluginSupportContext * const dcps_context = dcps_context_;
+
+    dcps_context->load_ret = plugin_support_context_load_all(dcps_context);
+    dcps_context->loaded_at = dnscrypt_hrtime();
+
+    return NULL;
+}
+
+/*
+ * Plugins are loaded and initialized (which is when blocklists get
+ * parsed) in a separate thread, while the proxy generates its keys and
+ * fetches the certificate. They are still loaded one after the other:
+ * libltdl isn't thread-safe, and plugins parse their options with
+ * getopt_long(), whose state is global.
+ */
+
+void
+plugin_support_context_load_start(DCPluginSupportContext * const dcps_context)
+{
+    assert(dcps_context != NULL);
+    assert(dcps_context->loading == 0);
+#ifdef HAVE_PTHREAD
+    if (! SLIST_EMPTY(&dcps_context->dcps_list)) {
+        pthread_attr_t attr;
+        int            ret = -1;
+
+        if (pthread_attr_init(&attr) == 0) {
+            (void) pthread_attr_setstacksize(&attr,
+                                             PLUGIN_SUPPORT_LOADER_STACK_SIZE);
+            ret = pthread_create(&dcps_context->loader, &attr,
+                                 plugin_support_context_loader, dcps_context);
+            pthread_attr_destroy(&attr);
+        }
+        if (ret == 0) {
+            dcps_context->loading = 1;
+            return;
+        }
+    }
+#endif
+    plugin_support_context_loader(dcps_context);
+}
+
+int
+plugin_support_context_load_wait(DCPluginSupportContext * const dcps_context,
+                                 uint64_t * const loaded_at_p)
+{
+    assert(dcps_context != NULL);
+#ifdef HAVE_PTHREAD
+    if (dcps_context->loading != 0) {
+        pthread_join(dcps_context->loader, NULL);
+        dcps_context->loading = 0;
+    }
+#endif
+    if (loaded_at_p != NULL) {
+        *loaded_at_p = dcps_context->loaded_at;
+    }
+    return dcps_context->load_ret;
+}
+
 static DCPluginSyncFilterResult
 plugin_support_context_get_result_from_dcps(DCPluginSyncFilterResult result,
                                             DCPluginSyncFilterResult result_dcps)
@@ -424,5 +490,10 @@ plugin_support_context_apply_sync_pre_filters(DCPluginSupportContext *dcps_conte
         assert(*dcp_packet->dns_packet_len_p <= dns_packet_max_len);
         assert(*dcp_packet->dns_packet_len_p > (size_t) 0U);
     }
+    SLIST_FOREACH(dcps, &dcps_context->dcps_list, next) {
+        if (dcps->sync_pre_filter_done != NULL) {
+            dcps->sync_pre_filter_done(dcps->plugin, dcp_packet, result);
+        }
+    }
     return result;
 }
@@ -2,6 +2,8 @@
 #ifndef __PLUGIN_SUPPORT_H__
 #define __PLUGIN_SUPPORT_H__ 1
 
+#include <stdint.h>
+
 #include <dnscrypt/plugin.h>
 
 #include "queue.h"
@@ -19,7 +21,11 @@ int plugin_support_context_remove(DCPluginSupportContext * const dcps_context,
 DCPluginSupport * plugin_support_new(const char * const plugin_file);
 void plugin_support_free(DCPluginSupport *dcps);
 int plugin_support_add_option(DCPluginSupport * const dcps, char * const arg);
-int plugin_support_context_load(DCPluginSupportContext * const dcps_context);
+
+void plugin_support_context_load_start(DCPluginSupportContext * const dcps_context);
+
+int plugin_support_context_load_wait(DCPluginSupportContext * const dcps_context,
+                                     uint64_t * const loaded_at_p);
 
 DCPluginSyncFilterResult
 plugin_support_context_apply_sync_post_filters(DCPluginSupportContext *dcps_context,
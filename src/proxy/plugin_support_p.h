@@ -2,12 +2,21 @@
 #ifndef __PLUGIN_SUPPORT_P_H__
 #define __PLUGIN_SUPPORT_P_H__ 1
 
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+#include <stdint.h>
+
 #include <ltdl.h>
 
 #include <dnscrypt/plugin.h>
 
 #include "queue.h"
 
+#ifndef PLUGIN_SUPPORT_LOADER_STACK_SIZE
+# define PLUGIN_SUPPORT_LOADER_STACK_SIZE (8U * 1024U * 1024U)
+#endif
+
 typedef int (*DCPluginInit)(DCPlugin * const dcplugin, int argc, char *argv[]);
 typedef int (*DCPluginDestroy)(DCPlugin * const dcplugin);
 typedef const char *(*DCPluginDescription)(DCPlugin * const dcplugin);
@@ -15,20 +24,31 @@ typedef const char *(*DCPluginDescription)(DCPlugin * const dcplugin);
 typedef DCPluginSyncFilterResult (*DCPluginSyncFilter)
 (DCPlugin * const dcplugin, DCPluginDNSPacket *dcp_packet);
 
+typedef void (*DCPluginSyncFilterDone)
+(DCPlugin * const dcplugin, DCPluginDNSPacket *dcp_packet,
+ DCPluginSyncFilterResult result);
+
 struct DCPluginSupport_ {
     SLIST_ENTRY(DCPluginSupport_) next;
-    DCPluginSyncFilter  sync_post_filter;
-    DCPluginSyncFilter  sync_pre_filter;
-    lt_dlhandle         handle;
-    DCPlugin           *plugin;
-    char               *plugin_file;
-    char              **argv;
-    int                 argc;
+    DCPluginSyncFilter      sync_post_filter;
+    DCPluginSyncFilter      sync_pre_filter;
+    DCPluginSyncFilterDone  sync_pre_filter_done;
+    lt_dlhandle             handle;
+    DCPlugin               *plugin;
+    char                   *plugin_file;
+    char                  **argv;
+    int                     argc;
 };
 
 struct DCPluginSupportContext_ {
     SLIST_HEAD(DCPluginSupportList_, DCPluginSupport_) dcps_list;
-    _Bool lt_enabled;
+#ifdef HAVE_PTHREAD
+    pthread_t loader;
+#endif
+    uint64_t  loaded_at;
+    int       load_ret;
+    _Bool     lt_enabled;
+    _Bool     loading;
 };
 
 #endif
@@ -0,0 +1,48 @@
+#
+# Turns probes_dnscrypt_proxy.d into a header defining USDT probes with
+# the <sys/sdt.h> macros, for systems with no dtrace(1) command.
+#
+
+BEGIN {
+    print "/* Generated from probes_dnscrypt_proxy.d - do not edit */"
+    print ""
+    print "#ifndef __PROBES_DNSCRYPT_PROXY_SDT_H__"
+    print "# define __PROBES_DNSCRYPT_PROXY_SDT_H__ 1"
+    print ""
+    print "#include <sys/sdt.h>"
+    print ""
+}
+
+/^[ \t]*provider[ \t]/ {
+    provider = $2
+}
+
+/^[ \t]*probe[ \t]/ {
+    name = $0
+    sub(/^[ \t]*probe[ \t]+/, "", name)
+    sub(/[ \t]*\(.*$/, "", name)
+    args = $0
+    sub(/^[^(]*\(/, "", args)
+    sub(/\).*$/, "", args)
+    gsub(/[ \t]/, "", args)
+    argc = (args == "" || args == "void") ? 0 : split(args, fodder, ",")
+
+    macro = toupper(provider "_" name)
+    gsub(/__/, "_", macro)
+    params = ""
+    for (i = 0; i < argc; i++) {
+        params = params (i > 0 ? ", " : "") "arg" i
+    }
+    printf "#define\t%s(%s) \\\n", macro, params
+    if (argc == 0) {
+        printf "\tDTRACE_PROBE(%s, %s)\n", provider, name
+    } else {
+        printf "\tDTRACE_PROBE%d(%s, %s, %s)\n", argc, provider, name, params
+    }
+    printf "#define\t%s_ENABLED() (1)\n", macro
+}
+
+END {
+    print ""
+    print "#endif"
+}
@@ -0,0 +1,550 @@
+
+#include <config.h>
+#include <sys/types.h>
+#ifdef _WIN32
+# include <winsock2.h>
+#else
+# include <sys/socket.h>
+# include <arpa/inet.h>
+# include <netinet/in.h>
+#endif
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <event2/dns.h>
+#include <event2/event.h>
+#include <event2/util.h>
+
+#include <sodium.h>
+
+#include "cert_p.h"
+#include "dnscrypt.h"
+#include "dnscrypt_client.h"
+#include "dnscrypt_proxy.h"
+#include "logger.h"
+#include "resolver_probe.h"
+#include "utils.h"
+
+#define RESOLVER_PROBE_QTYPE_NS 2U
+
+typedef struct ResolverProbeRun_ {
+    struct event_base *event_loop;
+    size_t             pending;
+} ResolverProbeRun;
+
+static void resolver_probe_reply_cb(evutil_socket_t handle, short ev_flags,
+                                    void * const probe_);
+
+int
+resolver_probe_init(ResolverProbe * const probe,
+                    const ResolversDBEntry * const entry)
+{
+    unsigned int i;
+
+    memset(probe, 0, sizeof *probe);
+    probe->query_handle = (evutil_socket_t) -1;
+    probe->state = RESOLVER_PROBE_STATE_IDLE;
+    for (i = 0U; i < RESOLVERS_DB_FIELDS; i++) {
+        if (entry->fields[i] == NULL) {
+            continue;
+        }
+        if ((probe->fields[i] = strdup(entry->fields[i])) == NULL) {
+            resolver_probe_free(probe);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void
+resolver_probe_entry(const ResolverProbe * const probe,
+                     ResolversDBEntry * const entry)
+{
+    unsigned int i;
+
+    for (i = 0U; i < RESOLVERS_DB_FIELDS; i++) {
+        entry->fields[i] = probe->fields[i];
+    }
+}
+
+static void
+resolver_probe_close(ResolverProbe * const probe)
+{
+    if (probe->evdns_base != NULL) {
+        evdns_base_free(probe->evdns_base, 0);
+        probe->evdns_base = NULL;
+    }
+    if (probe->query_event != NULL) {
+        event_free(probe->query_event);
+        probe->query_event = NULL;
+    }
+    if (probe->query_handle != (evutil_socket_t) -1) {
+        evutil_closesocket(probe->query_handle);
+        probe->query_handle = (evutil_socket_t) -1;
+    }
+}
+
+void
+resolver_probe_free(ResolverProbe * const probe)
+{
+    unsigned int i;
+
+    resolver_probe_close(probe);
+    for (i = 0U; i < RESOLVERS_DB_FIELDS; i++) {
+        free(probe->fields[i]);
+        probe->fields[i] = NULL;
+    }
+    sodium_memzero(&probe->client, sizeof probe->client);
+}
+
+static void
+resolver_probe_score(ResolverProbe * const probe, const _Bool tcp_only)
+{
+    uint64_t     rtts[RESOLVER_PROBE_SAMPLES];
+    uint64_t     rtt;
+    unsigned int i;
+    unsigned int j;
+    unsigned int samples = probe->samples;
+
+    memcpy(rtts, probe->rtts, sizeof rtts);
+    if (tcp_only == 0) {
+        while (samples < RESOLVER_PROBE_SAMPLES) {
+            rtts[samples++] = (uint64_t) RESOLVER_PROBE_QUERY_TIMEOUT_MS * 1000U;
+        }
+    }
+    assert(samples > 0U);
+    for (i = 1U; i < samples; i++) {
+        rtt = rtts[i];
+        for (j = i; j > 0U && rtts[j - 1U] > rtt; j--) {
+            rtts[j] = rtts[j - 1U];
+        }
+        rtts[j] = rtt;
+    }
+    if ((samples & 1U) != 0U) {
+        probe->score = rtts[samples / 2U];
+    } else {
+        probe->score = (rtts[samples / 2U - 1U] + rtts[samples / 2U]) / 2U;
+    }
+}
+
+/*
+ * Decides whether the resolver can be used, and computes its score. A
+ * probe that is still waiting for certificates has timed out, and one
+ * that is sending queries is scored with the samples it already has.
+ */
+
+static void
+resolver_probe_finish(ResolverProbe * const probe)
+{
+    const _Bool tcp_only = probe->proxy_context->tcp_only;
+
+    resolver_probe_close(probe);
+    if (probe->state == RESOLVER_PROBE_STATE_CERT) {
+        probe->state = RESOLVER_PROBE_STATE_FAILED;
+        probe->error = "timeout";
+    } else if (probe->state == RESOLVER_PROBE_STATE_QUERY) {
+        probe->state = RESOLVER_PROBE_STATE_DONE;
+    }
+    if (probe->state != RESOLVER_PROBE_STATE_FAILED &&
+        tcp_only == 0 && probe->replies <= 0U) {
+        probe->state = RESOLVER_PROBE_STATE_FAILED;
+        if (probe->error == NULL) {
+            probe->error = "no replies to encrypted queries";
+        }
+    }
+    if (probe->state != RESOLVER_PROBE_STATE_FAILED) {
+        resolver_probe_score(probe, tcp_only);
+    }
+}
+
+static void
+resolver_probe_done(ResolverProbe * const probe,
+                    const ResolverProbeState state, const char * const error)
+{
+    assert(probe->state == RESOLVER_PROBE_STATE_CERT ||
+           probe->state == RESOLVER_PROBE_STATE_QUERY);
+    probe->state = state;
+    probe->error = error;
+    resolver_probe_finish(probe);
+    if (probe->cb != NULL) {
+        probe->cb(probe, probe->cb_user_data);
+    }
+}
+
+static int
+resolver_probe_query_send(ResolverProbe * const probe)
+{
+    uint8_t              query[DNS_MAX_PACKET_SIZE_UDP_NO_EDNS_SEND];
+    const struct timeval tv = {
+        .tv_sec = (time_t) (RESOLVER_PROBE_QUERY_TIMEOUT_MS / 1000U),
+        .tv_usec = (RESOLVER_PROBE_QUERY_TIMEOUT_MS % 1000U) * 1000U
+    };
+    ssize_t              curve_ret;
+    size_t               query_len;
+
+    probe->query_id = (uint16_t) randombytes_uniform(65536U);
+    memset(query, 0, DNS_HEADER_SIZE);
+    query[0] = (uint8_t) (probe->query_id >> 8);
+    query[1] = (uint8_t) probe->query_id;
+    query[DNS_OFFSET_FLAGS] = 1U;
+    query[DNS_OFFSET_QDCOUNT + 1U] = 1U;
+    query_len = DNS_HEADER_SIZE;
+    query[query_len++] = 0U;
+    query[query_len++] = 0U;
+    query[query_len++] = RESOLVER_PROBE_QTYPE_NS;
+    query[query_len++] = 0U;
+    query[query_len++] = DNS_CLASS_IN;
+    curve_ret = dnscrypt_client_curve(&probe->client, probe->client_nonce,
+                                      query, query_len, sizeof query);
+    if (curve_ret <= (ssize_t) 0) {
+        return -1;
+    }
+    probe->sent_at = dnscrypt_hrtime();
+    if (send(probe->query_handle, (const void *) query,
+             (size_t) curve_ret, 0) != (ssize_t) curve_ret) {
+        return -1;
+    }
+    return event_add(probe->query_event, &tv);
+}
+
+static int
+resolver_probe_query_start(ResolverProbe * const probe)
+{
+    if ((probe->query_handle =
+         socket(probe->resolver_sockaddr.ss_family, SOCK_DGRAM,
+                IPPROTO_UDP)) == (evutil_socket_t) -1) {
+        return -1;
+    }
+    if (evutil_make_socket_closeonexec(probe->query_handle) != 0 ||
+        evutil_make_socket_nonblocking(probe->query_handle) != 0 ||
+        connect(probe->query_handle,
+                (const struct sockaddr *) &probe->resolver_sockaddr,
+                probe->resolver_sockaddr_len) != 0) {
+        return -1;
+    }
+    if ((probe->query_event =
+         event_new(probe->event_loop, probe->query_handle, EV_READ,
+                   resolver_probe_reply_cb, probe)) == NULL) {
+        return -1;
+    }
+    probe->state = RESOLVER_PROBE_STATE_QUERY;
+
+    return resolver_probe_query_send(probe);
+}
+
+/*
+ * Anything that isn't the reply to the current query is ignored, until
+ * the query times out.
+ */
+
+static int
+resolver_probe_reply_ok(ResolverProbe * const probe,
+                        uint8_t * const reply, size_t reply_len)
+{
+    if (dnscrypt_client_uncurve(&probe->client, probe->client_nonce,
+                                reply, &reply_len) != 0 ||
+        reply_len < DNS_HEADER_SIZE ||
+        (reply[DNS_OFFSET_FLAGS] & DNS_FLAGS_QR) == 0U ||
+        reply[0] != (uint8_t) (probe->query_id >> 8) ||
+        reply[1] != (uint8_t) probe->query_id) {
+        return 0;
+    }
+    return 1;
+}
+
+static void
+resolver_probe_reply_cb(evutil_socket_t handle, short ev_flags,
+                        void * const probe_)
+{
+    uint8_t         reply[DNS_MAX_PACKET_SIZE_UDP_RECV];
+    ResolverProbe  *probe = probe_;
+    const uint64_t  timeout = (uint64_t) RESOLVER_PROBE_QUERY_TIMEOUT_MS * 1000U;
+    uint64_t        elapsed;
+    ssize_t         nread;
+
+    elapsed = dnscrypt_hrtime() - probe->sent_at;
+    if ((ev_flags & EV_TIMEOUT) != 0 || elapsed >= timeout) {
+        probe->rtts[probe->samples++] = timeout;
+    } else {
+        nread = recv(handle, (void *) reply, sizeof reply, 0);
+        if (nread <= (ssize_t) 0 ||
+            resolver_probe_reply_ok(probe, reply, (size_t) nread) == 0) {
+            const uint64_t       remaining = timeout - elapsed;
+            const struct timeval tv = {
+                .tv_sec = (time_t) (remaining / 1000000U),
+                .tv_usec = (long) (remaining % 1000000U)
+            };
+            event_add(probe->query_event, &tv);
+            return;
+        }
+        probe->rtts[probe->samples++] = elapsed;
+        probe->replies++;
+    }
+    if (probe->samples >= RESOLVER_PROBE_SAMPLES) {
+        resolver_probe_done(probe, RESOLVER_PROBE_STATE_DONE, NULL);
+    } else if (resolver_probe_query_send(probe) != 0) {
+        resolver_probe_done(probe, RESOLVER_PROBE_STATE_DONE,
+                            "unable to send queries");
+    }
+}
+
+static void
+resolver_probe_cert_cb(int result, char type, int count, int ttl,
+                       void * const txt_records_, void * const probe_)
+{
+    Bincert                 *bincert = NULL;
+    ResolverProbe           *probe = probe_;
+    ProxyContext            *proxy_context = probe->proxy_context;
+    const struct txt_record *txt_records = txt_records_;
+    Cipher                   cipher;
+    int                      i = 0;
+
+    (void) type;
+    (void) ttl;
+    evdns_base_free(probe->evdns_base, 0);
+    probe->evdns_base = NULL;
+    if (result != DNS_ERR_NONE) {
+        resolver_probe_done(probe, RESOLVER_PROBE_STATE_FAILED,
+                            "unable to retrieve the certificates");
+        return;
+    }
+    probe->rtts[probe->samples++] = dnscrypt_hrtime() - probe->sent_at;
+    assert(count >= 0);
+
+    /*
+     * Certificates are checked again by the certificate updater once the
+     * resolver is used. Errors are reported by whoever started the probe,
+     * along with the name of the resolver, so they are only logged here
+     * at the debug level.
+     */
+    while (i < count) {
+        cert_open_bincert_for_provider(proxy_context,
+                                       probe->provider_publickey,
+                                       (const SignedBincert *) txt_records[i].txt,
+                                       txt_records[i].len, &bincert, 1);
+        i++;
+    }
+    if (bincert == NULL) {
+        resolver_probe_done(probe, RESOLVER_PROBE_STATE_FAILED,
+                            "no valid certificates");
+        return;
+    }
+    cipher = cert_bincert_cipher(bincert);
+    dnscrypt_client_init_with_new_key_pair(&probe->client);
+    dnscrypt_client_init_magic_query(&probe->client, bincert->magic_query,
+                                     cipher);
+    if (cipher == CIPHER_UNDEFINED ||
+        dnscrypt_client_init_resolver_publickey
+        (&probe->client, bincert->server_publickey) != 0) {
+        sodium_memzero(bincert, sizeof *bincert);
+        free(bincert);
+        resolver_probe_done(probe, RESOLVER_PROBE_STATE_FAILED,
+                            "unsupported certificate");
+        return;
+    }
+    COMPILER_ASSERT(sizeof probe->resolver_publickey ==
+                    sizeof bincert->server_publickey);
+    memcpy(probe->resolver_publickey, bincert->server_publickey,
+           sizeof probe->resolver_publickey);
+    sodium_memzero(bincert, sizeof *bincert);
+    free(bincert);
+    if (proxy_context->tcp_only != 0) {
+        resolver_probe_done(probe, RESOLVER_PROBE_STATE_DONE, NULL);
+        return;
+    }
+    if (resolver_probe_query_start(probe) != 0) {
+        resolver_probe_done(probe, RESOLVER_PROBE_STATE_FAILED,
+                            "unable to send queries");
+    }
+}
+
+/*
+ * Starts probing a resolver on the given event loop. cb() is called once
+ * the probe is done, unless resolver_probe_stop() is called first. If the
+ * probe can't even be started, -1 is returned and cb() is never called.
+ */
+
+int
+resolver_probe_start(ResolverProbe * const probe,
+                     ProxyContext * const proxy_context,
+                     struct event_base * const event_loop,
+                     ResolverProbeCallback cb, void * const user_data)
+{
+    char timeout_s[sizeof "4294967295.000"];
+
+    assert(probe->evdns_base == NULL && probe->query_event == NULL);
+    probe->proxy_context = proxy_context;
+    probe->event_loop = event_loop;
+    probe->cb = cb;
+    probe->cb_user_data = user_data;
+    probe->state = RESOLVER_PROBE_STATE_CERT;
+    probe->error = NULL;
+    probe->score = 0U;
+    probe->samples = 0U;
+    probe->replies = 0U;
+    if (dnscrypt_fingerprint_to_key
+        (probe->fields[RESOLVERS_DB_FIELD_PROVIDER_PUBLICKEY],
+         probe->provider_publickey) != 0) {
+        probe->state = RESOLVER_PROBE_STATE_FAILED;
+        probe->error = "invalid provider key";
+        return -1;
+    }
+    if (sockaddr_from_ip_and_port(&probe->resolver_sockaddr,
+                                  &probe->resolver_sockaddr_len,
+                                  probe->fields[RESOLVERS_DB_FIELD_RESOLVER_ADDRESS],
+                                  DNS_DEFAULT_RESOLVER_PORT,
+                                  "Unsupported resolver address") != 0) {
+        probe->state = RESOLVER_PROBE_STATE_FAILED;
+        probe->error = "unsupported resolver address";
+        return -1;
+    }
+    if ((probe->evdns_base = evdns_base_new(event_loop, 0)) == NULL ||
+        evdns_base_nameserver_sockaddr_add(probe->evdns_base,
+                                           (struct sockaddr *)
+                                           &probe->resolver_sockaddr,
+                                           probe->resolver_sockaddr_len,
+                                           DNS_QUERY_NO_SEARCH) != 0) {
+        resolver_probe_close(probe);
+        probe->state = RESOLVER_PROBE_STATE_FAILED;
+        probe->error = "unable to query the resolver";
+        return -1;
+    }
+    evutil_snprintf(timeout_s, sizeof timeout_s, "%u.%03u",
+                    RESOLVER_PROBE_QUERY_TIMEOUT_MS / 1000U,
+                    RESOLVER_PROBE_QUERY_TIMEOUT_MS % 1000U);
+    (void) evdns_base_set_option(probe->evdns_base, "timeout", timeout_s);
+    (void) evdns_base_set_option(probe->evdns_base, "attempts", "1");
+    if (proxy_context->tcp_only != 0) {
+        (void) evdns_base_set_option(probe->evdns_base, "use-tcp", "always");
+    } else {
+        (void) evdns_base_set_option(probe->evdns_base, "use-tcp", "on-tc");
+    }
+    probe->sent_at = dnscrypt_hrtime();
+    if (evdns_base_resolve_txt(probe->evdns_base,
+                               probe->fields[RESOLVERS_DB_FIELD_PROVIDER_NAME],
+                               DNS_QUERY_NO_SEARCH, resolver_probe_cert_cb,
+                               probe) == NULL) {
+        resolver_probe_close(probe);
+        probe->state = RESOLVER_PROBE_STATE_FAILED;
+        probe->error = "unable to query the resolver";
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Stops a probe that is still running, without calling its callback.
+ */
+
+void
+resolver_probe_stop(ResolverProbe * const probe)
+{
+    if (probe->state == RESOLVER_PROBE_STATE_CERT ||
+        probe->state == RESOLVER_PROBE_STATE_QUERY) {
+        resolver_probe_finish(probe);
+    }
+    probe->cb = NULL;
+    probe->cb_user_data = NULL;
+}
+
+static void
+resolver_probe_run_cb(ResolverProbe * const probe, void * const run_)
+{
+    ResolverProbeRun * const run = run_;
+
+    (void) probe;
+    assert(run->pending > (size_t) 0U);
+    if (--run->pending <= (size_t) 0U) {
+        event_base_loopbreak(run->event_loop);
+    }
+}
+
+static void
+resolver_probe_deadline_cb(evutil_socket_t handle, const short event,
+                           void * const run_)
+{
+    ResolverProbeRun * const run = run_;
+
+    (void) handle;
+    (void) event;
+    event_base_loopbreak(run->event_loop);
+}
+
+static int
+resolver_probe_cmp(const void * const a_, const void * const b_)
+{
+    const ResolverProbe * const a = a_;
+    const ResolverProbe * const b = b_;
+
+    if ((a->state == RESOLVER_PROBE_STATE_FAILED) !=
+        (b->state == RESOLVER_PROBE_STATE_FAILED)) {
+        return a->state == RESOLVER_PROBE_STATE_FAILED ? 1 : -1;
+    }
+    if (a->score != b->score) {
+        return a->score < b->score ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ * Probes all the resolvers, and sorts them, fastest first. Returns the
+ * number of resolvers that could be used.
+ */
+
+size_t
+resolver_probe_run(ProxyContext * const proxy_context,
+                   ResolverProbe * const probes, const size_t probes_count)
+{
+    ResolverProbeRun      run;
+    ResolverProbe        *probe;
+    struct event         *deadline_timer;
+    const struct timeval  tv = {
+        .tv_sec = (time_t) (RESOLVER_PROBE_TIMEOUT_MS / 1000U),
+        .tv_usec = (RESOLVER_PROBE_TIMEOUT_MS % 1000U) * 1000U
+    };
+    size_t                i;
+    size_t                usable = (size_t) 0U;
+
+    memset(&run, 0, sizeof run);
+    if ((run.event_loop = event_base_new()) == NULL) {
+        return (size_t) 0U;
+    }
+    if ((deadline_timer = evtimer_new(run.event_loop,
+                                      resolver_probe_deadline_cb,
+                                      &run)) == NULL) {
+        event_base_free(run.event_loop);
+        return (size_t) 0U;
+    }
+    evdns_set_random_init_fn(NULL);
+    evdns_set_random_bytes_fn(randombytes_buf);
+    for (i = (size_t) 0U; i < probes_count; i++) {
+        if (resolver_probe_start(&probes[i], proxy_context, run.event_loop,
+                                 resolver_probe_run_cb, &run) == 0) {
+            run.pending++;
+        }
+    }
+    if (run.pending > (size_t) 0U) {
+        evtimer_add(deadline_timer, &tv);
+        event_base_dispatch(run.event_loop);
+    }
+    for (i = (size_t) 0U; i < probes_count; i++) {
+        probe = &probes[i];
+        resolver_probe_stop(probe);
+        probe->event_loop = NULL;
+        if (probe->state == RESOLVER_PROBE_STATE_FAILED) {
+            logger(proxy_context, LOG_INFO, "- [%s] can't be used: %s",
+                   probe->fields[RESOLVERS_DB_FIELD_NAME], probe->error);
+            continue;
+        }
+        usable++;
+    }
+    event_free(deadline_timer);
+    event_base_free(run.event_loop);
+    qsort(probes, probes_count, sizeof *probes, resolver_probe_cmp);
+
+    return usable;
+}
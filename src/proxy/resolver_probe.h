@@ -0,0 +1,107 @@
+
+#ifndef __RESOLVER_PROBE_H__
+#define __RESOLVER_PROBE_H__ 1
+
+#include <sys/types.h>
+#ifdef _WIN32
+# include <winsock2.h>
+#else
+# include <sys/socket.h>
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <event2/event.h>
+#include <event2/util.h>
+
+#include <sodium.h>
+
+#include "dnscrypt_client.h"
+#include "resolvers_db.h"
+
+/*
+ * Measures how fast resolvers are, so that the fastest one can be picked
+ * at startup, and checks that standby resolvers are still usable.
+ *
+ * The certificates of every resolver are fetched and checked, then a few
+ * encrypted queries are sent to it, one after the other. All resolvers
+ * are probed at the same time. Their score is the median round-trip time
+ * of the certificate exchange and of the queries, a lost query counting
+ * as a full timeout.
+ *
+ * Once a probe is done, the key and the magic query of the certificate it
+ * received are kept, so that the resolver can be used right away.
+ */
+
+#ifndef RESOLVER_PROBE_QUERIES
+# define RESOLVER_PROBE_QUERIES 3U
+#endif
+#ifndef RESOLVER_PROBE_QUERY_TIMEOUT_MS
+# define RESOLVER_PROBE_QUERY_TIMEOUT_MS 1000U
+#endif
+#ifndef RESOLVER_PROBE_TIMEOUT_MS
+# define RESOLVER_PROBE_TIMEOUT_MS 3000U
+#endif
+
+#define RESOLVER_PROBE_SAMPLES (1U + RESOLVER_PROBE_QUERIES)
+
+typedef enum ResolverProbeState_ {
+    RESOLVER_PROBE_STATE_IDLE,
+    RESOLVER_PROBE_STATE_CERT,
+    RESOLVER_PROBE_STATE_QUERY,
+    RESOLVER_PROBE_STATE_DONE,
+    RESOLVER_PROBE_STATE_FAILED
+} ResolverProbeState;
+
+struct ProxyContext_;
+struct ResolverProbe_;
+
+typedef void (*ResolverProbeCallback)(struct ResolverProbe_ * const probe,
+                                      void * const user_data);
+
+typedef struct ResolverProbe_ {
+    DNSCryptClient            client;
+    uint8_t                   client_nonce[crypto_box_HALF_NONCEBYTES];
+    uint8_t                   provider_publickey[crypto_sign_ed25519_PUBLICKEYBYTES];
+    uint8_t                   resolver_publickey[crypto_box_PUBLICKEYBYTES];
+    struct sockaddr_storage   resolver_sockaddr;
+    char                     *fields[RESOLVERS_DB_FIELDS];
+    struct ProxyContext_     *proxy_context;
+    struct event_base        *event_loop;
+    ResolverProbeCallback     cb;
+    void                     *cb_user_data;
+    const char               *error;
+    struct evdns_base        *evdns_base;
+    struct event             *query_event;
+    ev_socklen_t              resolver_sockaddr_len;
+    evutil_socket_t           query_handle;
+    uint64_t                  rtts[RESOLVER_PROBE_SAMPLES];
+    uint64_t                  score;
+    uint64_t                  sent_at;
+    unsigned int              samples;
+    unsigned int              replies;
+    uint16_t                  query_id;
+    ResolverProbeState        state;
+} ResolverProbe;
+
+int resolver_probe_init(ResolverProbe * const probe,
+                        const ResolversDBEntry * const entry);
+
+void resolver_probe_entry(const ResolverProbe * const probe,
+                          ResolversDBEntry * const entry);
+
+void resolver_probe_free(ResolverProbe * const probe);
+
+int resolver_probe_start(ResolverProbe * const probe,
+                         struct ProxyContext_ * const proxy_context,
+                         struct event_base * const event_loop,
+                         ResolverProbeCallback cb, void * const user_data);
+
+void resolver_probe_stop(ResolverProbe * const probe);
+
+size_t resolver_probe_run(struct ProxyContext_ * const proxy_context,
+                          ResolverProbe * const probes,
+                          const size_t probes_count);
+
+#endif
@@ -0,0 +1,696 @@
+
+#include <config.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "resolvers_db.h"
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+# define RESOLVERS_DB_USE_MMAP 1
+#endif
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+typedef struct ResolversDBBuilderEntry_ {
+    char   *fields[RESOLVERS_DB_FIELDS];
+    size_t  rank;
+} ResolversDBBuilderEntry;
+
+struct ResolversDBBuilder_ {
+    ResolversDBBuilderEntry *entries;
+    size_t                   entries_count;
+    size_t                   entries_size;
+};
+
+static int
+resolvers_db_tolower(const int c)
+{
+    if (c >= 'A' && c <= 'Z') {
+        return c | 0x20;
+    }
+    return c;
+}
+
+static int
+resolvers_db_name_cmp(const char *a, const char *b)
+{
+    int ca;
+    int cb;
+
+    do {
+        ca = resolvers_db_tolower((unsigned char) *a++);
+        cb = resolvers_db_tolower((unsigned char) *b++);
+    } while (ca == cb && ca != 0);
+
+    return ca - cb;
+}
+
+/* FNV-1a over the lowercased name, followed by a 64-bit finalizer */
+
+static uint32_t
+resolvers_db_hash(const char *name, const uint32_t seed)
+{
+    uint64_t h = 0xcbf29ce484222325ULL ^
+        ((uint64_t) seed * 0x9e3779b97f4a7c15ULL);
+
+    while (*name != 0) {
+        h ^= (uint64_t) resolvers_db_tolower((unsigned char) *name++);
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return (uint32_t) h;
+}
+
+static uint32_t
+resolvers_db_load32(const unsigned char * const p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) |
+        ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint64_t
+resolvers_db_load64(const unsigned char * const p)
+{
+    return (uint64_t) resolvers_db_load32(p) |
+        ((uint64_t) resolvers_db_load32(p + 4) << 32);
+}
+
+static void
+resolvers_db_store32(unsigned char * const p, const uint32_t x)
+{
+    p[0] = (unsigned char) x;
+    p[1] = (unsigned char) (x >> 8);
+    p[2] = (unsigned char) (x >> 16);
+    p[3] = (unsigned char) (x >> 24);
+}
+
+static void
+resolvers_db_store64(unsigned char * const p, const uint64_t x)
+{
+    resolvers_db_store32(p, (uint32_t) x);
+    resolvers_db_store32(p + 4, (uint32_t) (x >> 32));
+}
+
+char *
+resolvers_db_path(const char * const resolvers_list)
+{
+    const size_t  suffix_len = sizeof RESOLVERS_DB_SUFFIX - 1U;
+    const size_t  resolvers_list_len = strlen(resolvers_list);
+    char         *db_file;
+    size_t        base_len = resolvers_list_len;
+
+    if (resolvers_list_len >= suffix_len &&
+        resolvers_db_name_cmp(resolvers_list + resolvers_list_len - suffix_len,
+                              RESOLVERS_DB_SUFFIX) == 0) {
+        return strdup(resolvers_list);
+    }
+    if (resolvers_list_len >= sizeof ".csv" - 1U &&
+        resolvers_db_name_cmp(resolvers_list + resolvers_list_len -
+                              (sizeof ".csv" - 1U), ".csv") == 0) {
+        base_len -= sizeof ".csv" - 1U;
+    }
+    if ((db_file = malloc(base_len + suffix_len + 1U)) == NULL) {
+        return NULL;
+    }
+    memcpy(db_file, resolvers_list, base_len);
+    memcpy(db_file + base_len, RESOLVERS_DB_SUFFIX, suffix_len + 1U);
+
+    return db_file;
+}
+
+static int
+resolvers_db_read(ResolversDB * const db, const int fd)
+{
+    unsigned char *buf;
+    size_t         pos = (size_t) 0U;
+    ssize_t        readnb;
+
+    if ((buf = malloc(db->map_size)) == NULL) {
+        return -1;
+    }
+    while (pos < db->map_size) {
+        readnb = read(fd, buf + pos, db->map_size - pos);
+        if (readnb < (ssize_t) 0 && errno == EINTR) {
+            continue;
+        }
+        if (readnb <= (ssize_t) 0) {
+            free(buf);
+            return -1;
+        }
+        pos += (size_t) readnb;
+    }
+    db->map = buf;
+    db->mapped = 0;
+
+    return 0;
+}
+
+static int
+resolvers_db_check(ResolversDB * const db)
+{
+    const unsigned char *p = db->map;
+    uint64_t             expected_size;
+
+    if (db->map_size < RESOLVERS_DB_HEADER_SIZE ||
+        memcmp(p, RESOLVERS_DB_MAGIC, RESOLVERS_DB_MAGIC_LEN) != 0) {
+        return -1;
+    }
+    p += RESOLVERS_DB_MAGIC_LEN;
+    db->entries_count = resolvers_db_load32(p);
+    db->buckets_count = resolvers_db_load32(p + 4);
+    db->slots_count = resolvers_db_load32(p + 8);
+    db->strings_size = resolvers_db_load32(p + 12);
+    db->csv_size = resolvers_db_load64(p + 16);
+    db->csv_mtime = resolvers_db_load64(p + 24);
+    if (db->entries_count > RESOLVERS_DB_MAX_ENTRIES ||
+        db->slots_count < db->entries_count ||
+        db->slots_count > RESOLVERS_DB_MAX_ENTRIES * 3U ||
+        db->buckets_count <= 0U || db->buckets_count > db->slots_count ||
+        db->strings_size <= 0U) {
+        return -1;
+    }
+    expected_size = (uint64_t) RESOLVERS_DB_HEADER_SIZE +
+        (uint64_t) db->buckets_count * 4U +
+        (uint64_t) db->slots_count * 4U +
+        (uint64_t) db->entries_count * RESOLVERS_DB_FIELDS * 4U +
+        (uint64_t) db->strings_size;
+    if (expected_size != (uint64_t) db->map_size) {
+        return -1;
+    }
+    db->seeds = db->map + RESOLVERS_DB_HEADER_SIZE;
+    db->slots = db->seeds + (size_t) db->buckets_count * 4U;
+    db->entries = db->slots + (size_t) db->slots_count * 4U;
+    db->strings = (const char *)
+        (db->entries + (size_t) db->entries_count * RESOLVERS_DB_FIELDS * 4U);
+    if (db->strings[db->strings_size - 1U] != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int
+resolvers_db_open(ResolversDB * const db, const char * const db_file)
+{
+    struct stat st;
+    int         fd;
+    int         ret;
+
+    memset(db, 0, sizeof *db);
+    if ((fd = open(db_file, O_RDONLY | O_BINARY)) == -1) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) RESOLVERS_DB_HEADER_SIZE ||
+        (uint64_t) st.st_size > (uint64_t) SIZE_MAX) {
+        (void) close(fd);
+        return -1;
+    }
+    db->map_size = (size_t) st.st_size;
+#ifdef RESOLVERS_DB_USE_MMAP
+    {
+        void *map = mmap(NULL, db->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (map != MAP_FAILED) {
+            db->map = (unsigned char *) map;
+            db->mapped = 1;
+        }
+    }
+#endif
+    if (db->map == NULL) {
+        ret = resolvers_db_read(db, fd);
+    } else {
+        ret = 0;
+    }
+    (void) close(fd);
+    if (ret != 0 || resolvers_db_check(db) != 0) {
+        resolvers_db_close(db);
+        return -1;
+    }
+    return 0;
+}
+
+int
+resolvers_db_is_fresh(const ResolversDB * const db,
+                      const char * const csv_file)
+{
+    struct stat st;
+
+    if (stat(csv_file, &st) != 0) {
+        return 1;
+    }
+    return (uint64_t) st.st_size == db->csv_size &&
+        (uint64_t) st.st_mtime == db->csv_mtime;
+}
+
+int
+resolvers_db_entry(const ResolversDB * const db, const uint32_t entry_idx,
+                   ResolversDBEntry * const entry)
+{
+    const unsigned char *fields;
+    uint32_t             offset;
+    unsigned int         i;
+
+    if (entry_idx >= db->entries_count) {
+        return -1;
+    }
+    fields = db->entries + (size_t) entry_idx * RESOLVERS_DB_FIELDS * 4U;
+    for (i = 0U; i < RESOLVERS_DB_FIELDS; i++) {
+        offset = resolvers_db_load32(fields + i * 4U);
+        if (offset == RESOLVERS_DB_NONE) {
+            entry->fields[i] = NULL;
+        } else if (offset >= db->strings_size) {
+            return -1;
+        } else {
+            entry->fields[i] = db->strings + offset;
+        }
+    }
+    if (entry->fields[RESOLVERS_DB_FIELD_NAME] == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+int
+resolvers_db_lookup(const ResolversDB * const db, const char * const name,
+                    ResolversDBEntry * const entry)
+{
+    uint32_t bucket;
+    uint32_t seed;
+    uint32_t slot;
+
+    if (db->entries_count <= 0U) {
+        memset(entry, 0, sizeof *entry);
+        return -1;
+    }
+    bucket = resolvers_db_hash(name, 0U) % db->buckets_count;
+    seed = resolvers_db_load32(db->seeds + (size_t) bucket * 4U);
+    slot = resolvers_db_hash(name, seed) % db->slots_count;
+    if (resolvers_db_entry(db, resolvers_db_load32(db->slots + (size_t) slot * 4U),
+                           entry) != 0 ||
+        resolvers_db_name_cmp(entry->fields[RESOLVERS_DB_FIELD_NAME],
+                              name) != 0) {
+        memset(entry, 0, sizeof *entry);
+        return -1;
+    }
+    return 0;
+}
+
+void
+resolvers_db_close(ResolversDB * const db)
+{
+    if (db->map != NULL) {
+#ifdef RESOLVERS_DB_USE_MMAP
+        if (db->mapped != 0) {
+            (void) munmap(db->map, db->map_size);
+        } else
+#endif
+        free(db->map);
+    }
+    memset(db, 0, sizeof *db);
+}
+
+ResolversDBBuilder *
+resolvers_db_builder_new(void)
+{
+    ResolversDBBuilder *builder;
+
+    if ((builder = calloc((size_t) 1U, sizeof *builder)) == NULL) {
+        return NULL;
+    }
+    return builder;
+}
+
+int
+resolvers_db_builder_add(ResolversDBBuilder * const builder,
+                         const ResolversDBEntry * const entry)
+{
+    ResolversDBBuilderEntry *builder_entry;
+    ResolversDBBuilderEntry *entries;
+    size_t                   entries_size;
+    unsigned int             i;
+
+    if (entry->fields[RESOLVERS_DB_FIELD_NAME] == NULL ||
+        builder->entries_count >= RESOLVERS_DB_MAX_ENTRIES) {
+        return -1;
+    }
+    if (builder->entries_count >= builder->entries_size) {
+        entries_size = builder->entries_size * 2U + 64U;
+        if ((entries = realloc(builder->entries,
+                               entries_size * sizeof *entries)) == NULL) {
+            return -1;
+        }
+        builder->entries = entries;
+        builder->entries_size = entries_size;
+    }
+    builder_entry = &builder->entries[builder->entries_count];
+    memset(builder_entry, 0, sizeof *builder_entry);
+    for (i = 0U; i < RESOLVERS_DB_FIELDS; i++) {
+        if (entry->fields[i] != NULL &&
+            (builder_entry->fields[i] = strdup(entry->fields[i])) == NULL) {
+            while (i-- > 0U) {
+                free(builder_entry->fields[i]);
+            }
+            return -1;
+        }
+    }
+    builder_entry->rank = builder->entries_count++;
+
+    return 0;
+}
+
+static int
+resolvers_db_builder_entry_cmp(const void * const a_, const void * const b_)
+{
+    const ResolversDBBuilderEntry * const a = a_;
+    const ResolversDBBuilderEntry * const b = b_;
+    int                                   ret;
+
+    ret = resolvers_db_name_cmp(a->fields[RESOLVERS_DB_FIELD_NAME],
+                                b->fields[RESOLVERS_DB_FIELD_NAME]);
+    if (ret == 0) {
+        ret = (a->rank > b->rank) - (a->rank < b->rank);
+    }
+    return ret;
+}
+
+/*
+ * When a name appears more than once, the first entry wins, just like
+ * when the CSV file is read from the top.
+ */
+
+static void
+resolvers_db_builder_dedup(ResolversDBBuilder * const builder)
+{
+    size_t       i;
+    size_t       j = (size_t) 0U;
+    unsigned int k;
+
+    if (builder->entries_count <= (size_t) 0U) {
+        return;
+    }
+    qsort(builder->entries, builder->entries_count, sizeof *builder->entries,
+          resolvers_db_builder_entry_cmp);
+    for (i = (size_t) 1U; i < builder->entries_count; i++) {
+        if (resolvers_db_name_cmp
+            (builder->entries[i].fields[RESOLVERS_DB_FIELD_NAME],
+             builder->entries[j].fields[RESOLVERS_DB_FIELD_NAME]) == 0) {
+            for (k = 0U; k < RESOLVERS_DB_FIELDS; k++) {
+                free(builder->entries[i].fields[k]);
+            }
+            continue;
+        }
+        builder->entries[++j] = builder->entries[i];
+    }
+    builder->entries_count = j + 1U;
+}
+
+typedef struct ResolversDBBucket_ {
+    uint32_t first;
+    uint32_t count;
+    uint32_t idx;
+} ResolversDBBucket;
+
+static int
+resolvers_db_bucket_cmp(const void * const a_, const void * const b_)
+{
+    const ResolversDBBucket * const a = a_;
+    const ResolversDBBucket * const b = b_;
+
+    if (a->count != b->count) {
+        return (a->count < b->count) - (a->count > b->count);
+    }
+    return (a->idx > b->idx) - (a->idx < b->idx);
+}
+
+/*
+ * Hash and displace: names are grouped by bucket, and starting with
+ * the largest buckets, a seed is searched for every bucket, so that
+ * all its names land on slots that are still free.
+ */
+
+static int
+resolvers_db_builder_place(const ResolversDBBuilder * const builder,
+                           uint32_t * const seeds, const uint32_t buckets_count,
+                           uint32_t * const slots, const uint32_t slots_count)
+{
+    ResolversDBBucket *buckets;
+    uint32_t          *bucket_entries;
+    uint32_t          *bucket_slots;
+    uint32_t           entries_count = (uint32_t) builder->entries_count;
+    uint32_t           b;
+    uint32_t           i;
+    uint32_t           j;
+    uint32_t           k;
+    uint32_t           seed;
+    int                ret = -1;
+
+    buckets = calloc((size_t) buckets_count, sizeof *buckets);
+    bucket_entries = calloc((size_t) entries_count + 1U, sizeof *bucket_entries);
+    bucket_slots = calloc((size_t) entries_count + 1U, sizeof *bucket_slots);
+    if (buckets == NULL || bucket_entries == NULL || bucket_slots == NULL) {
+        goto bye;
+    }
+    for (b = 0U; b < buckets_count; b++) {
+        buckets[b].idx = b;
+        seeds[b] = 0U;
+    }
+    for (i = 0U; i < slots_count; i++) {
+        slots[i] = RESOLVERS_DB_NONE;
+    }
+    for (i = 0U; i < entries_count; i++) {
+        b = resolvers_db_hash(builder->entries[i].fields[RESOLVERS_DB_FIELD_NAME],
+                              0U) % buckets_count;
+        buckets[b].count++;
+    }
+    for (b = 0U, j = 0U; b < buckets_count; b++) {
+        buckets[b].first = j;
+        j += buckets[b].count;
+        buckets[b].count = 0U;
+    }
+    for (i = 0U; i < entries_count; i++) {
+        b = resolvers_db_hash(builder->entries[i].fields[RESOLVERS_DB_FIELD_NAME],
+                              0U) % buckets_count;
+        bucket_entries[buckets[b].first + buckets[b].count++] = i;
+    }
+    qsort(buckets, buckets_count, sizeof *buckets, resolvers_db_bucket_cmp);
+    for (b = 0U; b < buckets_count && buckets[b].count > 0U; b++) {
+        for (seed = 1U; seed < RESOLVERS_DB_MAX_SEED_TRIALS; seed++) {
+            for (j = 0U; j < buckets[b].count; j++) {
+                i = bucket_entries[buckets[b].first + j];
+                bucket_slots[j] = resolvers_db_hash
+                    (builder->entries[i].fields[RESOLVERS_DB_FIELD_NAME],
+                     seed) % slots_count;
+                if (slots[bucket_slots[j]] != RESOLVERS_DB_NONE) {
+                    break;
+                }
+                for (k = 0U; k < j; k++) {
+                    if (bucket_slots[k] == bucket_slots[j]) {
+                        break;
+                    }
+                }
+                if (k < j) {
+                    break;
+                }
+            }
+            if (j == buckets[b].count) {
+                break;
+            }
+        }
+        if (seed >= RESOLVERS_DB_MAX_SEED_TRIALS) {
+            goto bye;
+        }
+        seeds[buckets[b].idx] = seed;
+        for (j = 0U; j < buckets[b].count; j++) {
+            slots[bucket_slots[j]] = bucket_entries[buckets[b].first + j];
+        }
+    }
+    ret = 0;
+bye:
+    free(bucket_slots);
+    free(bucket_entries);
+    free(buckets);
+
+    return ret;
+}
+
+static int
+resolvers_db_write_file(const char * const db_file,
+                        const unsigned char * const buf, const size_t buf_size)
+{
+    FILE   *fp;
+    char   *tmp_file;
+    size_t  db_file_len = strlen(db_file);
+
+    if ((tmp_file = malloc(db_file_len + sizeof ".tmp")) == NULL) {
+        return -1;
+    }
+    memcpy(tmp_file, db_file, db_file_len);
+    memcpy(tmp_file + db_file_len, ".tmp", sizeof ".tmp");
+    if ((fp = fopen(tmp_file, "wb")) == NULL) {
+        free(tmp_file);
+        return -1;
+    }
+    if (fwrite(buf, buf_size, (size_t) 1U, fp) != 1U) {
+        (void) fclose(fp);
+        (void) unlink(tmp_file);
+        free(tmp_file);
+        return -1;
+    }
+    if (fclose(fp) != 0) {
+        (void) unlink(tmp_file);
+        free(tmp_file);
+        return -1;
+    }
+#ifdef _WIN32
+    (void) unlink(db_file);
+#endif
+    if (rename(tmp_file, db_file) != 0) {
+        (void) unlink(tmp_file);
+        free(tmp_file);
+        return -1;
+    }
+    free(tmp_file);
+
+    return 0;
+}
+
+int
+resolvers_db_builder_write(ResolversDBBuilder * const builder,
+                           const char * const db_file,
+                           const char * const csv_file)
+{
+    struct stat     st;
+    unsigned char  *buf = NULL;
+    unsigned char  *p;
+    uint32_t       *seeds = NULL;
+    uint32_t       *slots = NULL;
+    uint64_t        strings_size = (uint64_t) 0U;
+    size_t          buf_size;
+    size_t          field_len;
+    uint32_t        buckets_count;
+    uint32_t        entries_count;
+    uint32_t        slots_count;
+    uint32_t        i;
+    uint32_t        offset;
+    unsigned int    attempt;
+    unsigned int    k;
+    int             ret = -1;
+
+    if (stat(csv_file, &st) != 0) {
+        return -1;
+    }
+    resolvers_db_builder_dedup(builder);
+    entries_count = (uint32_t) builder->entries_count;
+    for (i = 0U; i < entries_count; i++) {
+        for (k = 0U; k < RESOLVERS_DB_FIELDS; k++) {
+            if (builder->entries[i].fields[k] != NULL) {
+                strings_size +=
+                    (uint64_t) strlen(builder->entries[i].fields[k]) + 1U;
+            }
+        }
+    }
+    strings_size++;
+    if (strings_size >= (uint64_t) RESOLVERS_DB_NONE) {
+        return -1;
+    }
+    buckets_count = entries_count / RESOLVERS_DB_BUCKET_SIZE + 1U;
+    slots_count = entries_count + entries_count / 4U + 1U;
+    seeds = calloc((size_t) buckets_count, sizeof *seeds);
+    slots = calloc((size_t) slots_count + entries_count + 8U, sizeof *slots);
+    if (seeds == NULL || slots == NULL) {
+        goto bye;
+    }
+    for (attempt = 0U; resolvers_db_builder_place(builder, seeds, buckets_count,
+                                                  slots, slots_count) != 0;
+         attempt++) {
+        if (attempt >= 8U) {
+            goto bye;
+        }
+        slots_count += entries_count / 8U + 1U;
+    }
+    buf_size = RESOLVERS_DB_HEADER_SIZE + (size_t) buckets_count * 4U +
+        (size_t) slots_count * 4U +
+        (size_t) entries_count * RESOLVERS_DB_FIELDS * 4U +
+        (size_t) strings_size;
+    if ((buf = calloc((size_t) 1U, buf_size)) == NULL) {
+        goto bye;
+    }
+    p = buf;
+    memcpy(p, RESOLVERS_DB_MAGIC, RESOLVERS_DB_MAGIC_LEN);
+    p += RESOLVERS_DB_MAGIC_LEN;
+    resolvers_db_store32(p, entries_count);
+    resolvers_db_store32(p + 4, buckets_count);
+    resolvers_db_store32(p + 8, slots_count);
+    resolvers_db_store32(p + 12, (uint32_t) strings_size);
+    resolvers_db_store64(p + 16, (uint64_t) st.st_size);
+    resolvers_db_store64(p + 24, (uint64_t) st.st_mtime);
+    p = buf + RESOLVERS_DB_HEADER_SIZE;
+    for (i = 0U; i < buckets_count; i++, p += 4) {
+        resolvers_db_store32(p, seeds[i]);
+    }
+    for (i = 0U; i < slots_count; i++, p += 4) {
+        resolvers_db_store32(p, slots[i]);
+    }
+    offset = 0U;
+    for (i = 0U; i < entries_count; i++) {
+        for (k = 0U; k < RESOLVERS_DB_FIELDS; k++, p += 4) {
+            if (builder->entries[i].fields[k] == NULL) {
+                resolvers_db_store32(p, RESOLVERS_DB_NONE);
+                continue;
+            }
+            resolvers_db_store32(p, offset);
+            offset += (uint32_t) strlen(builder->entries[i].fields[k]) + 1U;
+        }
+    }
+    for (i = 0U; i < entries_count; i++) {
+        for (k = 0U; k < RESOLVERS_DB_FIELDS; k++) {
+            if (builder->entries[i].fields[k] == NULL) {
+                continue;
+            }
+            field_len = strlen(builder->entries[i].fields[k]) + 1U;
+            memcpy(p, builder->entries[i].fields[k], field_len);
+            p += field_len;
+        }
+    }
+    ret = resolvers_db_write_file(db_file, buf, buf_size);
+bye:
+    free(buf);
+    free(slots);
+    free(seeds);
+
+    return ret;
+}
+
+void
+resolvers_db_builder_free(ResolversDBBuilder * const builder)
+{
+    size_t       i;
+    unsigned int k;
+
+    if (builder == NULL) {
+        return;
+    }
+    for (i = (size_t) 0U; i < builder->entries_count; i++) {
+        for (k = 0U; k < RESOLVERS_DB_FIELDS; k++) {
+            free(builder->entries[i].fields[k]);
+        }
+    }
+    free(builder->entries);
+    free(builder);
+}
@@ -0,0 +1,101 @@
+
+#ifndef __RESOLVERS_DB_H__
+#define __RESOLVERS_DB_H__ 1
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * A compiled resolvers list, so that looking up a resolver doesn't
+ * require parsing the whole CSV file.
+ *
+ * Resolvers are found by name (case-insensitive) with a perfect hash
+ * function: names are spread over buckets, and every bucket stores
+ * the seed that sends its names to distinct slots. A lookup is two
+ * hashes and a single name comparison.
+ *
+ * The file is mapped in memory as is. All integers are little-endian,
+ * and strings are NUL-terminated:
+ *
+ *   header
+ *   uint32_t seeds[buckets_count]
+ *   uint32_t slots[slots_count]       (entry index, or empty)
+ *   uint32_t entries[entries_count][RESOLVERS_DB_FIELDS] (string offsets)
+ *   char     strings[strings_size]
+ *
+ * The header records the size and modification time of the CSV file
+ * it was compiled from, so that an outdated database is not used.
+ */
+
+#define RESOLVERS_DB_MAGIC "DNSCRDB1"
+#define RESOLVERS_DB_MAGIC_LEN 8U
+#define RESOLVERS_DB_HEADER_SIZE (RESOLVERS_DB_MAGIC_LEN + 4U * 4U + 2U * 8U)
+#define RESOLVERS_DB_SUFFIX ".db"
+#define RESOLVERS_DB_NONE 0xffffffffU
+#define RESOLVERS_DB_BUCKET_SIZE 4U
+#define RESOLVERS_DB_MAX_SEED_TRIALS 0x1000000U
+#define RESOLVERS_DB_MAX_ENTRIES 0x1000000U
+
+typedef enum ResolversDBField_ {
+    RESOLVERS_DB_FIELD_NAME,
+    RESOLVERS_DB_FIELD_PROVIDER_NAME,
+    RESOLVERS_DB_FIELD_PROVIDER_PUBLICKEY,
+    RESOLVERS_DB_FIELD_RESOLVER_ADDRESS,
+    RESOLVERS_DB_FIELD_DNSSEC,
+    RESOLVERS_DB_FIELD_NAMECOIN,
+    RESOLVERS_DB_FIELD_NOLOGS,
+    RESOLVERS_DB_FIELDS
+} ResolversDBField;
+
+/* A resolver's properties; missing columns are NULL */
+typedef struct ResolversDBEntry_ {
+    const char *fields[RESOLVERS_DB_FIELDS];
+} ResolversDBEntry;
+
+typedef struct ResolversDB_ {
+    unsigned char       *map;
+    const unsigned char *seeds;
+    const unsigned char *slots;
+    const unsigned char *entries;
+    const char          *strings;
+    size_t               map_size;
+    uint64_t             csv_size;
+    uint64_t             csv_mtime;
+    uint32_t             entries_count;
+    uint32_t             buckets_count;
+    uint32_t             slots_count;
+    uint32_t             strings_size;
+    _Bool                mapped;
+} ResolversDB;
+
+typedef struct ResolversDBBuilder_ ResolversDBBuilder;
+
+char *resolvers_db_path(const char * const resolvers_list);
+
+int resolvers_db_open(ResolversDB * const db, const char * const db_file);
+
+int resolvers_db_is_fresh(const ResolversDB * const db,
+                          const char * const csv_file);
+
+int resolvers_db_entry(const ResolversDB * const db, const uint32_t entry_idx,
+                       ResolversDBEntry * const entry);
+
+int resolvers_db_lookup(const ResolversDB * const db, const char * const name,
+                        ResolversDBEntry * const entry);
+
+void resolvers_db_close(ResolversDB * const db);
+
+ResolversDBBuilder *resolvers_db_builder_new(void);
+
+int resolvers_db_builder_add(ResolversDBBuilder * const builder,
+                             const ResolversDBEntry * const entry);
+
+int resolvers_db_builder_write(ResolversDBBuilder * const builder,
+                               const char * const db_file,
+                               const char * const csv_file);
+
+void resolvers_db_builder_free(ResolversDBBuilder * const builder);
+
+#endif
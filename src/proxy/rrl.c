@@ -0,0 +1,161 @@
+
+#include <config.h>
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sodium.h>
+
+#include "client_prefix.h"
+#include "rrl.h"
+
+/* Credits are counted in thousandths of a query */
+#define RRL_QUERY_COST 1000U
+#define RRL_BURST_MS   1000U
+
+static const char * const rrl_action_names[RRL_ACTIONS] = {
+    [RRL_ACTION_TRUNCATE] = "truncate",
+    [RRL_ACTION_DROP] = "drop"
+};
+
+int
+rrl_init(RRL * const rrl, const unsigned int rate,
+         const unsigned int ipv4_prefix, const unsigned int ipv6_prefix,
+         const RRLAction action)
+{
+    uintptr_t sets_addr;
+
+    assert(rate <= RRL_RATE_MAX);
+    assert(sizeof (RRLSet) == RRL_SET_SIZE);
+    assert((RRL_SETS & (RRL_SETS - 1U)) == 0U);
+    memset(rrl, 0, sizeof *rrl);
+    rrl->sets_base = NULL;
+    rrl->sets = NULL;
+    rrl->rate = (uint32_t) rate;
+    rrl->ipv4_prefix = ipv4_prefix;
+    rrl->ipv6_prefix = ipv6_prefix;
+    rrl->action = action;
+    if (rate == 0U) {
+        return 0;
+    }
+    if ((rrl->sets_base = calloc((size_t) RRL_SETS + 1U,
+                                 sizeof *rrl->sets)) == NULL) {
+        return -1;
+    }
+    sets_addr = ((uintptr_t) rrl->sets_base + (RRL_SET_SIZE - 1U)) &
+        ~ (uintptr_t) (RRL_SET_SIZE - 1U);
+    rrl->sets = (RRLSet *) (void *) sets_addr;
+    randombytes_buf(rrl->key, sizeof rrl->key);
+
+    return 0;
+}
+
+void
+rrl_free(RRL * const rrl)
+{
+    free(rrl->sets_base);
+    rrl->sets_base = NULL;
+    rrl->sets = NULL;
+}
+
+static RRLEntry *
+rrl_entry_lookup(RRL * const rrl, const uint64_t hash, const uint32_t now_ms,
+                 _Bool * const found)
+{
+    RRLSet * const set = &rrl->sets[hash & (RRL_SETS - 1U)];
+    RRLEntry      *entry;
+    RRLEntry      *victim = NULL;
+    const uint32_t tag = (uint32_t) (hash >> 32) | 1U;
+    unsigned int   i;
+
+    for (i = 0U; i < RRL_WAYS; i++) {
+        entry = &set->entries[i];
+        if (entry->tag == tag) {
+            *found = 1;
+            return entry;
+        }
+        if (victim == NULL || entry->tag == 0U ||
+            (victim->tag != 0U &&
+             (uint32_t) (now_ms - entry->ts) >
+             (uint32_t) (now_ms - victim->ts))) {
+            victim = entry;
+        }
+    }
+    assert(victim != NULL);
+    victim->tag = tag;
+    *found = 0;
+
+    return victim;
+}
+
+int
+rrl_check(RRL * const rrl, const struct sockaddr_storage * const sa,
+          const uint64_t now)
+{
+    RRLEntry      *entry;
+    const uint32_t now_ms = (uint32_t) (now / 1000U);
+    const uint32_t credit_max = rrl->rate * RRL_QUERY_COST;
+    uint32_t       elapsed;
+    _Bool          found;
+
+    if (rrl->rate == 0U) {
+        return 0;
+    }
+    entry = rrl_entry_lookup(rrl, client_prefix_hash(rrl->key, sa,
+                                                     rrl->ipv4_prefix,
+                                                     rrl->ipv6_prefix),
+                             now_ms, &found);
+    if (found == 0) {
+        entry->ts = now_ms;
+        entry->credit = credit_max - RRL_QUERY_COST;
+        entry->is_limited = 0U;
+        return 0;
+    }
+    elapsed = now_ms - entry->ts;
+    if (elapsed >= RRL_BURST_MS) {
+        entry->credit = credit_max;
+    } else if (elapsed > 0U) {
+        entry->credit += elapsed * rrl->rate;
+        if (entry->credit > credit_max) {
+            entry->credit = credit_max;
+        }
+    }
+    entry->ts = now_ms;
+    if (entry->credit >= RRL_QUERY_COST) {
+        entry->credit -= RRL_QUERY_COST;
+        entry->is_limited = 0U;
+        return 0;
+    }
+    if (entry->is_limited == 0U) {
+        entry->is_limited = 1U;
+        rrl->limited_clients++;
+    }
+    rrl->limited[rrl->action]++;
+
+    return -1;
+}
+
+int
+rrl_action_from_name(RRLAction * const action, const char * const name)
+{
+    unsigned int i;
+
+    for (i = 0U; i < RRL_ACTIONS; i++) {
+        if (strcmp(name, rrl_action_names[i]) == 0) {
+            *action = (RRLAction) i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *
+rrl_action_name(const RRLAction action)
+{
+    assert(action < RRL_ACTIONS);
+
+    return rrl_action_names[action];
+}
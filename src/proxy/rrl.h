@@ -0,0 +1,75 @@
+
+#ifndef __RRL_H__
+#define __RRL_H__ 1
+
+#include <stdint.h>
+
+#include "client_prefix.h"
+
+/*
+ * Response rate limiting for UDP clients.
+ *
+ * Every client network gets a token bucket refilled at the configured
+ * rate, with a one-second burst. Buckets live in a fixed-size table of
+ * RRL_SETS sets of RRL_WAYS entries: a set fills a single cache line,
+ * and when a network isn't in its set, the least recently seen entry
+ * is reused. Nothing is allocated or freed while queries are received.
+ */
+
+#ifndef RRL_SETS
+# define RRL_SETS 4096U
+#endif
+#define RRL_WAYS 4U
+#define RRL_SET_SIZE 64U
+
+#ifndef RRL_IPV4_PREFIX
+# define RRL_IPV4_PREFIX 24U
+#endif
+#ifndef RRL_IPV6_PREFIX
+# define RRL_IPV6_PREFIX 56U
+#endif
+#define RRL_RATE_MAX 1000000U
+
+typedef enum RRLAction_ {
+    RRL_ACTION_TRUNCATE,
+    RRL_ACTION_DROP,
+    RRL_ACTIONS
+} RRLAction;
+
+typedef struct RRLEntry_ {
+    uint32_t tag;
+    uint32_t ts;
+    uint32_t credit;
+    uint32_t is_limited;
+} RRLEntry;
+
+typedef struct RRLSet_ {
+    RRLEntry entries[RRL_WAYS];
+} RRLSet;
+
+typedef struct RRL_ {
+    uint8_t      key[CLIENT_PREFIX_KEYBYTES];
+    uint64_t     limited[RRL_ACTIONS];
+    uint64_t     limited_clients;
+    void        *sets_base;
+    RRLSet      *sets;
+    uint32_t     rate;
+    unsigned int ipv4_prefix;
+    unsigned int ipv6_prefix;
+    RRLAction    action;
+} RRL;
+
+int rrl_init(RRL * const rrl, const unsigned int rate,
+             const unsigned int ipv4_prefix, const unsigned int ipv6_prefix,
+             const RRLAction action);
+
+void rrl_free(RRL * const rrl);
+
+int rrl_check(RRL * const rrl, const struct sockaddr_storage * const sa,
+              const uint64_t now);
+
+int rrl_action_from_name(RRLAction * const action, const char * const name);
+
+const char *rrl_action_name(const RRLAction action);
+
+#endif
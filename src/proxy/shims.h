@@ -11,7 +11,7 @@
  * overlapping buffers. Use temporary buffers to work around this.
  */
 #if SODIUM_LIBRARY_VERSION_MAJOR < 7 || SODIUM_LIBRARY_VERSION_MINOR <= 2
-static int
+static inline int
 crypto_box_easy_nooverlap(unsigned char *c, const unsigned char *m,
                           unsigned long long mlen, const unsigned char *n,
                           const unsigned char *pk, const unsigned char *sk)
@@ -29,7 +29,7 @@ crypto_box_easy_nooverlap(unsigned char *c, const unsigned char *m,
     return 0;
 }
 
-static int
+static inline int
 crypto_box_open_easy_nooverlap(unsigned char *m, const unsigned char *c,
                                unsigned long long clen, const unsigned char *n,
                                const unsigned char *pk, const unsigned char *sk)
@@ -52,7 +52,7 @@ crypto_box_open_easy_nooverlap(unsigned char *m, const unsigned char *c,
 #endif
 
 #ifndef HAVE_CRYPTO_BOX_EASY_AFTERNM
-static int
+static inline int
 crypto_box_detached_afternm(unsigned char *c, unsigned char *mac,
                             const unsigned char *m, unsigned long long mlen,
                             const unsigned char *n, const unsigned char *k)
@@ -60,7 +60,7 @@ crypto_box_detached_afternm(unsigned char *c, unsigned char *mac,
     return crypto_secretbox_detached(c, mac, m, mlen, n, k);
 }
 
-static int
+static inline int
 crypto_box_easy_afternm(unsigned char *c, const unsigned char *m,
                         unsigned long long mlen, const unsigned char *n,
                         const unsigned char *k)
@@ -72,7 +72,7 @@ crypto_box_easy_afternm(unsigned char *c, const unsigned char *m,
                                        k);
 }
 
-static int
+static inline int
 crypto_box_open_detached_afternm(unsigned char *m, const unsigned char *c,
                                  const unsigned char *mac,
                                  unsigned long long clen,
@@ -82,7 +82,7 @@ crypto_box_open_detached_afternm(unsigned char *m, const unsigned char *c,
     return crypto_secretbox_open_detached(m, c, mac, clen, n, k);
 }
 
-static int
+static inline int
 crypto_box_open_easy_afternm(unsigned char *m, const unsigned char *c,
                              unsigned long long clen, const unsigned char *n,
                              const unsigned char *k)
@@ -106,7 +106,7 @@ crypto_box_open_easy_afternm(unsigned char *m, const unsigned char *c,
 # define crypto_secretbox_xchacha20poly1305_MACBYTES 16U
 # define crypto_box_curve25519xchacha20poly1305_MACBYTES 16U
 
-static int
+static inline int
 crypto_secretbox_xchacha20poly1305_detached(unsigned char *c,
                                             unsigned char *mac,
                                             const unsigned char *m,
@@ -163,7 +163,7 @@ crypto_secretbox_xchacha20poly1305_detached(unsigned char *c,
     return 0;
 }
 
-static int
+static inline int
 crypto_secretbox_xchacha20poly1305_open_detached(unsigned char *m,
                                                  const unsigned char *c,
                                                  const unsigned char *mac,
@@ -215,7 +215,7 @@ crypto_secretbox_xchacha20poly1305_open_detached(unsigned char *m,
     return 0;
 }
 
-static int
+static inline int
 crypto_box_curve25519xchacha20poly1305_detached_afternm(unsigned char *c,
                                                         unsigned char *mac,
                                                         const unsigned char *m,
@@ -226,7 +226,7 @@ crypto_box_curve25519xchacha20poly1305_detached_afternm(unsigned char *c,
     return crypto_secretbox_xchacha20poly1305_detached(c, mac, m, mlen, n, k);
 }
 
-static int
+static inline int
 crypto_box_curve25519xchacha20poly1305_easy_afternm(unsigned char *c,
                                                     const unsigned char *m,
                                                     unsigned long long mlen,
@@ -240,7 +240,7 @@ crypto_box_curve25519xchacha20poly1305_easy_afternm(unsigned char *c,
         c + crypto_box_curve25519xchacha20poly1305_MACBYTES, c, m, mlen, n, k);
 }
 
-static int
+static inline int
 crypto_box_curve25519xchacha20poly1305_open_detached_afternm(unsigned char *m,
                                                              const unsigned char *c,
                                                              const unsigned char *mac,
@@ -251,7 +251,7 @@ crypto_box_curve25519xchacha20poly1305_open_detached_afternm(unsigned char *m,
     return crypto_secretbox_xchacha20poly1305_open_detached(m, c, mac, clen, n, k);
 }
 
-static int
+static inline int
 crypto_box_curve25519xchacha20poly1305_open_easy_afternm(unsigned char *m,
                                                          const unsigned char *c,
                                                          unsigned long long clen,
@@ -266,7 +266,7 @@ crypto_box_curve25519xchacha20poly1305_open_easy_afternm(unsigned char *m,
         clen - crypto_box_curve25519xchacha20poly1305_MACBYTES, n, k);
 }
 
-static int
+static inline int
 crypto_box_curve25519xchacha20poly1305_detached(unsigned char *c,
                                                 unsigned char *mac,
                                                 const unsigned char *m,
@@ -291,7 +291,7 @@ crypto_box_curve25519xchacha20poly1305_detached(unsigned char *c,
     return ret;
 }
 
-static int
+static inline int
 crypto_box_curve25519xchacha20poly1305_easy(unsigned char *c,
                                             const unsigned char *m,
                                             unsigned long long mlen,
@@ -307,7 +307,7 @@ crypto_box_curve25519xchacha20poly1305_easy(unsigned char *c,
         sk);
 }
 
-static int
+static inline int
 crypto_box_curve25519xchacha20poly1305_open_detached(unsigned char *m,
                                                      const unsigned char *c,
                                                      const unsigned char *mac,
@@ -329,7 +329,7 @@ crypto_box_curve25519xchacha20poly1305_open_detached(unsigned char *m,
     return ret;
 }
 
-static int
+static inline int
 crypto_box_curve25519xchacha20poly1305_open_easy(unsigned char *m,
                                                  const unsigned char *c,
                                                  unsigned long long clen,
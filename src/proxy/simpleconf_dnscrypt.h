@@ -14,21 +14,34 @@ static const SimpleConfEntry simpleconf_options[] = {
     {"Daemonize? <bool>",            "--daemonize"},
     {"EDNSPayloadSize (<digits>)",   "--edns-payload-size=$0"},
     {"EphemeralKeys? <bool>",        "--ephemeral-keys"},
+    {"ForwardingRules (<any*>)",     "--forwarding-rules=$0"},
     {"IgnoreTimestamps? <bool>",     "--ignore-timestamps"},
     {"LocalAddress (<nospace>)",     "--local-address=$0"},
     {"LogFile (<any*>)",             "--logfile=$0"},
     {"LogLevel (<digits>)",          "--loglevel=$0"},
     {"MaxActiveRequests (<digits>)", "--max-active-requests=$0"},
+    {"Metrics (<any*>)",             "--metrics=$0"},
     {"PidFile (<any*>)",             "--pidfile=$0"},
     {"ProviderKey (<any>)",          "--provider-key=$0"},
     {"ProviderName (<any*>)",        "--provider-name=$0"},
     {"ResolverAddress (<nospace>)",  "--resolver-address=$0"},
     {"ResolverName (<nospace>)",     "--resolver-name=$0"},
+    {"ResolversListPublicKey (<nospace>)", "--resolvers-list-pubkey=$0"},
     {"ResolversList (<any*>)",       "--resolvers-list=$0"},
+    {"StandbyResolvers (<nospace>)", "--standby-resolvers=$0"},
     {"ServiceName (<nospace>)",      "--service-name=$0"},
+    {"SlowQueryLog (<any*>)",        "--slow-query-log=$0"},
+    {"SlowQueryThreshold (<digits>)", "--slow-query-threshold=$0"},
     {"SyslogPrefix (<nospace>)",     "--syslog-prefix=$0"},
     {"Syslog? <bool>",               "--syslog"},
     {"TCPOnly? <bool>",              "--tcp-only"},
+    {"TCPIdleTimeout (<digits>)",    "--tcp-idle-timeout=$0"},
+    {"TCPFastOpen? <bool>",          "--tcp-fast-open"},
+    {"OverloadDelayTarget (<digits>)", "--overload-delay-target=$0"},
+    {"RateLimit (<digits>)",         "--rate-limit=$0"},
+    {"RateLimitIPv4Prefix (<digits>)", "--rate-limit-ipv4-prefix=$0"},
+    {"RateLimitIPv6Prefix (<digits>)", "--rate-limit-ipv6-prefix=$0"},
+    {"RateLimitAction (<alnum>)",    "--rate-limit-action=$0"},
     {"Test (<digits>)",              "--test=$0"},
     {"User (<nospace>)",             "--user=$0"},
     {"BlackList domains:(<any>) logfile:(<any>)",             "--plugin=" PLUGIN_LIB("ldns_blocking") ",--domains=$0,--logfile=$1" },
@@ -0,0 +1,237 @@
+
+/*
+ * Time needed to send a query to a resolver over a new TCP connection
+ * and get a reply back, over the loopback interface, with and without
+ * TCP Fast Open, and with and without TCP_NODELAY/TCP_QUICKACK.
+ *
+ * make tcp-fastopen-bench && ./tcp-fastopen-bench [<iterations>]
+ *
+ * The server side of Fast Open has to be enabled in the kernel:
+ * sysctl -w net.ipv4.tcp_fastopen=3
+ * The loopback RTT is tiny; add some latency to see what Fast Open saves
+ * on a real network: tc qdisc add dev lo root netem delay 5ms
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_ITERATIONS 2000UL
+#define QUERY_SIZE 100U
+#define REPLY_SIZE 300U
+
+typedef struct BenchMode_ {
+    const char *name;
+    _Bool       fast_open;
+    _Bool       tune;
+} BenchMode;
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (double) tv.tv_sec + (double) tv.tv_usec / 1e6;
+}
+
+static int
+read_all(const int fd, unsigned char *buf, size_t len)
+{
+    ssize_t readnb;
+
+    while (len > (size_t) 0U) {
+        if ((readnb = read(fd, buf, len)) <= (ssize_t) 0) {
+            if (readnb < (ssize_t) 0 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += readnb;
+        len -= (size_t) readnb;
+    }
+    return 0;
+}
+
+static void
+tune(const int fd)
+{
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY,
+               (void *) (int []) { 1 }, sizeof (int));
+#ifdef TCP_QUICKACK
+    setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK,
+               (void *) (int []) { 1 }, sizeof (int));
+#endif
+}
+
+/* Reads a length-prefixed query, and sends a length-prefixed reply */
+
+static void
+server(const int listener)
+{
+    unsigned char query[2U + QUERY_SIZE];
+    unsigned char reply[2U + REPLY_SIZE] = {
+        (REPLY_SIZE >> 8) & 0xff, REPLY_SIZE & 0xff
+    };
+    int           fd;
+
+    for (;;) {
+        if ((fd = accept(listener, NULL, NULL)) == -1) {
+            continue;
+        }
+        tune(fd);
+        if (read_all(fd, query, sizeof query) == 0) {
+            if (write(fd, reply, sizeof reply) != (ssize_t) sizeof reply) {
+                perror("write");
+            }
+        }
+        close(fd);
+    }
+}
+
+static int
+query(const struct sockaddr_in * const sin, const BenchMode * const mode,
+      _Bool * const syn_data)
+{
+    unsigned char query[2U + QUERY_SIZE] = {
+        (QUERY_SIZE >> 8) & 0xff, QUERY_SIZE & 0xff
+    };
+    unsigned char reply[2U + REPLY_SIZE];
+    int           fd;
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) == -1) {
+        return -1;
+    }
+    if (mode->tune != 0) {
+        tune(fd);
+    }
+#ifdef TCP_FASTOPEN_CONNECT
+    if (mode->fast_open != 0 &&
+        setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+                   (void *) (int []) { 1 }, sizeof (int)) != 0) {
+        close(fd);
+        return -1;
+    }
+#else
+    if (mode->fast_open != 0) {
+        close(fd);
+        return -1;
+    }
+#endif
+    if (connect(fd, (const struct sockaddr *) sin, sizeof *sin) != 0 ||
+        write(fd, query, sizeof query) != (ssize_t) sizeof query ||
+        read_all(fd, reply, sizeof reply) != 0) {
+        close(fd);
+        return -1;
+    }
+    *syn_data = 0;
+#if defined(TCP_INFO) && defined(TCPI_OPT_SYN_DATA)
+    struct tcp_info ti;
+    socklen_t       ti_len = sizeof ti;
+
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &ti_len) == 0) {
+        *syn_data = (ti.tcpi_options & TCPI_OPT_SYN_DATA) != 0;
+    }
+#endif
+    close(fd);
+
+    return 0;
+}
+
+static int
+bench(const struct sockaddr_in * const sin, const BenchMode * const mode,
+      const unsigned long iterations)
+{
+    double        started;
+    double        elapsed;
+    unsigned long i;
+    unsigned long syn_data_count = 0UL;
+    _Bool         syn_data;
+
+    if (query(sin, mode, &syn_data) != 0) {
+        printf("%-24s unavailable\n", mode->name);
+        return -1;
+    }
+    started = now();
+    for (i = 0UL; i < iterations; i++) {
+        if (query(sin, mode, &syn_data) != 0) {
+            perror(mode->name);
+            return -1;
+        }
+        syn_data_count += syn_data;
+    }
+    elapsed = now() - started;
+    printf("%-24s %8.1f us/query, query sent with the SYN: %lu/%lu\n",
+           mode->name, elapsed * 1e6 / (double) iterations,
+           syn_data_count, iterations);
+
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const BenchMode modes[] = {
+        { "connect+write",          0, 0 },
+        { "connect+write, tuned",   0, 1 },
+        { "fast open",              1, 0 },
+        { "fast open, tuned",       1, 1 }
+    };
+    struct sockaddr_in sin;
+    socklen_t          sin_len = sizeof sin;
+    unsigned long      iterations = DEFAULT_ITERATIONS;
+    size_t             i;
+    pid_t              pid;
+    int                listener;
+
+    if (argc > 1 && (iterations = strtoul(argv[1], NULL, 10)) == 0UL) {
+        fputs("Usage: tcp-fastopen-bench [<iterations>]\n", stderr);
+        return 1;
+    }
+    memset(&sin, 0, sizeof sin);
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) == -1 ||
+        bind(listener, (struct sockaddr *) &sin, sizeof sin) != 0 ||
+        getsockname(listener, (struct sockaddr *) &sin, &sin_len) != 0) {
+        perror("bind");
+        return 1;
+    }
+#ifdef TCP_FASTOPEN
+    setsockopt(listener, IPPROTO_TCP, TCP_FASTOPEN,
+               (void *) (int []) { 128 }, sizeof (int));
+#endif
+    if (listen(listener, 128) != 0) {
+        perror("listen");
+        return 1;
+    }
+    if ((pid = fork()) == (pid_t) -1) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == (pid_t) 0) {
+        server(listener);
+        _exit(0);
+    }
+    close(listener);
+    for (i = 0U; i < sizeof modes / sizeof modes[0]; i++) {
+        bench(&sin, &modes[i], iterations);
+    }
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    return 0;
+}
@@ -25,7 +25,10 @@
 
 #include "dnscrypt_client.h"
 #include "dnscrypt_proxy.h"
+#include "failover.h"
+#include "forwarding.h"
 #include "logger.h"
+#include "metrics.h"
 #include "probes.h"
 #include "tcp_request.h"
 #include "tcp_request_p.h"
@@ -34,30 +37,54 @@
 # include "plugin_support.h"
 #endif
 
+static void tcp_session_kill(TCPSession * const session);
+static void tcp_session_read_queries(TCPSession * const session);
+
+static void
+tcp_session_request_done(TCPSession * const session)
+{
+    if (session->status.is_dying != 0) {
+        return;
+    }
+    if (session->status.close_after_write != 0) {
+        if (session->active_requests == 0U &&
+            evbuffer_get_length
+            (bufferevent_get_output(session->client_proxy_bev)) == 0U) {
+            tcp_session_kill(session);
+        }
+        return;
+    }
+    if (session->status.is_reading != 0) {
+        return;
+    }
+    /*
+     * Queries that were waiting for a slot are started from the event
+     * loop and not from here, as this can be called while another
+     * request is being started.
+     */
+    const struct timeval tv = { .tv_sec = (time_t) 0, .tv_usec = 0 };
+    evtimer_add(session->resume_timer, &tv);
+}
+
 static void
 tcp_request_free(TCPRequest * const tcp_request)
 {
     ProxyContext *proxy_context;
+    TCPSession   *session;
 
     if (tcp_request->timeout_timer != NULL) {
         event_free(tcp_request->timeout_timer);
         tcp_request->timeout_timer = NULL;
     }
-    if (tcp_request->client_proxy_bev != NULL) {
-        DNSCRYPT_PROXY_REQUEST_TCP_DONE(tcp_request);
-        bufferevent_free(tcp_request->client_proxy_bev);
-        tcp_request->client_proxy_bev = NULL;
-    }
     if (tcp_request->proxy_resolver_bev != NULL) {
         DNSCRYPT_PROXY_REQUEST_TCP_PROXY_RESOLVER_DONE(tcp_request);
         bufferevent_free(tcp_request->proxy_resolver_bev);
         tcp_request->proxy_resolver_bev = NULL;
     }
-    if (tcp_request->proxy_resolver_query_evbuf != NULL) {
-        evbuffer_free(tcp_request->proxy_resolver_query_evbuf);
-        tcp_request->proxy_resolver_query_evbuf = NULL;
-    }
+    DNSCRYPT_PROXY_REQUEST_TCP_DONE(tcp_request);
     proxy_context = tcp_request->proxy_context;
+    metrics_request_done(proxy_context, &tcp_request->trace, "tcp",
+                         tcp_request->id);
     if (tcp_request->status.is_in_queue != 0) {
         assert(! TAILQ_EMPTY(&proxy_context->tcp_request_queue));
         TAILQ_REMOVE(&proxy_context->tcp_request_queue, tcp_request, queue);
@@ -65,9 +92,18 @@ tcp_request_free(TCPRequest * const tcp_request)
         proxy_context->connections_count--;
         DNSCRYPT_PROXY_STATUS_REQUESTS_ACTIVE(proxy_context->connections_count,
                                               proxy_context->connections_count_max);
+        admission_request_done(&proxy_context->admission,
+                               tcp_request->client_bucket);
     }
+    session = tcp_request->session;
+    assert(session != NULL);
+    TAILQ_REMOVE(&session->requests, tcp_request, session_queue);
+    assert(session->active_requests > 0U);
+    session->active_requests--;
+    tcp_request->session = NULL;
     tcp_request->proxy_context = NULL;
     free(tcp_request);
+    tcp_session_request_done(session);
 }
 
 static void
@@ -80,18 +116,101 @@ tcp_request_kill(TCPRequest * const tcp_request)
     tcp_request_free(tcp_request);
 }
 
+static void
+tcp_session_kill(TCPSession * const session)
+{
+    ProxyContext *proxy_context;
+
+    if (session == NULL || session->status.is_dying) {
+        return;
+    }
+    session->status.is_dying = 1;
+    while (! TAILQ_EMPTY(&session->requests)) {
+        tcp_request_kill(TAILQ_FIRST(&session->requests));
+    }
+    if (session->idle_timer != NULL) {
+        event_free(session->idle_timer);
+        session->idle_timer = NULL;
+    }
+    if (session->resume_timer != NULL) {
+        event_free(session->resume_timer);
+        session->resume_timer = NULL;
+    }
+    if (session->client_proxy_bev != NULL) {
+        bufferevent_free(session->client_proxy_bev);
+        session->client_proxy_bev = NULL;
+    }
+    proxy_context = session->proxy_context;
+    if (session->status.is_in_queue != 0) {
+        assert(! TAILQ_EMPTY(&proxy_context->tcp_session_queue));
+        TAILQ_REMOVE(&proxy_context->tcp_session_queue, session, queue);
+        assert(proxy_context->tcp_sessions_count > 0U);
+        proxy_context->tcp_sessions_count--;
+    }
+    session->proxy_context = NULL;
+    free(session);
+}
+
+/*
+ * Stops reading queries, and closes the connection as soon as all the
+ * pending replies have been sent.
+ */
+
+static void
+tcp_session_close(TCPSession * const session)
+{
+    session->status.close_after_write = 1;
+    bufferevent_disable(session->client_proxy_bev, EV_READ);
+    tcp_session_request_done(session);
+}
+
 static void
 tcp_tune(evutil_socket_t handle)
 {
     if (handle == -1) {
         return;
     }
+    setsockopt(handle, IPPROTO_TCP, TCP_NODELAY,
+               (void *) (int []) { 1 }, sizeof (int));
 #ifdef TCP_QUICKACK
     setsockopt(handle, IPPROTO_TCP, TCP_QUICKACK,
                (void *) (int []) { 1 }, sizeof (int));
-#else
-    setsockopt(handle, IPPROTO_TCP, TCP_NODELAY,
+#endif
+}
+
+/*
+ * With TCP Fast Open, connect() returns immediately, and the query is
+ * sent along with the SYN packet if the resolver gave us a cookie before.
+ */
+
+static evutil_socket_t
+tcp_resolver_socket(const ProxyContext * const proxy_context,
+                    const struct sockaddr_storage * const resolver_sockaddr)
+{
+#ifdef TCP_FASTOPEN_CONNECT
+    evutil_socket_t handle;
+
+    if (proxy_context->tcp_fast_open == 0) {
+        return (evutil_socket_t) -1;
+    }
+    handle = socket(resolver_sockaddr->ss_family, SOCK_STREAM, IPPROTO_TCP);
+    if (handle == -1) {
+        return (evutil_socket_t) -1;
+    }
+    if (evutil_make_socket_nonblocking(handle) != 0) {
+        evutil_closesocket(handle);
+        return (evutil_socket_t) -1;
+    }
+    evutil_make_socket_closeonexec(handle);
+    setsockopt(handle, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
                (void *) (int []) { 1 }, sizeof (int));
+
+    return handle;
+#else
+    (void) proxy_context;
+    (void) resolver_sockaddr;
+
+    return (evutil_socket_t) -1;
 #endif
 }
 
@@ -104,11 +223,43 @@ timeout_timer_cb(evutil_socket_t timeout_timer_handle, short ev_flags,
     (void) ev_flags;
     (void) timeout_timer_handle;
     DNSCRYPT_PROXY_REQUEST_TCP_TIMEOUT(tcp_request);
+    tcp_request->proxy_context->metrics.timeouts_tcp++;
     logger_noformat(tcp_request->proxy_context, LOG_DEBUG,
                     "resolver timeout (TCP)");
+    if (tcp_request->target == NULL) {
+        failover_query_failed(tcp_request->proxy_context,
+                              tcp_request->resolver_generation);
+    }
     tcp_request_kill(tcp_request);
 }
 
+static void
+idle_timer_cb(evutil_socket_t idle_timer_handle, short ev_flags,
+              void * const session_)
+{
+    TCPSession * const session = session_;
+
+    (void) ev_flags;
+    (void) idle_timer_handle;
+    if (session->active_requests == 0U) {
+        tcp_session_close(session);
+    }
+}
+
+static void
+resume_timer_cb(evutil_socket_t resume_timer_handle, short ev_flags,
+                void * const session_)
+{
+    TCPSession * const session = session_;
+
+    (void) ev_flags;
+    (void) resume_timer_handle;
+    if (session->status.close_after_write == 0 &&
+        session->status.is_reading == 0) {
+        tcp_session_read_queries(session);
+    }
+}
+
 static void
 proxy_resolver_event_cb(struct bufferevent * const proxy_resolver_bev,
                         const short events, void * const tcp_request_)
@@ -118,29 +269,121 @@ proxy_resolver_event_cb(struct bufferevent * const proxy_resolver_bev,
     (void) proxy_resolver_bev;
     if ((events & BEV_EVENT_ERROR) != 0) {
         DNSCRYPT_PROXY_REQUEST_TCP_PROXY_RESOLVER_NETWORK_ERROR(tcp_request);
+        if (tcp_request->target == NULL) {
+            failover_query_failed(tcp_request->proxy_context,
+                                  tcp_request->resolver_generation);
+        }
         tcp_request_kill(tcp_request);
         return;
     }
-    if ((events & BEV_EVENT_CONNECTED) == 0) {
+    if ((events & BEV_EVENT_CONNECTED) != 0) {
         DNSCRYPT_PROXY_REQUEST_TCP_PROXY_RESOLVER_CONNECTED(tcp_request);
         tcp_tune(bufferevent_getfd(proxy_resolver_bev));
         return;
     }
 }
 
+static void
+tcp_reply_free_cb(const void * const data, const size_t datalen,
+                  void * const extra)
+{
+    (void) datalen;
+    (void) extra;
+    free((void *) data);
+}
+
+/*
+ * Sends a reply to the client. The reply must be preceded by two bytes,
+ * that receive its length. If is_owned is set, the buffer was allocated
+ * with malloc(), and is handed over to the output buffer without being
+ * copied: it is freed once it has been sent, or if this fails.
+ */
+
+static int
+tcp_request_reply(TCPRequest * const tcp_request,
+                  uint8_t * const dns_reply_with_len,
+                  const size_t dns_reply_len, const _Bool is_owned)
+{
+    TCPSession      *session = tcp_request->session;
+    struct evbuffer *output = bufferevent_get_output(session->client_proxy_bev);
+
+    dns_reply_with_len[0] = (dns_reply_len >> 8) & 0xff;
+    dns_reply_with_len[1] = dns_reply_len & 0xff;
+    if (is_owned != 0) {
+        if (evbuffer_add_reference(output, dns_reply_with_len,
+                                   2U + dns_reply_len,
+                                   tcp_reply_free_cb, NULL) != 0) {
+            free(dns_reply_with_len);
+            return -1;
+        }
+    } else if (evbuffer_add(output, dns_reply_with_len,
+                            2U + dns_reply_len) != 0) {
+        return -1;
+    }
+    bufferevent_enable(session->client_proxy_bev, EV_WRITE);
+    DNSCRYPT_PROXY_REQUEST_TCP_REPLIED(tcp_request);
+    REQUEST_TRACE_MARK(&tcp_request->trace, REQUEST_STAGE_REPLIED);
+
+    return 0;
+}
+
+/*
+ * Decrypts a reply in place, with the keys of the resolver the query was
+ * sent to. Only the resolver in use reports to the failover logic.
+ */
+
+static int
+tcp_request_uncurve(TCPRequest * const tcp_request, uint8_t * const dns_reply,
+                    size_t * const dns_reply_len_p)
+{
+    ProxyContext     * const proxy_context = tcp_request->proxy_context;
+    ForwardingTarget * const target = tcp_request->target;
+    size_t                   uncurved_len = *dns_reply_len_p;
+
+    DNSCRYPT_PROXY_REQUEST_UNCURVE_START(tcp_request, uncurved_len);
+    if (dnscrypt_client_uncurve(target == NULL ?
+                                &proxy_context->dnscrypt_client :
+                                &target->client,
+                                tcp_request->client_nonce,
+                                dns_reply, &uncurved_len) != 0) {
+        DNSCRYPT_PROXY_REQUEST_UNCURVE_ERROR(tcp_request);
+        proxy_context->metrics.uncurve_errors++;
+        DNSCRYPT_PROXY_REQUEST_TCP_PROXY_RESOLVER_GOT_INVALID_REPLY(tcp_request);
+        logger_noformat(proxy_context, LOG_INFO,
+                        "Received a corrupted reply from the resolver");
+        if (target == NULL) {
+            failover_query_failed(proxy_context,
+                                  tcp_request->resolver_generation);
+        }
+        return -1;
+    }
+    if (target == NULL) {
+        failover_query_succeeded(proxy_context,
+                                 tcp_request->resolver_generation);
+    }
+    DNSCRYPT_PROXY_REQUEST_UNCURVE_DONE(tcp_request, uncurved_len);
+    REQUEST_TRACE_MARK(&tcp_request->trace, REQUEST_STAGE_UNCURVE_DONE);
+    memset(tcp_request->client_nonce, 0, sizeof tcp_request->client_nonce);
+    assert(uncurved_len <= *dns_reply_len_p);
+    *dns_reply_len_p = uncurved_len;
+
+    return 0;
+}
+
 static void
 resolver_proxy_read_cb(struct bufferevent * const proxy_resolver_bev,
                        void * const tcp_request_)
 {
-    uint8_t          dns_reply_len_buf[2];
-    uint8_t          dns_uncurved_reply_len_buf[2];
-    uint8_t         *dns_reply;
-    TCPRequest      *tcp_request = tcp_request_;
-    ProxyContext    *proxy_context = tcp_request->proxy_context;
-    struct evbuffer *input = bufferevent_get_input(proxy_resolver_bev);
-    size_t           available_size;
-    size_t           dns_reply_len;
-    size_t           uncurved_len;
+    uint8_t           dns_reply_len_buf[2];
+    uint8_t          *dns_reply_with_len;
+    uint8_t          *dns_reply;
+    TCPRequest       *tcp_request = tcp_request_;
+    ProxyContext     *proxy_context = tcp_request->proxy_context;
+    ForwardingTarget *target = tcp_request->target;
+    struct evbuffer  *input = bufferevent_get_input(proxy_resolver_bev);
+    size_t            available_size;
+    size_t            dns_reply_len;
+    size_t            min_reply_len = DNS_HEADER_SIZE;
 
     if (tcp_request->status.has_dns_reply_len == 0) {
         assert(evbuffer_get_length(input) >= (size_t) 2U);
@@ -151,8 +394,10 @@ resolver_proxy_read_cb(struct bufferevent * const proxy_resolver_bev,
     }
     assert(tcp_request->status.has_dns_reply_len != 0);
     dns_reply_len = tcp_request->dns_reply_len;
-    if (dns_reply_len <
-        (size_t) DNS_HEADER_SIZE + dnscrypt_response_header_size()) {
+    if (target == NULL || target->type == FORWARDING_TARGET_DNSCRYPT) {
+        min_reply_len += dnscrypt_response_header_size();
+    }
+    if (dns_reply_len < min_reply_len) {
         logger_noformat(proxy_context, LOG_WARNING, "Short reply received");
         DNSCRYPT_PROXY_REQUEST_TCP_PROXY_RESOLVER_GOT_INVALID_REPLY(tcp_request);
         tcp_request_kill(tcp_request);
@@ -165,35 +410,35 @@ resolver_proxy_read_cb(struct bufferevent * const proxy_resolver_bev,
         return;
     }
     DNSCRYPT_PROXY_REQUEST_TCP_PROXY_RESOLVER_REPLIED(tcp_request);
+    REQUEST_TRACE_MARK(&tcp_request->trace, REQUEST_STAGE_UPSTREAM_REPLIED);
     assert(available_size >= dns_reply_len);
-    dns_reply = evbuffer_pullup(input, (ssize_t) dns_reply_len);
-    if (dns_reply == NULL) {
+    proxy_context->metrics.upstream_bytes_received_tcp += 2U + dns_reply_len;
+    if ((dns_reply_with_len = malloc(2U + dns_reply_len)) == NULL) {
         tcp_request_kill(tcp_request);
         return;
     }
-    uncurved_len = dns_reply_len;
-    DNSCRYPT_PROXY_REQUEST_UNCURVE_START(tcp_request, uncurved_len);
-    if (dnscrypt_client_uncurve(&proxy_context->dnscrypt_client,
-                                tcp_request->client_nonce,
-                                dns_reply, &uncurved_len) != 0) {
-        DNSCRYPT_PROXY_REQUEST_UNCURVE_ERROR(tcp_request);
-        DNSCRYPT_PROXY_REQUEST_TCP_PROXY_RESOLVER_GOT_INVALID_REPLY(tcp_request);
-        logger_noformat(tcp_request->proxy_context, LOG_INFO,
-                        "Received a corrupted reply from the resolver");
+    dns_reply = dns_reply_with_len + 2U;
+    if ((ssize_t) evbuffer_remove(input, dns_reply, dns_reply_len)
+        != (ssize_t) dns_reply_len) {
+        free(dns_reply_with_len);
+        tcp_request_kill(tcp_request);
+        return;
+    }
+    if ((target == NULL || target->type == FORWARDING_TARGET_DNSCRYPT) &&
+        tcp_request_uncurve(tcp_request, dns_reply, &dns_reply_len) != 0) {
+        free(dns_reply_with_len);
         tcp_request_kill(tcp_request);
         return;
     }
-    DNSCRYPT_PROXY_REQUEST_UNCURVE_DONE(tcp_request, uncurved_len);
-    memset(tcp_request->client_nonce, 0, sizeof tcp_request->client_nonce);
-    assert(uncurved_len <= dns_reply_len);
-    dns_reply_len = uncurved_len;
 #ifdef PLUGINS
+    TCPSession * const session = tcp_request->session;
     const size_t max_reply_size_for_filter = tcp_request->dns_reply_len;
     DCPluginDNSPacket dcp_packet = {
-        .client_sockaddr = &tcp_request->client_sockaddr,
+        .client_sockaddr = &session->client_sockaddr,
         .dns_packet = dns_reply,
         .dns_packet_len_p = &dns_reply_len,
-        .client_sockaddr_len_s = (size_t) tcp_request->client_sockaddr_len,
+        .client_sockaddr_len_s = (size_t) session->client_sockaddr_len,
+        .request_id = tcp_request->id,
         .dns_packet_max_len = max_reply_size_for_filter
     };
     DNSCRYPT_PROXY_REQUEST_PLUGINS_POST_START(tcp_request, dns_reply_len,
@@ -207,132 +452,213 @@ resolver_proxy_read_cb(struct bufferevent * const proxy_resolver_bev,
            dns_reply_len <= max_reply_size_for_filter);
     if (res != DCP_SYNC_FILTER_RESULT_OK) {
         DNSCRYPT_PROXY_REQUEST_PLUGINS_POST_ERROR(tcp_request, res);
+        free(dns_reply_with_len);
         tcp_request_kill(tcp_request);
         return;
     }
     DNSCRYPT_PROXY_REQUEST_PLUGINS_POST_DONE(tcp_request, dns_reply_len,
                                              max_reply_size_for_filter);
+    REQUEST_TRACE_MARK(&tcp_request->trace, REQUEST_STAGE_PLUGINS_POST_DONE);
 #endif
-    dns_uncurved_reply_len_buf[0] = (dns_reply_len >> 8) & 0xff;
-    dns_uncurved_reply_len_buf[1] = dns_reply_len & 0xff;
-    if (bufferevent_write(tcp_request->client_proxy_bev,
-                          dns_uncurved_reply_len_buf, (size_t) 2U) != 0 ||
-        bufferevent_write(tcp_request->client_proxy_bev, dns_reply,
-                          dns_reply_len) != 0) {
-        tcp_request_kill(tcp_request);
+    if (tcp_request_reply(tcp_request, dns_reply_with_len,
+                          dns_reply_len, 1) != 0) {
+        tcp_session_kill(tcp_request->session);
         return;
     }
-    bufferevent_enable(tcp_request->client_proxy_bev, EV_WRITE);
-    DNSCRYPT_PROXY_REQUEST_TCP_PROXY_RESOLVER_DONE(tcp_request);
-    bufferevent_free(tcp_request->proxy_resolver_bev);
-    tcp_request->proxy_resolver_bev = NULL;
+    tcp_request_kill(tcp_request);
 }
 
 static void
 client_proxy_event_cb(struct bufferevent * const client_proxy_bev,
-                      const short events, void * const tcp_request_)
+                      const short events, void * const session_)
 {
-    TCPRequest * const tcp_request = tcp_request_;
+    TCPSession * const session = session_;
 
     (void) client_proxy_bev;
-    (void) events;
-    tcp_request_kill(tcp_request);
+    if ((events & BEV_EVENT_EOF) != 0 && (events & BEV_EVENT_ERROR) == 0 &&
+        session->active_requests > 0U) {
+        tcp_session_close(session);
+        return;
+    }
+    tcp_session_kill(session);
 }
 
 static void
 client_proxy_write_cb(struct bufferevent * const client_proxy_bev,
-                      void * const tcp_request_)
+                      void * const session_)
 {
-    TCPRequest * const tcp_request = tcp_request_;
+    TCPSession * const session = session_;
 
     (void) client_proxy_bev;
-    DNSCRYPT_PROXY_REQUEST_TCP_REPLIED(tcp_request);
-    tcp_request_kill(tcp_request);
+    if (session->status.close_after_write != 0 &&
+        session->active_requests == 0U) {
+        tcp_session_kill(session);
+    }
 }
 
-#ifdef PLUGINS
-static void
-proxy_to_client_direct(TCPRequest * const tcp_request,
-                       const uint8_t * const dns_reply,
-                       const size_t dns_reply_len)
+/*
+ * Encrypts a query in place, for the resolver in use or for the DNSCrypt
+ * target of a forwarding rule. The query starts DNSCRYPT_QUERY_BOX_OFFSET
+ * bytes after boxed.
+ */
+
+static ssize_t
+tcp_request_curve(TCPRequest * const tcp_request, uint8_t * const boxed,
+                  const size_t dns_query_len, const size_t max_query_size)
 {
-    uint8_t dns_reply_len_buf[2];
+    ProxyContext     * const proxy_context = tcp_request->proxy_context;
+    ForwardingTarget * const target = tcp_request->target;
+    ssize_t                  curve_ret;
 
-    DNSCRYPT_PROXY_REQUEST_TCP_PROXY_RESOLVER_DONE(tcp_request);
-    bufferevent_free(tcp_request->proxy_resolver_bev);
-    tcp_request->proxy_resolver_bev = NULL;
+    assert(SIZE_MAX - DNSCRYPT_MAX_PADDING - dnscrypt_query_header_size()
+           > dns_query_len);
+    size_t max_len = dns_query_len + DNSCRYPT_MAX_PADDING +
+        dnscrypt_query_header_size();
+    if (max_len > max_query_size) {
+        max_len = max_query_size;
+    }
+    if (dns_query_len + dnscrypt_query_header_size() > max_len) {
+        return (ssize_t) -1;
+    }
+    assert(max_len <= DNS_MAX_PACKET_SIZE_TCP - 2U);
+    assert(dns_query_len <= max_len);
+    DNSCRYPT_PROXY_REQUEST_CURVE_START(tcp_request, dns_query_len);
+    curve_ret =
+        dnscrypt_client_curve_in_place(target == NULL ?
+                                       &proxy_context->dnscrypt_client :
+                                       &target->client,
+                                       tcp_request->client_nonce,
+                                       boxed, dns_query_len, max_len);
+    if (curve_ret <= (ssize_t) 0) {
+        DNSCRYPT_PROXY_REQUEST_CURVE_ERROR(tcp_request);
+        return (ssize_t) -1;
+    }
+    DNSCRYPT_PROXY_REQUEST_CURVE_DONE(tcp_request, (size_t) curve_ret);
+    REQUEST_TRACE_MARK(&tcp_request->trace, REQUEST_STAGE_CURVE_DONE);
 
-    dns_reply_len_buf[0] = (dns_reply_len >> 8) & 0xff;
-    dns_reply_len_buf[1] = dns_reply_len & 0xff;
-    if (bufferevent_write(tcp_request->client_proxy_bev,
-                          dns_reply_len_buf, (size_t) 2U) != 0 ||
-        bufferevent_write(tcp_request->client_proxy_bev, dns_reply,
-                          dns_reply_len) != 0) {
-        tcp_request_kill(tcp_request);
-        return;
+    return curve_ret;
+}
+
+/*
+ * Count a query as an active request, dropping another one to make room
+ * for it if needed. Returns -1 if the query itself has to be dropped.
+ */
+
+static int
+tcp_request_admit(TCPRequest * const tcp_request)
+{
+    ProxyContext *proxy_context = tcp_request->proxy_context;
+
+    if (proxy_context->connections_count >=
+        proxy_context->connections_count_max) {
+        DNSCRYPT_PROXY_REQUEST_TCP_OVERLOADED();
+        if (admission_make_room(proxy_context,
+                                tcp_request->client_bucket) != 0) {
+            return -1;
+        }
+        proxy_context->metrics.overload_kills_tcp++;
     }
-    bufferevent_enable(tcp_request->client_proxy_bev, EV_WRITE);
-    assert(tcp_request->proxy_resolver_bev == NULL);
+    proxy_context->connections_count++;
+    assert(proxy_context->connections_count
+           <= proxy_context->connections_count_max);
+    DNSCRYPT_PROXY_STATUS_REQUESTS_ACTIVE(proxy_context->connections_count,
+                                          proxy_context->connections_count_max);
+    admission_request_start(&proxy_context->admission,
+                            tcp_request->client_bucket);
+    TAILQ_INSERT_TAIL(&proxy_context->tcp_request_queue,
+                      tcp_request, queue);
+    tcp_request->status.is_in_queue = 1;
+
+    return 0;
 }
-#endif
 
-static void
-client_proxy_read_cb(struct bufferevent * const client_proxy_bev,
-                     void * const tcp_request_)
+/*
+ * Starts processing a query whose length has been read and that is
+ * fully available in the input buffer.
+ * Returns -1 if the whole session has to be closed.
+ */
+
+static int
+tcp_request_start(TCPSession * const session, struct evbuffer * const input,
+                  size_t dns_query_len)
 {
-    uint8_t          dns_query[DNS_MAX_PACKET_SIZE_TCP - 2U];
-    uint8_t          dns_query_len_buf[2];
-    uint8_t          dns_curved_query_len_buf[2];
-    TCPRequest      *tcp_request = tcp_request_;
-    ProxyContext    *proxy_context = tcp_request->proxy_context;
-    struct evbuffer *input = bufferevent_get_input(client_proxy_bev);
-    ssize_t          curve_ret;
-    size_t           available_size;
-    size_t           dns_query_len;
-    size_t           max_query_size;
+    struct evbuffer_iovec    iov;
+    uint8_t                 *dns_query;
+    TCPRequest              *tcp_request;
+    ProxyContext            *proxy_context = session->proxy_context;
+    ForwardingTarget        *target;
+    struct evbuffer         *output;
+    struct sockaddr_storage *resolver_sockaddr;
+    ssize_t                  curve_ret;
+    evutil_socket_t          resolver_handle;
+    ev_socklen_t             resolver_sockaddr_len;
+    size_t                   max_query_size;
 
-    if (tcp_request->status.has_dns_query_len == 0) {
-        assert(evbuffer_get_length(input) >= (size_t) 2U);
-        evbuffer_remove(input, dns_query_len_buf, sizeof dns_query_len_buf);
-        tcp_request->dns_query_len = (size_t)
-            ((dns_query_len_buf[0] << 8) | dns_query_len_buf[1]);
-        tcp_request->status.has_dns_query_len = 1;
-    }
-    assert(tcp_request->status.has_dns_query_len != 0);
-    dns_query_len = tcp_request->dns_query_len;
-    if (dns_query_len < (size_t) DNS_HEADER_SIZE) {
-        logger_noformat(proxy_context, LOG_WARNING, "Short query received");
-        tcp_request_kill(tcp_request);
-        return;
+    if ((tcp_request = calloc((size_t) 1U, sizeof *tcp_request)) == NULL) {
+        return -1;
     }
-    available_size = evbuffer_get_length(input);
-    if (available_size < dns_query_len) {
-        bufferevent_setwatermark(tcp_request->client_proxy_bev,
-                                 EV_READ, dns_query_len, dns_query_len);
-        return;
+    tcp_request->proxy_context = proxy_context;
+    tcp_request->session = session;
+    tcp_request->timeout_timer = NULL;
+    tcp_request->proxy_resolver_bev = NULL;
+    tcp_request->id = ++proxy_context->last_request_id;
+    tcp_request->client_bucket = session->client_bucket;
+    memset(&tcp_request->status, 0, sizeof tcp_request->status);
+    TAILQ_INSERT_TAIL(&session->requests, tcp_request, session_queue);
+    session->active_requests++;
+    TAILQ_REMOVE(&proxy_context->tcp_session_queue, session, queue);
+    TAILQ_INSERT_TAIL(&proxy_context->tcp_session_queue, session, queue);
+
+    /*
+     * The query is read directly into space reserved in the output buffer
+     * of the resolver connection, after room for the length prefix and
+     * the DNSCrypt header, and then encrypted in place.
+     */
+    max_query_size = dns_query_len + dnscrypt_query_header_size() +
+        DNSCRYPT_MAX_PADDING + TCP_QUERY_HEADROOM;
+    if (max_query_size > DNS_MAX_PACKET_SIZE_TCP - 2U) {
+        max_query_size = DNS_MAX_PACKET_SIZE_TCP - 2U;
     }
-    assert(available_size >= dns_query_len);
-    bufferevent_disable(tcp_request->client_proxy_bev, EV_READ);
-    assert(tcp_request->proxy_resolver_query_evbuf == NULL);
-    if ((tcp_request->proxy_resolver_query_evbuf = evbuffer_new()) == NULL) {
+    assert(max_query_size >= DNSCRYPT_QUERY_BOX_OFFSET + dns_query_len);
+    tcp_request->proxy_resolver_bev = bufferevent_socket_new
+        (proxy_context->event_loop, -1, BEV_OPT_CLOSE_ON_FREE);
+    if (tcp_request->proxy_resolver_bev == NULL) {
         tcp_request_kill(tcp_request);
-        return;
+        return -1;
     }
-    if ((ssize_t)
-        evbuffer_remove_buffer(input, tcp_request->proxy_resolver_query_evbuf,
-                               dns_query_len) != (ssize_t) dns_query_len) {
+    output = bufferevent_get_output(tcp_request->proxy_resolver_bev);
+    if (evbuffer_reserve_space(output, (ev_ssize_t) (2U + max_query_size),
+                               &iov, 1) != 1) {
         tcp_request_kill(tcp_request);
-        return;
+        return -1;
     }
-    assert(dns_query_len <= sizeof dns_query);
-    if ((ssize_t) evbuffer_remove(tcp_request->proxy_resolver_query_evbuf,
-                                  dns_query, dns_query_len)
+    dns_query = (uint8_t *) iov.iov_base + 2U + DNSCRYPT_QUERY_BOX_OFFSET;
+    if ((ssize_t) evbuffer_remove(input, dns_query, dns_query_len)
         != (ssize_t) dns_query_len) {
         tcp_request_kill(tcp_request);
-        return;
+        return -1;
+    }
+    REQUEST_TRACE_MARK(&tcp_request->trace, REQUEST_STAGE_RECEIVED);
+    proxy_context->metrics.queries_tcp++;
+    DNSCRYPT_PROXY_REQUEST_TCP_START(tcp_request);
+    /*
+     * As with UDP, an overloaded proxy only admits queries that the
+     * plugins didn't answer locally.
+     */
+    if (proxy_context->connections_count <
+        proxy_context->connections_count_max) {
+        (void) tcp_request_admit(tcp_request);
     }
-    max_query_size = sizeof dns_query;
-    assert(max_query_size < DNS_MAX_PACKET_SIZE_TCP);
+    if ((tcp_request->timeout_timer =
+         evtimer_new(proxy_context->event_loop,
+                     timeout_timer_cb, tcp_request)) == NULL) {
+        tcp_request_kill(tcp_request);
+        return 0;
+    }
+    const struct timeval tv = {
+        .tv_sec = (time_t) DNS_QUERY_TIMEOUT, .tv_usec = 0
+    };
+    evtimer_add(tcp_request->timeout_timer, &tv);
 #ifdef PLUGINS
     size_t max_query_size_for_filter = dns_query_len;
     const size_t header_size = dnscrypt_query_header_size();
@@ -342,10 +668,11 @@ client_proxy_read_cb(struct bufferevent * const client_proxy_bev,
             (DNSCRYPT_MAX_PADDING + header_size);
     }
     DCPluginDNSPacket dcp_packet = {
-        .client_sockaddr = &tcp_request->client_sockaddr,
+        .client_sockaddr = &session->client_sockaddr,
         .dns_packet = dns_query,
         .dns_packet_len_p = &dns_query_len,
-        .client_sockaddr_len_s = (size_t) tcp_request->client_sockaddr_len,
+        .client_sockaddr_len_s = (size_t) session->client_sockaddr_len,
+        .request_id = tcp_request->id,
         .dns_packet_max_len = max_query_size_for_filter
     };
     DNSCRYPT_PROXY_REQUEST_PLUGINS_PRE_START(tcp_request, dns_query_len,
@@ -354,7 +681,8 @@ client_proxy_read_cb(struct bufferevent * const client_proxy_bev,
     const DCPluginSyncFilterResult res =
         plugin_support_context_apply_sync_pre_filters
         (proxy_context->app_context->dcps_context, &dcp_packet);
-    assert(dns_query_len > (size_t) 0U && dns_query_len <= max_query_size &&
+    assert(dns_query_len > (size_t) 0U &&
+           dns_query_len <= max_query_size - DNSCRYPT_QUERY_BOX_OFFSET &&
            dns_query_len <= max_query_size_for_filter);
     switch (res) {
     case DCP_SYNC_FILTER_RESULT_OK:
@@ -362,51 +690,176 @@ client_proxy_read_cb(struct bufferevent * const client_proxy_bev,
     case DCP_SYNC_FILTER_RESULT_DIRECT:
         DNSCRYPT_PROXY_REQUEST_PLUGINS_PRE_DONE(tcp_request, dns_query_len,
                                                 max_query_size_for_filter);
-        proxy_to_client_direct(tcp_request, dns_query, dns_query_len);
-        return;
+        REQUEST_TRACE_MARK(&tcp_request->trace,
+                           REQUEST_STAGE_PLUGINS_PRE_DONE);
+        proxy_context->metrics.local_replies_tcp++;
+        if (tcp_request_reply(tcp_request, dns_query - 2U, dns_query_len,
+                              0) != 0) {
+            return -1;
+        }
+        tcp_request_kill(tcp_request);
+        return 0;
     default:
         DNSCRYPT_PROXY_REQUEST_PLUGINS_PRE_ERROR(tcp_request, res);
         tcp_request_kill(tcp_request);
-        return;
+        return 0;
     }
     DNSCRYPT_PROXY_REQUEST_PLUGINS_PRE_DONE(tcp_request, dns_query_len,
                                             max_query_size_for_filter);
+    REQUEST_TRACE_MARK(&tcp_request->trace, REQUEST_STAGE_PLUGINS_PRE_DONE);
 #endif
-    assert(SIZE_MAX - DNSCRYPT_MAX_PADDING - dnscrypt_query_header_size()
-           > dns_query_len);
-    size_t max_len = dns_query_len + DNSCRYPT_MAX_PADDING +
-        dnscrypt_query_header_size();
-    if (max_len > max_query_size) {
-        max_len = max_query_size;
+    if (tcp_request->status.is_in_queue == 0 &&
+        tcp_request_admit(tcp_request) != 0) {
+        tcp_request_kill(tcp_request);
+        return 0;
     }
-    if (dns_query_len + dnscrypt_query_header_size() > max_len) {
+    resolver_sockaddr = &proxy_context->resolver_sockaddr;
+    resolver_sockaddr_len = proxy_context->resolver_sockaddr_len;
+    if ((target = forwarding_target_for_query(&proxy_context->forwarding,
+                                              dns_query,
+                                              dns_query_len)) != NULL) {
+        if (target->type == FORWARDING_TARGET_DNSCRYPT &&
+            target->has_cert == 0) {
+            logger(proxy_context, LOG_DEBUG,
+                   "No certificates for [%s] yet", target->name);
+            tcp_request_kill(tcp_request);
+            return 0;
+        }
+        tcp_request->target = target;
+        resolver_sockaddr = &target->resolver_sockaddr;
+        resolver_sockaddr_len = target->resolver_sockaddr_len;
+    }
+    if ((resolver_handle = tcp_resolver_socket(proxy_context,
+                                               resolver_sockaddr)) != -1 &&
+        bufferevent_setfd(tcp_request->proxy_resolver_bev,
+                          resolver_handle) != 0) {
+        evutil_closesocket(resolver_handle);
         tcp_request_kill(tcp_request);
-        return;
+        return 0;
     }
-    assert(max_len <= DNS_MAX_PACKET_SIZE_TCP - 2U);
-    assert(max_len <= sizeof dns_query);
-    assert(dns_query_len <= max_len);
-    DNSCRYPT_PROXY_REQUEST_CURVE_START(tcp_request, dns_query_len);
-    curve_ret =
-        dnscrypt_client_curve(&proxy_context->dnscrypt_client,
-                              tcp_request->client_nonce,
-                              dns_query, dns_query_len, max_len);
-    if (curve_ret <= (ssize_t) 0) {
-        DNSCRYPT_PROXY_REQUEST_CURVE_ERROR(tcp_request);
+    if (target != NULL && target->type == FORWARDING_TARGET_PLAIN) {
+        memmove((uint8_t *) iov.iov_base + 2U, dns_query, dns_query_len);
+        curve_ret = (ssize_t) dns_query_len;
+    } else if ((curve_ret = tcp_request_curve(tcp_request,
+                                              (uint8_t *) iov.iov_base + 2U,
+                                              dns_query_len,
+                                              max_query_size)) <= (ssize_t) 0) {
         tcp_request_kill(tcp_request);
-        return;
+        return 0;
     }
-    DNSCRYPT_PROXY_REQUEST_CURVE_DONE(tcp_request, (size_t) curve_ret);
-    dns_curved_query_len_buf[0] = (curve_ret >> 8) & 0xff;
-    dns_curved_query_len_buf[1] = curve_ret & 0xff;
-    if (bufferevent_write(tcp_request->proxy_resolver_bev,
-                          dns_curved_query_len_buf, (size_t) 2U) != 0 ||
-        bufferevent_write(tcp_request->proxy_resolver_bev, dns_query,
-                          (size_t) curve_ret) != 0) {
+    ((uint8_t *) iov.iov_base)[0] = (curve_ret >> 8) & 0xff;
+    ((uint8_t *) iov.iov_base)[1] = curve_ret & 0xff;
+    iov.iov_len = 2U + (size_t) curve_ret;
+    DNSCRYPT_PROXY_REQUEST_TCP_PROXY_RESOLVER_START(tcp_request);
+    tcp_request->resolver_generation = proxy_context->failover.generation;
+    if (bufferevent_socket_connect
+        (tcp_request->proxy_resolver_bev,
+            (struct sockaddr *) resolver_sockaddr,
+            (int) resolver_sockaddr_len) != 0) {
         tcp_request_kill(tcp_request);
-        return;
+        return 0;
+    }
+    bufferevent_setwatermark(tcp_request->proxy_resolver_bev,
+                             EV_READ, (size_t) 2U,
+                             (size_t) DNS_MAX_PACKET_SIZE_TCP);
+    bufferevent_setcb(tcp_request->proxy_resolver_bev,
+                      resolver_proxy_read_cb, NULL, proxy_resolver_event_cb,
+                      tcp_request);
+    if (evbuffer_commit_space(output, &iov, 1) != 0) {
+        tcp_request_kill(tcp_request);
+        return 0;
+    }
+    REQUEST_TRACE_MARK(&tcp_request->trace, REQUEST_STAGE_UPSTREAM_SENT);
+    proxy_context->metrics.upstream_queries_tcp++;
+    proxy_context->metrics.upstream_bytes_sent_tcp += 2U + (size_t) curve_ret;
+    if (target != NULL) {
+        proxy_context->metrics.forwarded_queries_tcp++;
     }
     bufferevent_enable(tcp_request->proxy_resolver_bev, EV_READ);
+
+    return 0;
+}
+
+/*
+ * Starts processing every complete query available in the input buffer,
+ * as long as the session doesn't have too many queries in flight.
+ * Reading is suspended while that limit is reached, and resumed when
+ * a request completes.
+ */
+
+static void
+tcp_session_read_queries(TCPSession * const session)
+{
+    uint8_t          dns_query_len_buf[2];
+    ProxyContext    *proxy_context = session->proxy_context;
+    struct evbuffer *input = bufferevent_get_input(session->client_proxy_bev);
+    size_t           dns_query_len;
+
+    session->status.is_reading = 1;
+    while (session->active_requests < TCP_SESSION_MAX_QUERIES) {
+        if (session->status.has_dns_query_len == 0) {
+            if (evbuffer_get_length(input) < (size_t) 2U) {
+                break;
+            }
+            evbuffer_remove(input, dns_query_len_buf,
+                            sizeof dns_query_len_buf);
+            session->dns_query_len = (size_t)
+                ((dns_query_len_buf[0] << 8) | dns_query_len_buf[1]);
+            session->status.has_dns_query_len = 1;
+            if (session->dns_query_len < (size_t) DNS_HEADER_SIZE) {
+                logger_noformat(proxy_context, LOG_WARNING,
+                                "Short query received");
+                tcp_session_kill(session);
+                return;
+            }
+        }
+        dns_query_len = session->dns_query_len;
+        if (evbuffer_get_length(input) < dns_query_len) {
+            break;
+        }
+        session->status.has_dns_query_len = 0;
+        if (tcp_request_start(session, input, dns_query_len) != 0) {
+            tcp_session_kill(session);
+            return;
+        }
+    }
+    session->status.is_reading = 0;
+    if (session->active_requests >= TCP_SESSION_MAX_QUERIES) {
+        bufferevent_disable(session->client_proxy_bev, EV_READ);
+        return;
+    }
+    bufferevent_setwatermark(session->client_proxy_bev, EV_READ,
+                             session->status.has_dns_query_len != 0 ?
+                             session->dns_query_len : (size_t) 2U,
+                             (size_t) DNS_MAX_PACKET_SIZE_TCP);
+    bufferevent_enable(session->client_proxy_bev, EV_READ);
+    if (session->active_requests > 0U) {
+        return;
+    }
+    if (proxy_context->tcp_idle_timeout <= (time_t) 0) {
+        if (session->status.has_dns_query_len == 0 &&
+            evbuffer_get_length(input) == (size_t) 0U) {
+            tcp_session_close(session);
+        }
+        return;
+    }
+    const struct timeval tv = {
+        .tv_sec = proxy_context->tcp_idle_timeout, .tv_usec = 0
+    };
+    evtimer_add(session->idle_timer, &tv);
+}
+
+static void
+client_proxy_read_cb(struct bufferevent * const client_proxy_bev,
+                     void * const session_)
+{
+    TCPSession * const session = session_;
+
+    (void) client_proxy_bev;
+    if (session->status.close_after_write == 0 &&
+        session->status.is_reading == 0) {
+        tcp_session_read_queries(session);
+    }
 }
 
 static void
@@ -417,89 +870,65 @@ tcp_connection_cb(struct evconnlistener * const tcp_conn_listener,
                   void * const proxy_context_)
 {
     ProxyContext *proxy_context = proxy_context_;
-    TCPRequest   *tcp_request;
+    TCPSession   *session;
 
     (void) tcp_conn_listener;
-    (void) client_sockaddr;
-    (void) client_sockaddr_len_int;
-    if ((tcp_request = calloc((size_t) 1U, sizeof *tcp_request)) == NULL) {
+    if ((session = calloc((size_t) 1U, sizeof *session)) == NULL) {
+        evutil_closesocket(handle);
         return;
     }
-    tcp_request->proxy_context = proxy_context;
-    tcp_request->timeout_timer = NULL;
-    tcp_request->proxy_resolver_query_evbuf = NULL;
-#ifdef PLUGINS
+    session->proxy_context = proxy_context;
+    session->idle_timer = NULL;
+    session->resume_timer = NULL;
+    TAILQ_INIT(&session->requests);
     assert(client_sockaddr_len_int >= 0 &&
-           sizeof tcp_request->client_sockaddr >=
+           sizeof session->client_sockaddr >=
            (size_t) client_sockaddr_len_int);
-    memcpy(&tcp_request->client_sockaddr, client_sockaddr,
+    memcpy(&session->client_sockaddr, client_sockaddr,
            (size_t) client_sockaddr_len_int);
-    tcp_request->client_sockaddr_len = (ev_socklen_t) client_sockaddr_len_int;
-#endif
-    tcp_request->client_proxy_bev =
+    session->client_sockaddr_len = (ev_socklen_t) client_sockaddr_len_int;
+    session->client_bucket =
+        admission_client_bucket(&proxy_context->admission,
+                                &session->client_sockaddr);
+    tcp_tune(handle);
+    session->client_proxy_bev =
         bufferevent_socket_new(proxy_context->event_loop, handle,
                                BEV_OPT_CLOSE_ON_FREE);
-    if (tcp_request->client_proxy_bev == NULL) {
+    if (session->client_proxy_bev == NULL) {
         evutil_closesocket(handle);
-        free(tcp_request);
+        free(session);
         return;
     }
-    tcp_request->proxy_resolver_bev = bufferevent_socket_new
-        (proxy_context->event_loop, -1, BEV_OPT_CLOSE_ON_FREE);
-    if (tcp_request->proxy_resolver_bev == NULL) {
-        bufferevent_free(tcp_request->client_proxy_bev);
-        tcp_request->client_proxy_bev = NULL;
-        free(tcp_request);
-        return;
-    }
-    if (proxy_context->connections_count >=
+    if (proxy_context->tcp_sessions_count >=
         proxy_context->connections_count_max) {
-        DNSCRYPT_PROXY_REQUEST_TCP_OVERLOADED();
-        if (tcp_listener_kill_oldest_request(proxy_context) != 0) {
-            udp_listener_kill_oldest_request(proxy_context);
-        }
+        tcp_session_kill(TAILQ_FIRST(&proxy_context->tcp_session_queue));
     }
-    proxy_context->connections_count++;
-    assert(proxy_context->connections_count
-           <= proxy_context->connections_count_max);
-    DNSCRYPT_PROXY_STATUS_REQUESTS_ACTIVE(proxy_context->connections_count,
-                                          proxy_context->connections_count_max);
-    DNSCRYPT_PROXY_REQUEST_TCP_START(tcp_request);
-    TAILQ_INSERT_TAIL(&proxy_context->tcp_request_queue,
-                      tcp_request, queue);
-    memset(&tcp_request->status, 0, sizeof tcp_request->status);
-    tcp_request->status.is_in_queue = 1;
-    if ((tcp_request->timeout_timer =
-         evtimer_new(tcp_request->proxy_context->event_loop,
-                     timeout_timer_cb, tcp_request)) == NULL) {
-        tcp_request_kill(tcp_request);
+    proxy_context->tcp_sessions_count++;
+    TAILQ_INSERT_TAIL(&proxy_context->tcp_session_queue, session, queue);
+    memset(&session->status, 0, sizeof session->status);
+    session->status.is_in_queue = 1;
+    if ((session->idle_timer =
+         evtimer_new(proxy_context->event_loop,
+                     idle_timer_cb, session)) == NULL ||
+        (session->resume_timer =
+         evtimer_new(proxy_context->event_loop,
+                     resume_timer_cb, session)) == NULL) {
+        tcp_session_kill(session);
         return;
     }
     const struct timeval tv = {
-        .tv_sec = (time_t) DNS_QUERY_TIMEOUT, .tv_usec = 0
+        .tv_sec = proxy_context->tcp_idle_timeout > (time_t) 0 ?
+        proxy_context->tcp_idle_timeout : (time_t) DNS_QUERY_TIMEOUT,
+        .tv_usec = 0
     };
-    evtimer_add(tcp_request->timeout_timer, &tv);
-    bufferevent_setwatermark(tcp_request->client_proxy_bev,
+    evtimer_add(session->idle_timer, &tv);
+    bufferevent_setwatermark(session->client_proxy_bev,
                              EV_READ, (size_t) 2U,
                              (size_t) DNS_MAX_PACKET_SIZE_TCP);
-    bufferevent_setcb(tcp_request->client_proxy_bev,
+    bufferevent_setcb(session->client_proxy_bev,
                       client_proxy_read_cb, client_proxy_write_cb,
-                      client_proxy_event_cb, tcp_request);
-    if (bufferevent_socket_connect
-        (tcp_request->proxy_resolver_bev,
-            (struct sockaddr *) &proxy_context->resolver_sockaddr,
-            (int) proxy_context->resolver_sockaddr_len) != 0) {
-        tcp_request_kill(tcp_request);
-        return;
-    }
-    bufferevent_setwatermark(tcp_request->proxy_resolver_bev,
-                             EV_READ, (size_t) 2U,
-                             (size_t) DNS_MAX_PACKET_SIZE_TCP);
-    bufferevent_setcb(tcp_request->proxy_resolver_bev,
-                      resolver_proxy_read_cb, NULL, proxy_resolver_event_cb,
-                      tcp_request);
-    DNSCRYPT_PROXY_REQUEST_TCP_PROXY_RESOLVER_START(tcp_request);
-    bufferevent_enable(tcp_request->client_proxy_bev, EV_READ);
+                      client_proxy_event_cb, session);
+    bufferevent_enable(session->client_proxy_bev, EV_READ);
 }
 
 static void
@@ -550,6 +979,47 @@ tcp_listener_kill_oldest_request(ProxyContext * const proxy_context)
     return 0;
 }
 
+int
+tcp_listener_kill_oldest_heavy_request(ProxyContext * const proxy_context)
+{
+    TCPRequest *tcp_request;
+
+    TAILQ_FOREACH(tcp_request, &proxy_context->tcp_request_queue, queue) {
+        if (admission_client_is_heavy(proxy_context,
+                                      tcp_request->client_bucket)) {
+            tcp_request_kill(tcp_request);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+uint64_t
+tcp_listener_oldest_request_ts(const ProxyContext * const proxy_context)
+{
+    if (TAILQ_EMPTY(&proxy_context->tcp_request_queue)) {
+        return 0U;
+    }
+    return TAILQ_FIRST(&proxy_context->tcp_request_queue)
+        ->trace.ts[REQUEST_STAGE_RECEIVED];
+}
+
+static void
+tcp_connection_timed_cb(struct evconnlistener * const tcp_conn_listener,
+                        evutil_socket_t handle,
+                        struct sockaddr * const client_sockaddr,
+                        const int client_sockaddr_len_int,
+                        void * const proxy_context_)
+{
+    ProxyContext   *proxy_context = proxy_context_;
+    const uint64_t  started = metrics_now();
+
+    tcp_connection_cb(tcp_conn_listener, handle, client_sockaddr,
+                      client_sockaddr_len_int, proxy_context);
+    metrics_callback_done(&proxy_context->metrics,
+                          METRICS_CALLBACK_TCP_CONNECTION, started);
+}
+
 int
 tcp_listener_bind(ProxyContext * const proxy_context)
 {
@@ -560,7 +1030,7 @@ tcp_listener_bind(ProxyContext * const proxy_context)
     if (proxy_context->tcp_listener_handle == -1) {
         proxy_context->tcp_conn_listener =
             evconnlistener_new_bind(proxy_context->event_loop,
-                                    tcp_connection_cb, proxy_context,
+                                    tcp_connection_timed_cb, proxy_context,
                                     LEV_OPT_CLOSE_ON_FREE |
                                     LEV_OPT_CLOSE_ON_EXEC |
                                     LEV_OPT_REUSEABLE |
@@ -573,14 +1043,9 @@ tcp_listener_bind(ProxyContext * const proxy_context)
     } else {
         evutil_make_socket_closeonexec(proxy_context->tcp_listener_handle);
         evutil_make_socket_nonblocking(proxy_context->tcp_listener_handle);
-#ifdef TCP_FASTOPEN
-        setsockopt(proxy_context->tcp_listener_handle,
-                   IPPROTO_TCP, TCP_FASTOPEN,
-                   (void *) (int[]) { TCP_FASTOPEN_QUEUES }, sizeof (int));
-#endif
         proxy_context->tcp_conn_listener =
             evconnlistener_new(proxy_context->event_loop,
-                               tcp_connection_cb, proxy_context,
+                               tcp_connection_timed_cb, proxy_context,
                                LEV_OPT_CLOSE_ON_FREE |
                                LEV_OPT_CLOSE_ON_EXEC |
                                LEV_OPT_REUSEABLE |
@@ -592,6 +1057,11 @@ tcp_listener_bind(ProxyContext * const proxy_context)
         logger_noformat(proxy_context, LOG_ERR, "Unable to bind (TCP)");
         return -1;
     }
+#ifdef TCP_FASTOPEN
+    setsockopt(evconnlistener_get_fd(proxy_context->tcp_conn_listener),
+               IPPROTO_TCP, TCP_FASTOPEN,
+               (void *) (int[]) { TCP_FASTOPEN_QUEUES }, sizeof (int));
+#endif
     if (evconnlistener_disable(proxy_context->tcp_conn_listener) != 0) {
         evconnlistener_free(proxy_context->tcp_conn_listener);
         proxy_context->tcp_conn_listener = NULL;
@@ -600,6 +1070,8 @@ tcp_listener_bind(ProxyContext * const proxy_context)
     evconnlistener_set_error_cb(proxy_context->tcp_conn_listener,
                                 tcp_accept_error_cb);
     TAILQ_INIT(&proxy_context->tcp_request_queue);
+    TAILQ_INIT(&proxy_context->tcp_session_queue);
+    proxy_context->tcp_sessions_count = 0U;
 
     return 0;
 }
@@ -622,6 +1094,9 @@ tcp_listener_stop(ProxyContext * const proxy_context)
     }
     evconnlistener_free(proxy_context->tcp_conn_listener);
     proxy_context->tcp_conn_listener = NULL;
-    while (tcp_listener_kill_oldest_request(proxy_context) == 0) { }
+    while (! TAILQ_EMPTY(&proxy_context->tcp_session_queue)) {
+        tcp_session_kill(TAILQ_FIRST(&proxy_context->tcp_session_queue));
+    }
+    assert(TAILQ_EMPTY(&proxy_context->tcp_request_queue));
     logger_noformat(proxy_context, LOG_INFO, "TCP listener shut down");
 }
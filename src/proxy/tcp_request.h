@@ -12,10 +12,18 @@
 #ifndef TCP_FASTOPEN_QUEUES
 # define TCP_FASTOPEN_QUEUES TCP_REQUEST_BACKLOG
 #endif
+#ifndef TCP_QUERY_HEADROOM
+# define TCP_QUERY_HEADROOM 512U
+#endif
+#ifndef TCP_SESSION_MAX_QUERIES
+# define TCP_SESSION_MAX_QUERIES 32U
+#endif
 
 int tcp_listener_bind(ProxyContext * const proxy_context);
 int tcp_listener_start(ProxyContext * const proxy_context);
 void tcp_listener_stop(ProxyContext * const proxy_context);
 int tcp_listener_kill_oldest_request(ProxyContext * const proxy_context);
+int tcp_listener_kill_oldest_heavy_request(ProxyContext * const proxy_context);
+uint64_t tcp_listener_oldest_request_ts(const ProxyContext * const proxy_context);
 
 #endif
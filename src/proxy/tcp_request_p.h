@@ -9,10 +9,39 @@
 #include <event2/event.h>
 
 #include "dnscrypt.h"
+#include "metrics.h"
 #include "queue.h"
 
-typedef struct TCPRequestStatus_ {
+typedef struct TCPSessionStatus_ {
     _Bool has_dns_query_len : 1;
+    _Bool is_in_queue : 1;
+    _Bool is_dying : 1;
+    _Bool is_reading : 1;
+    _Bool close_after_write : 1;
+} TCPSessionStatus;
+
+/*
+ * A client connection. A session can carry any number of queries,
+ * up to TCP_SESSION_MAX_QUERIES of them being processed at the same
+ * time, and replies are sent back as soon as they are ready.
+ */
+
+typedef struct TCPSession_ {
+    TAILQ_HEAD(TCPSessionRequests_, TCPRequest_) requests;
+    TAILQ_ENTRY(TCPSession_) queue;
+    struct sockaddr_storage  client_sockaddr;
+    struct bufferevent      *client_proxy_bev;
+    ProxyContext            *proxy_context;
+    struct event            *idle_timer;
+    struct event            *resume_timer;
+    ev_socklen_t             client_sockaddr_len;
+    TCPSessionStatus         status;
+    size_t                   dns_query_len;
+    uint32_t                 client_bucket;
+    unsigned int             active_requests;
+} TCPSession;
+
+typedef struct TCPRequestStatus_ {
     _Bool has_dns_reply_len : 1;
     _Bool is_in_queue : 1;
     _Bool is_dying : 1;
@@ -21,20 +50,18 @@ typedef struct TCPRequestStatus_ {
 typedef struct TCPRequest_ {
     uint8_t                  client_nonce[crypto_box_HALF_NONCEBYTES];
     TAILQ_ENTRY(TCPRequest_) queue;
-#ifdef PLUGINS
-    struct sockaddr_storage  client_sockaddr;
-#endif
-    struct bufferevent      *client_proxy_bev;
+    TAILQ_ENTRY(TCPRequest_) session_queue;
+    TCPSession              *session;
     struct bufferevent      *proxy_resolver_bev;
-    struct evbuffer         *proxy_resolver_query_evbuf;
     ProxyContext            *proxy_context;
+    ForwardingTarget        *target;
     struct event            *timeout_timer;
-#ifdef PLUGINS
-    ev_socklen_t             client_sockaddr_len;
-#endif
+    RequestTrace             trace;
+    uint64_t                 id;
     TCPRequestStatus         status;
-    size_t                   dns_query_len;
     size_t                   dns_reply_len;
+    uint32_t                 client_bucket;
+    unsigned int             resolver_generation;
 } TCPRequest;
 
 #endif
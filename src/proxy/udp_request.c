@@ -5,6 +5,7 @@
 # include <winsock2.h>
 #else
 # include <sys/socket.h>
+# include <sys/uio.h>
 # include <arpa/inet.h>
 # include <netinet/in.h>
 #endif
@@ -22,7 +23,10 @@
 #include "dnscrypt_client.h"
 #include "dnscrypt_proxy.h"
 #include "edns.h"
+#include "failover.h"
+#include "forwarding.h"
 #include "logger.h"
+#include "metrics.h"
 #include "probes.h"
 #include "queue.h"
 #include "tcp_request.h"
@@ -44,6 +48,8 @@ udp_request_free(UDPRequest * const udp_request)
     }
     DNSCRYPT_PROXY_REQUEST_UDP_DONE(udp_request);
     proxy_context = udp_request->proxy_context;
+    metrics_request_done(proxy_context, &udp_request->trace, "udp",
+                         udp_request->id);
     if (udp_request->status.is_in_queue != 0) {
         assert(! TAILQ_EMPTY(&proxy_context->udp_request_queue));
         TAILQ_REMOVE(&proxy_context->udp_request_queue, udp_request, queue);
@@ -51,6 +57,13 @@ udp_request_free(UDPRequest * const udp_request)
         proxy_context->connections_count--;
         DNSCRYPT_PROXY_STATUS_REQUESTS_ACTIVE(proxy_context->connections_count,
                                               proxy_context->connections_count_max);
+        admission_request_done(&proxy_context->admission,
+                               udp_request->client_bucket);
+    }
+    if (udp_request->status.is_in_target_queue != 0) {
+        assert(! TAILQ_EMPTY(&udp_request->target->udp_request_queue));
+        TAILQ_REMOVE(&udp_request->target->udp_request_queue, udp_request,
+                     target_queue);
     }
     udp_request->proxy_context = NULL;
     free(udp_request);
@@ -83,6 +96,147 @@ udp_send(SendtoWithRetryCtx * const ctx)
     return 0;
 }
 
+/*
+ * recvfrom() that also picks up the number of datagrams the kernel
+ * dropped because the receive queue was full, when SO_RXQ_OVFL is set.
+ */
+
+static ssize_t
+udp_recvfrom(evutil_socket_t const handle, uint8_t * const buf,
+             const size_t len, struct sockaddr * const addr,
+             ev_socklen_t * const addr_len, uint32_t * const drops)
+{
+#ifdef SO_RXQ_OVFL
+    unsigned char   control[CMSG_SPACE(sizeof(uint32_t))];
+    struct iovec    iov = { .iov_base = (void *) buf, .iov_len = len };
+    struct msghdr   msg;
+    struct cmsghdr *cmsg;
+    ssize_t         nread;
+
+    memset(&msg, 0, sizeof msg);
+    msg.msg_name = addr;
+    msg.msg_namelen = (socklen_t) *addr_len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    if ((nread = recvmsg(handle, &msg, 0)) < (ssize_t) 0) {
+        return nread;
+    }
+    *addr_len = (ev_socklen_t) msg.msg_namelen;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SO_RXQ_OVFL) {
+            memcpy(drops, CMSG_DATA(cmsg), sizeof *drops);
+        }
+    }
+    return nread;
+#else
+    (void) drops;
+    return recvfrom(handle, (void *) buf, len, 0, addr, addr_len);
+#endif
+}
+
+/*
+ * Decrypts a reply from a DNSCrypt resolver in place.
+ */
+
+static int
+udp_request_uncurve(UDPRequest * const udp_request,
+                    const DNSCryptClient * const client,
+                    uint8_t * const dns_reply, size_t * const dns_reply_len_p)
+{
+    ProxyContext * const proxy_context = udp_request->proxy_context;
+    size_t               uncurved_len = *dns_reply_len_p;
+
+    DNSCRYPT_PROXY_REQUEST_UNCURVE_START(udp_request, uncurved_len);
+    if (dnscrypt_client_uncurve(client, udp_request->client_nonce,
+                                dns_reply, &uncurved_len) != 0) {
+        DNSCRYPT_PROXY_REQUEST_UNCURVE_ERROR(udp_request);
+        proxy_context->metrics.uncurve_errors++;
+        DNSCRYPT_PROXY_REQUEST_UDP_PROXY_RESOLVER_GOT_INVALID_REPLY(udp_request);
+        logger_noformat(proxy_context, LOG_INFO,
+                        "Received a corrupted reply from the resolver");
+        return -1;
+    }
+    DNSCRYPT_PROXY_REQUEST_UNCURVE_DONE(udp_request, uncurved_len);
+    REQUEST_TRACE_MARK(&udp_request->trace, REQUEST_STAGE_UNCURVE_DONE);
+    memset(udp_request->client_nonce, 0, sizeof udp_request->client_nonce);
+    assert(uncurved_len <= *dns_reply_len_p);
+    *dns_reply_len_p = uncurved_len;
+
+    return 0;
+}
+
+/*
+ * Queries sent over UDP are allowed to grow, up to the maximum size, every
+ * time a truncated reply is received.
+ */
+
+static void
+udp_grow_max_size(const ProxyContext * const proxy_context,
+                  size_t * const current_max_size_p)
+{
+    if (*current_max_size_p < proxy_context->udp_max_size) {
+        COMPILER_ASSERT(DNS_MAX_PACKET_SIZE_UDP_NO_EDNS_SEND >=
+                        DNSCRYPT_BLOCK_SIZE);
+        if (proxy_context->udp_max_size -
+            *current_max_size_p > DNSCRYPT_BLOCK_SIZE) {
+            *current_max_size_p += DNSCRYPT_BLOCK_SIZE;
+        } else {
+            *current_max_size_p = proxy_context->udp_max_size;
+        }
+    }
+}
+
+static void
+proxy_client_send_reply(UDPRequest * const udp_request,
+                        uint8_t dns_reply[DNS_MAX_PACKET_SIZE_UDP],
+                        size_t dns_reply_len)
+{
+#ifdef PLUGINS
+    ProxyContext * const proxy_context = udp_request->proxy_context;
+    const size_t max_reply_size_for_filter = DNS_MAX_PACKET_SIZE_UDP;
+    DCPluginDNSPacket dcp_packet = {
+        .client_sockaddr = &udp_request->client_sockaddr,
+        .dns_packet = dns_reply,
+        .dns_packet_len_p = &dns_reply_len,
+        .client_sockaddr_len_s = (size_t) udp_request->client_sockaddr_len,
+        .request_id = udp_request->id,
+        .dns_packet_max_len = max_reply_size_for_filter
+    };
+    DNSCRYPT_PROXY_REQUEST_PLUGINS_POST_START(udp_request, dns_reply_len,
+                                              max_reply_size_for_filter);
+    assert(proxy_context->app_context->dcps_context != NULL);
+    const DCPluginSyncFilterResult res =
+        plugin_support_context_apply_sync_post_filters
+        (proxy_context->app_context->dcps_context, &dcp_packet);
+    assert(dns_reply_len > (size_t) 0U &&
+           dns_reply_len <= DNS_MAX_PACKET_SIZE_UDP &&
+           dns_reply_len <= max_reply_size_for_filter);
+    if (res != DCP_SYNC_FILTER_RESULT_OK) {
+        DNSCRYPT_PROXY_REQUEST_PLUGINS_POST_ERROR(udp_request, res);
+        udp_request_kill(udp_request);
+        return;
+    }
+    DNSCRYPT_PROXY_REQUEST_PLUGINS_POST_DONE(udp_request, dns_reply_len,
+                                             max_reply_size_for_filter);
+    REQUEST_TRACE_MARK(&udp_request->trace, REQUEST_STAGE_PLUGINS_POST_DONE);
+#endif
+    REQUEST_TRACE_MARK(&udp_request->trace, REQUEST_STAGE_REPLIED);
+    udp_send(& (SendtoWithRetryCtx) {
+       .udp_request = udp_request,
+       .handle = udp_request->client_proxy_handle,
+       .buffer = dns_reply,
+       .length = dns_reply_len,
+       .flags = 0,
+       .dest_addr = (struct sockaddr *) &udp_request->client_sockaddr,
+       .dest_len = udp_request->client_sockaddr_len,
+       .cb = udp_request_kill
+    });
+}
+
 static void
 resolver_to_proxy_cb(evutil_socket_t proxy_resolver_handle, short ev_flags,
                      void * const proxy_context_)
@@ -95,13 +249,13 @@ resolver_to_proxy_cb(evutil_socket_t proxy_resolver_handle, short ev_flags,
     ev_socklen_t             resolver_sockaddr_len = sizeof resolver_sockaddr;
     ssize_t                  nread;
     size_t                   dns_reply_len = (size_t) 0U;
-    size_t                   uncurved_len;
 
     (void) ev_flags;
-    nread = recvfrom(proxy_resolver_handle,
-                     (void *) dns_reply, sizeof dns_reply, 0,
-                     (struct sockaddr *) &resolver_sockaddr,
-                     &resolver_sockaddr_len);
+    nread = udp_recvfrom(proxy_resolver_handle,
+                         dns_reply, sizeof dns_reply,
+                         (struct sockaddr *) &resolver_sockaddr,
+                         &resolver_sockaddr_len,
+                         &proxy_context->metrics.udp_resolver_drops);
     if (nread < (ssize_t) 0) {
         const int err = evutil_socket_geterror(proxy_resolver_handle);
         if (!EVUTIL_ERR_RW_RETRIABLE(err)) {
@@ -120,7 +274,8 @@ resolver_to_proxy_cb(evutil_socket_t proxy_resolver_handle, short ev_flags,
     }
     TAILQ_FOREACH(scanned_udp_request,
                   &proxy_context->udp_request_queue, queue) {
-        if (dnscrypt_cmp_client_nonce(scanned_udp_request->client_nonce,
+        if (scanned_udp_request->target == NULL &&
+            dnscrypt_cmp_client_nonce(scanned_udp_request->client_nonce,
                                       dns_reply, (size_t) nread) == 0) {
             udp_request = scanned_udp_request;
             break;
@@ -138,79 +293,125 @@ resolver_to_proxy_cb(evutil_socket_t proxy_resolver_handle, short ev_flags,
         return;
     }
     DNSCRYPT_PROXY_REQUEST_UDP_PROXY_RESOLVER_REPLIED(udp_request);
+    REQUEST_TRACE_MARK(&udp_request->trace, REQUEST_STAGE_UPSTREAM_REPLIED);
     dns_reply_len = (size_t) nread;
+    proxy_context->metrics.upstream_bytes_received_udp += dns_reply_len;
     assert(dns_reply_len <= sizeof dns_reply);
 
-    uncurved_len = dns_reply_len;
-    DNSCRYPT_PROXY_REQUEST_UNCURVE_START(udp_request, uncurved_len);
-    if (dnscrypt_client_uncurve
-        (&udp_request->proxy_context->dnscrypt_client,
-            udp_request->client_nonce, dns_reply, &uncurved_len) != 0) {
-        DNSCRYPT_PROXY_REQUEST_UNCURVE_ERROR(udp_request);
-        DNSCRYPT_PROXY_REQUEST_UDP_PROXY_RESOLVER_GOT_INVALID_REPLY(udp_request);
-        logger_noformat(udp_request->proxy_context, LOG_INFO,
-                        "Received a corrupted reply from the resolver");
+    if (udp_request_uncurve(udp_request, &proxy_context->dnscrypt_client,
+                            dns_reply, &dns_reply_len) != 0) {
+        failover_query_failed(proxy_context, udp_request->resolver_generation);
         udp_request_kill(udp_request);
         return;
     }
-    DNSCRYPT_PROXY_REQUEST_UNCURVE_DONE(udp_request, uncurved_len);
-    memset(udp_request->client_nonce, 0, sizeof udp_request->client_nonce);
-    assert(uncurved_len <= dns_reply_len);
-    dns_reply_len = uncurved_len;
+    failover_query_succeeded(proxy_context, udp_request->resolver_generation);
 
     assert(dns_reply_len >= DNS_HEADER_SIZE);
     COMPILER_ASSERT(DNS_OFFSET_FLAGS < DNS_HEADER_SIZE);
     if ((dns_reply[DNS_OFFSET_FLAGS] & DNS_FLAGS_TC) != 0) {
-        if (proxy_context->udp_current_max_size <
-            proxy_context->udp_max_size) {
-            COMPILER_ASSERT(DNS_MAX_PACKET_SIZE_UDP_NO_EDNS_SEND >=
-                            DNSCRYPT_BLOCK_SIZE);
-            if (proxy_context->udp_max_size -
-                proxy_context->udp_current_max_size > DNSCRYPT_BLOCK_SIZE) {
-                proxy_context->udp_current_max_size += DNSCRYPT_BLOCK_SIZE;
-            } else {
-                proxy_context->udp_current_max_size =
-                    proxy_context->udp_max_size;
-            }
-        }
+        udp_grow_max_size(proxy_context, &proxy_context->udp_current_max_size);
     }
+    proxy_client_send_reply(udp_request, dns_reply, dns_reply_len);
+}
 
-#ifdef PLUGINS
-    const size_t max_reply_size_for_filter = sizeof dns_reply;
-    DCPluginDNSPacket dcp_packet = {
-        .client_sockaddr = &udp_request->client_sockaddr,
-        .dns_packet = dns_reply,
-        .dns_packet_len_p = &dns_reply_len,
-        .client_sockaddr_len_s = (size_t) udp_request->client_sockaddr_len,
-        .dns_packet_max_len = max_reply_size_for_filter
-    };
-    DNSCRYPT_PROXY_REQUEST_PLUGINS_POST_START(udp_request, dns_reply_len,
-                                              max_reply_size_for_filter);
-    assert(proxy_context->app_context->dcps_context != NULL);
-    const DCPluginSyncFilterResult res =
-        plugin_support_context_apply_sync_post_filters
-        (proxy_context->app_context->dcps_context, &dcp_packet);
-    assert(dns_reply_len > (size_t) 0U &&
-           dns_reply_len <= sizeof dns_reply &&
-           dns_reply_len <= max_reply_size_for_filter);
-    if (res != DCP_SYNC_FILTER_RESULT_OK) {
-        DNSCRYPT_PROXY_REQUEST_PLUGINS_POST_ERROR(udp_request, res);
+/*
+ * Replies to queries sent by a forwarding rule are received on the socket
+ * of the target. Replies from plain DNS resolvers are matched by ID and
+ * question, and get the ID of the client query back.
+ */
+
+static void
+forwarding_resolver_to_proxy_cb(evutil_socket_t proxy_resolver_handle,
+                                short ev_flags, void * const target_)
+{
+    uint8_t                  dns_reply[DNS_MAX_PACKET_SIZE_UDP];
+    ForwardingTarget        *target = target_;
+    ProxyContext            *proxy_context = target->proxy_context;
+    UDPRequest              *scanned_udp_request;
+    UDPRequest              *udp_request = NULL;
+    struct sockaddr_storage  resolver_sockaddr;
+    ev_socklen_t             resolver_sockaddr_len = sizeof resolver_sockaddr;
+    ssize_t                  nread;
+    size_t                   dns_reply_len = (size_t) 0U;
+    uint64_t                 question_hash = 0U;
+    uint16_t                 query_id = 0U;
+
+    (void) ev_flags;
+    nread = udp_recvfrom(proxy_resolver_handle,
+                         dns_reply, sizeof dns_reply,
+                         (struct sockaddr *) &resolver_sockaddr,
+                         &resolver_sockaddr_len,
+                         &proxy_context->metrics.udp_resolver_drops);
+    if (nread < (ssize_t) 0) {
+        const int err = evutil_socket_geterror(proxy_resolver_handle);
+        if (!EVUTIL_ERR_RW_RETRIABLE(err)) {
+            logger(proxy_context, LOG_WARNING,
+                   "recvfrom(resolver): [%s]", evutil_socket_error_to_string(err));
+        }
+        DNSCRYPT_PROXY_REQUEST_UDP_NETWORK_ERROR(NULL);
+        return;
+    }
+    if (evutil_sockaddr_cmp((const struct sockaddr *) &resolver_sockaddr,
+                            (const struct sockaddr *)
+                            &target->resolver_sockaddr, 1) != 0) {
+        logger_noformat(proxy_context, LOG_DEBUG,
+                        "Received a resolver reply from a different resolver");
+        return;
+    }
+    if (nread < (ssize_t) DNS_HEADER_SIZE) {
+        logger_noformat(proxy_context, LOG_WARNING, "Short reply received");
+        return;
+    }
+    dns_reply_len = (size_t) nread;
+    if (target->type == FORWARDING_TARGET_PLAIN) {
+        query_id = (uint16_t) ((dns_reply[0] << 8) | dns_reply[1]);
+        if (forwarding_question_hash(&proxy_context->forwarding, dns_reply,
+                                     dns_reply_len, &question_hash) != 0) {
+            logger_noformat(proxy_context, LOG_DEBUG,
+                            "Received a reply without a valid question");
+            return;
+        }
+    }
+    TAILQ_FOREACH(scanned_udp_request, &target->udp_request_queue,
+                  target_queue) {
+        if (target->type == FORWARDING_TARGET_PLAIN ?
+            (scanned_udp_request->upstream_query_id == query_id &&
+             scanned_udp_request->question_hash == question_hash) :
+            dnscrypt_cmp_client_nonce(scanned_udp_request->client_nonce,
+                                      dns_reply, dns_reply_len) == 0) {
+            udp_request = scanned_udp_request;
+            break;
+        }
+    }
+    if (udp_request == NULL) {
+        logger(proxy_context, LOG_DEBUG,
+               "Received a reply that doesn't match any active query");
+        return;
+    }
+    if (target->type == FORWARDING_TARGET_DNSCRYPT &&
+        dns_reply_len < DNS_HEADER_SIZE + dnscrypt_response_header_size()) {
+        logger_noformat(proxy_context, LOG_WARNING, "Short reply received");
         udp_request_kill(udp_request);
         return;
     }
-    DNSCRYPT_PROXY_REQUEST_PLUGINS_POST_DONE(udp_request, dns_reply_len,
-                                             max_reply_size_for_filter);
-#endif
-    udp_send(& (SendtoWithRetryCtx) {
-       .udp_request = udp_request,
-       .handle = udp_request->client_proxy_handle,
-       .buffer = dns_reply,
-       .length = dns_reply_len,
-       .flags = 0,
-       .dest_addr = (struct sockaddr *) &udp_request->client_sockaddr,
-       .dest_len = udp_request->client_sockaddr_len,
-       .cb = udp_request_kill
-    });
+    DNSCRYPT_PROXY_REQUEST_UDP_PROXY_RESOLVER_REPLIED(udp_request);
+    REQUEST_TRACE_MARK(&udp_request->trace, REQUEST_STAGE_UPSTREAM_REPLIED);
+    proxy_context->metrics.upstream_bytes_received_udp += dns_reply_len;
+    if (target->type == FORWARDING_TARGET_PLAIN) {
+        memcpy(dns_reply, udp_request->client_query_id,
+               sizeof udp_request->client_query_id);
+    } else {
+        if (udp_request_uncurve(udp_request, &target->client,
+                                dns_reply, &dns_reply_len) != 0) {
+            udp_request_kill(udp_request);
+            return;
+        }
+        assert(dns_reply_len >= DNS_HEADER_SIZE);
+        if ((dns_reply[DNS_OFFSET_FLAGS] & DNS_FLAGS_TC) != 0) {
+            udp_grow_max_size(proxy_context, &target->udp_current_max_size);
+        }
+    }
+    proxy_client_send_reply(udp_request, dns_reply, dns_reply_len);
 }
 
 static void
@@ -219,7 +420,8 @@ proxy_client_send_truncated(UDPRequest * const udp_request,
                             size_t dns_reply_len)
 {
     DNSCRYPT_PROXY_REQUEST_UDP_TRUNCATED(udp_request);
-
+    udp_request->proxy_context->metrics.truncated++;
+    REQUEST_TRACE_MARK(&udp_request->trace, REQUEST_STAGE_REPLIED);
     assert(dns_reply_len > DNS_OFFSET_FLAGS2);
     dns_reply[DNS_OFFSET_FLAGS] |= DNS_FLAGS_TC | DNS_FLAGS_QR;
     dns_reply[DNS_OFFSET_FLAGS2] |= DNS_FLAGS2_RA;
@@ -244,8 +446,13 @@ timeout_timer_cb(evutil_socket_t timeout_timer_handle, short ev_flags,
     (void) ev_flags;
     (void) timeout_timer_handle;
     DNSCRYPT_PROXY_REQUEST_UDP_TIMEOUT(udp_request);
+    udp_request->proxy_context->metrics.timeouts_udp++;
     logger_noformat(udp_request->proxy_context, LOG_DEBUG,
                     "resolver timeout (UDP)");
+    if (udp_request->target == NULL) {
+        failover_query_failed(udp_request->proxy_context,
+                              udp_request->resolver_generation);
+    }
     udp_request_kill(udp_request);
 }
 
@@ -276,13 +483,17 @@ udp_tune(evutil_socket_t const handle)
     setsockopt(handle, IPPROTO_IP, IP_DONTFRAG,
                (void *) (int []) { 0 }, sizeof (int));
 #endif
+#ifdef SO_RXQ_OVFL
+    setsockopt(handle, SOL_SOCKET, SO_RXQ_OVFL,
+               (void *) (int []) { 1 }, sizeof (int));
+#endif
 }
 
 static void
 client_to_proxy_cb_sendto_cb(UDPRequest * const udp_request)
 {
-    (void) udp_request;
     DNSCRYPT_PROXY_REQUEST_UDP_PROXY_RESOLVER_START(udp_request);
+    REQUEST_TRACE_MARK(&udp_request->trace, REQUEST_STAGE_UPSTREAM_SENT);
 }
 
 #ifdef PLUGINS
@@ -291,6 +502,7 @@ proxy_to_client_direct(UDPRequest * const udp_request,
                        const uint8_t * const dns_reply,
                        const size_t dns_reply_len)
 {
+    REQUEST_TRACE_MARK(&udp_request->trace, REQUEST_STAGE_REPLIED);
     udp_send(& (SendtoWithRetryCtx) {
        .udp_request = udp_request,
        .handle = udp_request->client_proxy_handle,
@@ -304,18 +516,151 @@ proxy_to_client_direct(UDPRequest * const udp_request,
 }
 #endif
 
+static void
+udp_request_send(UDPRequest * const udp_request,
+                 const evutil_socket_t resolver_handle,
+                 const struct sockaddr_storage * const resolver_sockaddr,
+                 const ev_socklen_t resolver_sockaddr_len,
+                 const uint8_t * const dns_query, const size_t dns_query_len)
+{
+    ProxyContext * const proxy_context = udp_request->proxy_context;
+
+    udp_request->timeout_timer =
+        evtimer_new(proxy_context->event_loop, timeout_timer_cb, udp_request);
+    if (udp_request->timeout_timer != NULL) {
+        const struct timeval tv = {
+            .tv_sec = (time_t) DNS_QUERY_TIMEOUT, .tv_usec = 0
+        };
+        evtimer_add(udp_request->timeout_timer, &tv);
+    }
+    proxy_context->metrics.upstream_queries_udp++;
+    proxy_context->metrics.upstream_bytes_sent_udp += dns_query_len;
+    udp_send(& (SendtoWithRetryCtx) {
+        .udp_request = udp_request,
+        .handle = resolver_handle,
+        .buffer = dns_query,
+        .length = dns_query_len,
+        .flags = 0,
+        .dest_addr = (const struct sockaddr *) resolver_sockaddr,
+        .dest_len = resolver_sockaddr_len,
+        .cb = client_to_proxy_cb_sendto_cb
+    });
+}
+
+/*
+ * Sends a query to the target of the forwarding rule it matched. Queries
+ * for plain DNS resolvers are sent as they are, with a random ID: if two
+ * queries in flight get the same one, the question still tells their
+ * replies apart, unless it is the same question.
+ */
+
+static void
+udp_forward(UDPRequest * const udp_request, ForwardingTarget * const target,
+            uint8_t dns_query[DNS_MAX_PACKET_SIZE_UDP], size_t dns_query_len,
+            const size_t max_query_size)
+{
+    ProxyContext * const proxy_context = udp_request->proxy_context;
+    ssize_t              curve_ret;
+    size_t               max_len;
+
+    if (target->type == FORWARDING_TARGET_PLAIN) {
+        if (forwarding_question_hash(&proxy_context->forwarding,
+                                     dns_query, dns_query_len,
+                                     &udp_request->question_hash) != 0) {
+            udp_request_kill(udp_request);
+            return;
+        }
+        memcpy(udp_request->client_query_id, dns_query,
+               sizeof udp_request->client_query_id);
+        udp_request->upstream_query_id =
+            (uint16_t) randombytes_uniform(65536U);
+        dns_query[0] = (uint8_t) (udp_request->upstream_query_id >> 8);
+        dns_query[1] = (uint8_t) (udp_request->upstream_query_id & 0xff);
+    } else {
+        if (target->has_cert == 0) {
+            logger(proxy_context, LOG_DEBUG,
+                   "No certificates for [%s] yet", target->name);
+            udp_request_kill(udp_request);
+            return;
+        }
+        max_len = target->udp_current_max_size;
+        if (max_len > max_query_size) {
+            max_len = max_query_size;
+        }
+        if (dns_query_len + dnscrypt_query_header_size() > max_len) {
+            proxy_client_send_truncated(udp_request, dns_query, dns_query_len);
+            return;
+        }
+        DNSCRYPT_PROXY_REQUEST_CURVE_START(udp_request, dns_query_len);
+        curve_ret = dnscrypt_client_curve(&target->client,
+                                          udp_request->client_nonce,
+                                          dns_query, dns_query_len, max_len);
+        if (curve_ret <= (ssize_t) 0) {
+            DNSCRYPT_PROXY_REQUEST_CURVE_ERROR(udp_request);
+            udp_request_kill(udp_request);
+            return;
+        }
+        dns_query_len = (size_t) curve_ret;
+        DNSCRYPT_PROXY_REQUEST_CURVE_DONE(udp_request, dns_query_len);
+        REQUEST_TRACE_MARK(&udp_request->trace, REQUEST_STAGE_CURVE_DONE);
+    }
+    assert(dns_query_len <= DNS_MAX_PACKET_SIZE_UDP);
+    udp_request->target = target;
+    TAILQ_INSERT_TAIL(&target->udp_request_queue, udp_request, target_queue);
+    udp_request->status.is_in_target_queue = 1;
+    proxy_context->metrics.forwarded_queries_udp++;
+    udp_request_send(udp_request, target->udp_resolver_handle,
+                     &target->resolver_sockaddr,
+                     target->resolver_sockaddr_len,
+                     dns_query, dns_query_len);
+}
+
+/*
+ * Count a query as an active request, dropping another one to make room
+ * for it if needed. Returns -1 if the query itself has to be dropped.
+ */
+
+static int
+udp_request_admit(UDPRequest * const udp_request)
+{
+    ProxyContext *proxy_context = udp_request->proxy_context;
+
+    if (proxy_context->connections_count >=
+        proxy_context->connections_count_max) {
+        DNSCRYPT_PROXY_REQUEST_UDP_OVERLOADED();
+        if (admission_make_room(proxy_context,
+                                udp_request->client_bucket) != 0) {
+            return -1;
+        }
+        proxy_context->metrics.overload_kills_udp++;
+    }
+    proxy_context->connections_count++;
+    assert(proxy_context->connections_count
+           <= proxy_context->connections_count_max);
+    DNSCRYPT_PROXY_STATUS_REQUESTS_ACTIVE(proxy_context->connections_count,
+                                          proxy_context->connections_count_max);
+    admission_request_start(&proxy_context->admission,
+                            udp_request->client_bucket);
+    TAILQ_INSERT_TAIL(&proxy_context->udp_request_queue,
+                      udp_request, queue);
+    udp_request->status.is_in_queue = 1;
+
+    return 0;
+}
+
 static void
 client_to_proxy_cb(evutil_socket_t client_proxy_handle, short ev_flags,
                    void * const proxy_context_)
 {
-    uint8_t       dns_query[DNS_MAX_PACKET_SIZE_UDP];
-    ProxyContext *proxy_context = proxy_context_;
-    UDPRequest   *udp_request;
-    ssize_t       curve_ret;
-    ssize_t       nread;
-    size_t        dns_query_len = (size_t) 0U;
-    size_t        max_query_size;
-    size_t        request_edns_payload_size;
+    uint8_t           dns_query[DNS_MAX_PACKET_SIZE_UDP];
+    ProxyContext     *proxy_context = proxy_context_;
+    UDPRequest       *udp_request;
+    ForwardingTarget *target;
+    ssize_t           curve_ret;
+    ssize_t           nread;
+    size_t            dns_query_len = (size_t) 0U;
+    size_t            max_query_size;
+    size_t            request_edns_payload_size;
 
     (void) ev_flags;
     assert(client_proxy_handle == proxy_context->udp_listener_handle);
@@ -324,12 +669,14 @@ client_to_proxy_cb(evutil_socket_t client_proxy_handle, short ev_flags,
     }
     udp_request->proxy_context = proxy_context;
     udp_request->timeout_timer = NULL;
+    udp_request->id = ++proxy_context->last_request_id;
     udp_request->client_proxy_handle = client_proxy_handle;
     udp_request->client_sockaddr_len = sizeof udp_request->client_sockaddr;
-    nread = recvfrom(client_proxy_handle,
-                     (void *) dns_query, sizeof dns_query, 0,
-                     (struct sockaddr *) &udp_request->client_sockaddr,
-                     &udp_request->client_sockaddr_len);
+    nread = udp_recvfrom(client_proxy_handle,
+                         dns_query, sizeof dns_query,
+                         (struct sockaddr *) &udp_request->client_sockaddr,
+                         &udp_request->client_sockaddr_len,
+                         &proxy_context->metrics.udp_client_drops);
     if (nread < (ssize_t) 0) {
         const int err = evutil_socket_geterror(client_proxy_handle);
         if (!EVUTIL_ERR_RW_RETRIABLE(err)) {
@@ -346,23 +693,32 @@ client_to_proxy_cb(evutil_socket_t client_proxy_handle, short ev_flags,
         free(udp_request);
         return;
     }
-    if (proxy_context->connections_count >=
-        proxy_context->connections_count_max) {
-        DNSCRYPT_PROXY_REQUEST_UDP_OVERLOADED();
-        if (udp_listener_kill_oldest_request(proxy_context) != 0) {
-            tcp_listener_kill_oldest_request(proxy_context);
+    REQUEST_TRACE_MARK(&udp_request->trace, REQUEST_STAGE_RECEIVED);
+    if (rrl_check(&proxy_context->rrl, &udp_request->client_sockaddr,
+                  udp_request->trace.ts[REQUEST_STAGE_RECEIVED]) != 0) {
+        if (proxy_context->rrl.action == RRL_ACTION_DROP) {
+            free(udp_request);
+        } else {
+            proxy_client_send_truncated(udp_request, dns_query,
+                                        (size_t) nread);
         }
+        return;
     }
-    proxy_context->connections_count++;
-    assert(proxy_context->connections_count
-           <= proxy_context->connections_count_max);
-    DNSCRYPT_PROXY_STATUS_REQUESTS_ACTIVE(proxy_context->connections_count,
-                                          proxy_context->connections_count_max);
-    DNSCRYPT_PROXY_REQUEST_UDP_START(udp_request);
-    TAILQ_INSERT_TAIL(&proxy_context->udp_request_queue,
-                      udp_request, queue);
+    udp_request->client_bucket =
+        admission_client_bucket(&proxy_context->admission,
+                                &udp_request->client_sockaddr);
     memset(&udp_request->status, 0, sizeof udp_request->status);
-    udp_request->status.is_in_queue = 1;
+    DNSCRYPT_PROXY_REQUEST_UDP_START(udp_request);
+    proxy_context->metrics.queries_udp++;
+    /*
+     * When the proxy is overloaded, queries are only admitted once the
+     * plugins had a chance to answer them locally, so that replies from
+     * a cache don't cause other requests to be dropped.
+     */
+    if (proxy_context->connections_count <
+        proxy_context->connections_count_max) {
+        (void) udp_request_admit(udp_request);
+    }
 
     dns_query_len = (size_t) nread;
     assert(dns_query_len <= sizeof dns_query);
@@ -396,6 +752,7 @@ client_to_proxy_cb(evutil_socket_t client_proxy_handle, short ev_flags,
         .dns_packet = dns_query,
         .dns_packet_len_p = &dns_query_len,
         .client_sockaddr_len_s = (size_t) udp_request->client_sockaddr_len,
+        .request_id = udp_request->id,
         .dns_packet_max_len = max_query_size_for_filter
     };
     DNSCRYPT_PROXY_REQUEST_PLUGINS_PRE_START(udp_request, dns_query_len,
@@ -412,6 +769,9 @@ client_to_proxy_cb(evutil_socket_t client_proxy_handle, short ev_flags,
     case DCP_SYNC_FILTER_RESULT_DIRECT:
         DNSCRYPT_PROXY_REQUEST_PLUGINS_PRE_DONE(udp_request, dns_query_len,
                                                 max_query_size_for_filter);
+        REQUEST_TRACE_MARK(&udp_request->trace,
+                           REQUEST_STAGE_PLUGINS_PRE_DONE);
+        proxy_context->metrics.local_replies_udp++;
         proxy_to_client_direct(udp_request, dns_query, dns_query_len);
         return;
     default:
@@ -421,7 +781,20 @@ client_to_proxy_cb(evutil_socket_t client_proxy_handle, short ev_flags,
     }
     DNSCRYPT_PROXY_REQUEST_PLUGINS_PRE_DONE(udp_request, dns_query_len,
                                             max_query_size_for_filter);
+    REQUEST_TRACE_MARK(&udp_request->trace, REQUEST_STAGE_PLUGINS_PRE_DONE);
 #endif
+    if (udp_request->status.is_in_queue == 0 &&
+        udp_request_admit(udp_request) != 0) {
+        udp_request_kill(udp_request);
+        return;
+    }
+    if ((target = forwarding_target_for_query(&proxy_context->forwarding,
+                                              dns_query,
+                                              dns_query_len)) != NULL) {
+        udp_forward(udp_request, target, dns_query, dns_query_len,
+                    max_query_size);
+        return;
+    }
     assert(SIZE_MAX - DNSCRYPT_MAX_PADDING - dnscrypt_query_header_size()
            > dns_query_len);
 
@@ -446,27 +819,14 @@ client_to_proxy_cb(evutil_socket_t client_proxy_handle, short ev_flags,
     dns_query_len = (size_t) curve_ret;
     assert(dns_query_len >= dnscrypt_query_header_size());
     DNSCRYPT_PROXY_REQUEST_CURVE_DONE(udp_request, dns_query_len);
+    REQUEST_TRACE_MARK(&udp_request->trace, REQUEST_STAGE_CURVE_DONE);
     assert(dns_query_len <= sizeof dns_query);
 
-    udp_request->timeout_timer =
-        evtimer_new(udp_request->proxy_context->event_loop,
-                    timeout_timer_cb, udp_request);
-    if (udp_request->timeout_timer != NULL) {
-        const struct timeval tv = {
-            .tv_sec = (time_t) DNS_QUERY_TIMEOUT, .tv_usec = 0
-        };
-        evtimer_add(udp_request->timeout_timer, &tv);
-    }
-    udp_send(& (SendtoWithRetryCtx) {
-        .udp_request = udp_request,
-        .handle = proxy_context->udp_proxy_resolver_handle,
-        .buffer = dns_query,
-        .length = dns_query_len,
-        .flags = 0,
-        .dest_addr = (struct sockaddr *) &proxy_context->resolver_sockaddr,
-        .dest_len = proxy_context->resolver_sockaddr_len,
-        .cb = client_to_proxy_cb_sendto_cb
-    });
+    udp_request->resolver_generation = proxy_context->failover.generation;
+    udp_request_send(udp_request, proxy_context->udp_proxy_resolver_handle,
+                     &proxy_context->resolver_sockaddr,
+                     proxy_context->resolver_sockaddr_len,
+                     dns_query, dns_query_len);
 }
 
 int
@@ -480,6 +840,60 @@ udp_listener_kill_oldest_request(ProxyContext * const proxy_context)
     return 0;
 }
 
+int
+udp_listener_kill_oldest_heavy_request(ProxyContext * const proxy_context)
+{
+    UDPRequest *udp_request;
+
+    TAILQ_FOREACH(udp_request, &proxy_context->udp_request_queue, queue) {
+        if (admission_client_is_heavy(proxy_context,
+                                      udp_request->client_bucket)) {
+            udp_request_kill(udp_request);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+uint64_t
+udp_listener_oldest_request_ts(const ProxyContext * const proxy_context)
+{
+    if (TAILQ_EMPTY(&proxy_context->udp_request_queue)) {
+        return 0U;
+    }
+    return TAILQ_FIRST(&proxy_context->udp_request_queue)
+        ->trace.ts[REQUEST_STAGE_RECEIVED];
+}
+
+/*
+ * Every forwarding target gets its own socket, for the address family of
+ * the target.
+ */
+
+static int
+udp_forwarding_bind(ProxyContext * const proxy_context)
+{
+    ForwardingTarget *target;
+    size_t            i;
+
+    for (i = (size_t) 0U; i < proxy_context->forwarding.targets_count; i++) {
+        target = &proxy_context->forwarding.targets[i];
+        TAILQ_INIT(&target->udp_request_queue);
+        assert(target->udp_resolver_handle == -1);
+        if ((target->udp_resolver_handle = socket
+             (target->resolver_sockaddr.ss_family,
+                 SOCK_DGRAM, IPPROTO_UDP)) == -1) {
+            logger(proxy_context, LOG_ERR,
+                   "Unable to create a socket to [%s]", target->name);
+            return -1;
+        }
+        evutil_make_socket_closeonexec(target->udp_resolver_handle);
+        evutil_make_socket_nonblocking(target->udp_resolver_handle);
+        udp_tune(target->udp_resolver_handle);
+    }
+    return 0;
+}
+
 int
 udp_listener_bind(ProxyContext * const proxy_context)
 {
@@ -524,17 +938,56 @@ udp_listener_bind(ProxyContext * const proxy_context)
 
     TAILQ_INIT(&proxy_context->udp_request_queue);
 
-    return 0;
+    return udp_forwarding_bind(proxy_context);
+}
+
+static void
+client_to_proxy_timed_cb(evutil_socket_t client_proxy_handle, short ev_flags,
+                         void * const proxy_context_)
+{
+    ProxyContext   *proxy_context = proxy_context_;
+    const uint64_t  started = metrics_now();
+
+    client_to_proxy_cb(client_proxy_handle, ev_flags, proxy_context);
+    metrics_callback_done(&proxy_context->metrics,
+                          METRICS_CALLBACK_UDP_CLIENT, started);
+}
+
+static void
+resolver_to_proxy_timed_cb(evutil_socket_t proxy_resolver_handle,
+                           short ev_flags, void * const proxy_context_)
+{
+    ProxyContext   *proxy_context = proxy_context_;
+    const uint64_t  started = metrics_now();
+
+    resolver_to_proxy_cb(proxy_resolver_handle, ev_flags, proxy_context);
+    metrics_callback_done(&proxy_context->metrics,
+                          METRICS_CALLBACK_UDP_RESOLVER, started);
+}
+
+static void
+forwarding_resolver_to_proxy_timed_cb(evutil_socket_t proxy_resolver_handle,
+                                      short ev_flags, void * const target_)
+{
+    ForwardingTarget *target = target_;
+    const uint64_t    started = metrics_now();
+
+    forwarding_resolver_to_proxy_cb(proxy_resolver_handle, ev_flags, target);
+    metrics_callback_done(&target->proxy_context->metrics,
+                          METRICS_CALLBACK_UDP_RESOLVER, started);
 }
 
 int
 udp_listener_start(ProxyContext * const proxy_context)
 {
+    ForwardingTarget *target;
+    size_t            i;
+
     assert(proxy_context->udp_listener_handle != -1);
     if ((proxy_context->udp_listener_event =
          event_new(proxy_context->event_loop,
                    proxy_context->udp_listener_handle, EV_READ | EV_PERSIST,
-                   client_to_proxy_cb, proxy_context)) == NULL) {
+                   client_to_proxy_timed_cb, proxy_context)) == NULL) {
         return -1;
     }
     if (event_add(proxy_context->udp_listener_event, NULL) != 0) {
@@ -547,7 +1000,7 @@ udp_listener_start(ProxyContext * const proxy_context)
          event_new(proxy_context->event_loop,
                    proxy_context->udp_proxy_resolver_handle,
                    EV_READ | EV_PERSIST,
-                   resolver_to_proxy_cb, proxy_context)) == NULL) {
+                   resolver_to_proxy_timed_cb, proxy_context)) == NULL) {
         udp_listener_stop(proxy_context);
         return -1;
     }
@@ -555,12 +1008,28 @@ udp_listener_start(ProxyContext * const proxy_context)
         udp_listener_stop(proxy_context);
         return -1;
     }
+    for (i = (size_t) 0U; i < proxy_context->forwarding.targets_count; i++) {
+        target = &proxy_context->forwarding.targets[i];
+        assert(target->udp_resolver_handle != -1);
+        if ((target->udp_resolver_event =
+             event_new(proxy_context->event_loop,
+                       target->udp_resolver_handle, EV_READ | EV_PERSIST,
+                       forwarding_resolver_to_proxy_timed_cb,
+                       target)) == NULL ||
+            event_add(target->udp_resolver_event, NULL) != 0) {
+            udp_listener_stop(proxy_context);
+            return -1;
+        }
+    }
     return 0;
 }
 
 void
 udp_listener_stop(ProxyContext * const proxy_context)
 {
+    ForwardingTarget *target;
+    size_t            i;
+
     if (proxy_context->udp_proxy_resolver_event == NULL) {
         return;
     }
@@ -568,6 +1037,13 @@ udp_listener_stop(ProxyContext * const proxy_context)
     proxy_context->udp_listener_event = NULL;
     event_free(proxy_context->udp_proxy_resolver_event);
     proxy_context->udp_proxy_resolver_event = NULL;
+    for (i = (size_t) 0U; i < proxy_context->forwarding.targets_count; i++) {
+        target = &proxy_context->forwarding.targets[i];
+        if (target->udp_resolver_event != NULL) {
+            event_free(target->udp_resolver_event);
+            target->udp_resolver_event = NULL;
+        }
+    }
     while (udp_listener_kill_oldest_request(proxy_context) == 0) { }
     logger_noformat(proxy_context, LOG_INFO, "UDP listener shut down");
 }
@@ -22,5 +22,7 @@ int udp_listener_bind(ProxyContext * const proxy_context);
 int udp_listener_start(ProxyContext * const proxy_context);
 void udp_listener_stop(ProxyContext * const proxy_context);
 int udp_listener_kill_oldest_request(ProxyContext * const proxy_context);
+int udp_listener_kill_oldest_heavy_request(ProxyContext * const proxy_context);
+uint64_t udp_listener_oldest_request_ts(const ProxyContext * const proxy_context);
 
 #endif
@@ -9,22 +9,33 @@
 #include <event2/event.h>
 
 #include "dnscrypt.h"
+#include "metrics.h"
 #include "queue.h"
 
 typedef struct UDPRequestStatus_ {
     _Bool is_dying : 1;
     _Bool is_in_queue : 1;
+    _Bool is_in_target_queue : 1;
 } UDPRequestStatus;
 
 typedef struct UDPRequest_ {
     uint8_t                  client_nonce[crypto_box_HALF_NONCEBYTES];
     TAILQ_ENTRY(UDPRequest_) queue;
+    TAILQ_ENTRY(UDPRequest_) target_queue;
     struct sockaddr_storage  client_sockaddr;
     ProxyContext            *proxy_context;
+    ForwardingTarget        *target;
     struct event            *timeout_timer;
+    RequestTrace             trace;
+    uint64_t                 id;
+    uint64_t                 question_hash;
     evutil_socket_t          client_proxy_handle;
     ev_socklen_t             client_sockaddr_len;
+    uint32_t                 client_bucket;
+    unsigned int             resolver_generation;
     UDPRequestStatus         status;
+    uint16_t                 upstream_query_id;
+    uint8_t                  client_query_id[2];
     unsigned char            retries;
 } UDPRequest;
 
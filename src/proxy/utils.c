@@ -2,6 +2,12 @@
 #include <config.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#ifdef _WIN32
+# include <winsock2.h>
+#else
+# include <sys/socket.h>
+# include <arpa/inet.h>
+#endif
 
 #include <assert.h>
 #include <fcntl.h>
@@ -15,6 +21,10 @@
 #include "pathnames.h"
 #include "utils.h"
 
+#ifndef INET6_ADDRSTRLEN
+# define INET6_ADDRSTRLEN 46U
+#endif
+
 uint64_t
 dnscrypt_hrtime(void)
 {
@@ -116,6 +126,52 @@ do_daemonize(void)
 
 #endif
 
+int
+sockaddr_from_ip_and_port(struct sockaddr_storage * const sockaddr,
+                          ev_socklen_t * const sockaddr_len_p,
+                          const char * const ip, const char * const port,
+                          const char * const error_msg)
+{
+    char   sockaddr_port[INET6_ADDRSTRLEN + sizeof "[]:65535"];
+    int    sockaddr_len_int;
+    char  *pnt;
+    _Bool  has_column = 0;
+    _Bool  has_columns = 0;
+    _Bool  has_brackets = *ip == '[';
+
+    if ((pnt = strchr(ip, ':')) != NULL) {
+        has_column = 1;
+        if (strchr(pnt + 1, ':') != NULL) {
+            has_columns = 1;
+        }
+    }
+    sockaddr_len_int = (int) sizeof *sockaddr;
+    if ((has_brackets != 0 || has_column != has_columns) &&
+        evutil_parse_sockaddr_port(ip, (struct sockaddr *) sockaddr,
+                                   &sockaddr_len_int) == 0) {
+        *sockaddr_len_p = (ev_socklen_t) sockaddr_len_int;
+        return 0;
+    }
+    if (has_columns != 0 && has_brackets == 0) {
+        evutil_snprintf(sockaddr_port, sizeof sockaddr_port, "[%s]:%s",
+                        ip, port);
+    } else {
+        evutil_snprintf(sockaddr_port, sizeof sockaddr_port, "%s:%s",
+                        ip, port);
+    }
+    sockaddr_len_int = (int) sizeof *sockaddr;
+    if (evutil_parse_sockaddr_port(sockaddr_port, (struct sockaddr *) sockaddr,
+                                   &sockaddr_len_int) != 0) {
+        logger(NULL, LOG_ERR, "%s: %s", error_msg, sockaddr_port);
+        *sockaddr_len_p = (ev_socklen_t) 0U;
+
+        return -1;
+    }
+    *sockaddr_len_p = (ev_socklen_t) sockaddr_len_int;
+
+    return 0;
+}
+
 #ifndef _WIN32
 char *
 path_from_app_folder(const char *file_name)
@@ -5,6 +5,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <event2/util.h>
+
 #define COMPILER_ASSERT(X) (void) sizeof(char[(X) ? 1 : -1])
 
 uint64_t dnscrypt_hrtime(void);
@@ -12,4 +14,10 @@ int closedesc_all(const int closestdin);
 int do_daemonize(void);
 char * path_from_app_folder(const char *file_name);
 
+struct sockaddr_storage;
+int sockaddr_from_ip_and_port(struct sockaddr_storage * const sockaddr,
+                              ev_socklen_t * const sockaddr_len_p,
+                              const char * const ip, const char * const port,
+                              const char * const error_msg);
+
 #endif
@@ -0,0 +1,626 @@
+
+#include <config.h>
+#include <sys/types.h>
+#ifdef _WIN32
+# include <winsock2.h>
+#else
+# include <sys/socket.h>
+# include <arpa/inet.h>
+# include <netinet/in.h>
+#endif
+
+#include <assert.h>
+#include <getopt.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+#include <event2/listener.h>
+#include <event2/util.h>
+#include <sodium.h>
+
+#include "cert_p.h"
+#include "dnscrypt.h"
+#include "shims.h"
+#include "test_server.h"
+#include "zone.h"
+
+#define TCP_IDLE_TIMEOUT 10
+
+typedef struct TCPConnection_ {
+    TestServer         *server;
+    struct bufferevent *bev;
+    unsigned int        pending_replies;
+} TCPConnection;
+
+typedef struct PendingReply_ {
+    TestServer              *server;
+    TCPConnection           *tcp_connection;
+    struct sockaddr_storage  client_sockaddr;
+    ev_socklen_t             client_sockaddr_len;
+    size_t                   len;
+    uint8_t                  data[];
+} PendingReply;
+
+static struct option getopt_long_options[] = {
+    { "listen-address", 1, NULL, 'a' },
+    { "help", 0, NULL, 'h' },
+    { "latency", 1, NULL, 'l' },
+    { "loss", 1, NULL, 'L' },
+    { "provider-name", 1, NULL, 'N' },
+    { "truncate", 1, NULL, 'T' },
+    { "zone", 1, NULL, 'z' },
+    { NULL, 0, NULL, 0 }
+};
+static const char *getopt_options = "a:hl:L:N:T:z:";
+
+static void
+options_usage(void)
+{
+    puts("Usage: dnscrypt-test-server [options]\n"
+         "  -a, --listen-address=<ip[:port]>: UDP and TCP address to listen to\n"
+         "    (default: " TEST_SERVER_DEFAULT_LISTEN_ADDRESS ")\n"
+         "  -h, --help: show usage\n"
+         "  -l, --latency=<ms>: delay every reply\n"
+         "  -L, --loss=<percent>: ignore this share of UDP queries\n"
+         "  -N, --provider-name=<name>: provider name\n"
+         "    (default: " TEST_SERVER_DEFAULT_PROVIDER_NAME ")\n"
+         "  -T, --truncate=<percent>: answer this share of UDP queries\n"
+         "    with a truncated reply\n"
+         "  -z, --zone=<file>: records to serve\n");
+}
+
+static unsigned int
+options_parse_uint(const char * const name, const char * const arg,
+                   const unsigned long max)
+{
+    char          *endptr;
+    unsigned long  value;
+
+    value = strtoul(arg, &endptr, 10);
+    if (*arg == 0 || *endptr != 0 || value > max) {
+        fprintf(stderr, "Invalid %s: [%s]\n", name, arg);
+        exit(1);
+    }
+    return (unsigned int) value;
+}
+
+static void
+options_parse(TestServer * const server, int argc, char *argv[])
+{
+    int opt_flag;
+    int option_index = 0;
+
+    server->listen_address = TEST_SERVER_DEFAULT_LISTEN_ADDRESS;
+    server->provider_name = TEST_SERVER_DEFAULT_PROVIDER_NAME;
+    server->zone_file = NULL;
+    server->latency = 0U;
+    server->loss = 0U;
+    server->truncate = 0U;
+    while ((opt_flag = getopt_long(argc, argv,
+                                   getopt_options, getopt_long_options,
+                                   &option_index)) != -1) {
+        switch (opt_flag) {
+        case 'a':
+            server->listen_address = optarg;
+            break;
+        case 'h':
+            options_usage();
+            exit(0);
+        case 'l':
+            server->latency = options_parse_uint("latency", optarg, 60000UL);
+            break;
+        case 'L':
+            server->loss = options_parse_uint("loss", optarg, 100UL);
+            break;
+        case 'N':
+            server->provider_name = optarg;
+            break;
+        case 'T':
+            server->truncate = options_parse_uint("truncate", optarg, 100UL);
+            break;
+        case 'z':
+            server->zone_file = optarg;
+            break;
+        default:
+            options_usage();
+            exit(1);
+        }
+    }
+}
+
+static void
+key_to_fingerprint(char fingerprint[80U], const uint8_t * const key)
+{
+    size_t fingerprint_pos = (size_t) 0U;
+    size_t key_pos;
+
+    for (key_pos = (size_t) 0U; key_pos < crypto_sign_ed25519_PUBLICKEYBYTES;
+         key_pos += 2U) {
+        if (key_pos > (size_t) 0U) {
+            fingerprint[fingerprint_pos++] = ':';
+        }
+        evutil_snprintf(&fingerprint[fingerprint_pos],
+                        80U - fingerprint_pos, "%02X%02X",
+                        key[key_pos], key[key_pos + 1U]);
+        fingerprint_pos += 4U;
+    }
+}
+
+/*
+ * Signs a certificate for the resolver key, and adds it to the zone
+ * as a TXT record for the provider name.
+ */
+
+static int
+test_server_add_cert(TestServer * const server)
+{
+    uint8_t             txt[1U + offsetof(SignedBincert, signed_data) +
+                            crypto_sign_ed25519_BYTES + sizeof (Bincert) -
+                            offsetof(Bincert, server_publickey)];
+    Bincert             bincert;
+    SignedBincert      *signed_bincert = (SignedBincert *) (void *) &txt[1];
+    unsigned long long  signed_data_len;
+    const uint32_t      now_u32 = (uint32_t) time(NULL);
+    uint32_t            serial = htonl(now_u32);
+    uint32_t            ts_begin = htonl(now_u32 - 60U);
+    uint32_t            ts_end =
+        htonl(now_u32 - 60U + TEST_SERVER_CERT_VALIDITY);
+
+    memcpy(bincert.magic_cert, CERT_MAGIC_CERT, sizeof bincert.magic_cert);
+    bincert.version_major[0] = 0U;
+    bincert.version_major[1] = 1U;
+    bincert.version_minor[0] = 0U;
+    bincert.version_minor[1] = 0U;
+    memcpy(bincert.server_publickey, server->resolver_publickey,
+           sizeof bincert.server_publickey);
+    memcpy(bincert.magic_query, server->magic_query,
+           sizeof bincert.magic_query);
+    memcpy(bincert.serial, &serial, sizeof bincert.serial);
+    memcpy(bincert.ts_begin, &ts_begin, sizeof bincert.ts_begin);
+    memcpy(bincert.ts_end, &ts_end, sizeof bincert.ts_end);
+
+    memcpy(signed_bincert, &bincert, offsetof(SignedBincert, signed_data));
+    if (crypto_sign_ed25519(signed_bincert->signed_data, &signed_data_len,
+                            bincert.server_publickey,
+                            sizeof bincert - offsetof(Bincert, server_publickey),
+                            server->provider_secretkey) != 0) {
+        return -1;
+    }
+    assert(1U + offsetof(SignedBincert, signed_data) + signed_data_len ==
+           sizeof txt);
+    txt[0] = (uint8_t) (sizeof txt - 1U);
+
+    return zone_add(server->zone, server->provider_name, DNS_TYPE_TXT,
+                    txt, sizeof txt);
+}
+
+static int
+test_server_init(TestServer * const server)
+{
+    char fingerprint[80U];
+
+    if ((server->zone = zone_new()) == NULL ||
+        (server->zone_file != NULL &&
+         zone_load(server->zone, server->zone_file) != 0)) {
+        return -1;
+    }
+    crypto_sign_ed25519_keypair(server->provider_publickey,
+                                server->provider_secretkey);
+    crypto_box_keypair(server->resolver_publickey,
+                       server->resolver_secretkey);
+    memcpy(server->magic_query, server->resolver_publickey,
+           sizeof server->magic_query);
+    if (test_server_add_cert(server) != 0) {
+        return -1;
+    }
+    key_to_fingerprint(fingerprint, server->provider_publickey);
+    printf("Provider name: %s\n"
+           "Provider public key: %s\n", server->provider_name, fingerprint);
+    fflush(stdout);
+
+    return 0;
+}
+
+static size_t
+test_server_reply_plain(TestServer * const server, uint8_t * const packet,
+                        const size_t packet_len, const size_t reply_max_len)
+{
+    uint8_t  reply[DNSCRYPT_MAX_PACKET_SIZE];
+    char     name[DNS_MAX_HOSTNAME_LEN + 1U];
+    size_t   question_end;
+    ssize_t  reply_len;
+    uint16_t qtype;
+
+    if (zone_question(packet, packet_len, name, &qtype, &question_end) != 0) {
+        return (size_t) 0U;
+    }
+    if (evutil_ascii_strcasecmp(name, server->provider_name) == 0) {
+        reply_len = zone_answer(server->zone, packet, packet_len,
+                                reply, reply_max_len);
+    } else {
+        reply_len = zone_reply(packet, packet_len, reply, reply_max_len,
+                               DNS_RCODE_REFUSED, 0);
+    }
+    if (reply_len <= (ssize_t) 0) {
+        return (size_t) 0U;
+    }
+    memcpy(packet, reply, (size_t) reply_len);
+
+    return (size_t) reply_len;
+}
+
+/*
+ * Clients usually keep the same key for many queries: remember the
+ * shared key computed for the last one.
+ */
+
+static int
+test_server_nmkey(TestServer * const server,
+                  uint8_t nmkey[crypto_box_BEFORENMBYTES],
+                  const uint8_t client_publickey[crypto_box_PUBLICKEYBYTES])
+{
+    if (server->has_last_nmkey == 0 ||
+        memcmp(server->last_client_publickey, client_publickey,
+               crypto_box_PUBLICKEYBYTES) != 0) {
+        if (crypto_box_beforenm(server->last_nmkey, client_publickey,
+                                server->resolver_secretkey) != 0) {
+            server->has_last_nmkey = 0;
+            return -1;
+        }
+        memcpy(server->last_client_publickey, client_publickey,
+               crypto_box_PUBLICKEYBYTES);
+        server->has_last_nmkey = 1;
+    }
+    memcpy(nmkey, server->last_nmkey, crypto_box_BEFORENMBYTES);
+
+    return 0;
+}
+
+/*
+ * Replaces the query in packet with a reply. Returns the length of the
+ * reply, or 0 if the query has to be ignored.
+ * Over UDP, the reply cannot be larger than the query, and is truncated
+ * if it doesn't fit.
+ */
+
+static size_t
+test_server_reply(TestServer * const server, uint8_t * const packet,
+                  const size_t packet_len, const _Bool is_udp)
+{
+    uint8_t  query[DNSCRYPT_MAX_PACKET_SIZE];
+    uint8_t  reply[DNSCRYPT_MAX_PACKET_SIZE];
+    uint8_t  nmkey[crypto_box_BEFORENMBYTES];
+    uint8_t  nonce[crypto_box_NONCEBYTES];
+    size_t   query_len;
+    size_t   reply_max_len;
+    size_t   padded_len;
+    ssize_t  reply_len;
+
+    if (packet_len < DNSCRYPT_QUERY_HEADER_SIZE + DNS_HEADER_SIZE ||
+        memcmp(packet, server->magic_query, sizeof server->magic_query) != 0) {
+        return test_server_reply_plain(server, packet, packet_len,
+                                       is_udp ? DNS_MAX_PACKET_SIZE_UDP_NO_EDNS
+                                       : sizeof reply);
+    }
+    memcpy(nonce, packet + DNSCRYPT_MAGIC_QUERY_LEN + crypto_box_PUBLICKEYBYTES,
+           crypto_box_HALF_NONCEBYTES);
+    memset(nonce + crypto_box_HALF_NONCEBYTES, 0, crypto_box_HALF_NONCEBYTES);
+    if (test_server_nmkey(server, nmkey,
+                          packet + DNSCRYPT_MAGIC_QUERY_LEN) != 0 ||
+        crypto_box_open_easy_afternm
+        (query, packet + DNSCRYPT_QUERY_HEADER_SIZE - crypto_box_MACBYTES,
+         packet_len - DNSCRYPT_QUERY_HEADER_SIZE + crypto_box_MACBYTES,
+         nonce, nmkey) != 0) {
+        return (size_t) 0U;
+    }
+    query_len = packet_len - DNSCRYPT_QUERY_HEADER_SIZE;
+    while (query_len > (size_t) 0U && query[--query_len] == 0U) { }
+    if (query[query_len] != 0x80) {
+        return (size_t) 0U;
+    }
+    reply_max_len = DNSCRYPT_MAX_PACKET_SIZE - DNSCRYPT_RESPONSE_HEADER_SIZE -
+        DNSCRYPT_BLOCK_SIZE;
+    if (is_udp != 0) {
+        if (packet_len < DNSCRYPT_RESPONSE_HEADER_SIZE + DNSCRYPT_BLOCK_SIZE) {
+            return (size_t) 0U;
+        }
+        reply_max_len = (packet_len - DNSCRYPT_RESPONSE_HEADER_SIZE) /
+            DNSCRYPT_BLOCK_SIZE * DNSCRYPT_BLOCK_SIZE - 1U;
+    }
+    reply_len = zone_answer(server->zone, query, query_len,
+                            reply, reply_max_len);
+    if (is_udp != 0 && server->truncate > 0U &&
+        randombytes_uniform(100U) < server->truncate) {
+        reply_len = zone_reply(query, query_len, reply, reply_max_len,
+                               DNS_RCODE_NOERROR, 1);
+    }
+    if (reply_len <= (ssize_t) 0) {
+        return (size_t) 0U;
+    }
+    padded_len = ((size_t) reply_len + DNSCRYPT_BLOCK_SIZE) &
+        ~ (size_t) (DNSCRYPT_BLOCK_SIZE - 1U);
+    reply[reply_len] = 0x80;
+    memset(reply + reply_len + 1U, 0, padded_len - (size_t) reply_len - 1U);
+
+    memcpy(packet, DNSCRYPT_MAGIC_RESPONSE, sizeof DNSCRYPT_MAGIC_RESPONSE - 1U);
+    memcpy(packet + sizeof DNSCRYPT_MAGIC_RESPONSE - 1U, nonce,
+           crypto_box_HALF_NONCEBYTES);
+    randombytes_buf(nonce + crypto_box_HALF_NONCEBYTES,
+                    crypto_box_HALF_NONCEBYTES);
+    memcpy(packet + sizeof DNSCRYPT_MAGIC_RESPONSE - 1U +
+           crypto_box_HALF_NONCEBYTES,
+           nonce + crypto_box_HALF_NONCEBYTES, crypto_box_HALF_NONCEBYTES);
+    if (crypto_box_easy_afternm(packet + sizeof DNSCRYPT_MAGIC_RESPONSE - 1U +
+                                crypto_box_NONCEBYTES,
+                                reply, padded_len, nonce, nmkey) != 0) {
+        return (size_t) 0U;
+    }
+    return DNSCRYPT_RESPONSE_HEADER_SIZE + padded_len;
+}
+
+static void
+tcp_connection_free(TCPConnection * const tcp_connection)
+{
+    if (tcp_connection->bev != NULL) {
+        bufferevent_free(tcp_connection->bev);
+        tcp_connection->bev = NULL;
+    }
+    if (tcp_connection->pending_replies == 0U) {
+        free(tcp_connection);
+    }
+}
+
+static void
+test_server_send_now(TestServer * const server,
+                     TCPConnection * const tcp_connection,
+                     const struct sockaddr_storage * const client_sockaddr,
+                     const ev_socklen_t client_sockaddr_len,
+                     const uint8_t * const data, const size_t len)
+{
+    if (tcp_connection == NULL) {
+        (void) sendto(server->udp_handle, (const void *) data, len, 0,
+                      (const struct sockaddr *) client_sockaddr,
+                      client_sockaddr_len);
+    } else if (tcp_connection->bev != NULL) {
+        bufferevent_write(tcp_connection->bev, data, len);
+    }
+}
+
+static void
+pending_reply_timer_cb(evutil_socket_t handle, short ev_flags,
+                       void * const pending_reply_)
+{
+    PendingReply * const  pending_reply = pending_reply_;
+    TCPConnection * const tcp_connection = pending_reply->tcp_connection;
+
+    (void) handle;
+    (void) ev_flags;
+    test_server_send_now(pending_reply->server, tcp_connection,
+                         &pending_reply->client_sockaddr,
+                         pending_reply->client_sockaddr_len,
+                         pending_reply->data, pending_reply->len);
+    free(pending_reply);
+    if (tcp_connection != NULL) {
+        assert(tcp_connection->pending_replies > 0U);
+        tcp_connection->pending_replies--;
+        if (tcp_connection->bev == NULL) {
+            tcp_connection_free(tcp_connection);
+        }
+    }
+}
+
+static void
+test_server_send(TestServer * const server,
+                 TCPConnection * const tcp_connection,
+                 const struct sockaddr_storage * const client_sockaddr,
+                 const ev_socklen_t client_sockaddr_len,
+                 const uint8_t * const data, const size_t len)
+{
+    PendingReply *pending_reply;
+
+    if (server->latency == 0U) {
+        test_server_send_now(server, tcp_connection,
+                             client_sockaddr, client_sockaddr_len, data, len);
+        return;
+    }
+    if ((pending_reply = malloc(sizeof *pending_reply + len)) == NULL) {
+        return;
+    }
+    pending_reply->server = server;
+    pending_reply->tcp_connection = tcp_connection;
+    if (client_sockaddr != NULL) {
+        memcpy(&pending_reply->client_sockaddr, client_sockaddr,
+               (size_t) client_sockaddr_len);
+    }
+    pending_reply->client_sockaddr_len = client_sockaddr_len;
+    pending_reply->len = len;
+    memcpy(pending_reply->data, data, len);
+
+    const struct timeval tv = {
+        .tv_sec = (time_t) (server->latency / 1000U),
+        .tv_usec = (server->latency % 1000U) * 1000U
+    };
+    if (event_base_once(server->event_loop, -1, EV_TIMEOUT,
+                        pending_reply_timer_cb, pending_reply, &tv) != 0) {
+        free(pending_reply);
+        return;
+    }
+    if (tcp_connection != NULL) {
+        tcp_connection->pending_replies++;
+    }
+}
+
+static void
+udp_query_cb(evutil_socket_t handle, short ev_flags, void * const server_)
+{
+    uint8_t                  packet[DNSCRYPT_MAX_PACKET_SIZE];
+    struct sockaddr_storage  client_sockaddr;
+    TestServer              *server = server_;
+    ev_socklen_t             client_sockaddr_len = sizeof client_sockaddr;
+    ssize_t                  nread;
+    size_t                   reply_len;
+
+    (void) ev_flags;
+    nread = recvfrom(handle, (void *) packet, sizeof packet, 0,
+                     (struct sockaddr *) &client_sockaddr,
+                     &client_sockaddr_len);
+    if (nread <= (ssize_t) 0) {
+        return;
+    }
+    if (server->loss > 0U && randombytes_uniform(100U) < server->loss) {
+        return;
+    }
+    if ((reply_len = test_server_reply(server, packet, (size_t) nread,
+                                       1)) == (size_t) 0U) {
+        return;
+    }
+    test_server_send(server, NULL, &client_sockaddr, client_sockaddr_len,
+                     packet, reply_len);
+}
+
+static void
+tcp_connection_read_cb(struct bufferevent * const bev,
+                       void * const tcp_connection_)
+{
+    uint8_t                packet[2U + DNSCRYPT_MAX_PACKET_SIZE];
+    TCPConnection * const  tcp_connection = tcp_connection_;
+    struct evbuffer       *input = bufferevent_get_input(bev);
+    size_t                 query_len;
+    size_t                 reply_len;
+
+    while (evbuffer_get_length(input) >= (size_t) 2U) {
+        evbuffer_copyout(input, packet, (size_t) 2U);
+        query_len = ((size_t) packet[0] << 8) | (size_t) packet[1];
+        if (evbuffer_get_length(input) < 2U + query_len) {
+            break;
+        }
+        evbuffer_remove(input, packet, 2U + query_len);
+        if ((reply_len = test_server_reply(tcp_connection->server,
+                                           packet + 2U, query_len,
+                                           0)) == (size_t) 0U) {
+            continue;
+        }
+        packet[0] = (uint8_t) (reply_len >> 8);
+        packet[1] = (uint8_t) reply_len;
+        test_server_send(tcp_connection->server, tcp_connection, NULL, 0,
+                         packet, 2U + reply_len);
+    }
+}
+
+static void
+tcp_connection_event_cb(struct bufferevent * const bev, const short events,
+                        void * const tcp_connection_)
+{
+    TCPConnection * const tcp_connection = tcp_connection_;
+
+    (void) bev;
+    if ((events & (BEV_EVENT_EOF | BEV_EVENT_ERROR |
+                   BEV_EVENT_TIMEOUT)) != 0) {
+        tcp_connection_free(tcp_connection);
+    }
+}
+
+static void
+tcp_accept_cb(struct evconnlistener * const tcp_listener,
+              evutil_socket_t handle, struct sockaddr * const client_sockaddr,
+              const int client_sockaddr_len, void * const server_)
+{
+    const struct timeval  tv = { .tv_sec = TCP_IDLE_TIMEOUT, .tv_usec = 0 };
+    TestServer           *server = server_;
+    TCPConnection        *tcp_connection;
+
+    (void) tcp_listener;
+    (void) client_sockaddr;
+    (void) client_sockaddr_len;
+    if ((tcp_connection = calloc((size_t) 1U, sizeof *tcp_connection)) == NULL) {
+        evutil_closesocket(handle);
+        return;
+    }
+    tcp_connection->server = server;
+    tcp_connection->pending_replies = 0U;
+    if ((tcp_connection->bev =
+         bufferevent_socket_new(server->event_loop, handle,
+                                BEV_OPT_CLOSE_ON_FREE)) == NULL) {
+        evutil_closesocket(handle);
+        free(tcp_connection);
+        return;
+    }
+    bufferevent_setcb(tcp_connection->bev, tcp_connection_read_cb, NULL,
+                      tcp_connection_event_cb, tcp_connection);
+    bufferevent_set_timeouts(tcp_connection->bev, &tv, NULL);
+    bufferevent_enable(tcp_connection->bev, EV_READ);
+}
+
+static int
+test_server_listen(TestServer * const server)
+{
+    server->listen_sockaddr_len = (int) sizeof server->listen_sockaddr;
+    if (evutil_parse_sockaddr_port(server->listen_address,
+                                   (struct sockaddr *) &server->listen_sockaddr,
+                                   &server->listen_sockaddr_len) != 0) {
+        fprintf(stderr, "Unsupported listen address: [%s]\n",
+                server->listen_address);
+        return -1;
+    }
+    if ((server->udp_handle =
+         socket(server->listen_sockaddr.ss_family, SOCK_DGRAM,
+                IPPROTO_UDP)) == -1 ||
+        evutil_make_socket_nonblocking(server->udp_handle) != 0 ||
+        bind(server->udp_handle, (struct sockaddr *) &server->listen_sockaddr,
+             (ev_socklen_t) server->listen_sockaddr_len) != 0) {
+        perror("Unable to bind the UDP socket");
+        return -1;
+    }
+    if ((server->udp_event = event_new(server->event_loop, server->udp_handle,
+                                       EV_READ | EV_PERSIST,
+                                       udp_query_cb, server)) == NULL ||
+        event_add(server->udp_event, NULL) != 0) {
+        return -1;
+    }
+    if ((server->tcp_listener =
+         evconnlistener_new_bind(server->event_loop, tcp_accept_cb, server,
+                                 LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE,
+                                 -1,
+                                 (struct sockaddr *) &server->listen_sockaddr,
+                                 server->listen_sockaddr_len)) == NULL) {
+        perror("Unable to bind the TCP socket");
+        return -1;
+    }
+    printf("Listening on %s\n", server->listen_address);
+    fflush(stdout);
+
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    TestServer server;
+
+    memset(&server, 0, sizeof server);
+    options_parse(&server, argc, argv);
+    if (sodium_init() < 0) {
+        return 1;
+    }
+    if ((server.event_loop = event_base_new()) == NULL ||
+        test_server_init(&server) != 0 ||
+        test_server_listen(&server) != 0) {
+        return 1;
+    }
+    event_base_dispatch(server.event_loop);
+
+    evconnlistener_free(server.tcp_listener);
+    event_free(server.udp_event);
+    evutil_closesocket(server.udp_handle);
+    event_base_free(server.event_loop);
+    zone_free(server.zone);
+
+    return 0;
+}
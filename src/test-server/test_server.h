@@ -0,0 +1,71 @@
+
+#ifndef __TEST_SERVER_H__
+#define __TEST_SERVER_H__ 1
+
+#include <sys/types.h>
+#ifdef _WIN32
+# include <winsock2.h>
+#else
+# include <sys/socket.h>
+#endif
+
+#include <stdint.h>
+
+#include <event2/event.h>
+#include <event2/listener.h>
+#include <sodium.h>
+
+#include "dnscrypt.h"
+#include "zone.h"
+
+/*
+ * A DNSCrypt resolver stand-in for tests and benchmarks.
+ *
+ * It generates a provider key pair and a resolver key pair at startup,
+ * serves a signed certificate for the provider name, and answers
+ * encrypted queries over UDP and TCP from a zone file.
+ * Replies can be delayed, and UDP queries can be dropped or answered
+ * with a truncated reply, to exercise the proxy's error paths.
+ */
+
+#ifndef TEST_SERVER_DEFAULT_LISTEN_ADDRESS
+# define TEST_SERVER_DEFAULT_LISTEN_ADDRESS "127.0.0.1:5443"
+#endif
+#ifndef TEST_SERVER_DEFAULT_PROVIDER_NAME
+# define TEST_SERVER_DEFAULT_PROVIDER_NAME "2.dnscrypt-cert.test.local"
+#endif
+#define TEST_SERVER_CERT_VALIDITY 86400U
+
+#define DNSCRYPT_QUERY_HEADER_SIZE \
+    (DNSCRYPT_MAGIC_QUERY_LEN + crypto_box_PUBLICKEYBYTES + \
+     crypto_box_HALF_NONCEBYTES + crypto_box_MACBYTES)
+#define DNSCRYPT_RESPONSE_HEADER_SIZE \
+    (sizeof DNSCRYPT_MAGIC_RESPONSE - 1U + crypto_box_NONCEBYTES + \
+     crypto_box_MACBYTES)
+#define DNSCRYPT_MAX_PACKET_SIZE 65535U
+
+typedef struct TestServer_ {
+    uint8_t                  provider_publickey[crypto_sign_ed25519_PUBLICKEYBYTES];
+    uint8_t                  provider_secretkey[crypto_sign_ed25519_SECRETKEYBYTES];
+    uint8_t                  resolver_publickey[crypto_box_PUBLICKEYBYTES];
+    uint8_t                  resolver_secretkey[crypto_box_SECRETKEYBYTES];
+    uint8_t                  magic_query[DNSCRYPT_MAGIC_QUERY_LEN];
+    uint8_t                  last_client_publickey[crypto_box_PUBLICKEYBYTES];
+    uint8_t                  last_nmkey[crypto_box_BEFORENMBYTES];
+    struct sockaddr_storage  listen_sockaddr;
+    Zone                    *zone;
+    struct event_base       *event_loop;
+    struct event            *udp_event;
+    struct evconnlistener   *tcp_listener;
+    const char              *listen_address;
+    const char              *provider_name;
+    const char              *zone_file;
+    int                      listen_sockaddr_len;
+    evutil_socket_t          udp_handle;
+    unsigned int             latency;
+    unsigned int             loss;
+    unsigned int             truncate;
+    _Bool                    has_last_nmkey;
+} TestServer;
+
+#endif
@@ -0,0 +1,334 @@
+
+#include <config.h>
+#include <sys/types.h>
+#ifdef _WIN32
+# include <winsock2.h>
+#else
+# include <sys/socket.h>
+#endif
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <event2/util.h>
+
+#include "zone.h"
+
+#define DNS_OFFSET_FLAGS   2U
+#define DNS_OFFSET_FLAGS2  3U
+#define DNS_OFFSET_QDCOUNT 4U
+#define DNS_OFFSET_ANCOUNT 6U
+
+#define DNS_FLAGS_QR 0x80U
+#define DNS_FLAGS_AA 0x04U
+#define DNS_FLAGS_TC 0x02U
+#define DNS_FLAGS_OPCODE_RD 0x79U
+#define DNS_FLAGS2_RA 0x80U
+
+#define DNS_RR_FIXED_LEN 12U
+
+#define ZONE_LINE_MAX 1024U
+
+static void
+zone_put_u16(uint8_t * const p, const unsigned int v)
+{
+    p[0] = (uint8_t) (v >> 8);
+    p[1] = (uint8_t) v;
+}
+
+static unsigned int
+zone_get_u16(const uint8_t * const p)
+{
+    return ((unsigned int) p[0] << 8) | (unsigned int) p[1];
+}
+
+static void
+zone_normalize_name(char * const name)
+{
+    size_t i;
+
+    for (i = (size_t) 0U; name[i] != 0; i++) {
+        name[i] = (char) tolower((unsigned char) name[i]);
+    }
+    if (i > (size_t) 0U && name[i - 1U] == '.') {
+        name[i - 1U] = 0;
+    }
+}
+
+Zone *
+zone_new(void)
+{
+    Zone *zone;
+
+    if ((zone = calloc((size_t) 1U, sizeof *zone)) == NULL) {
+        return NULL;
+    }
+    zone->records = NULL;
+    zone->records_count = (size_t) 0U;
+
+    return zone;
+}
+
+void
+zone_free(Zone * const zone)
+{
+    size_t i;
+
+    if (zone == NULL) {
+        return;
+    }
+    for (i = (size_t) 0U; i < zone->records_count; i++) {
+        free(zone->records[i].name);
+        free(zone->records[i].rdata);
+    }
+    free(zone->records);
+    free(zone);
+}
+
+int
+zone_add(Zone * const zone, const char * const name, const uint16_t type,
+         const uint8_t * const rdata, const size_t rdata_len)
+{
+    ZoneRecord *records;
+    ZoneRecord *record;
+
+    if (strlen(name) > DNS_MAX_HOSTNAME_LEN || rdata_len > 0xffff) {
+        return -1;
+    }
+    if ((records = realloc(zone->records, (zone->records_count + 1U) *
+                           sizeof *records)) == NULL) {
+        return -1;
+    }
+    zone->records = records;
+    record = &records[zone->records_count];
+    if ((record->name = strdup(name)) == NULL) {
+        return -1;
+    }
+    if ((record->rdata = malloc(rdata_len + 1U)) == NULL) {
+        free(record->name);
+        return -1;
+    }
+    memcpy(record->rdata, rdata, rdata_len);
+    record->rdata_len = (uint16_t) rdata_len;
+    record->type = type;
+    zone_normalize_name(record->name);
+    zone->records_count++;
+
+    return 0;
+}
+
+static int
+zone_parse_record(Zone * const zone, char * const line)
+{
+    uint8_t     rdata[256];
+    char       *name;
+    char       *type;
+    char       *value;
+    size_t      value_len;
+
+    if ((name = strtok(line, " \t\r\n")) == NULL) {
+        return 0;
+    }
+    if ((type = strtok(NULL, " \t\r\n")) == NULL ||
+        (value = strtok(NULL, "\r\n")) == NULL) {
+        return -1;
+    }
+    while (*value == ' ' || *value == '\t') {
+        value++;
+    }
+    value_len = strlen(value);
+    while (value_len > (size_t) 0U &&
+           (value[value_len - 1U] == ' ' || value[value_len - 1U] == '\t')) {
+        value[--value_len] = 0;
+    }
+    if (evutil_ascii_strcasecmp(type, "A") == 0) {
+        if (evutil_inet_pton(AF_INET, value, rdata) != 1) {
+            return -1;
+        }
+        return zone_add(zone, name, DNS_TYPE_A, rdata, (size_t) 4U);
+    }
+    if (evutil_ascii_strcasecmp(type, "AAAA") == 0) {
+        if (evutil_inet_pton(AF_INET6, value, rdata) != 1) {
+            return -1;
+        }
+        return zone_add(zone, name, DNS_TYPE_AAAA, rdata, (size_t) 16U);
+    }
+    if (evutil_ascii_strcasecmp(type, "TXT") == 0) {
+        if (value_len >= (size_t) 2U && *value == '"' &&
+            value[value_len - 1U] == '"') {
+            value++;
+            value_len -= 2U;
+        }
+        if (value_len >= sizeof rdata) {
+            return -1;
+        }
+        rdata[0] = (uint8_t) value_len;
+        memcpy(&rdata[1], value, value_len);
+        return zone_add(zone, name, DNS_TYPE_TXT, rdata, value_len + 1U);
+    }
+    return -1;
+}
+
+int
+zone_load(Zone * const zone, const char * const file)
+{
+    char          line[ZONE_LINE_MAX];
+    FILE         *fp;
+    char         *comment;
+    unsigned int  line_count = 0U;
+    int           ret = 0;
+
+    if ((fp = fopen(file, "r")) == NULL) {
+        perror(file);
+        return -1;
+    }
+    while (fgets(line, (int) sizeof line, fp) != NULL) {
+        line_count++;
+        if ((comment = strchr(line, ';')) != NULL) {
+            *comment = 0;
+        }
+        if (zone_parse_record(zone, line) != 0) {
+            fprintf(stderr, "%s:%u: invalid record\n", file, line_count);
+            ret = -1;
+            break;
+        }
+    }
+    fclose(fp);
+
+    return ret;
+}
+
+int
+zone_question(const uint8_t * const query, const size_t query_len,
+              char name[DNS_MAX_HOSTNAME_LEN + 1U],
+              uint16_t * const qtype, size_t * const question_end)
+{
+    size_t  offset = DNS_HEADER_SIZE;
+    size_t  name_len = (size_t) 0U;
+    uint8_t label_len;
+
+    if (query_len < DNS_HEADER_SIZE ||
+        zone_get_u16(query + DNS_OFFSET_QDCOUNT) != 1U) {
+        return -1;
+    }
+    for (;;) {
+        if (offset >= query_len) {
+            return -1;
+        }
+        label_len = query[offset++];
+        if (label_len == 0U) {
+            break;
+        }
+        if ((label_len & 0xc0) != 0U || query_len - offset < label_len ||
+            name_len + label_len + 1U > DNS_MAX_HOSTNAME_LEN) {
+            return -1;
+        }
+        if (name_len > (size_t) 0U) {
+            name[name_len++] = '.';
+        }
+        memcpy(&name[name_len], &query[offset], label_len);
+        name_len += label_len;
+        offset += label_len;
+    }
+    name[name_len] = 0;
+    zone_normalize_name(name);
+    if (query_len - offset < 4U) {
+        return -1;
+    }
+    *qtype = (uint16_t) zone_get_u16(query + offset);
+    *question_end = offset + 4U;
+
+    return 0;
+}
+
+/*
+ * Writes the header and the question of a reply to query, with no
+ * records. Returns the length of the reply, or -1 if the query cannot
+ * be parsed.
+ */
+
+ssize_t
+zone_reply(const uint8_t * const query, const size_t query_len,
+           uint8_t * const reply, const size_t reply_max_len,
+           const unsigned int rcode, const _Bool truncated)
+{
+    char     name[DNS_MAX_HOSTNAME_LEN + 1U];
+    size_t   question_end;
+    uint16_t qtype;
+
+    if (zone_question(query, query_len, name, &qtype, &question_end) != 0 ||
+        question_end > reply_max_len) {
+        return (ssize_t) -1;
+    }
+    memmove(reply, query, question_end);
+    reply[DNS_OFFSET_FLAGS] = (uint8_t)
+        ((query[DNS_OFFSET_FLAGS] & DNS_FLAGS_OPCODE_RD) |
+         DNS_FLAGS_QR | DNS_FLAGS_AA | (truncated ? DNS_FLAGS_TC : 0U));
+    reply[DNS_OFFSET_FLAGS2] = (uint8_t) (DNS_FLAGS2_RA | rcode);
+    memset(reply + DNS_OFFSET_ANCOUNT, 0, DNS_HEADER_SIZE - DNS_OFFSET_ANCOUNT);
+
+    return (ssize_t) question_end;
+}
+
+ssize_t
+zone_answer(const Zone * const zone,
+            const uint8_t * const query, const size_t query_len,
+            uint8_t * const reply, const size_t reply_max_len)
+{
+    char              name[DNS_MAX_HOSTNAME_LEN + 1U];
+    const ZoneRecord *record;
+    size_t            question_end;
+    size_t            reply_len;
+    size_t            i;
+    unsigned int      ancount = 0U;
+    uint16_t          qtype;
+    _Bool             name_found = 0;
+    _Bool             truncated = 0;
+
+    if (zone_question(query, query_len, name, &qtype, &question_end) != 0) {
+        return (ssize_t) -1;
+    }
+    if (zone_reply(query, query_len, reply, reply_max_len,
+                   DNS_RCODE_NOERROR, 0) < (ssize_t) 0) {
+        return (ssize_t) -1;
+    }
+    reply_len = question_end;
+    for (i = (size_t) 0U; i < zone->records_count; i++) {
+        record = &zone->records[i];
+        if (strcmp(record->name, name) != 0) {
+            continue;
+        }
+        name_found = 1;
+        if (record->type != qtype && qtype != DNS_TYPE_ANY) {
+            continue;
+        }
+        if (reply_max_len - reply_len < DNS_RR_FIXED_LEN + record->rdata_len ||
+            ancount >= 0xffff) {
+            truncated = 1;
+            break;
+        }
+        reply[reply_len] = 0xc0;
+        reply[reply_len + 1U] = DNS_HEADER_SIZE;
+        zone_put_u16(reply + reply_len + 2U, record->type);
+        zone_put_u16(reply + reply_len + 4U, DNS_CLASS_IN);
+        zone_put_u16(reply + reply_len + 6U, 0U);
+        zone_put_u16(reply + reply_len + 8U, ZONE_TTL);
+        zone_put_u16(reply + reply_len + 10U, record->rdata_len);
+        memcpy(reply + reply_len + DNS_RR_FIXED_LEN,
+               record->rdata, record->rdata_len);
+        reply_len += DNS_RR_FIXED_LEN + record->rdata_len;
+        ancount++;
+    }
+    if (name_found == 0) {
+        reply[DNS_OFFSET_FLAGS2] |= DNS_RCODE_NXDOMAIN;
+    }
+    if (truncated != 0) {
+        reply[DNS_OFFSET_FLAGS] |= DNS_FLAGS_TC;
+    }
+    zone_put_u16(reply + DNS_OFFSET_ANCOUNT, ancount);
+
+    return (ssize_t) reply_len;
+}
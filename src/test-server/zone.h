@@ -0,0 +1,75 @@
+
+#ifndef __ZONE_H__
+#define __ZONE_H__ 1
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * A tiny in-memory zone, loaded from a text file with one record per
+ * line:
+ *
+ *   <name> A <IPv4 address>
+ *   <name> AAAA <IPv6 address>
+ *   <name> TXT <text>
+ *
+ * Names are case-insensitive, and a name can have any number of
+ * records. Everything after a ';' is a comment.
+ */
+
+#define DNS_CLASS_IN   1U
+#define DNS_TYPE_A     1U
+#define DNS_TYPE_TXT   16U
+#define DNS_TYPE_AAAA  28U
+#define DNS_TYPE_ANY   255U
+
+#define DNS_HEADER_SIZE 12U
+#define DNS_MAX_HOSTNAME_LEN 255U
+#define DNS_MAX_PACKET_SIZE_UDP_NO_EDNS 512U
+
+#define DNS_RCODE_NOERROR  0U
+#define DNS_RCODE_FORMERR  1U
+#define DNS_RCODE_NXDOMAIN 3U
+#define DNS_RCODE_REFUSED  5U
+
+#ifndef ZONE_TTL
+# define ZONE_TTL 60U
+#endif
+
+typedef struct ZoneRecord_ {
+    char     *name;
+    uint8_t  *rdata;
+    uint16_t  type;
+    uint16_t  rdata_len;
+} ZoneRecord;
+
+typedef struct Zone_ {
+    ZoneRecord *records;
+    size_t      records_count;
+} Zone;
+
+Zone *zone_new(void);
+
+void zone_free(Zone * const zone);
+
+int zone_add(Zone * const zone, const char * const name,
+             const uint16_t type,
+             const uint8_t * const rdata, const size_t rdata_len);
+
+int zone_load(Zone * const zone, const char * const file);
+
+int zone_question(const uint8_t * const query, const size_t query_len,
+                  char name[DNS_MAX_HOSTNAME_LEN + 1U],
+                  uint16_t * const qtype, size_t * const question_end);
+
+ssize_t zone_reply(const uint8_t * const query, const size_t query_len,
+                   uint8_t * const reply, const size_t reply_max_len,
+                   const unsigned int rcode, const _Bool truncated);
+
+ssize_t zone_answer(const Zone * const zone,
+                    const uint8_t * const query, const size_t query_len,
+                    uint8_t * const reply, const size_t reply_max_len);
+
+#endif
@@ -1,8 +1,11 @@
 
 require 'net/dns/resolver'
+require 'socket'
+require 'tempfile'
 
 PROXY_IP = '127.0.0.1'
 PROXY_PORT = 5300
+RCODES = { 'NOERROR' => 0, 'NXDOMAIN' => 3, 'REFUSED' => 5 }
 
 Before do
   @resolver = Net::DNS::Resolver.new(nameserver: PROXY_IP, port: PROXY_PORT)
@@ -11,17 +14,36 @@ end
 After do
   Process.kill("KILL", @pipe.pid) if @pipe
   @pipe = nil
+  @forwarding_rules.close! if @forwarding_rules
+  @forwarding_rules = nil
 end
 
 Around do |scenario, block|
-  Timeout.timeout(3.0) do
+  Timeout.timeout(scenario.source_tag_names.include?('@slow') ? 30.0 : 3.0) do
     block.call
   end
 end
 
+Given /^a forwarding rules file:$/ do |rules|
+  @forwarding_rules = Tempfile.new(['dnscrypt-forwarding-rules', '.txt'])
+  @forwarding_rules.puts(rules)
+  @forwarding_rules.flush
+end
+
 Given /^a running dnscrypt proxy with options "([^"]*)"$/ do |options|
+  if @provider_key
+    options = "--resolver-address=#{TEST_SERVER_ADDRESS} " +
+      "--provider-name=#{TEST_SERVER_PROVIDER_NAME} " +
+      "--provider-key=#{@provider_key} #{options}"
+  end
+  if @resolvers_list
+    options = "--resolvers-list=#{@resolvers_list.path} #{options}"
+  end
+  if @forwarding_rules
+    options = "--forwarding-rules=#{@forwarding_rules.path} #{options}"
+  end
   @pipe = IO.popen("dnscrypt-proxy " +
-    "--local-address=#{PROXY_IP}:#{PROXY_PORT} $#{options}", "r")
+    "--local-address=#{PROXY_IP}:#{PROXY_PORT} #{options}", "r")
   sleep(1.5)
 end
 
@@ -29,6 +51,32 @@ When /^a client asks dnscrypt\-proxy for "([^"]*)"$/ do |name|
   @answer_section = @resolver.query(name, Net::DNS::A).answer
 end
 
+def ask_proxy(packet)
+  socket = UDPSocket.new
+  socket.send(packet.data, 0, PROXY_IP, PROXY_PORT)
+  @reply_data = socket.recvfrom(65536).first
+  socket.close
+  @reply = Net::DNS::Packet.parse(@reply_data)
+  @answer_section = @reply.answer
+end
+
+When /^a client asks dnscrypt\-proxy for "([^"]*)" with query ID (\d+)$/ do |name, id|
+  packet = Net::DNS::Packet.new(name, Net::DNS::A)
+  packet.header.id = id.to_i
+  ask_proxy(packet)
+end
+
+When /^a client asks dnscrypt\-proxy for the ([A-Z]+) records of "([^"]*)"(?: in the ([A-Z]+) class)?$/ do |type, name, cls|
+  ask_proxy(Net::DNS::Packet.new(name, type, cls || 'IN'))
+end
+
+When /^a client sends dnscrypt\-proxy a query for "([^"]*)" without waiting for the reply$/ do |name|
+  socket = UDPSocket.new
+  socket.send(Net::DNS::Packet.new(name, Net::DNS::A).data, 0,
+              PROXY_IP, PROXY_PORT)
+  socket.close
+end
+
 Then /^dnscrypt\-proxy returns "([^"]*)"$/ do |ip_for_name|
   expect(@answer_section.collect { |a| a.address.to_s }).to include(ip_for_name)
 end
@@ -36,3 +84,28 @@ end
 Then /^dnscrypt\-proxy returns a NXDOMAIN answer$/ do
   expect(@answer_section).to be_empty
 end
+
+Then /^the reply has query ID (\d+)$/ do |id|
+  expect(@reply.header.id).to eq(id.to_i)
+end
+
+Then /^the reply has the (NOERROR|NXDOMAIN|REFUSED) rcode$/ do |rcode|
+  expect(@reply_data.getbyte(3) & 0x0f).to eq(RCODES[rcode])
+end
+
+Then /^dnscrypt\-proxy returns no records, with an SOA record in the authority section$/ do
+  expect(@answer_section).to be_empty
+  expect(@reply.authority.collect(&:type)).to include('SOA')
+end
+
+Then /^dnscrypt\-proxy picks the "([^"]*)" resolver$/ do |name|
+  expect(@pipe.read_nonblock(65536)).to include("[#{name}] is the fastest")
+end
+
+Then /^dnscrypt\-proxy switches to the "([^"]*)" resolver$/ do |name|
+  output = ''
+  until output.include?("to [#{name}]")
+    IO.select([@pipe])
+    output << @pipe.readpartial(65536)
+  end
+end
@@ -1,5 +1,39 @@
 
+require 'ipaddr'
 require 'net/dns/resolver'
+require 'socket'
+require 'tempfile'
+
+TEST_SERVER_ADDRESS = '127.0.0.1:5443'
+TEST_SERVER_PROVIDER_NAME = '2.dnscrypt-cert.test.local'
+TEST_SERVER_ZONE = File.expand_path('../support/test.zone', File.dirname(__FILE__))
+
+After do
+  Process.kill("KILL", @server_pipe.pid) if @server_pipe
+  @server_pipe = nil
+  @provider_key = nil
+  (@server_pipes || {}).each_value { |pipe| Process.kill("KILL", pipe.pid) }
+  @server_pipes = nil
+  @resolvers_list.close! if @resolvers_list
+  @resolvers_list = nil
+  @plain_resolver.kill if @plain_resolver
+  @plain_resolver = nil
+  @plain_resolver_socket.close if @plain_resolver_socket
+  @plain_resolver_socket = nil
+end
+
+def start_test_server(address, options, zone = TEST_SERVER_ZONE)
+  pipe = IO.popen("dnscrypt-test-server " +
+    "--listen-address=#{address} " +
+    "--provider-name=#{TEST_SERVER_PROVIDER_NAME} " +
+    "--zone=#{zone} #{options}", "r")
+  provider_key = nil
+  while (line = pipe.gets)
+    break if (provider_key = line[/^Provider public key: (\S+)/, 1])
+  end
+  expect(provider_key).not_to be_nil
+  [pipe, provider_key]
+end
 
 Given /^a working server proxy on (\d+\.\d+\.\d+\.\d+)$/ do |resolver|
   resolver = Net::DNS::Resolver.new(nameserver: resolver, port: 443)
@@ -7,3 +41,51 @@ Given /^a working server proxy on (\d+\.\d+\.\d+\.\d+)$/ do |resolver|
   answer_section = resolver.query('2.dnscrypt-cert.fr.dnscrypt.org', Net::DNS::TXT).answer
   expect(answer_section).not_to be_empty
 end
+
+Given /^a local dnscrypt server(?: with options "([^"]*)")?$/ do |options|
+  @server_pipe, @provider_key = start_test_server(TEST_SERVER_ADDRESS, options)
+end
+
+Given /^a resolvers list of local dnscrypt servers:$/ do |table|
+  @resolvers_list = Tempfile.new(['dnscrypt-resolvers', '.csv'])
+  @resolvers_list.puts('Name,Resolver address,Provider name,Provider public key')
+  @server_pipes = {}
+  table.hashes.each do |row|
+    zone = TEST_SERVER_ZONE
+    if row['zone'] && !row['zone'].empty?
+      zone = File.expand_path("../support/#{row['zone']}",
+                              File.dirname(__FILE__))
+    end
+    pipe, provider_key = start_test_server(row['address'], row['options'], zone)
+    @resolvers_list.puts("#{row['name']},#{row['address']}," +
+      "#{TEST_SERVER_PROVIDER_NAME},#{provider_key}")
+    @server_pipes[row['name']] = pipe
+  end
+  @resolvers_list.flush
+end
+
+When /^the "([^"]*)" dnscrypt server stops$/ do |name|
+  pipe = @server_pipes.delete(name)
+  Process.kill("KILL", pipe.pid)
+  pipe.close
+end
+
+# Answers every A query with the same address, over UDP, without DNSCrypt.
+# Only the question is kept from the query.
+Given /^a plain DNS resolver on (\d+\.\d+\.\d+\.\d+):(\d+) answering "([^"]*)"$/ do |ip, port, answer|
+  @plain_resolver_socket = UDPSocket.new
+  @plain_resolver_socket.bind(ip, port.to_i)
+  socket = @plain_resolver_socket
+  @plain_resolver = Thread.new do
+    loop do
+      query, from = socket.recvfrom(65536)
+      question_end = 12
+      question_end += query.getbyte(question_end) + 1 while query.getbyte(question_end) != 0
+      question_end += 5
+      reply = query[0, 2] + [0x8180, 1, 1, 0, 0].pack('n5') +
+        query[12...question_end] +
+        [0xc00c, 1, 1, 60, 4].pack('n3Nn') + IPAddr.new(answer).hton
+      socket.send(reply, 0, from[3], from[1])
+    end
+  end
+end
@@ -1,3 +1,5 @@
 require 'aruba/cucumber'
 require 'net/dns'
-ENV['PATH'] = "#{File.expand_path(File.dirname(__FILE__) + '/../../../src/dnscrypt-proxy')}#{File::PATH_SEPARATOR}#{ENV['PATH']}"
+%w(proxy test-server).each do |dir|
+  ENV['PATH'] = "#{File.expand_path(File.dirname(__FILE__) + '/../../../src/' + dir)}#{File::PATH_SEPARATOR}#{ENV['PATH']}"
+end
@@ -0,0 +1,15 @@
+Feature: automatic resolver selection
+
+  With --resolver-name=auto, every resolver of the list is probed at
+startup, and the fastest one is used.
+
+  Scenario: one of the resolvers is slow, expect the other one to be picked.
+
+    Given a resolvers list of local dnscrypt servers:
+      | name | address        | options         |
+      | slow | 127.0.0.1:5444 | --latency=200   |
+      | fast | 127.0.0.1:5445 |                 |
+    And a running dnscrypt proxy with options "--resolver-name=auto"
+    When a client asks dnscrypt-proxy for "test-ff.dnscrypt.org"
+    Then dnscrypt-proxy returns "255.255.255.255"
+    And dnscrypt-proxy picks the "fast" resolver
@@ -0,0 +1,20 @@
+Feature: failover to standby resolvers
+
+  When the resolver in use stops working, queries are sent to the first
+healthy standby resolver instead.
+
+  @slow
+  Scenario: the resolver in use goes down, expect the standby resolver to be used.
+
+    Given a resolvers list of local dnscrypt servers:
+      | name    | address        | options |
+      | primary | 127.0.0.1:5444 |         |
+      | standby | 127.0.0.1:5445 |         |
+    And a running dnscrypt proxy with options "--resolver-name=primary --standby-resolvers=standby"
+    When a client asks dnscrypt-proxy for "test-ff.dnscrypt.org"
+    Then dnscrypt-proxy returns "255.255.255.255"
+    When the "primary" dnscrypt server stops
+    And a client sends dnscrypt-proxy a query for "test-ff.dnscrypt.org" without waiting for the reply
+    Then dnscrypt-proxy switches to the "standby" resolver
+    When a client asks dnscrypt-proxy for "test-ff.dnscrypt.org"
+    Then dnscrypt-proxy returns "255.255.255.255"
@@ -0,0 +1,51 @@
+Feature: forwarding rules
+
+  Queries for some domains can be sent to other resolvers than the one in
+use: another resolver from the list, queried with DNSCrypt, or a plain
+DNS resolver for local zones.
+
+  Background:
+    Given a resolvers list of local dnscrypt servers:
+      | name   | address        | options | zone            |
+      | main   | 127.0.0.1:5444 |         |                 |
+      | pinned | 127.0.0.1:5445 |         | forwarding.zone |
+    And a plain DNS resolver on 127.0.0.1:5446 answering "10.0.2.1"
+    And a forwarding rules file:
+      """
+      # Sent to another DNSCrypt resolver
+      Pinned.DNSCrypt.org  pinned
+      # Sent in plaintext
+      corp.test            127.0.0.1:5446
+      """
+    And a running dnscrypt proxy with options "--resolver-name=main"
+
+  Scenario: query a name below a domain pinned to another resolver.
+
+    When a client asks dnscrypt-proxy for "www.pinned.dnscrypt.org"
+    Then dnscrypt-proxy returns "10.0.1.1"
+
+  Scenario: query a pinned name using a different case than the rule.
+
+    When a client asks dnscrypt-proxy for "WWW.PINNED.dnscrypt.Org"
+    Then dnscrypt-proxy returns "10.0.1.1"
+
+  Scenario: query a name that doesn't match any rule.
+
+    When a client asks dnscrypt-proxy for "test-ff.dnscrypt.org"
+    Then dnscrypt-proxy returns "255.255.255.255"
+
+  Scenario: query a sibling of a pinned domain, expect the resolver in use to answer.
+
+    When a client asks dnscrypt-proxy for "www.notpinned.dnscrypt.org"
+    Then dnscrypt-proxy returns a NXDOMAIN answer
+
+  Scenario: query a name that only contains a forwarded domain, expect the resolver in use to answer.
+
+    When a client asks dnscrypt-proxy for "corp.test.dnscrypt.org"
+    Then dnscrypt-proxy returns a NXDOMAIN answer
+
+  Scenario: query a local name, expect the plain resolver to answer with the client's query ID.
+
+    When a client asks dnscrypt-proxy for "www.Corp.Test" with query ID 4242
+    Then dnscrypt-proxy returns "10.0.2.1"
+    And the reply has query ID 4242
@@ -19,3 +19,35 @@ Feature: Plugins
     Directly return an empty response to AAAA queries
     """
     And the exit status should be 0
+
+  Scenario: start the proxy with the qtype_filter plugin
+
+    When I run `dnscrypt-proxy --test=0 -R dnscrypt.org-fr --plugin=libdcplugin_example_qtype_filter.la,--block=AAAA,--block=ANY`
+    Then the output should contain:
+    """
+    Directly return an empty response to queries for specific types
+    """
+    And the exit status should be 0
+
+  Scenario: query a type blocked by the qtype_filter plugin, expect an empty answer with an SOA record.
+
+    Given a local dnscrypt server
+    And a running dnscrypt proxy with options "--plugin=libdcplugin_example_qtype_filter.la,--block=TXT,--block-class=CHAOS"
+    When a client asks dnscrypt-proxy for the TXT records of "test-txt.dnscrypt.org"
+    Then the reply has the NOERROR rcode
+    And dnscrypt-proxy returns no records, with an SOA record in the authority section
+
+  Scenario: query a class blocked by the qtype_filter plugin, expect a refusal.
+
+    Given a local dnscrypt server
+    And a running dnscrypt proxy with options "--plugin=libdcplugin_example_qtype_filter.la,--block=TXT,--block-class=CHAOS"
+    When a client asks dnscrypt-proxy for the A records of "test-ff.dnscrypt.org" in the CHAOS class
+    Then the reply has the REFUSED rcode
+
+  Scenario: query a type that the qtype_filter plugin doesn't block.
+
+    Given a local dnscrypt server
+    And a running dnscrypt proxy with options "--plugin=libdcplugin_example_qtype_filter.la,--block=TXT,--block-class=CHAOS"
+    When a client asks dnscrypt-proxy for the A records of "test-ff.dnscrypt.org"
+    Then the reply has the NOERROR rcode
+    And dnscrypt-proxy returns "255.255.255.255"
@@ -0,0 +1,18 @@
+Feature: resolver faults
+
+  The local test server can delay replies and truncate them, so that
+the proxy's error paths can be exercised without a public resolver.
+
+  Scenario: the resolver truncates every UDP reply, expect fallback to TCP.
+
+    Given a local dnscrypt server with options "--truncate=100"
+    And a running dnscrypt proxy with options "--edns-payload-size=0"
+    When a client asks dnscrypt-proxy for "test-ff.dnscrypt.org"
+    Then dnscrypt-proxy returns "255.255.255.255"
+
+  Scenario: the resolver is slow, but answers in time.
+
+    Given a local dnscrypt server with options "--latency=500"
+    And a running dnscrypt proxy with options "--edns-payload-size=0"
+    When a client asks dnscrypt-proxy for "test-ff.dnscrypt.org"
+    Then dnscrypt-proxy returns "255.255.255.255"
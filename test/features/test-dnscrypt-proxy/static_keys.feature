@@ -22,14 +22,14 @@ Feature: Static client keys
 
   Scenario: query an existing name, with a static client key
 
-    Given a working server proxy on 212.47.228.136
-    And a running dnscrypt proxy with options "--edns-payload-size=0 -R dnscrypt.org-fr --client-key=test-client.key"
+    Given a local dnscrypt server
+    And a running dnscrypt proxy with options "--edns-payload-size=0 --client-key=test-client.key"
     When a client asks dnscrypt-proxy for "test-ff.dnscrypt.org"
     Then dnscrypt-proxy returns "255.255.255.255"
 
   Scenario: query a nonexistent name, with a static client key
 
-    Given a working server proxy on 212.47.228.136
-    And a running dnscrypt proxy with options "--edns-payload-size=0 -R dnscrypt.org-fr --client-key=test-client.key"
+    Given a local dnscrypt server
+    And a running dnscrypt proxy with options "--edns-payload-size=0 --client-key=test-client.key"
     When a client asks dnscrypt-proxy for "test-nonexistent.dnscrypt.org"
     Then dnscrypt-proxy returns a NXDOMAIN answer